@@ -36,7 +36,13 @@
 #include <linux/fs_struct.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/rcupdate.h>
+#include <linux/ktime.h>
 #include <redirfs.h>
+#include "avflt_proto.h"
 
 #define AVFLT_VERSION    "0.7"
 
@@ -46,9 +52,20 @@
 #define AVFLT_FILE_CLEAN    1
 #define AVFLT_FILE_INFECTED    2
 
+#define AVFLT_DIGEST_SIZE 32
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,29) && \
+    (defined(CONFIG_CRYPTO_HASH) || defined(CONFIG_CRYPTO_HASH_MODULE))
+#define AVFLT_DIGEST 1
+#else
+#define AVFLT_DIGEST 0
+#endif
+
 struct avflt_event {
     struct list_head req_list;
     struct list_head proc_list;
+    struct hlist_node inflight;
+    struct list_head async_list;
     struct avflt_root_data *root_data;
     struct completion wait;
     atomic_t count;
@@ -67,6 +84,7 @@ struct avflt_event {
 #endif
     unsigned int flags;
     struct file *file;
+    struct file *content;
     int fd;
     int root_cache_ver;
     int cache_ver;
@@ -74,19 +92,51 @@ struct avflt_event {
     pid_t pid;
     pid_t tgid;
     int was_removed_from_req_list;
+    int queue;
+    int aborted;
+    int async;
+    int warm;
+    int nodigest;
+    int class;
+    struct avflt_pcache_rec pcache;
+    u8 digest[AVFLT_DIGEST_SIZE];
+    int digest_valid;
+    int epoch;
+    unsigned int sigver;
+    u64 queued;
+    u64 handed;
+    loff_t digest_size;
+    struct timespec digest_ctime;
+    int digest_ver;
 };
 
 struct avflt_event *avflt_event_get(struct avflt_event *event);
 void avflt_event_put(struct avflt_event *event);
 void avflt_readd_request(struct avflt_event *event);
-struct avflt_event *avflt_get_request(void);
+#define AVFLT_QUEUES_MAX 64
+
+struct avflt_event *avflt_get_request(int queue);
+int avflt_get_requests(int queue, struct avflt_event **events, int count);
+int avflt_queue_bind(void);
+int avflt_queues_count(void);
 int avflt_process_request(struct file *file, int type);
+int avflt_process_request_async(struct file *file, int type, int class);
+int avflt_process_request_nowait(struct file *file, int type, int class);
+int avflt_process_request_warm(struct file *file);
 void avflt_event_done(struct avflt_event *event);
-int avflt_get_file(struct avflt_event *event);
+struct file *avflt_open_file(struct avflt_event *event);
+ssize_t avflt_kernel_read(struct file *file, char *buf, size_t size,
+        loff_t *pos);
+ssize_t avflt_read_content(struct avflt_event *event, char __user *buf,
+        size_t size, loff_t pos);
+int avflt_get_content_fd(struct avflt_event *event);
+char *avflt_get_path(struct avflt_event *event, char *buf, int size);
+int avflt_get_file(struct avflt_event *event, int nofd);
 void avflt_put_file(struct avflt_event *event);
 void avflt_install_fd(struct avflt_event *event);
 ssize_t avflt_copy_cmd(char __user *buf, size_t size,
         struct avflt_event *event);
+void avflt_copy_event(struct avflt_proto_event *rec, struct avflt_event *event);
 int avflt_add_reply(struct avflt_event *event);
 int avflt_request_empty(void);
 void avflt_start_accept(void);
@@ -94,11 +144,74 @@ void avflt_stop_accept(void);
 int avflt_is_stopped(void);
 void avflt_rem_requests(void);
 struct avflt_event *avflt_get_reply(const char __user *buf, size_t size);
+struct avflt_event *avflt_set_reply(int id, int result, int cache);
+u64 avflt_clock(void);
+int avflt_get_service_time(void);
+int avflt_get_queue_depth(int queue);
+int avflt_get_queued(void);
 int avflt_check_init(void);
 void avflt_check_exit(void);
 
+#define AVFLT_CLASS_INTERACTIVE 0
+#define AVFLT_CLASS_NORMAL 1
+#define AVFLT_CLASS_BACKGROUND 2
+#define AVFLT_CLASSES 3
+
+#define AVFLT_CLASS_RULE_PGRP 'g'
+#define AVFLT_CLASS_RULE_TYPE 't'
+#define AVFLT_CLASS_RULE_CGROUP 'u'
+#define AVFLT_CLASS_RULES_MAX 64
+#define AVFLT_CLASS_WEIGHT_MAX 1000
+
+int avflt_class_get(int type);
+int avflt_class_weight(int class);
+int avflt_class_set_weights(int *weights);
+int avflt_class_set_rule(char type, int id, int class);
+void avflt_class_clear_rules(void);
+ssize_t avflt_class_get_info(char *buf, int size);
+void avflt_class_exit(void);
+
+#define AVFLT_RULE_SCAN 0
+#define AVFLT_RULE_SKIP 1
+#define AVFLT_RULE_DENY 2
+#define AVFLT_RULES_MAX 64
+
+int avflt_rules_check(struct file *file, int type);
+int avflt_rules_add(const char *buf, size_t size);
+void avflt_rules_clear(void);
+ssize_t avflt_rules_get_info(char *buf, int size);
+void avflt_rules_exit(void);
+
+#define AVFLT_STAT_ENQUEUED 0
+#define AVFLT_STAT_DEQUEUED 1
+#define AVFLT_STAT_CACHE_HIT 2
+#define AVFLT_STAT_CACHE_DISABLED 3
+#define AVFLT_STAT_CACHE_NEW 4
+#define AVFLT_STAT_CACHE_ROOT_VER 5
+#define AVFLT_STAT_CACHE_INODE_VER 6
+#define AVFLT_STAT_PCACHE_HIT 7
+#define AVFLT_STAT_DIGEST_HIT 8
+#define AVFLT_STAT_COALESCED 9
+#define AVFLT_STAT_TIMEOUT 10
+#define AVFLT_STAT_SHED 11
+#define AVFLT_STAT_CACHE_INVALIDATED 12
+#define AVFLT_STAT_CACHE_STALE 13
+#define AVFLT_STAT_LIMIT_TGID 14
+#define AVFLT_STAT_LIMIT_CGROUP 15
+#define AVFLT_STATS 16
+#define AVFLT_STATS_BUCKETS 24
+
+void avflt_stats_inc(int stat);
+long avflt_stats_get(int stat);
+void avflt_stats_wait_time(u64 time);
+void avflt_stats_service_time(u64 time);
+void avflt_stats_reset(void);
+ssize_t avflt_stats_get_info(char *buf, int size);
+
 struct avflt_trusted {
     struct list_head list;
+    struct list_head hash;
+    struct rcu_head rcu;
     pid_t tgid;
     int open;
 };
@@ -110,7 +223,9 @@ ssize_t avflt_trusted_get_info(char *buf, int size);
 
 struct avflt_proc {
     struct list_head list;
+    struct list_head hash;
     struct list_head events; 
+    struct rcu_head rcu;
     spinlock_t lock;
     atomic_t count;
     pid_t tgid;
@@ -127,15 +242,24 @@ int avflt_proc_empty(void);
 void avflt_proc_add_event(struct avflt_proc *proc, struct avflt_event *event);
 void avflt_proc_rem_event(struct avflt_proc *proc, struct avflt_event *event);
 struct avflt_event *avflt_proc_get_event(struct avflt_proc *proc, int id);
+struct avflt_event *avflt_proc_find_event(struct avflt_proc *proc, int id);
 ssize_t avflt_proc_get_info(char *buf, int size);
+void avflt_proc_init(void);
+void avflt_proc_exit(void);
 
 #define rfs_to_root_data(ptr) \
     container_of(ptr, struct avflt_root_data, rfs_data)
 
+#define AVFLT_POLICY_OPEN 'o'
+#define AVFLT_POLICY_CLOSED 'c'
+
 struct avflt_root_data {
     struct redirfs_data rfs_data;
     atomic_t cache_enabled;
     atomic_t cache_ver;
+    atomic_t timeout;
+    atomic_t policy;
+    atomic_t shed;
 };
 
 struct avflt_root_data *avflt_get_root_data_root(redirfs_root root);
@@ -153,7 +277,11 @@ struct avflt_inode_data {
     int root_cache_ver;
     int inode_cache_ver;
     int cache_ver;
+    int epoch;
+    unsigned int sigver;
     int state;
+    u8 digest[AVFLT_DIGEST_SIZE];
+    int digest_valid;
     spinlock_t lock;
 };
 
@@ -164,9 +292,89 @@ struct avflt_inode_data *avflt_attach_inode_data(struct inode *inode);
 int avflt_data_init(void);
 void avflt_data_exit(void);
 
+int avflt_pcache_find(struct inode *inode, int *epoch);
+void avflt_pcache_event(struct avflt_event *event, struct inode *inode);
+void avflt_pcache_update(struct avflt_event *event);
+void avflt_pcache_flush(void);
+void avflt_pcache_forget(struct inode *inode);
+void avflt_pcache_set_sigver(unsigned int sigver);
+unsigned int avflt_pcache_get_sigver(void);
+long avflt_pcache_load(struct avflt_pcache_buf __user *ubuf);
+long avflt_pcache_dump(struct avflt_pcache_buf __user *ubuf);
+int avflt_pcache_init(void);
+void avflt_pcache_exit(void);
+
+int avflt_digest_self(void);
+int avflt_digest_event(struct avflt_event *event);
+void avflt_digest_update(struct avflt_event *event);
+void avflt_digest_flush(void);
+void avflt_digest_forget(struct inode *inode);
+int avflt_digest_set_max(long max);
+long avflt_digest_get_max(void);
+void avflt_digest_init(void);
+void avflt_digest_exit(void);
+
 void avflt_invalidate_cache_root(redirfs_root root);
 void avflt_invalidate_cache(void);
 
+#define AVFLT_INVAL_MAX 64
+
+int avflt_inval_get_epoch(void);
+int avflt_inval_check(struct dentry *dentry, int epoch);
+int avflt_inval_path(const char *buf, size_t size);
+void avflt_inval_root(redirfs_path path);
+void avflt_inval_flush(void);
+void avflt_inval_exit(void);
+
+extern atomic_t avflt_revalidate;
+
+int avflt_warm_start(void);
+void avflt_warm_finish(void);
+void avflt_warm_skip(void);
+int avflt_warm_set_limit(int limit);
+ssize_t avflt_warm_get_info(char *buf, int size);
+int avflt_warm_file(struct file *file);
+
+#define AVFLT_LIMIT_RULE_TGID 't'
+#define AVFLT_LIMIT_RULE_CGROUP 'c'
+#define AVFLT_LIMIT_BACKGROUND 'b'
+#define AVFLT_LIMIT_OPEN 'o'
+#define AVFLT_LIMIT_DELAY 'd'
+#define AVFLT_LIMIT_MAX 100000
+
+void avflt_limit_init(void);
+unsigned long avflt_cgroup_id(void);
+int avflt_limit_request(struct avflt_event *event, int can_wait);
+int avflt_limit_set_rule(char type, int rate, int burst);
+int avflt_limit_set_policy(char policy);
+ssize_t avflt_limit_get_info(char *buf, int size);
+
+#define AVFLT_PROTO_BATCH_MAX 64
+
+struct avflt_ring {
+    struct mutex lock;
+    struct avflt_ring_hdr *hdr;
+    struct avflt_proto_event *events;
+    struct avflt_proto_reply *replies;
+    unsigned int entries;
+    unsigned long size;
+    u32 ev_tail;
+    u32 rep_head;
+};
+
+struct avflt_ring *avflt_ring_alloc(unsigned long entries);
+void avflt_ring_free(struct avflt_ring *ring);
+int avflt_ring_mmap(struct avflt_ring *ring, struct vm_area_struct *vma);
+long avflt_ring_enter(struct avflt_ring *ring, int queue, int nofd);
+
+struct avflt_conn {
+    int proto;
+    int queue;
+    unsigned long flags;
+    unsigned long wait;
+    struct avflt_ring *ring;
+};
+
 int avflt_dev_init(void);
 void avflt_dev_exit(void);
 
@@ -178,6 +386,9 @@ void avflt_sys_exit(void);
 
 extern atomic_t avflt_reply_timeout;
 extern atomic_t avflt_cache_enabled;
+extern atomic_t avflt_async_close;
+extern atomic_t avflt_exec_only;
+extern atomic_t avflt_scanners;
 extern redirfs_filter avflt;
 extern wait_queue_head_t avflt_request_available;
 
@@ -21,6 +21,7 @@
  * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <linux/hash.h>
 #include "avflt.h"
 
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(3,18,0))
@@ -30,10 +31,43 @@ static int get_unused_fd(void)
 }
 #endif
 
+/*
+ * Pending events are spread over per CPU queues so openers on different
+ * CPUs do not contend on one lock. A scanner takes events from the queue its
+ * connection is bound to and steals from the other queues when it is empty.
+ * The accept flag is kept in every queue and changed under
+ * avflt_accept_lock, so an event is never added to a queue after
+ * avflt_rem_requests drained it.
+ */
+struct avflt_queue {
+    spinlock_t lock;
+    struct list_head list[AVFLT_CLASSES];
+    int credit[AVFLT_CLASSES];
+    int accept;
+    int nr;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Open and close events waiting for a reply are hashed by inode, so an event
+ * for the same inode content can be shared by all processes which miss the
+ * cache at the same time instead of sending one scan request for each.
+ */
+#define AVFLT_INFLIGHT_BITS 8
+
+struct avflt_inflight {
+    spinlock_t lock;
+    struct hlist_head head;
+};
+
 DECLARE_WAIT_QUEUE_HEAD(avflt_request_available);
-static DEFINE_SPINLOCK(avflt_request_lock);
-static LIST_HEAD(avflt_request_list);
-static int avflt_request_accept = 0;
+static struct avflt_inflight avflt_inflight[1 << AVFLT_INFLIGHT_BITS];
+static struct avflt_queue avflt_queues[AVFLT_QUEUES_MAX];
+static int avflt_queues_nr;
+static atomic_t avflt_queue_next = ATOMIC_INIT(0);
+static DEFINE_SPINLOCK(avflt_accept_lock);
+static atomic_t avflt_request_accept = ATOMIC_INIT(0);
+static LIST_HEAD(avflt_async_list);
+static DEFINE_SPINLOCK(avflt_async_lock);
 static struct kmem_cache *avflt_event_cache = NULL;
 atomic_t avflt_cache_ver = ATOMIC_INIT(0);
 atomic_t avflt_event_ids = ATOMIC_INIT(0);
@@ -50,6 +84,8 @@ static struct avflt_event *avflt_event_alloc(struct file *file, int type)
 
     INIT_LIST_HEAD(&event->req_list);
     INIT_LIST_HEAD(&event->proc_list);
+    INIT_HLIST_NODE(&event->inflight);
+    INIT_LIST_HEAD(&event->async_list);
     init_completion(&event->wait);
     atomic_set(&event->count, 1);
     event->type = type;
@@ -66,6 +102,10 @@ static struct avflt_event *avflt_event_alloc(struct file *file, int type)
     event->pid = current->pid;
     event->tgid = current->tgid;
     event->cache = 1;
+    event->class = avflt_class_get(type);
+    event->epoch = avflt_inval_get_epoch();
+    event->sigver = avflt_pcache_get_sigver();
+    avflt_pcache_event(event, file->f_dentry->d_inode);
 
     root_data = avflt_get_root_data_inode(file->f_dentry->d_inode);
     inode_data = avflt_get_inode_data_inode(file->f_dentry->d_inode);
@@ -109,6 +149,13 @@ void avflt_event_put(struct avflt_event *event)
         return;
 
     avflt_put_root_data(event->root_data);
+
+    if (event->content)
+        fput(event->content);
+
+    if (event->warm)
+        avflt_warm_finish();
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
     mntput(event->mnt);
     dput(event->f_path_dentry);
@@ -120,24 +167,34 @@ void avflt_event_put(struct avflt_event *event)
 
 static int avflt_add_request(struct avflt_event *event, int tail)
 {
-    spin_lock(&avflt_request_lock);
+    struct avflt_queue *queue;
+
+    if (tail)
+        event->queue = raw_smp_processor_id() % avflt_queues_nr;
+
+    queue = &avflt_queues[event->queue];
+
+    spin_lock(&queue->lock);
 
-    if (avflt_request_accept == 0) {
-        spin_unlock(&avflt_request_lock);
+    if (queue->accept == 0) {
+        spin_unlock(&queue->lock);
         return 1;
     }
 
     event->was_removed_from_req_list = 0;
     if (tail)
-        list_add_tail(&event->req_list, &avflt_request_list);
+        list_add_tail(&event->req_list, &queue->list[event->class]);
     else
-        list_add(&event->req_list, &avflt_request_list);
+        list_add(&event->req_list, &queue->list[event->class]);
 
     avflt_event_get(event);
+    queue->nr++;
+    event->queued = avflt_clock();
+    avflt_stats_inc(AVFLT_STAT_ENQUEUED);
     
     wake_up_interruptible(&avflt_request_available);
 
-    spin_unlock(&avflt_request_lock);
+    spin_unlock(&queue->lock);
 
     return 0;
 }
@@ -150,44 +207,286 @@ void avflt_readd_request(struct avflt_event *event)
 
 static void avflt_rem_request(struct avflt_event *event)
 {
-    spin_lock(&avflt_request_lock);
+    struct avflt_queue *queue = &avflt_queues[event->queue];
+
+    spin_lock(&queue->lock);
     if (event->was_removed_from_req_list || list_empty(&event->req_list)) {
-        spin_unlock(&avflt_request_lock);
+        spin_unlock(&queue->lock);
         return;
     }
     list_del_init(&event->req_list);
     event->was_removed_from_req_list = 1;
-    spin_unlock(&avflt_request_lock);
+    queue->nr--;
+    spin_unlock(&queue->lock);
     avflt_event_put(event);
 }
 
-struct avflt_event *avflt_get_request(void)
+/*
+ * Moves a pending event to a higher priority class, the event may be queued
+ * concurrently, so its queue is checked again under the queue lock.
+ */
+static void avflt_promote_request(struct avflt_event *event, int class)
 {
-    struct avflt_event *event;
+    struct avflt_queue *queue;
+
+    for (;;) {
+        queue = &avflt_queues[event->queue];
+
+        spin_lock(&queue->lock);
+
+        if (queue == &avflt_queues[event->queue])
+            break;
 
-    spin_lock(&avflt_request_lock);
+        spin_unlock(&queue->lock);
+    }
+
+    /*
+     * avflt_rem_requests moves the events of a closed queue to its own
+     * list and drops the queue lock before it puts them, such an event is
+     * not empty on req_list but must not be put back into the queue.
+     */
+    if (class < event->class) {
+        event->class = class;
+        if (!event->was_removed_from_req_list &&
+                !list_empty(&event->req_list))
+            list_move_tail(&event->req_list, &queue->list[class]);
+    }
+
+    spin_unlock(&queue->lock);
+}
 
-    if (list_empty(&avflt_request_list)) {
-        spin_unlock(&avflt_request_lock);
+static int avflt_queue_empty(struct avflt_queue *queue)
+{
+    int i;
+
+    for (i = 0; i < AVFLT_CLASSES; i++) {
+        if (!list_empty(&queue->list[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * weighted round robin over the priority classes, a new round starts when
+ * none of the classes with pending events has credit left
+ */
+static struct avflt_event *avflt_queue_pop(struct avflt_queue *queue)
+{
+    struct avflt_event *event;
+    int refilled = 0;
+    int i;
+
+again:
+    for (i = 0; i < AVFLT_CLASSES; i++) {
+        if (list_empty(&queue->list[i]) || !queue->credit[i])
+            continue;
+
+        queue->credit[i]--;
+        queue->nr--;
+        event = list_entry(queue->list[i].next, struct avflt_event,
+                req_list);
+        list_del_init(&event->req_list);
+        return event;
+    }
+
+    if (refilled)
         return NULL;
+
+    for (i = 0; i < AVFLT_CLASSES; i++)
+        queue->credit[i] = avflt_class_weight(i);
+
+    refilled = 1;
+    goto again;
+}
+
+static int avflt_queue_get_requests(struct avflt_queue *queue,
+        struct avflt_event **events, int count)
+{
+    struct avflt_event *event;
+    int nr = 0;
+
+    if (avflt_queue_empty(queue))
+        return 0;
+
+    spin_lock(&queue->lock);
+
+    while (nr < count) {
+        event = avflt_queue_pop(queue);
+        if (!event)
+            break;
+
+        events[nr++] = event;
     }
 
-    event = list_entry(avflt_request_list.next, struct avflt_event,
-            req_list);
-    list_del_init(&event->req_list);
+    spin_unlock(&queue->lock);
+
+    return nr;
+}
+
+int avflt_queue_bind(void)
+{
+    unsigned int next = atomic_inc_return(&avflt_queue_next);
+
+    return next % avflt_queues_nr;
+}
+
+int avflt_queues_count(void)
+{
+    return avflt_queues_nr;
+}
+
+/*
+ * takes up to count pending events, from the given queue first and then
+ * from its siblings
+ */
+int avflt_get_requests(int queue, struct avflt_event **events, int count)
+{
+    int nr = 0;
+    int i;
+
+    for (i = 0; i < avflt_queues_nr && nr < count; i++) {
+        nr += avflt_queue_get_requests(
+                &avflt_queues[(queue + i) % avflt_queues_nr],
+                events + nr, count - nr);
+    }
+
+    for (i = 0; i < nr; i++) {
+        events[i]->id = atomic_inc_return(&avflt_event_ids);
+        events[i]->handed = avflt_clock();
+        avflt_stats_inc(AVFLT_STAT_DEQUEUED);
+        avflt_stats_wait_time(events[i]->handed - events[i]->queued);
+    }
 
-    spin_unlock(&avflt_request_lock);
+    return nr;
+}
+
+struct avflt_event *avflt_get_request(int queue)
+{
+    struct avflt_event *event;
+
+    if (!avflt_get_requests(queue, &event, 1))
+        return NULL;
 
-    event->id = atomic_inc_return(&avflt_event_ids);
     return event;
 }
 
+/*
+ * The service time of the scanners, from handing an event over until its
+ * reply, is kept as a moving average in microseconds. It is updated by all
+ * reply paths at once, so the update retries when it races with another one.
+ */
+static atomic_t avflt_service_time = ATOMIC_INIT(0);
+
+u64 avflt_clock(void)
+{
+    return ktime_to_ns(ktime_get());
+}
+
+static void avflt_update_service_time(struct avflt_event *event)
+{
+    u64 time = avflt_clock() - event->handed;
+    int sample;
+    int avg;
+    int old;
+
+    avflt_stats_service_time(time);
+    do_div(time, NSEC_PER_USEC);
+    sample = min_t(u64, time, INT_MAX);
+
+    avg = atomic_read(&avflt_service_time);
+    for (;;) {
+        old = atomic_cmpxchg(&avflt_service_time, avg,
+                avg + (sample - avg) / 8);
+        if (old == avg)
+            break;
+
+        avg = old;
+    }
+}
+
+int avflt_get_service_time(void)
+{
+    return atomic_read(&avflt_service_time);
+}
+
+int avflt_get_queue_depth(int queue)
+{
+    return avflt_queues[queue].nr;
+}
+
+int avflt_get_queued(void)
+{
+    int nr = 0;
+    int i;
+
+    for (i = 0; i < avflt_queues_nr; i++)
+        nr += avflt_queues[i].nr;
+
+    return nr;
+}
+
+static int avflt_event_timeout(struct avflt_event *event)
+{
+    int timeout = -1;
+
+    if (event->root_data)
+        timeout = atomic_read(&event->root_data->timeout);
+
+    if (timeout < 0)
+        timeout = atomic_read(&avflt_reply_timeout);
+
+    return timeout;
+}
+
+/*
+ * result used when the scanner does not reply in time
+ */
+static int avflt_event_policy(struct avflt_event *event)
+{
+    if (event->root_data && atomic_read(&event->root_data->policy) ==
+            AVFLT_POLICY_CLOSED)
+        return AVFLT_FILE_INFECTED;
+
+    return AVFLT_FILE_CLEAN;
+}
+
+/*
+ * An event is shed when the scanners are not expected to reply before its
+ * timeout, each scanner has to serve its share of the queued events first.
+ */
+static int avflt_shed_request(struct avflt_event *event)
+{
+    long long wait;
+    int scanners;
+    int timeout;
+
+    if (!event->root_data || !atomic_read(&event->root_data->shed))
+        return 0;
+
+    timeout = avflt_event_timeout(event);
+    if (!timeout)
+        return 0;
+
+    scanners = max(atomic_read(&avflt_scanners), 1);
+    wait = (long long)(avflt_get_queued() / scanners + 1) *
+        atomic_read(&avflt_service_time);
+
+    if (wait <= (long long)timeout * 1000)
+        return 0;
+
+    avflt_stats_inc(AVFLT_STAT_SHED);
+    event->result = avflt_event_policy(event);
+    event->cache = 0;
+    return 1;
+}
+
 static int avflt_wait_for_reply(struct avflt_event *event)
 {
     long jiffies;
     int timeout;
 
-    timeout = atomic_read(&avflt_reply_timeout);
+    timeout = avflt_event_timeout(event);
     if (timeout)
         jiffies = msecs_to_jiffies(timeout);
     else
@@ -201,13 +500,61 @@ static int avflt_wait_for_reply(struct avflt_event *event)
 
     if (!jiffies) {
         printk(KERN_WARNING "avflt: wait for reply timeout\n");
-        event->result = AVFLT_FILE_CLEAN;
+        avflt_stats_inc(AVFLT_STAT_TIMEOUT);
+        event->result = avflt_event_policy(event);
         event->cache = 0;
     }
 
     return 0;
 }
 
+static struct inode *avflt_event_inode(struct avflt_event *event)
+{
+    return event->f_path_dentry->d_inode;
+}
+
+static struct avflt_inflight *avflt_inflight_head(struct avflt_event *event)
+{
+    return &avflt_inflight[hash_ptr(avflt_event_inode(event),
+            AVFLT_INFLIGHT_BITS)];
+}
+
+static int avflt_inflight_match(struct avflt_event *a, struct avflt_event *b)
+{
+    return avflt_event_inode(a) == avflt_event_inode(b) &&
+        a->root_data == b->root_data &&
+        a->root_cache_ver == b->root_cache_ver &&
+        a->cache_ver == b->cache_ver;
+}
+
+/*
+ * Events can be shared only when the cache versions identify the file
+ * content, which is true only for files with the cache enabled and not
+ * opened for writing. The only writer allowed is the one being closed.
+ */
+static int avflt_inflight_allowed(struct avflt_event *event)
+{
+    int writers = 0;
+
+    if (event->type == AVFLT_EVENT_CLOSE &&
+            (event->flags & O_ACCMODE) != O_RDONLY)
+        writers = 1;
+
+    if (!atomic_read(&avflt_cache_enabled))
+        return 0;
+
+    if (!event->root_data)
+        return 0;
+
+    if (!atomic_read(&event->root_data->cache_enabled))
+        return 0;
+
+    if (atomic_read(&avflt_event_inode(event)->i_writecount) > writers)
+        return 0;
+
+    return 1;
+}
+
 static void avflt_update_cache(struct avflt_event *event)
 {
     struct avflt_inode_data *inode_data;
@@ -229,6 +576,10 @@ static void avflt_update_cache(struct avflt_event *event)
     }
 
     avflt_put_root_data(root_data);
+    avflt_pcache_update(event);
+
+    if (avflt_inflight_allowed(event))
+        avflt_digest_update(event);
 
     inode_data = avflt_attach_inode_data(event->f_path_dentry->d_inode);
     if (!inode_data)
@@ -239,20 +590,171 @@ static void avflt_update_cache(struct avflt_event *event)
     inode_data->root_data = avflt_get_root_data(event->root_data);
     inode_data->root_cache_ver = event->root_cache_ver;
     inode_data->cache_ver = event->cache_ver;
+    inode_data->epoch = event->epoch;
+    inode_data->sigver = event->sigver;
     inode_data->state = event->result;
+    inode_data->digest_valid = event->digest_valid;
+    if (event->digest_valid)
+        memcpy(inode_data->digest, event->digest, AVFLT_DIGEST_SIZE);
     spin_unlock(&inode_data->lock);
     avflt_put_inode_data(inode_data);
 }
 
+/*
+ * returns the event in flight for the same inode content or adds the event
+ * to the in flight hash and returns NULL, a pending event found is moved to
+ * the class of the new event if it is higher, so an interactive open does not
+ * wait behind background events for a warm or revalidation event
+ */
+static struct avflt_event *avflt_inflight_add(struct avflt_event *event)
+{
+    struct avflt_inflight *inflight;
+    struct avflt_event *found;
+    struct hlist_node *pos;
+
+    if (!avflt_inflight_allowed(event))
+        return NULL;
+
+    inflight = avflt_inflight_head(event);
+
+    spin_lock(&inflight->lock);
+
+    hlist_for_each(pos, &inflight->head) {
+        found = hlist_entry(pos, struct avflt_event, inflight);
+        if (avflt_inflight_match(found, event)) {
+            avflt_event_get(found);
+            spin_unlock(&inflight->lock);
+            avflt_stats_inc(AVFLT_STAT_COALESCED);
+            if (event->class < found->class)
+                avflt_promote_request(found, event->class);
+            return found;
+        }
+    }
+
+    hlist_add_head(&event->inflight, &inflight->head);
+
+    spin_unlock(&inflight->lock);
+
+    return NULL;
+}
+
+/*
+ * Wakes up the processes sharing the event. They get the result of the
+ * event, or retry with their own event when the owner was interrupted before
+ * the scanner replied.
+ */
+static void avflt_inflight_rem(struct avflt_event *event, int aborted)
+{
+    struct avflt_inflight *inflight;
+
+    if (hlist_unhashed(&event->inflight))
+        return;
+
+    inflight = avflt_inflight_head(event);
+
+    spin_lock(&inflight->lock);
+    hlist_del_init(&event->inflight);
+    spin_unlock(&inflight->lock);
+
+    event->aborted = aborted;
+    smp_wmb();
+    avflt_event_done(event);
+}
+
+/*
+ * The owner can be an asynchronous event with no timeout of its own, so the
+ * sharing process waits at most for its reply timeout and gets the timeout
+ * policy then, like with an event of its own. The matching events have the
+ * same root, so the timeout and policy of the owner are those of the
+ * sharing process.
+ */
+static int avflt_wait_for_inflight(struct avflt_event *event)
+{
+    long jiffies;
+    int timeout;
+
+    timeout = avflt_event_timeout(event);
+    if (timeout)
+        jiffies = msecs_to_jiffies(timeout);
+    else
+        jiffies = MAX_SCHEDULE_TIMEOUT;
+
+    jiffies = wait_for_completion_interruptible_timeout(&event->wait,
+            jiffies);
+
+    if (jiffies < 0)
+        return (int)jiffies;
+
+    if (!jiffies) {
+        printk(KERN_WARNING "avflt: wait for shared reply timeout\n");
+        avflt_stats_inc(AVFLT_STAT_TIMEOUT);
+        return avflt_event_policy(event);
+    }
+
+    smp_rmb();
+
+    if (event->aborted)
+        return -EAGAIN;
+
+    return event->result;
+}
+
+/*
+ * Files with a known digest get the verdict without a scan, it is stored in
+ * the inode cache as if the scanner replied. The file is hashed before the
+ * event is added to the in flight hash, so nothing waits for an event while
+ * its file is read.
+ */
+static int avflt_check_digest(struct avflt_event *event)
+{
+    int result;
+
+    if (event->nodigest || !avflt_inflight_allowed(event))
+        return 0;
+
+    result = avflt_digest_event(event);
+    if (!result)
+        return 0;
+
+    event->result = result;
+    avflt_update_cache(event);
+    avflt_stats_inc(AVFLT_STAT_DIGEST_HIT);
+    return result;
+}
+
 int avflt_process_request(struct file *file, int type)
 {
+    struct avflt_event *inflight;
     struct avflt_event *event;
     int rv = 0;
 
+again:
     event = avflt_event_alloc(file, type);
     if (IS_ERR(event))
         return PTR_ERR(event);
 
+    if (avflt_check_digest(event)) {
+        rv = event->result;
+        avflt_event_put(event);
+        return rv;
+    }
+
+    inflight = avflt_inflight_add(event);
+    if (inflight) {
+        avflt_event_put(event);
+        rv = avflt_wait_for_inflight(inflight);
+        avflt_event_put(inflight);
+        if (rv == -EAGAIN)
+            goto again;
+
+        return rv;
+    }
+
+    if (avflt_shed_request(event) || avflt_limit_request(event, 1)) {
+        rv = event->result;
+        goto exit;
+    }
+
     if (avflt_add_request(event, 1))
         goto exit;
 
@@ -263,29 +765,174 @@ int avflt_process_request(struct file *file, int type)
     avflt_update_cache(event);
     rv = event->result;
 exit:
+    avflt_inflight_rem(event, rv < 0);
     avflt_rem_request(event);
     avflt_event_put(event);
     return rv;
 }
 
+/*
+ * Asynchronous events have no process waiting for them, they are finished
+ * once the scanner replies or the event is dropped. The event is queued
+ * without waiting for the reply, the reference of the caller is taken over.
+ */
+static void avflt_queue_async(struct avflt_event *event)
+{
+    struct avflt_event *inflight;
+
+    if (avflt_check_digest(event)) {
+        avflt_event_put(event);
+        return;
+    }
+
+    inflight = avflt_inflight_add(event);
+    if (inflight) {
+        avflt_event_put(inflight);
+        avflt_event_put(event);
+        return;
+    }
+
+    if (!event->warm && avflt_limit_request(event, 0)) {
+        avflt_inflight_rem(event, 0);
+        avflt_event_put(event);
+        return;
+    }
+
+    event->async = 1;
+
+    if (avflt_add_request(event, 1)) {
+        event->async = 0;
+        avflt_inflight_rem(event, 0);
+        avflt_event_put(event);
+    }
+}
+
+/*
+ * class -1 keeps the class given by the class rules
+ */
+int avflt_process_request_async(struct file *file, int type, int class)
+{
+    struct avflt_event *event;
+
+    event = avflt_event_alloc(file, type);
+    if (IS_ERR(event))
+        return PTR_ERR(event);
+
+    if (class != -1)
+        event->class = class;
+
+    avflt_queue_async(event);
+    return 0;
+}
+
+/*
+ * For callers holding locks a scanner may need, e.g. the mmap_sem. The file
+ * is not hashed and the caller is never delayed by the limits.
+ */
+int avflt_process_request_nowait(struct file *file, int type, int class)
+{
+    struct avflt_event *event;
+
+    event = avflt_event_alloc(file, type);
+    if (IS_ERR(event))
+        return PTR_ERR(event);
+
+    if (class != -1)
+        event->class = class;
+
+    event->nodigest = 1;
+    avflt_queue_async(event);
+    return 0;
+}
+
+int avflt_process_request_warm(struct file *file)
+{
+    struct avflt_event *event;
+    int rv;
+
+    rv = avflt_warm_start();
+    if (rv)
+        return rv;
+
+    event = avflt_event_alloc(file, AVFLT_EVENT_OPEN);
+    if (IS_ERR(event)) {
+        avflt_warm_finish();
+        return PTR_ERR(event);
+    }
+
+    event->class = AVFLT_CLASS_BACKGROUND;
+    event->warm = 1;
+    avflt_queue_async(event);
+    return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+static void avflt_async_work_fn(void *data)
+#else
+static void avflt_async_work_fn(struct work_struct *work)
+#endif
+{
+    LIST_HEAD(list);
+    struct avflt_event *event;
+    struct avflt_event *tmp;
+
+    spin_lock(&avflt_async_lock);
+    list_splice_init(&avflt_async_list, &list);
+    spin_unlock(&avflt_async_lock);
+
+    list_for_each_entry_safe(event, tmp, &list, async_list) {
+        list_del_init(&event->async_list);
+
+        if (event->result)
+            avflt_update_cache(event);
+
+        avflt_inflight_rem(event, 0);
+        avflt_rem_request(event);
+        avflt_event_put(event);
+    }
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+static DECLARE_WORK(avflt_async_work, avflt_async_work_fn, NULL);
+#else
+static DECLARE_WORK(avflt_async_work, avflt_async_work_fn);
+#endif
+
 void avflt_event_done(struct avflt_event *event)
 {
-    complete(&event->wait);
+    complete_all(&event->wait);
+
+    if (!event->async || !xchg(&event->async, 0))
+        return;
+
+    spin_lock(&avflt_async_lock);
+    list_add_tail(&event->async_list, &avflt_async_list);
+    spin_unlock(&avflt_async_lock);
+
+    schedule_work(&avflt_async_work);
+}
+
+static void avflt_event_path(struct avflt_event *event, struct path *path)
+{
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
+    path->mnt = event->mnt;
+    path->dentry = event->f_path_dentry;
+#else
+    *path = event->f_path;
+#endif
 }
 
-int avflt_get_file(struct avflt_event *event)
+/*
+ * opens the event file read only for the scanner or the kernel itself
+ */
+struct file *avflt_open_file(struct avflt_event *event)
 {
     struct file *file;
     int flags;
-    int fd;
     char* buff;
     char* buff_s;
     struct path path;
 
-    fd = get_unused_fd();
-    if (fd < 0)
-        return fd;
-
     flags = O_RDONLY;
     flags |= event->flags & O_LARGEFILE;
 
@@ -299,12 +946,7 @@ int avflt_get_file(struct avflt_event *event)
 #endif
     if (IS_ERR(file)) {
         buff = (char *)kmalloc(PAGE_SIZE, GFP_KERNEL);
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
-        path.mnt = event->mnt;
-        path.dentry = event->f_path_dentry;
-#else
-        path = event->f_path;
-#endif
+        avflt_event_path(event, &path);
         buff_s = d_path(&path, buff, PAGE_SIZE);
         if (!IS_ERR(buff_s)) {
             avlft_pr_debug("dentry=%p, path=%s", path.dentry, buff_s);
@@ -313,6 +955,130 @@ int avflt_get_file(struct avflt_event *event)
         }
         kfree(buff);
     }
+
+    return file;
+}
+
+ssize_t avflt_kernel_read(struct file *file, char *buf, size_t size,
+        loff_t *pos)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
+    ssize_t rv;
+
+    rv = kernel_read(file, *pos, buf, size);
+    if (rv > 0)
+        *pos += rv;
+
+    return rv;
+#else
+    return kernel_read(file, buf, size, pos);
+#endif
+}
+
+/*
+ * The scanners which do not take an fd with the event read the content by
+ * the event id, the file is opened on the first read and kept until the
+ * event is freed.
+ */
+static struct file *avflt_event_content(struct avflt_event *event)
+{
+    struct file *file;
+
+    file = event->content;
+    if (file)
+        return file;
+
+    file = avflt_open_file(event);
+    if (IS_ERR(file))
+        return file;
+
+    if (cmpxchg(&event->content, NULL, file))
+        fput(file);
+
+    return event->content;
+}
+
+ssize_t avflt_read_content(struct avflt_event *event, char __user *buf,
+        size_t size, loff_t pos)
+{
+    struct file *file;
+    size_t done = 0;
+    ssize_t len = 0;
+    char *page;
+
+    file = avflt_event_content(event);
+    if (IS_ERR(file))
+        return PTR_ERR(file);
+
+    page = (char *)__get_free_page(GFP_KERNEL);
+    if (!page)
+        return -ENOMEM;
+
+    while (done < size) {
+        len = avflt_kernel_read(file, page,
+                min_t(size_t, size - done, PAGE_SIZE), &pos);
+        if (len <= 0)
+            break;
+
+        if (copy_to_user(buf + done, page, len)) {
+            len = -EFAULT;
+            break;
+        }
+
+        done += len;
+    }
+
+    free_page((unsigned long)page);
+
+    if (done)
+        return done;
+
+    return len;
+}
+
+int avflt_get_content_fd(struct avflt_event *event)
+{
+    struct file *file;
+    int fd;
+
+    file = avflt_event_content(event);
+    if (IS_ERR(file))
+        return PTR_ERR(file);
+
+    fd = get_unused_fd();
+    if (fd < 0)
+        return fd;
+
+    get_file(file);
+    fd_install(fd, file);
+
+    return fd;
+}
+
+char *avflt_get_path(struct avflt_event *event, char *buf, int size)
+{
+    struct path path;
+
+    avflt_event_path(event, &path);
+    return d_path(&path, buf, size);
+}
+
+int avflt_get_file(struct avflt_event *event, int nofd)
+{
+    struct file *file;
+    int fd;
+
+    if (nofd) {
+        event->file = NULL;
+        event->fd = -1;
+        return 0;
+    }
+
+    fd = get_unused_fd();
+    if (fd < 0)
+        return fd;
+
+    file = avflt_open_file(event);
     if (IS_ERR(file)) {
         put_unused_fd(fd);
         return PTR_ERR(file);
@@ -338,6 +1104,9 @@ void avflt_put_file(struct avflt_event *event)
 
 void avflt_install_fd(struct avflt_event *event)
 {
+    if (event->fd < 0)
+        return;
+
     fd_install(event->fd, event->file);
 }
 
@@ -363,6 +1132,16 @@ ssize_t avflt_copy_cmd(char __user *buf, size_t size, struct avflt_event *event)
     return len;
 }
 
+void avflt_copy_event(struct avflt_proto_event *rec, struct avflt_event *event)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->id = event->id;
+    rec->type = event->type;
+    rec->fd = event->fd;
+    rec->pid = event->pid;
+    rec->tgid = event->tgid;
+}
+
 int avflt_add_reply(struct avflt_event *event)
 {
     struct avflt_proc *proc;
@@ -379,44 +1158,47 @@ int avflt_add_reply(struct avflt_event *event)
 
 int avflt_request_empty(void)
 {
-    int rv;
+    int i;
 
-    spin_lock(&avflt_request_lock);
+    for (i = 0; i < avflt_queues_nr; i++) {
+        if (!avflt_queue_empty(&avflt_queues[i]))
+            return 0;
+    }
 
-    if (list_empty(&avflt_request_list))
-        rv = 1;
-    else
-        rv = 0;
+    return 1;
+}
 
-    spin_unlock(&avflt_request_lock);
+static void avflt_set_accept(int accept)
+{
+    int i;
 
-    return rv;
+    atomic_set(&avflt_request_accept, accept);
+
+    for (i = 0; i < avflt_queues_nr; i++) {
+        spin_lock(&avflt_queues[i].lock);
+        avflt_queues[i].accept = accept;
+        spin_unlock(&avflt_queues[i].lock);
+    }
 }
 
 void avflt_start_accept(void)
 {
-    spin_lock(&avflt_request_lock);
-    avflt_request_accept = 1;
-    spin_unlock(&avflt_request_lock);
+    spin_lock(&avflt_accept_lock);
+    avflt_set_accept(1);
+    spin_unlock(&avflt_accept_lock);
 }
 
 void avflt_stop_accept(void)
 {
-    spin_lock(&avflt_request_lock);
+    spin_lock(&avflt_accept_lock);
     if (avflt_proc_empty())
-        avflt_request_accept = 0;
-    spin_unlock(&avflt_request_lock);
+        avflt_set_accept(0);
+    spin_unlock(&avflt_accept_lock);
 }
 
 int avflt_is_stopped(void)
 {
-    int stopped;
-
-    spin_lock(&avflt_request_lock);
-    stopped = avflt_request_accept == 0;
-    spin_unlock(&avflt_request_lock);
-
-    return stopped;
+    return atomic_read(&avflt_request_accept) == 0;
 }
 
 void avflt_rem_requests(void)
@@ -424,22 +1206,33 @@ void avflt_rem_requests(void)
     LIST_HEAD(list);
     struct avflt_event *event;
     struct avflt_event *tmp;
+    struct avflt_queue *queue;
+    int i;
+    int j;
 
-    spin_lock(&avflt_request_lock);
+    for (i = 0; i < avflt_queues_nr; i++) {
+        queue = &avflt_queues[i];
 
-    if (avflt_request_accept == 1) {
-        spin_unlock(&avflt_request_lock);
-        return;
+        spin_lock(&queue->lock);
 
-    }
+        if (queue->accept == 1) {
+            spin_unlock(&queue->lock);
+            continue;
+        }
 
-    list_for_each_entry_safe(event, tmp, &avflt_request_list, req_list) {
-        event->was_removed_from_req_list = 1;
-        list_move_tail(&event->req_list, &list);
-        avflt_event_done(event);
-    }
+        for (j = 0; j < AVFLT_CLASSES; j++) {
+            list_for_each_entry_safe(event, tmp, &queue->list[j],
+                    req_list) {
+                event->was_removed_from_req_list = 1;
+                list_move_tail(&event->req_list, &list);
+                avflt_event_done(event);
+            }
+        }
 
-    spin_unlock(&avflt_request_lock);
+        queue->nr = 0;
+
+        spin_unlock(&queue->lock);
+    }
 
     list_for_each_entry_safe(event, tmp, &list, req_list) {
         list_del_init(&event->req_list);
@@ -447,46 +1240,56 @@ void avflt_rem_requests(void)
     }
 }
 
-struct avflt_event *avflt_get_reply(const char __user *buf, size_t size)
+struct avflt_event *avflt_set_reply(int id, int result, int cache)
 {
     struct avflt_proc *proc;
     struct avflt_event *event;
+
+    proc = avflt_proc_find(current->tgid);
+    if (!proc)
+        return ERR_PTR(-ENOENT);
+
+    event = avflt_proc_get_event(proc, id);
+    avflt_proc_put(proc);
+    if (!event)
+        return ERR_PTR(-ENOENT);
+
+    event->result = result;
+    
+    if (cache != -1)
+        event->cache = cache;
+
+    avflt_update_service_time(event);
+
+    return event;
+}
+
+struct avflt_event *avflt_get_reply(const char __user *buf, size_t size)
+{
     char cmd[256];
     int id;
     int result;
     int cache;
     int rv;
 
-    if (size > 256)
+    if (!size || size > 256)
         return ERR_PTR(-EINVAL);
 
     if (copy_from_user(cmd, buf, size))
         return ERR_PTR(-EFAULT);
 
+    cmd[size - 1] = 0;
+
     cache = -1;
     /*
      * v0: id:%d,res:%d
      * v1: id:%d,res:%d,cache:%d
      */
-    rv = sscanf(buf, "id:%d,res:%d,cache:%d", &id, &result, &cache);
+    rv = sscanf(cmd, "id:%d,res:%d,cache:%d", &id, &result, &cache);
     if (rv != 2 && rv != 3)
         return ERR_PTR(-EINVAL);
 
-    proc = avflt_proc_find(current->tgid);
-    if (!proc)
-        return ERR_PTR(-ENOENT);
-
-    event = avflt_proc_get_event(proc, id);
-    avflt_proc_put(proc);
-    if (!event)
-        return ERR_PTR(-ENOENT);
-
-    event->result = result;
-    
-    if (cache != -1)
-        event->cache = cache;
-
-    return event;
+    return avflt_set_reply(id, result, cache);
 }
 
 void avflt_invalidate_cache_root(redirfs_root root)
@@ -522,10 +1325,27 @@ void avflt_invalidate_cache(void)
     }
 
     redirfs_put_paths(paths);
+    avflt_digest_flush();
 }
 
 int avflt_check_init(void)
 {
+    int i;
+    int j;
+
+    avflt_queues_nr = min_t(int, num_possible_cpus(), AVFLT_QUEUES_MAX);
+
+    for (i = 0; i < avflt_queues_nr; i++) {
+        spin_lock_init(&avflt_queues[i].lock);
+        for (j = 0; j < AVFLT_CLASSES; j++)
+            INIT_LIST_HEAD(&avflt_queues[i].list[j]);
+    }
+
+    for (i = 0; i < (1 << AVFLT_INFLIGHT_BITS); i++) {
+        spin_lock_init(&avflt_inflight[i].lock);
+        INIT_HLIST_HEAD(&avflt_inflight[i].head);
+    }
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,22)
     avflt_event_cache = kmem_cache_create("avflt_event_cache",
             sizeof(struct avflt_event),
@@ -544,6 +1364,7 @@ int avflt_check_init(void)
 
 void avflt_check_exit(void)
 {
+    flush_scheduled_work();
     kmem_cache_destroy(avflt_event_cache);
 }
 
@@ -0,0 +1,255 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "avflt.h"
+
+/*
+ * Events are put into one of the priority classes by rules matching the
+ * process group or the cgroup of the process accessing the file or the event
+ * type, in this order of precedence. Cgroups of the unified hierarchy are
+ * matched by the inode number of their directory. The request queues serve
+ * the classes in a weighted round robin, in each round up to weight events
+ * of a class are taken before the lower classes get their turn.
+ */
+
+struct avflt_class_rule {
+    char type;
+    int id;
+    int class;
+};
+
+/*
+ * The rules change rarely and are looked up for every event, so they are
+ * replaced as a whole under avflt_class_mutex and read under RCU.
+ */
+struct avflt_class_rules {
+    struct rcu_head rcu;
+    int nr;
+    struct avflt_class_rule rules[0];
+};
+
+static struct avflt_class_rules *avflt_class_rules = NULL;
+static DEFINE_MUTEX(avflt_class_mutex);
+static atomic_t avflt_class_weights[AVFLT_CLASSES] = {
+    ATOMIC_INIT(8),
+    ATOMIC_INIT(4),
+    ATOMIC_INIT(1)
+};
+
+static pid_t avflt_class_pgrp(void)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
+    return process_group(current);
+#else
+    return task_pgrp_nr(current);
+#endif
+}
+
+static int avflt_class_find(struct avflt_class_rules *rules, char type,
+        int id)
+{
+    int i;
+
+    for (i = 0; rules && i < rules->nr; i++) {
+        if (rules->rules[i].type == type && rules->rules[i].id == id)
+            return i;
+    }
+
+    return -1;
+}
+
+int avflt_class_get(int type)
+{
+    struct avflt_class_rules *rules;
+    int class = AVFLT_CLASS_NORMAL;
+    int i;
+
+    rcu_read_lock();
+
+    rules = rcu_dereference(avflt_class_rules);
+    if (!rules)
+        goto exit;
+
+    i = avflt_class_find(rules, AVFLT_CLASS_RULE_PGRP, avflt_class_pgrp());
+    if (i == -1)
+        i = avflt_class_find(rules, AVFLT_CLASS_RULE_CGROUP,
+                (int)avflt_cgroup_id());
+    if (i == -1)
+        i = avflt_class_find(rules, AVFLT_CLASS_RULE_TYPE, type);
+
+    if (i != -1)
+        class = rules->rules[i].class;
+exit:
+    rcu_read_unlock();
+    return class;
+}
+
+int avflt_class_weight(int class)
+{
+    return atomic_read(&avflt_class_weights[class]);
+}
+
+int avflt_class_set_weights(int *weights)
+{
+    int i;
+
+    for (i = 0; i < AVFLT_CLASSES; i++) {
+        if (weights[i] < 1 || weights[i] > AVFLT_CLASS_WEIGHT_MAX)
+            return -EINVAL;
+    }
+
+    for (i = 0; i < AVFLT_CLASSES; i++)
+        atomic_set(&avflt_class_weights[i], weights[i]);
+
+    return 0;
+}
+
+static void avflt_class_free_rcu(struct rcu_head *rcu)
+{
+    kfree(container_of(rcu, struct avflt_class_rules, rcu));
+}
+
+static void avflt_class_replace(struct avflt_class_rules *rules)
+{
+    struct avflt_class_rules *old = avflt_class_rules;
+
+    rcu_assign_pointer(avflt_class_rules, rules);
+
+    if (old)
+        call_rcu(&old->rcu, avflt_class_free_rcu);
+}
+
+/*
+ * class -1 removes the rule
+ */
+int avflt_class_set_rule(char type, int id, int class)
+{
+    struct avflt_class_rules *old;
+    struct avflt_class_rules *rules;
+    int nr = 0;
+    int rv = 0;
+    int i;
+
+    if (type != AVFLT_CLASS_RULE_PGRP && type != AVFLT_CLASS_RULE_TYPE &&
+            type != AVFLT_CLASS_RULE_CGROUP)
+        return -EINVAL;
+
+    if (type == AVFLT_CLASS_RULE_CGROUP && !avflt_cgroup_id())
+        return -EOPNOTSUPP;
+
+    if (class < -1 || class >= AVFLT_CLASSES)
+        return -EINVAL;
+
+    mutex_lock(&avflt_class_mutex);
+
+    old = avflt_class_rules;
+    if (old)
+        nr = old->nr;
+
+    i = avflt_class_find(old, type, id);
+
+    if (class == -1) {
+        if (i == -1) {
+            rv = -ENOENT;
+            goto exit;
+        }
+
+        if (nr == 1) {
+            avflt_class_replace(NULL);
+            goto exit;
+        }
+    }
+
+    if (class != -1 && i == -1 && nr == AVFLT_CLASS_RULES_MAX) {
+        rv = -ENOSPC;
+        goto exit;
+    }
+
+    rules = kmalloc(sizeof(struct avflt_class_rules) +
+            sizeof(struct avflt_class_rule) * (nr + 1), GFP_KERNEL);
+    if (!rules) {
+        rv = -ENOMEM;
+        goto exit;
+    }
+
+    if (nr)
+        memcpy(rules->rules, old->rules,
+                sizeof(struct avflt_class_rule) * nr);
+
+    rules->nr = nr;
+
+    if (class == -1)
+        rules->rules[i] = rules->rules[--rules->nr];
+
+    else {
+        if (i == -1)
+            i = rules->nr++;
+
+        rules->rules[i].type = type;
+        rules->rules[i].id = id;
+        rules->rules[i].class = class;
+    }
+
+    avflt_class_replace(rules);
+exit:
+    mutex_unlock(&avflt_class_mutex);
+    return rv;
+}
+
+void avflt_class_clear_rules(void)
+{
+    mutex_lock(&avflt_class_mutex);
+    avflt_class_replace(NULL);
+    mutex_unlock(&avflt_class_mutex);
+}
+
+ssize_t avflt_class_get_info(char *buf, int size)
+{
+    struct avflt_class_rules *rules;
+    ssize_t len;
+    int i;
+
+    len = snprintf(buf, size, "w:%d:%d:%d",
+            avflt_class_weight(AVFLT_CLASS_INTERACTIVE),
+            avflt_class_weight(AVFLT_CLASS_NORMAL),
+            avflt_class_weight(AVFLT_CLASS_BACKGROUND)) + 1;
+
+    mutex_lock(&avflt_class_mutex);
+
+    rules = avflt_class_rules;
+
+    for (i = 0; rules && i < rules->nr && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%c:%d:%d",
+                rules->rules[i].type, rules->rules[i].id,
+                rules->rules[i].class) + 1;
+    }
+
+    mutex_unlock(&avflt_class_mutex);
+
+    if (len > size)
+        len = size;
+
+    return len;
+}
+
+void avflt_class_exit(void)
+{
+    avflt_class_clear_rules();
+    rcu_barrier();
+}
@@ -50,6 +50,9 @@ static struct avflt_root_data *avflt_root_data_alloc(void)
 
     atomic_set(&data->cache_enabled, 1);
     atomic_set(&data->cache_ver, 0);
+    atomic_set(&data->timeout, -1);
+    atomic_set(&data->policy, AVFLT_POLICY_OPEN);
+    atomic_set(&data->shed, 0);
 
     return data;
 }
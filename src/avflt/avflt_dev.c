@@ -30,15 +30,27 @@ static dev_t avflt_dev;
 static int avflt_dev_open_registered(struct inode *inode, struct file *file)
 {
     struct avflt_proc *proc;
+    struct avflt_conn *conn;
 
-    if (avflt_proc_empty())
+    conn = kzalloc(sizeof(struct avflt_conn), GFP_KERNEL);
+    if (!conn)
+        return -ENOMEM;
+
+    conn->proto = AVFLT_PROTO_TEXT;
+    conn->queue = avflt_queue_bind();
+
+    if (avflt_proc_empty() && !avflt_pcache_get_sigver())
         avflt_invalidate_cache();
 
     proc = avflt_proc_add(current->tgid);
-    if (IS_ERR(proc))
+    if (IS_ERR(proc)) {
+        kfree(conn);
         return PTR_ERR(proc);
+    }
 
     avflt_proc_put(proc);
+    file->private_data = conn;
+    atomic_inc(&avflt_scanners);
     avflt_start_accept();
     return 0;
 }
@@ -58,6 +70,11 @@ static int avflt_dev_open(struct inode *inode, struct file *file)
 
 static int avflt_dev_release_registered(struct inode *inode, struct file *file)
 {
+    struct avflt_conn *conn = file->private_data;
+
+    avflt_ring_free(conn->ring);
+    kfree(conn);
+    atomic_dec(&avflt_scanners);
     avflt_proc_rem(current->tgid);
     if (!avflt_proc_empty())
         return 0;
@@ -81,21 +98,19 @@ static int avflt_dev_release(struct inode *inode, struct file *file)
     return avflt_dev_release_trusted(inode, file);
 }
 
-static ssize_t avflt_dev_read(struct file *file, char __user *buf,
+static ssize_t avflt_dev_read_text(struct file *file, char __user *buf,
         size_t size, loff_t *pos)
 {
+    struct avflt_conn *conn = file->private_data;
     struct avflt_event *event;
     ssize_t len;
     ssize_t rv;
 
-    if (!(file->f_mode & FMODE_WRITE))
-        return -EINVAL;
-
-    event = avflt_get_request();
+    event = avflt_get_request(conn->queue);
     if (!event)
         return 0;
 
-    rv = avflt_get_file(event);
+    rv = avflt_get_file(event, conn->flags & AVFLT_FLAG_NOFD);
     if (rv)
         goto error;
 
@@ -118,7 +133,234 @@ error:
     return rv;
 }
 
-static ssize_t avflt_dev_write(struct file *file, const char __user *buf,
+/*
+ * Events are taken from the request queue in one go and handed over with one
+ * copy_to_user. Events which could not be handed over are returned to the
+ * queue, the read never loses an event.
+ */
+static ssize_t avflt_dev_read_binary(struct file *file, char __user *buf,
+        size_t size, loff_t *pos)
+{
+    struct avflt_conn *conn = file->private_data;
+    struct avflt_event *events[AVFLT_PROTO_BATCH_MAX];
+    struct avflt_proto_event *recs;
+    struct avflt_proc *proc;
+    int count;
+    int nr;
+    int i;
+    ssize_t rv = 0;
+
+    count = size / sizeof(struct avflt_proto_event);
+    if (!count)
+        return -EINVAL;
+
+    if (count > AVFLT_PROTO_BATCH_MAX)
+        count = AVFLT_PROTO_BATCH_MAX;
+
+    proc = avflt_proc_find(current->tgid);
+    if (!proc)
+        return -ENOENT;
+
+    recs = kmalloc(sizeof(struct avflt_proto_event) * count, GFP_KERNEL);
+    if (!recs) {
+        avflt_proc_put(proc);
+        return -ENOMEM;
+    }
+
+    nr = avflt_get_requests(conn->queue, events, count);
+
+    for (i = 0; i < nr; i++) {
+        rv = avflt_get_file(events[i], conn->flags & AVFLT_FLAG_NOFD);
+        if (rv)
+            break;
+
+        avflt_proc_add_event(proc, events[i]);
+        avflt_copy_event(&recs[i], events[i]);
+    }
+
+    count = i;
+
+    if (count && copy_to_user(buf, recs,
+                sizeof(struct avflt_proto_event) * count)) {
+        for (i = 0; i < count; i++)
+            avflt_proc_rem_event(proc, events[i]);
+        rv = -EFAULT;
+        count = 0;
+    }
+
+    for (i = 0; i < nr; i++) {
+        if (i < count) {
+            avflt_install_fd(events[i]);
+        } else {
+            avflt_put_file(events[i]);
+            avflt_readd_request(events[i]);
+        }
+        avflt_event_put(events[i]);
+    }
+
+    avflt_proc_put(proc);
+    kfree(recs);
+
+    if (count)
+        return sizeof(struct avflt_proto_event) * count;
+
+    return rv;
+}
+
+/*
+ * Binary read with the file path after each event record. The records are
+ * copied one by one since their size is known only after the path is built,
+ * the events which do not fit are returned to the queue.
+ */
+static ssize_t avflt_dev_read_paths(struct file *file, char __user *buf,
+        size_t size, loff_t *pos)
+{
+    struct avflt_conn *conn = file->private_data;
+    struct avflt_event *events[AVFLT_PROTO_BATCH_MAX];
+    struct avflt_proto_event rec;
+    struct avflt_proc *proc;
+    size_t done = 0;
+    size_t len;
+    char *page;
+    char *path;
+    int count;
+    int nr;
+    int i;
+    ssize_t rv = 0;
+
+    count = size / (sizeof(struct avflt_proto_event) + AVFLT_PATH_MAX);
+    if (!count)
+        return -EINVAL;
+
+    if (count > AVFLT_PROTO_BATCH_MAX)
+        count = AVFLT_PROTO_BATCH_MAX;
+
+    proc = avflt_proc_find(current->tgid);
+    if (!proc)
+        return -ENOENT;
+
+    page = (char *)__get_free_page(GFP_KERNEL);
+    if (!page) {
+        avflt_proc_put(proc);
+        return -ENOMEM;
+    }
+
+    nr = avflt_get_requests(conn->queue, events, count);
+
+    for (i = 0; i < nr; i++) {
+        path = avflt_get_path(events[i], page, AVFLT_PATH_MAX);
+        len = IS_ERR(path) ? 0 : strlen(path) + 1;
+
+        if (done + sizeof(rec) + ALIGN(len, 8) > size) {
+            rv = -ENOSPC;
+            break;
+        }
+
+        rv = avflt_get_file(events[i], conn->flags & AVFLT_FLAG_NOFD);
+        if (rv)
+            break;
+
+        avflt_copy_event(&rec, events[i]);
+        rec.path_len = len;
+
+        if (copy_to_user(buf + done, &rec, sizeof(rec)) ||
+                copy_to_user(buf + done + sizeof(rec), path, len)) {
+            avflt_put_file(events[i]);
+            rv = -EFAULT;
+            break;
+        }
+
+        avflt_proc_add_event(proc, events[i]);
+        done += sizeof(rec) + ALIGN(len, 8);
+    }
+
+    count = i;
+
+    for (i = 0; i < nr; i++) {
+        if (i < count) {
+            avflt_install_fd(events[i]);
+        } else {
+            avflt_put_file(events[i]);
+            avflt_readd_request(events[i]);
+        }
+        avflt_event_put(events[i]);
+    }
+
+    free_page((unsigned long)page);
+    avflt_proc_put(proc);
+
+    if (done)
+        return done;
+
+    return rv;
+}
+
+/*
+ * Scanners blocked here wait exclusively, so each queued event wakes up just
+ * one of them instead of all scanners sleeping in poll.
+ */
+static int avflt_dev_wait(struct avflt_conn *conn)
+{
+    DEFINE_WAIT(wait);
+    long timeout;
+    int rv = 0;
+
+    if (!conn->wait || !avflt_request_empty())
+        return 0;
+
+    if (conn->wait == AVFLT_WAIT_INFINITE)
+        timeout = MAX_SCHEDULE_TIMEOUT;
+    else
+        timeout = msecs_to_jiffies(conn->wait);
+
+    for (;;) {
+        prepare_to_wait_exclusive(&avflt_request_available, &wait,
+                TASK_INTERRUPTIBLE);
+
+        if (!avflt_request_empty() || !timeout)
+            break;
+
+        if (signal_pending(current)) {
+            rv = -ERESTARTSYS;
+            break;
+        }
+
+        timeout = schedule_timeout(timeout);
+    }
+
+    finish_wait(&avflt_request_available, &wait);
+
+    /* do not swallow the wakeup meant for an event we are not taking */
+    if (rv && !avflt_request_empty())
+        wake_up_interruptible_nr(&avflt_request_available, 1);
+
+    return rv;
+}
+
+static ssize_t avflt_dev_read(struct file *file, char __user *buf,
+        size_t size, loff_t *pos)
+{
+    struct avflt_conn *conn = file->private_data;
+    int rv;
+
+    if (!(file->f_mode & FMODE_WRITE))
+        return -EINVAL;
+
+    rv = avflt_dev_wait(conn);
+    if (rv)
+        return rv;
+
+    if (conn->proto == AVFLT_PROTO_BINARY) {
+        if (conn->flags & AVFLT_FLAG_PATH)
+            return avflt_dev_read_paths(file, buf, size, pos);
+
+        return avflt_dev_read_binary(file, buf, size, pos);
+    }
+
+    return avflt_dev_read_text(file, buf, size, pos);
+}
+
+static ssize_t avflt_dev_write_text(struct file *file, const char __user *buf,
         size_t size, loff_t *pos)
 {
     struct avflt_event *event;
@@ -143,6 +385,291 @@ static ssize_t avflt_dev_write(struct file *file, const char __user *buf,
     return iter - buf;
 }
 
+static ssize_t avflt_dev_write_binary(struct file *file,
+        const char __user *buf, size_t size, loff_t *pos)
+{
+    struct avflt_proto_reply recs[16];
+    struct avflt_event *event;
+    size_t done = 0;
+    size_t len;
+    int nr;
+    int i;
+
+    if (size % sizeof(struct avflt_proto_reply))
+        return -EINVAL;
+
+    while (done < size) {
+        len = min(size - done, sizeof(recs));
+        if (copy_from_user(recs, buf + done, len))
+            return done ? done : -EFAULT;
+
+        nr = len / sizeof(struct avflt_proto_reply);
+
+        for (i = 0; i < nr; i++) {
+            event = avflt_set_reply(recs[i].id, recs[i].result,
+                    recs[i].cache);
+            if (IS_ERR(event))
+                return done ? done : PTR_ERR(event);
+
+            avflt_event_done(event);
+            avflt_event_put(event);
+            done += sizeof(struct avflt_proto_reply);
+        }
+    }
+
+    return done;
+}
+
+static ssize_t avflt_dev_write(struct file *file, const char __user *buf,
+        size_t size, loff_t *pos)
+{
+    struct avflt_conn *conn = file->private_data;
+
+    if (!(file->f_mode & FMODE_WRITE))
+        return -EINVAL;
+
+    if (conn->proto == AVFLT_PROTO_BINARY)
+        return avflt_dev_write_binary(file, buf, size, pos);
+
+    return avflt_dev_write_text(file, buf, size, pos);
+}
+
+static long avflt_dev_ring_setup(struct avflt_conn *conn, unsigned long arg)
+{
+    struct avflt_ring *ring;
+
+    ring = avflt_ring_alloc(arg);
+    if (IS_ERR(ring))
+        return PTR_ERR(ring);
+
+    if (cmpxchg(&conn->ring, NULL, ring)) {
+        avflt_ring_free(ring);
+        return -EBUSY;
+    }
+
+    return ring->size;
+}
+
+static struct avflt_event *avflt_dev_get_event(int id)
+{
+    struct avflt_event *event;
+    struct avflt_proc *proc;
+
+    proc = avflt_proc_find(current->tgid);
+    if (!proc)
+        return ERR_PTR(-ENOENT);
+
+    event = avflt_proc_find_event(proc, id);
+    avflt_proc_put(proc);
+
+    if (!event)
+        return ERR_PTR(-ENOENT);
+
+    return event;
+}
+
+static long avflt_dev_pread(struct avflt_proto_read __user *arg)
+{
+    struct avflt_proto_read req;
+    struct avflt_event *event;
+    long rv;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+
+    event = avflt_dev_get_event(req.id);
+    if (IS_ERR(event))
+        return PTR_ERR(event);
+
+    rv = avflt_read_content(event,
+            (char __user *)(unsigned long)req.buf, req.size, req.offset);
+
+    avflt_event_put(event);
+    return rv;
+}
+
+static long avflt_dev_get_fd(int id)
+{
+    struct avflt_event *event;
+    long rv;
+
+    event = avflt_dev_get_event(id);
+    if (IS_ERR(event))
+        return PTR_ERR(event);
+
+    rv = avflt_get_content_fd(event);
+
+    avflt_event_put(event);
+    return rv;
+}
+
+static long avflt_dev_get_path(struct avflt_proto_read __user *arg)
+{
+    struct avflt_proto_read req;
+    struct avflt_event *event;
+    char *page;
+    char *path;
+    long rv;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+
+    event = avflt_dev_get_event(req.id);
+    if (IS_ERR(event))
+        return PTR_ERR(event);
+
+    page = (char *)__get_free_page(GFP_KERNEL);
+    if (!page) {
+        avflt_event_put(event);
+        return -ENOMEM;
+    }
+
+    path = avflt_get_path(event, page, PAGE_SIZE);
+    if (IS_ERR(path)) {
+        rv = PTR_ERR(path);
+        goto exit;
+    }
+
+    rv = strlen(path) + 1;
+    if (rv > req.size) {
+        rv = -ENAMETOOLONG;
+        goto exit;
+    }
+
+    if (copy_to_user((char __user *)(unsigned long)req.buf, path, rv))
+        rv = -EFAULT;
+exit:
+    free_page((unsigned long)page);
+    avflt_event_put(event);
+    return rv;
+}
+
+/*
+ * available to registered and trusted processes, their opens are not
+ * checked so the crawler does not wait for the scans
+ */
+static long avflt_dev_warm(unsigned long fd)
+{
+    struct file *file;
+    long rv;
+
+    file = fget(fd);
+    if (!file)
+        return -EBADF;
+
+    rv = avflt_warm_file(file);
+    fput(file);
+    return rv;
+}
+
+static long avflt_dev_ioctl(struct file *file, unsigned int cmd,
+        unsigned long arg)
+{
+    struct avflt_conn *conn = file->private_data;
+    long rv;
+
+    if (cmd == AVFLT_IOC_WARM)
+        return avflt_dev_warm(arg);
+
+    if (!(file->f_mode & FMODE_WRITE))
+        return -ENOTTY;
+
+    switch (cmd) {
+        case AVFLT_IOC_SET_PROTO:
+            if (arg != AVFLT_PROTO_TEXT && arg != AVFLT_PROTO_BINARY)
+                return -EINVAL;
+
+            conn->proto = arg;
+            return 0;
+
+        case AVFLT_IOC_GET_PROTO:
+            return conn->proto;
+
+        case AVFLT_IOC_RING_SETUP:
+            return avflt_dev_ring_setup(conn, arg);
+
+        case AVFLT_IOC_RING_ENTER:
+            if (!conn->ring)
+                return -EINVAL;
+
+            if (arg & ~AVFLT_RING_ENTER_WAIT)
+                return -EINVAL;
+
+            rv = avflt_ring_enter(conn->ring, conn->queue,
+                    conn->flags & AVFLT_FLAG_NOFD);
+            if (rv || !(arg & AVFLT_RING_ENTER_WAIT))
+                return rv;
+
+            rv = avflt_dev_wait(conn);
+            if (rv)
+                return rv;
+
+            return avflt_ring_enter(conn->ring, conn->queue,
+                    conn->flags & AVFLT_FLAG_NOFD);
+
+        case AVFLT_IOC_SET_WAIT:
+            conn->wait = arg;
+            return 0;
+
+        case AVFLT_IOC_SET_QUEUE:
+            if (arg >= avflt_queues_count())
+                return -EINVAL;
+
+            conn->queue = arg;
+            return 0;
+
+        case AVFLT_IOC_GET_QUEUE:
+            return conn->queue;
+
+        case AVFLT_IOC_GET_QUEUES:
+            return avflt_queues_count();
+
+        case AVFLT_IOC_SET_SIGVER:
+            avflt_pcache_set_sigver(arg);
+            return 0;
+
+        case AVFLT_IOC_PCACHE_LOAD:
+            return avflt_pcache_load(
+                    (struct avflt_pcache_buf __user *)arg);
+
+        case AVFLT_IOC_PCACHE_DUMP:
+            return avflt_pcache_dump(
+                    (struct avflt_pcache_buf __user *)arg);
+
+        case AVFLT_IOC_SET_FLAGS:
+            if (arg & ~AVFLT_FLAGS)
+                return -EINVAL;
+
+            conn->flags = arg;
+            return 0;
+
+        case AVFLT_IOC_PREAD:
+            return avflt_dev_pread((struct avflt_proto_read __user *)arg);
+
+        case AVFLT_IOC_GET_FD:
+            return avflt_dev_get_fd(arg);
+
+        case AVFLT_IOC_GET_PATH:
+            return avflt_dev_get_path(
+                    (struct avflt_proto_read __user *)arg);
+    }
+
+    return -ENOTTY;
+}
+
+static int avflt_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct avflt_conn *conn = file->private_data;
+
+    if (!(file->f_mode & FMODE_WRITE))
+        return -EINVAL;
+
+    if (!conn->ring)
+        return -EINVAL;
+
+    return avflt_ring_mmap(conn->ring, vma);
+}
+
 static unsigned int avflt_poll(struct file *file, poll_table *wait)
 {
     unsigned int mask;
@@ -163,6 +690,11 @@ static struct file_operations avflt_fops = {
     .release = avflt_dev_release,
     .read = avflt_dev_read,
     .write = avflt_dev_write,
+    .unlocked_ioctl = avflt_dev_ioctl,
+#ifdef CONFIG_COMPAT
+    .compat_ioctl = avflt_dev_ioctl,
+#endif
+    .mmap = avflt_dev_mmap,
     .poll = avflt_poll
 };
 
@@ -0,0 +1,477 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "avflt.h"
+#if AVFLT_DIGEST
+#include <linux/hash.h>
+#include <crypto/hash.h>
+#endif
+
+/*
+ * The digest cache shares verdicts between files with the same content. A
+ * file missing the inode cache is read by the kernel and its SHA-256 digest
+ * is looked up in a table of the digests of the files scanned before. Files
+ * larger than avflt_digest_max are not hashed, 0 turns the digest cache off.
+ * The table keeps the most recently used AVFLT_DIGEST_MAX verdicts.
+ */
+
+#if AVFLT_DIGEST
+
+#define AVFLT_DIGEST_BITS 10
+#define AVFLT_DIGEST_MAX 16384
+
+struct avflt_digest_entry {
+    struct hlist_node hash;
+    struct list_head lru;
+    u8 digest[AVFLT_DIGEST_SIZE];
+    int result;
+    int epoch;
+};
+
+static struct hlist_head avflt_digest_hash[1 << AVFLT_DIGEST_BITS];
+static LIST_HEAD(avflt_digest_lru);
+static DEFINE_SPINLOCK(avflt_digest_lock);
+static DEFINE_MUTEX(avflt_digest_mutex);
+static int avflt_digest_nr = 0;
+static struct crypto_shash *avflt_digest_tfm = NULL;
+static atomic_long_t avflt_digest_max = ATOMIC_LONG_INIT(0);
+
+static struct hlist_head *avflt_digest_head(const u8 *digest)
+{
+    return &avflt_digest_hash[hash_long(*(unsigned long *)digest,
+            AVFLT_DIGEST_BITS)];
+}
+
+static struct avflt_digest_entry *avflt_digest_lookup(const u8 *digest)
+{
+    struct avflt_digest_entry *entry;
+    struct hlist_node *pos;
+
+    hlist_for_each(pos, avflt_digest_head(digest)) {
+        entry = hlist_entry(pos, struct avflt_digest_entry, hash);
+        if (!memcmp(entry->digest, digest, AVFLT_DIGEST_SIZE))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void avflt_digest_remove(struct avflt_digest_entry *entry)
+{
+    hlist_del(&entry->hash);
+    list_del(&entry->lru);
+    kfree(entry);
+    avflt_digest_nr--;
+}
+
+static void avflt_digest_evict(void)
+{
+    avflt_digest_remove(list_entry(avflt_digest_lru.prev,
+                struct avflt_digest_entry, lru));
+}
+
+static int avflt_digest_file(struct file *file, u8 *digest)
+{
+    struct shash_desc *desc;
+    loff_t pos = 0;
+    ssize_t len;
+    char *buf;
+    int rv = -ENOMEM;
+
+    desc = kmalloc(sizeof(struct shash_desc) +
+            crypto_shash_descsize(avflt_digest_tfm), GFP_KERNEL);
+    if (!desc)
+        return -ENOMEM;
+
+    buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!buf)
+        goto exit;
+
+    desc->tfm = avflt_digest_tfm;
+    desc->flags = 0;
+
+    rv = crypto_shash_init(desc);
+    if (rv)
+        goto exit;
+
+    while ((len = avflt_kernel_read(file, buf, PAGE_SIZE, &pos)) > 0) {
+        rv = crypto_shash_update(desc, buf, len);
+        if (rv)
+            goto exit;
+
+        cond_resched();
+    }
+
+    if (len < 0) {
+        rv = len;
+        goto exit;
+    }
+
+    rv = crypto_shash_final(desc, digest);
+exit:
+    kfree(buf);
+    kfree(desc);
+    return rv;
+}
+
+/*
+ * The files are opened and read in the context of the process accessing the
+ * event file, which is not a registered scanner. The reading tasks are kept
+ * in a list so their own opens are not checked, otherwise the open would be
+ * checked again and could wait for the event being hashed.
+ */
+struct avflt_digest_reader {
+    struct list_head list;
+    struct task_struct *task;
+};
+
+static LIST_HEAD(avflt_digest_readers);
+static DEFINE_SPINLOCK(avflt_digest_readers_lock);
+static atomic_t avflt_digest_readers_nr = ATOMIC_INIT(0);
+
+int avflt_digest_self(void)
+{
+    struct avflt_digest_reader *reader;
+    int rv = 0;
+
+    if (!atomic_read(&avflt_digest_readers_nr))
+        return 0;
+
+    spin_lock(&avflt_digest_readers_lock);
+
+    list_for_each_entry(reader, &avflt_digest_readers, list) {
+        if (reader->task == current) {
+            rv = 1;
+            break;
+        }
+    }
+
+    spin_unlock(&avflt_digest_readers_lock);
+
+    return rv;
+}
+
+static int avflt_digest_read(struct avflt_event *event)
+{
+    struct avflt_digest_reader reader;
+    struct file *file;
+    int rv;
+
+    reader.task = current;
+
+    spin_lock(&avflt_digest_readers_lock);
+    list_add(&reader.list, &avflt_digest_readers);
+    atomic_inc(&avflt_digest_readers_nr);
+    spin_unlock(&avflt_digest_readers_lock);
+
+    file = avflt_open_file(event);
+    if (IS_ERR(file)) {
+        rv = PTR_ERR(file);
+        goto exit;
+    }
+
+    rv = avflt_digest_file(file, event->digest);
+    fput(file);
+exit:
+    spin_lock(&avflt_digest_readers_lock);
+    list_del(&reader.list);
+    atomic_dec(&avflt_digest_readers_nr);
+    spin_unlock(&avflt_digest_readers_lock);
+
+    return rv;
+}
+
+/*
+ * The content did not change if the inode cache version, which is bumped
+ * whenever a writer closes the file, and the ctime and size are the same.
+ */
+static int avflt_digest_changed(struct avflt_event *event,
+        struct avflt_inode_data *inode_data)
+{
+    struct inode *inode = event->f_path_dentry->d_inode;
+    int ver;
+
+    spin_lock(&inode_data->lock);
+    ver = inode_data->inode_cache_ver;
+    spin_unlock(&inode_data->lock);
+
+    return ver != event->digest_ver ||
+        !timespec_equal(&inode->i_ctime, &event->digest_ctime) ||
+        i_size_read(inode) != event->digest_size;
+}
+
+/*
+ * Computes the digest of the event file and returns the known verdict for
+ * it, or 0. The inode data is attached so writes are tracked from now on,
+ * the verdict of the event is stored under the digest only if the content
+ * did not change until the reply.
+ */
+int avflt_digest_event(struct avflt_event *event)
+{
+    struct inode *inode = event->f_path_dentry->d_inode;
+    struct avflt_inode_data *inode_data;
+    struct avflt_digest_entry *entry;
+    loff_t size;
+    int result = 0;
+    int epoch = 0;
+    int changed;
+
+    size = i_size_read(inode);
+    if (size > atomic_long_read(&avflt_digest_max))
+        return 0;
+
+    smp_rmb();
+    if (!avflt_digest_tfm)
+        return 0;
+
+    inode_data = avflt_attach_inode_data(inode);
+    if (!inode_data)
+        return 0;
+
+    spin_lock(&inode_data->lock);
+    event->digest_ver = inode_data->inode_cache_ver;
+    spin_unlock(&inode_data->lock);
+
+    event->digest_ctime = inode->i_ctime;
+    event->digest_size = size;
+
+    if (avflt_digest_read(event)) {
+        avflt_put_inode_data(inode_data);
+        return 0;
+    }
+
+    changed = avflt_digest_changed(event, inode_data);
+    avflt_put_inode_data(inode_data);
+    if (changed)
+        return 0;
+
+    event->digest_valid = 1;
+
+    spin_lock(&avflt_digest_lock);
+
+    entry = avflt_digest_lookup(event->digest);
+    if (entry) {
+        list_move(&entry->lru, &avflt_digest_lru);
+        result = entry->result;
+        epoch = entry->epoch;
+    }
+
+    spin_unlock(&avflt_digest_lock);
+
+    if (!result || !avflt_inval_check(event->f_path_dentry, epoch))
+        return result;
+
+    /* a directory above the file was invalidated after the verdict */
+    spin_lock(&avflt_digest_lock);
+
+    entry = avflt_digest_lookup(event->digest);
+    if (entry && entry->epoch == epoch)
+        avflt_digest_remove(entry);
+
+    spin_unlock(&avflt_digest_lock);
+
+    return 0;
+}
+
+void avflt_digest_update(struct avflt_event *event)
+{
+    struct inode *inode = event->f_path_dentry->d_inode;
+    struct avflt_inode_data *inode_data;
+    struct avflt_digest_entry *entry;
+    struct avflt_digest_entry *new;
+    int changed;
+
+    if (!event->digest_valid)
+        return;
+
+    inode_data = avflt_get_inode_data_inode(inode);
+    if (!inode_data)
+        return;
+
+    changed = avflt_digest_changed(event, inode_data);
+    avflt_put_inode_data(inode_data);
+    if (changed)
+        return;
+
+    new = kmalloc(sizeof(struct avflt_digest_entry), GFP_KERNEL);
+    if (!new)
+        return;
+
+    memcpy(new->digest, event->digest, AVFLT_DIGEST_SIZE);
+    new->result = event->result;
+    new->epoch = event->epoch;
+
+    spin_lock(&avflt_digest_lock);
+
+    entry = avflt_digest_lookup(event->digest);
+    if (entry) {
+        entry->result = event->result;
+        entry->epoch = event->epoch;
+        list_move(&entry->lru, &avflt_digest_lru);
+        spin_unlock(&avflt_digest_lock);
+        kfree(new);
+        return;
+    }
+
+    if (avflt_digest_nr == AVFLT_DIGEST_MAX)
+        avflt_digest_evict();
+
+    hlist_add_head(&new->hash, avflt_digest_head(new->digest));
+    list_add(&new->lru, &avflt_digest_lru);
+    avflt_digest_nr++;
+
+    spin_unlock(&avflt_digest_lock);
+}
+
+void avflt_digest_flush(void)
+{
+    spin_lock(&avflt_digest_lock);
+
+    while (!list_empty(&avflt_digest_lru))
+        avflt_digest_evict();
+
+    spin_unlock(&avflt_digest_lock);
+}
+
+/*
+ * drops the verdict stored under the digest of the last verdict of the inode
+ */
+void avflt_digest_forget(struct inode *inode)
+{
+    struct avflt_inode_data *inode_data;
+    struct avflt_digest_entry *entry;
+    u8 digest[AVFLT_DIGEST_SIZE];
+    int valid;
+
+    inode_data = avflt_get_inode_data_inode(inode);
+    if (!inode_data)
+        return;
+
+    spin_lock(&inode_data->lock);
+    valid = inode_data->digest_valid;
+    memcpy(digest, inode_data->digest, AVFLT_DIGEST_SIZE);
+    inode_data->digest_valid = 0;
+    spin_unlock(&inode_data->lock);
+    avflt_put_inode_data(inode_data);
+
+    if (!valid)
+        return;
+
+    spin_lock(&avflt_digest_lock);
+
+    entry = avflt_digest_lookup(digest);
+    if (entry)
+        avflt_digest_remove(entry);
+
+    spin_unlock(&avflt_digest_lock);
+}
+
+int avflt_digest_set_max(long max)
+{
+    struct crypto_shash *tfm;
+
+    if (max < 0)
+        return -EINVAL;
+
+    mutex_lock(&avflt_digest_mutex);
+
+    if (max && !avflt_digest_tfm) {
+        tfm = crypto_alloc_shash("sha256", 0, 0);
+        if (IS_ERR(tfm)) {
+            mutex_unlock(&avflt_digest_mutex);
+            return PTR_ERR(tfm);
+        }
+
+        avflt_digest_tfm = tfm;
+        smp_wmb();
+    }
+
+    atomic_long_set(&avflt_digest_max, max);
+
+    if (!max)
+        avflt_digest_flush();
+
+    mutex_unlock(&avflt_digest_mutex);
+    return 0;
+}
+
+long avflt_digest_get_max(void)
+{
+    return atomic_long_read(&avflt_digest_max);
+}
+
+void avflt_digest_init(void)
+{
+    int i;
+
+    for (i = 0; i < (1 << AVFLT_DIGEST_BITS); i++)
+        INIT_HLIST_HEAD(&avflt_digest_hash[i]);
+}
+
+void avflt_digest_exit(void)
+{
+    avflt_digest_flush();
+
+    if (avflt_digest_tfm)
+        crypto_free_shash(avflt_digest_tfm);
+}
+
+#else
+
+int avflt_digest_self(void)
+{
+    return 0;
+}
+
+int avflt_digest_event(struct avflt_event *event)
+{
+    return 0;
+}
+
+void avflt_digest_update(struct avflt_event *event)
+{
+}
+
+void avflt_digest_flush(void)
+{
+}
+
+void avflt_digest_forget(struct inode *inode)
+{
+}
+
+int avflt_digest_set_max(long max)
+{
+    return max ? -EOPNOTSUPP : 0;
+}
+
+long avflt_digest_get_max(void)
+{
+    return 0;
+}
+
+void avflt_digest_init(void)
+{
+}
+
+void avflt_digest_exit(void)
+{
+}
+
+#endif
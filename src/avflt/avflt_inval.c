@@ -0,0 +1,216 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "avflt.h"
+#include <linux/namei.h>
+
+/*
+ * Targeted cache invalidation. A file is invalidated directly through its
+ * inode, which also drops the digest cache entry of its last verdict. A
+ * directory is remembered together with a new invalidation epoch,
+ * verdicts are stored with the epoch they were given in and a verdict from
+ * an older epoch is not used for files below a directory invalidated since.
+ * When more than AVFLT_INVAL_MAX directories are invalidated the whole cache
+ * is invalidated instead and the list starts over.
+ */
+
+struct avflt_inval {
+    struct path path;
+    int epoch;
+};
+
+static struct avflt_inval avflt_inval[AVFLT_INVAL_MAX];
+static int avflt_inval_nr = 0;
+static DEFINE_SPINLOCK(avflt_inval_lock);
+static DEFINE_MUTEX(avflt_inval_mutex);
+static atomic_t avflt_inval_epoch = ATOMIC_INIT(0);
+
+int avflt_inval_get_epoch(void)
+{
+    return atomic_read(&avflt_inval_epoch);
+}
+
+/*
+ * returns 1 if the dentry is below a directory invalidated after the epoch
+ */
+int avflt_inval_check(struct dentry *dentry, int epoch)
+{
+    int rv = 0;
+    int i;
+
+    if (epoch == atomic_read(&avflt_inval_epoch))
+        return 0;
+
+    spin_lock(&avflt_inval_lock);
+
+    for (i = 0; i < avflt_inval_nr; i++) {
+        if (avflt_inval[i].epoch <= epoch)
+            continue;
+
+        if (is_subdir(dentry, avflt_inval[i].path.dentry)) {
+            rv = 1;
+            break;
+        }
+    }
+
+    spin_unlock(&avflt_inval_lock);
+
+    return rv;
+}
+
+/*
+ * the list is changed under avflt_inval_mutex, the lock only protects the
+ * readers from a half added entry
+ */
+static void avflt_inval_clear(void)
+{
+    int nr;
+    int i;
+
+    spin_lock(&avflt_inval_lock);
+    nr = avflt_inval_nr;
+    avflt_inval_nr = 0;
+    spin_unlock(&avflt_inval_lock);
+
+    for (i = 0; i < nr; i++)
+        path_put(&avflt_inval[i].path);
+}
+
+static void avflt_inval_inode(struct inode *inode)
+{
+    struct avflt_inode_data *data;
+
+    data = avflt_get_inode_data_inode(inode);
+    if (data) {
+        spin_lock(&data->lock);
+        data->inode_cache_ver++;
+        spin_unlock(&data->lock);
+        avflt_put_inode_data(data);
+    }
+
+    avflt_pcache_forget(inode);
+    avflt_digest_forget(inode);
+}
+
+static void avflt_inval_dir(struct path *path)
+{
+    mutex_lock(&avflt_inval_mutex);
+
+    if (avflt_inval_nr == AVFLT_INVAL_MAX) {
+        avflt_invalidate_cache();
+        avflt_pcache_flush();
+        avflt_inval_clear();
+        mutex_unlock(&avflt_inval_mutex);
+        return;
+    }
+
+    path_get(path);
+    spin_lock(&avflt_inval_lock);
+    avflt_inval[avflt_inval_nr].path = *path;
+    avflt_inval[avflt_inval_nr].epoch =
+        atomic_inc_return(&avflt_inval_epoch);
+    avflt_inval_nr++;
+    spin_unlock(&avflt_inval_lock);
+
+    mutex_unlock(&avflt_inval_mutex);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,28)
+static int avflt_inval_lookup(const char *name, struct path *path)
+{
+    struct nameidata nd;
+    int rv;
+
+    rv = path_lookup(name, LOOKUP_FOLLOW, &nd);
+    if (rv)
+        return rv;
+
+    *path = nd.path;
+    return 0;
+}
+#else
+static int avflt_inval_lookup(const char *name, struct path *path)
+{
+    return kern_path(name, LOOKUP_FOLLOW, path);
+}
+#endif
+
+int avflt_inval_path(const char *buf, size_t size)
+{
+    struct path path;
+    char *name;
+    int rv;
+
+    name = kmalloc(size + 1, GFP_KERNEL);
+    if (!name)
+        return -ENOMEM;
+
+    memcpy(name, buf, size);
+    name[size] = 0;
+
+    if (size && name[size - 1] == '\n')
+        name[size - 1] = 0;
+
+    rv = avflt_inval_lookup(name, &path);
+    kfree(name);
+    if (rv)
+        return rv;
+
+    if (S_ISDIR(path.dentry->d_inode->i_mode))
+        avflt_inval_dir(&path);
+    else
+        avflt_inval_inode(path.dentry->d_inode);
+
+    path_put(&path);
+    return 0;
+}
+
+/*
+ * The inode cache of the root is invalidated by its cache version, the
+ * persistent and digest cache records below it by a new epoch.
+ */
+void avflt_inval_root(redirfs_path path)
+{
+    struct redirfs_path_info *info;
+    struct path root;
+
+    info = redirfs_get_path_info(avflt, path);
+    if (IS_ERR(info))
+        return;
+
+    root.mnt = info->mnt;
+    root.dentry = info->dentry;
+    avflt_inval_dir(&root);
+
+    redirfs_put_path_info(info);
+}
+
+void avflt_inval_flush(void)
+{
+    mutex_lock(&avflt_inval_mutex);
+    avflt_inval_clear();
+    mutex_unlock(&avflt_inval_mutex);
+}
+
+void avflt_inval_exit(void)
+{
+    mutex_lock(&avflt_inval_mutex);
+    avflt_inval_clear();
+    mutex_unlock(&avflt_inval_mutex);
+}
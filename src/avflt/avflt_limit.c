@@ -0,0 +1,343 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "avflt.h"
+#include <linux/hash.h>
+#include <linux/cgroup.h>
+
+/*
+ * Scan request rate limits. Each thread group and each cgroup of the unified
+ * hierarchy gets a token bucket, rate tokens are added per second up to
+ * burst and every event sent to the scanners takes one. Buckets live in a
+ * small set associative table, a group missing there evicts the least
+ * recently used bucket of its set and starts with a full one. Each set has
+ * its own lock and a disabled limit takes no lock at all. An event over the
+ * limit is put into the background class, allowed without a scan or delayed
+ * until a token is available, a delay longer than AVFLT_LIMIT_DELAY_MAX puts
+ * it into the background class. A token is kept only if the event passes
+ * both limits.
+ */
+
+#define AVFLT_LIMIT_BITS 6
+#define AVFLT_LIMIT_WAYS 4
+#define AVFLT_LIMIT_DELAY_MAX HZ
+
+struct avflt_limit_bucket {
+    unsigned long id;
+    unsigned long stamp;
+    s64 tokens;
+    int used;
+};
+
+struct avflt_limit_row {
+    struct avflt_limit_bucket buckets[AVFLT_LIMIT_WAYS];
+    spinlock_t lock;
+};
+
+struct avflt_limit {
+    struct avflt_limit_row rows[1 << AVFLT_LIMIT_BITS];
+    atomic_t rate;
+    atomic_t burst;
+    int stat;
+};
+
+static struct avflt_limit avflt_limit_tgid = {
+    .stat = AVFLT_STAT_LIMIT_TGID
+};
+
+static struct avflt_limit avflt_limit_cgroup = {
+    .stat = AVFLT_STAT_LIMIT_CGROUP
+};
+
+static DEFINE_MUTEX(avflt_limit_mutex);
+static atomic_t avflt_limit_policy = ATOMIC_INIT(AVFLT_LIMIT_BACKGROUND);
+
+/*
+ * returns the inode number of the cgroup directory of the current process
+ * in the unified hierarchy, also used by the class rules, or 0 if cgroups
+ * are not supported
+ */
+#if defined(CONFIG_CGROUPS) && LINUX_VERSION_CODE >= KERNEL_VERSION(4,5,0)
+unsigned long avflt_cgroup_id(void)
+{
+    struct cgroup *cgrp;
+    unsigned long id;
+
+    rcu_read_lock();
+    cgrp = task_dfl_cgroup(current);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,5,0)
+    id = cgrp->kn->ino;
+#else
+    id = cgroup_ino(cgrp);
+#endif
+    rcu_read_unlock();
+
+    return id;
+}
+#else
+unsigned long avflt_cgroup_id(void)
+{
+    return 0;
+}
+#endif
+
+static struct avflt_limit_row *avflt_limit_row(struct avflt_limit *limit,
+        unsigned long id)
+{
+    return &limit->rows[hash_long(id, AVFLT_LIMIT_BITS)];
+}
+
+static struct avflt_limit_bucket *avflt_limit_find(
+        struct avflt_limit_row *row, unsigned long id, int burst)
+{
+    struct avflt_limit_bucket *set = row->buckets;
+    struct avflt_limit_bucket *lru;
+    int i;
+
+    lru = &set[0];
+
+    for (i = 0; i < AVFLT_LIMIT_WAYS; i++) {
+        if (set[i].used && set[i].id == id)
+            return &set[i];
+
+        if (!set[i].used)
+            lru = &set[i];
+
+        else if (lru->used && time_before(set[i].stamp, lru->stamp))
+            lru = &set[i];
+    }
+
+    lru->id = id;
+    lru->stamp = jiffies;
+    lru->tokens = (s64)burst * HZ;
+    lru->used = 1;
+
+    return lru;
+}
+
+/*
+ * returns 0 if a token was taken, the number of jiffies to wait for a token
+ * taken in advance if delay is set or -1 if the limit is exceeded
+ */
+static long avflt_limit_take(struct avflt_limit *limit, unsigned long id,
+        int delay)
+{
+    struct avflt_limit_row *row;
+    struct avflt_limit_bucket *bucket;
+    unsigned long now = jiffies;
+    unsigned long elapsed;
+    int rate;
+    int burst;
+    s64 max;
+    long wait = 0;
+
+    if (!atomic_read(&limit->rate))
+        return 0;
+
+    row = avflt_limit_row(limit, id);
+    spin_lock(&row->lock);
+
+    rate = atomic_read(&limit->rate);
+    burst = atomic_read(&limit->burst);
+    if (!rate)
+        goto exit;
+
+    bucket = avflt_limit_find(row, id, burst);
+    max = (s64)burst * HZ;
+    elapsed = now - bucket->stamp;
+    bucket->stamp = now;
+
+    if (elapsed >= (unsigned long)burst * HZ)
+        bucket->tokens = max;
+    else
+        bucket->tokens = min(bucket->tokens + (s64)elapsed * rate, max);
+
+    if (bucket->tokens >= HZ) {
+        bucket->tokens -= HZ;
+        goto exit;
+    }
+
+    wait = -1;
+    if (!delay)
+        goto exit;
+
+    wait = (long)(HZ - bucket->tokens + rate - 1) / rate;
+    if (wait > AVFLT_LIMIT_DELAY_MAX) {
+        wait = -1;
+        goto exit;
+    }
+
+    bucket->tokens -= HZ;
+exit:
+    spin_unlock(&row->lock);
+
+    if (wait < 0)
+        avflt_stats_inc(limit->stat);
+
+    return wait;
+}
+
+/*
+ * gives back a token taken by avflt_limit_take, the bucket may have been
+ * evicted or reset in the meantime and then there is nothing to give back
+ */
+static void avflt_limit_refund(struct avflt_limit *limit, unsigned long id)
+{
+    struct avflt_limit_row *row;
+    s64 max;
+    int i;
+
+    if (!atomic_read(&limit->rate))
+        return;
+
+    row = avflt_limit_row(limit, id);
+    spin_lock(&row->lock);
+
+    max = (s64)atomic_read(&limit->burst) * HZ;
+
+    for (i = 0; i < AVFLT_LIMIT_WAYS; i++) {
+        if (!row->buckets[i].used || row->buckets[i].id != id)
+            continue;
+
+        row->buckets[i].tokens = min(row->buckets[i].tokens + HZ, max);
+        break;
+    }
+
+    spin_unlock(&row->lock);
+}
+
+/*
+ * returns 1 if the event is allowed without a scan, its result is set then
+ */
+int avflt_limit_request(struct avflt_event *event, int can_wait)
+{
+    int policy = atomic_read(&avflt_limit_policy);
+    int delay = can_wait && policy == AVFLT_LIMIT_DELAY;
+    long wait;
+    long cwait;
+
+    wait = avflt_limit_take(&avflt_limit_tgid, event->tgid, delay);
+    if (wait < 0)
+        goto over;
+
+    cwait = avflt_limit_take(&avflt_limit_cgroup, avflt_cgroup_id(),
+            delay);
+    if (cwait < 0) {
+        avflt_limit_refund(&avflt_limit_tgid, event->tgid);
+        goto over;
+    }
+
+    wait = max(wait, cwait);
+    if (wait)
+        schedule_timeout_interruptible(wait);
+
+    return 0;
+over:
+    if (policy == AVFLT_LIMIT_OPEN) {
+        event->result = AVFLT_FILE_CLEAN;
+        event->cache = 0;
+        return 1;
+    }
+
+    event->class = AVFLT_CLASS_BACKGROUND;
+    return 0;
+}
+
+static void avflt_limit_set(struct avflt_limit *limit, int rate, int burst)
+{
+    int i;
+
+    mutex_lock(&avflt_limit_mutex);
+    atomic_set(&limit->rate, 0);
+
+    for (i = 0; i < (1 << AVFLT_LIMIT_BITS); i++) {
+        spin_lock(&limit->rows[i].lock);
+        memset(limit->rows[i].buckets, 0, sizeof(limit->rows[i].buckets));
+        spin_unlock(&limit->rows[i].lock);
+    }
+
+    atomic_set(&limit->burst, burst);
+    atomic_set(&limit->rate, rate);
+    mutex_unlock(&avflt_limit_mutex);
+}
+
+void avflt_limit_init(void)
+{
+    int i;
+
+    for (i = 0; i < (1 << AVFLT_LIMIT_BITS); i++) {
+        spin_lock_init(&avflt_limit_tgid.rows[i].lock);
+        spin_lock_init(&avflt_limit_cgroup.rows[i].lock);
+    }
+}
+
+int avflt_limit_set_rule(char type, int rate, int burst)
+{
+    if (rate < 0 || rate > AVFLT_LIMIT_MAX)
+        return -EINVAL;
+
+    if (burst < 1 || burst > AVFLT_LIMIT_MAX)
+        return -EINVAL;
+
+    switch (type) {
+        case AVFLT_LIMIT_RULE_TGID:
+            avflt_limit_set(&avflt_limit_tgid, rate, burst);
+            return 0;
+
+        case AVFLT_LIMIT_RULE_CGROUP:
+            avflt_limit_set(&avflt_limit_cgroup, rate, burst);
+            return 0;
+    }
+
+    return -EINVAL;
+}
+
+int avflt_limit_set_policy(char policy)
+{
+    if (policy != AVFLT_LIMIT_BACKGROUND && policy != AVFLT_LIMIT_OPEN &&
+            policy != AVFLT_LIMIT_DELAY)
+        return -EINVAL;
+
+    atomic_set(&avflt_limit_policy, policy);
+    return 0;
+}
+
+ssize_t avflt_limit_get_info(char *buf, int size)
+{
+    ssize_t len;
+
+    len = snprintf(buf, size, "%c:%d:%d", AVFLT_LIMIT_RULE_TGID,
+            atomic_read(&avflt_limit_tgid.rate),
+            atomic_read(&avflt_limit_tgid.burst)) + 1;
+
+    if (len < size)
+        len += snprintf(buf + len, size - len, "%c:%d:%d",
+                AVFLT_LIMIT_RULE_CGROUP,
+                atomic_read(&avflt_limit_cgroup.rate),
+                atomic_read(&avflt_limit_cgroup.burst)) + 1;
+
+    if (len < size)
+        len += snprintf(buf + len, size - len, "p:%c",
+                atomic_read(&avflt_limit_policy)) + 1;
+
+    if (len > size)
+        len = size;
+
+    return len;
+}
@@ -27,6 +27,10 @@ static int __init avflt_init(void)
 {
     int rv;
 
+    avflt_proc_init();
+    avflt_digest_init();
+    avflt_limit_init();
+
     rv = avflt_check_init();
     if (rv)
         return rv;
@@ -35,10 +39,14 @@ static int __init avflt_init(void)
     if (rv)
         goto err_check;
 
-    rv = avflt_rfs_init();
+    rv = avflt_pcache_init();
     if (rv)
         goto err_data;
 
+    rv = avflt_rfs_init();
+    if (rv)
+        goto err_pcache;
+
     rv = avflt_sys_init();
     if (rv)
         goto err_rfs;
@@ -55,6 +63,8 @@ err_sys:
     avflt_sys_exit();
 err_rfs:
     avflt_rfs_exit();
+err_pcache:
+    avflt_pcache_exit();
 err_data:
     avflt_data_exit();
 err_check:
@@ -67,8 +77,14 @@ static void __exit avflt_exit(void)
     avflt_dev_exit();
     avflt_sys_exit();
     avflt_rfs_exit();
+    avflt_rules_exit();
+    avflt_class_exit();
+    avflt_inval_exit();
+    avflt_pcache_exit();
+    avflt_digest_exit();
     avflt_data_exit();
     avflt_check_exit();
+    avflt_proc_exit();
 }
 
 module_init(avflt_init);
@@ -0,0 +1,406 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/hash.h>
+#include <linux/vmalloc.h>
+#include "avflt.h"
+
+/*
+ * The persistent cache keeps verdicts by the file identity which survives a
+ * reboot, the file system uuid, inode number and generation, together with
+ * the inode ctime and the scanner signature version. Any change of the file
+ * content or attributes moves the ctime and the record no longer matches.
+ * The records are loaded and saved by the scanner, the kernel only keeps the
+ * most recently used AVFLT_PCACHE_MAX of them. File systems without an uuid
+ * are not cached.
+ */
+
+#define AVFLT_PCACHE_BITS 12
+#define AVFLT_PCACHE_MAX 65536
+#define AVFLT_PCACHE_CHUNK 64
+
+#define AVFLT_PCACHE_KEY_SIZE offsetof(struct avflt_pcache_rec, result)
+
+struct avflt_pcache_entry {
+    struct hlist_node hash;
+    struct list_head lru;
+    struct avflt_pcache_rec rec;
+    int epoch;
+};
+
+static struct hlist_head avflt_pcache_hash[1 << AVFLT_PCACHE_BITS];
+static LIST_HEAD(avflt_pcache_lru);
+static DEFINE_SPINLOCK(avflt_pcache_lock);
+static int avflt_pcache_nr = 0;
+static struct kmem_cache *avflt_pcache_cache = NULL;
+static atomic_t avflt_pcache_sigver = ATOMIC_INIT(0);
+
+static struct hlist_head *avflt_pcache_head(struct avflt_pcache_rec *rec)
+{
+    unsigned long key;
+
+    key = (unsigned long)rec->ino ^ rec->generation ^ *(u32 *)rec->uuid;
+    return &avflt_pcache_hash[hash_long(key, AVFLT_PCACHE_BITS)];
+}
+
+/*
+ * fills the key part of the record, the signature version included
+ */
+static int avflt_pcache_key(struct avflt_pcache_rec *rec, struct inode *inode)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,0,0)
+    return -1;
+#else
+    int i;
+
+    memset(rec, 0, sizeof(struct avflt_pcache_rec));
+    memcpy(rec->uuid, &inode->i_sb->s_uuid, sizeof(rec->uuid));
+
+    for (i = 0; i < sizeof(rec->uuid); i++) {
+        if (rec->uuid[i])
+            break;
+    }
+
+    if (i == sizeof(rec->uuid))
+        return -1;
+
+    rec->ino = inode->i_ino;
+    rec->generation = inode->i_generation;
+    rec->ctime_sec = inode->i_ctime.tv_sec;
+    rec->ctime_nsec = inode->i_ctime.tv_nsec;
+    rec->sigver = atomic_read(&avflt_pcache_sigver);
+
+    return 0;
+#endif
+}
+
+static struct avflt_pcache_entry *avflt_pcache_lookup(
+        struct avflt_pcache_rec *rec)
+{
+    struct avflt_pcache_entry *entry;
+    struct hlist_node *pos;
+
+    hlist_for_each(pos, avflt_pcache_head(rec)) {
+        entry = hlist_entry(pos, struct avflt_pcache_entry, hash);
+        if (!memcmp(&entry->rec, rec, AVFLT_PCACHE_KEY_SIZE))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void avflt_pcache_evict(void)
+{
+    struct avflt_pcache_entry *entry;
+
+    entry = list_entry(avflt_pcache_lru.prev, struct avflt_pcache_entry,
+            lru);
+    hlist_del(&entry->hash);
+    list_del(&entry->lru);
+    kmem_cache_free(avflt_pcache_cache, entry);
+    avflt_pcache_nr--;
+}
+
+static void avflt_pcache_insert(struct avflt_pcache_rec *rec,
+        struct avflt_pcache_entry *new, int epoch)
+{
+    struct avflt_pcache_entry *entry;
+
+    spin_lock(&avflt_pcache_lock);
+
+    entry = avflt_pcache_lookup(rec);
+    if (entry) {
+        entry->rec.result = rec->result;
+        entry->epoch = epoch;
+        list_move(&entry->lru, &avflt_pcache_lru);
+        spin_unlock(&avflt_pcache_lock);
+        kmem_cache_free(avflt_pcache_cache, new);
+        return;
+    }
+
+    if (avflt_pcache_nr == AVFLT_PCACHE_MAX)
+        avflt_pcache_evict();
+
+    new->rec = *rec;
+    new->epoch = epoch;
+    hlist_add_head(&new->hash, avflt_pcache_head(rec));
+    list_add(&new->lru, &avflt_pcache_lru);
+    avflt_pcache_nr++;
+
+    spin_unlock(&avflt_pcache_lock);
+}
+
+static int avflt_pcache_add(struct avflt_pcache_rec *rec, int epoch)
+{
+    struct avflt_pcache_entry *entry;
+
+    if (rec->result != AVFLT_FILE_CLEAN && rec->result != AVFLT_FILE_INFECTED)
+        return -EINVAL;
+
+    entry = kmem_cache_alloc(avflt_pcache_cache, GFP_KERNEL);
+    if (!entry)
+        return -ENOMEM;
+
+    avflt_pcache_insert(rec, entry, epoch);
+    return 0;
+}
+
+/*
+ * returns the verdict and the invalidation epoch it was stored in
+ */
+int avflt_pcache_find(struct inode *inode, int *epoch)
+{
+    struct avflt_pcache_entry *entry;
+    struct avflt_pcache_rec rec;
+    int result = 0;
+
+    if (!atomic_read(&avflt_pcache_sigver))
+        return 0;
+
+    if (avflt_pcache_key(&rec, inode))
+        return 0;
+
+    spin_lock(&avflt_pcache_lock);
+
+    entry = avflt_pcache_lookup(&rec);
+    if (entry) {
+        list_move(&entry->lru, &avflt_pcache_lru);
+        result = entry->rec.result;
+        *epoch = entry->epoch;
+    }
+
+    spin_unlock(&avflt_pcache_lock);
+
+    return result;
+}
+
+void avflt_pcache_event(struct avflt_event *event, struct inode *inode)
+{
+    if (!atomic_read(&avflt_pcache_sigver))
+        return;
+
+    if (avflt_pcache_key(&event->pcache, inode))
+        event->pcache.sigver = 0;
+}
+
+/*
+ * The record key is taken when the event is created, the verdict is stored
+ * only if the file did not change while it was scanned.
+ */
+void avflt_pcache_update(struct avflt_event *event)
+{
+    struct avflt_pcache_rec rec;
+
+    if (!event->pcache.sigver)
+        return;
+
+    if (avflt_pcache_key(&rec, event->f_path_dentry->d_inode))
+        return;
+
+    if (memcmp(&rec, &event->pcache, AVFLT_PCACHE_KEY_SIZE))
+        return;
+
+    rec.result = event->result;
+    avflt_pcache_add(&rec, event->epoch);
+}
+
+void avflt_pcache_flush(void)
+{
+    spin_lock(&avflt_pcache_lock);
+
+    while (!list_empty(&avflt_pcache_lru))
+        avflt_pcache_evict();
+
+    spin_unlock(&avflt_pcache_lock);
+}
+
+void avflt_pcache_forget(struct inode *inode)
+{
+    struct avflt_pcache_entry *entry;
+    struct avflt_pcache_rec rec;
+
+    if (avflt_pcache_key(&rec, inode))
+        return;
+
+    spin_lock(&avflt_pcache_lock);
+
+    entry = avflt_pcache_lookup(&rec);
+    if (entry) {
+        hlist_del(&entry->hash);
+        list_del(&entry->lru);
+        avflt_pcache_nr--;
+    }
+
+    spin_unlock(&avflt_pcache_lock);
+
+    if (entry)
+        kmem_cache_free(avflt_pcache_cache, entry);
+}
+
+/*
+ * Verdicts in the inode cache remember the signature version they were
+ * given with, a new version makes them stale instead of dropping them.
+ */
+void avflt_pcache_set_sigver(unsigned int sigver)
+{
+    if (atomic_xchg(&avflt_pcache_sigver, sigver) == sigver)
+        return;
+
+    avflt_pcache_flush();
+    avflt_digest_flush();
+}
+
+unsigned int avflt_pcache_get_sigver(void)
+{
+    return atomic_read(&avflt_pcache_sigver);
+}
+
+long avflt_pcache_load(struct avflt_pcache_buf __user *ubuf)
+{
+    struct avflt_pcache_rec __user *urecs;
+    struct avflt_pcache_rec *recs;
+    struct avflt_pcache_buf buf;
+    unsigned int sigver;
+    long loaded = 0;
+    int epoch;
+    int count;
+    int i;
+
+    if (copy_from_user(&buf, ubuf, sizeof(struct avflt_pcache_buf)))
+        return -EFAULT;
+
+    sigver = atomic_read(&avflt_pcache_sigver);
+    if (!sigver)
+        return -EINVAL;
+
+    recs = kmalloc(sizeof(struct avflt_pcache_rec) * AVFLT_PCACHE_CHUNK,
+            GFP_KERNEL);
+    if (!recs)
+        return -ENOMEM;
+
+    urecs = (struct avflt_pcache_rec __user *)(unsigned long)buf.recs;
+    epoch = avflt_inval_get_epoch();
+
+    /*
+     * only the last AVFLT_PCACHE_MAX records would stay in the cache, they
+     * are the most recently used ones
+     */
+    if (buf.count > AVFLT_PCACHE_MAX) {
+        urecs += buf.count - AVFLT_PCACHE_MAX;
+        buf.count = AVFLT_PCACHE_MAX;
+    }
+
+    while (buf.count) {
+        count = min_t(unsigned int, buf.count, AVFLT_PCACHE_CHUNK);
+
+        if (fatal_signal_pending(current)) {
+            kfree(recs);
+            return -EINTR;
+        }
+
+        if (copy_from_user(recs, urecs, sizeof(*recs) * count)) {
+            kfree(recs);
+            return -EFAULT;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (recs[i].sigver != sigver)
+                continue;
+
+            if (avflt_pcache_add(&recs[i], epoch))
+                continue;
+
+            loaded++;
+        }
+
+        urecs += count;
+        buf.count -= count;
+        cond_resched();
+    }
+
+    kfree(recs);
+    return loaded;
+}
+
+long avflt_pcache_dump(struct avflt_pcache_buf __user *ubuf)
+{
+    struct avflt_pcache_entry *entry;
+    struct avflt_pcache_rec *recs;
+    struct avflt_pcache_buf buf;
+    long count = 0;
+
+    if (copy_from_user(&buf, ubuf, sizeof(struct avflt_pcache_buf)))
+        return -EFAULT;
+
+    buf.count = min_t(unsigned int, buf.count, AVFLT_PCACHE_MAX);
+    if (!buf.count)
+        return 0;
+
+    recs = vmalloc(sizeof(struct avflt_pcache_rec) * buf.count);
+    if (!recs)
+        return -ENOMEM;
+
+    spin_lock(&avflt_pcache_lock);
+
+    /* oldest first so loading the records keeps the lru order */
+    list_for_each_entry_reverse(entry, &avflt_pcache_lru, lru) {
+        if (count == buf.count)
+            break;
+
+        recs[count++] = entry->rec;
+    }
+
+    spin_unlock(&avflt_pcache_lock);
+
+    if (copy_to_user((void __user *)(unsigned long)buf.recs, recs,
+                sizeof(struct avflt_pcache_rec) * count))
+        count = -EFAULT;
+
+    vfree(recs);
+    return count;
+}
+
+int avflt_pcache_init(void)
+{
+    int i;
+
+    for (i = 0; i < (1 << AVFLT_PCACHE_BITS); i++)
+        INIT_HLIST_HEAD(&avflt_pcache_hash[i]);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,22)
+    avflt_pcache_cache = kmem_cache_create("avflt_pcache_cache",
+            sizeof(struct avflt_pcache_entry),
+            0, SLAB_RECLAIM_ACCOUNT, NULL, NULL);
+#else
+    avflt_pcache_cache = kmem_cache_create("avflt_pcache_cache",
+            sizeof(struct avflt_pcache_entry),
+            0, SLAB_RECLAIM_ACCOUNT, NULL);
+#endif
+
+    if (!avflt_pcache_cache)
+        return -ENOMEM;
+
+    return 0;
+}
+
+void avflt_pcache_exit(void)
+{
+    avflt_pcache_flush();
+    kmem_cache_destroy(avflt_pcache_cache);
+}
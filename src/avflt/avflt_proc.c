@@ -21,13 +21,30 @@
  * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <linux/hash.h>
 #include "avflt.h"
 
+/*
+ * Every open checks whether the current process is a registered or trusted
+ * one. The processes are hashed by tgid and looked up under rcu_read_lock,
+ * so the check takes no lock. The global lists are kept for the sysfs info
+ * and both the lists and the hashes are modified under the spinlocks.
+ */
+#define AVFLT_PID_HASH_BITS 6
+#define AVFLT_PID_HASH_SIZE (1 << AVFLT_PID_HASH_BITS)
+
 static LIST_HEAD(avflt_proc_list);
 static DEFINE_SPINLOCK(avflt_proc_lock);
+static struct list_head avflt_proc_hash[AVFLT_PID_HASH_SIZE];
 
 static LIST_HEAD(avflt_trusted_list);
 static DEFINE_SPINLOCK(avflt_trusted_lock);
+static struct list_head avflt_trusted_hash[AVFLT_PID_HASH_SIZE];
+
+static struct list_head *avflt_pid_hash(struct list_head *table, pid_t tgid)
+{
+    return &table[hash_long((unsigned long)tgid, AVFLT_PID_HASH_BITS)];
+}
 
 static struct avflt_trusted *avflt_trusted_alloc(pid_t tgid)
 {
@@ -37,6 +54,7 @@ static struct avflt_trusted *avflt_trusted_alloc(pid_t tgid)
     if (!trusted)
         return ERR_PTR(-ENOMEM);
 
+    INIT_LIST_HEAD(&trusted->hash);
     trusted->tgid = tgid;
     trusted->open = 1;
 
@@ -48,11 +66,17 @@ static void avflt_trusted_free(struct avflt_trusted *trusted)
     kfree(trusted);
 }
 
+static void avflt_trusted_free_rcu(struct rcu_head *rcu)
+{
+    avflt_trusted_free(container_of(rcu, struct avflt_trusted, rcu));
+}
+
 static struct avflt_trusted *avflt_trusted_find(pid_t tgid)
 {
     struct avflt_trusted *trusted;
 
-    list_for_each_entry(trusted, &avflt_trusted_list, list) {
+    list_for_each_entry(trusted, avflt_pid_hash(avflt_trusted_hash, tgid),
+            hash) {
         if (trusted->tgid == tgid)
             return trusted;
     }
@@ -76,8 +100,11 @@ int avflt_trusted_add(pid_t tgid)
         found->open++;
         avflt_trusted_free(trusted);
 
-    } else
+    } else {
         list_add_tail(&trusted->list, &avflt_trusted_list);
+        list_add_rcu(&trusted->hash,
+                avflt_pid_hash(avflt_trusted_hash, tgid));
+    }
 
     spin_unlock(&avflt_trusted_lock);
 
@@ -98,24 +125,31 @@ void avflt_trusted_rem(pid_t tgid)
         goto exit;
 
     list_del_init(&found->list);
+    list_del_rcu(&found->hash);
 
-    avflt_trusted_free(found);
+    call_rcu(&found->rcu, avflt_trusted_free_rcu);
 exit:
     spin_unlock(&avflt_trusted_lock);
 }
 
 int avflt_trusted_allow(pid_t tgid)
 {
-    struct avflt_trusted *found;
+    struct avflt_trusted *trusted;
+    int found = 0;
 
-    spin_lock(&avflt_trusted_lock);
-    found = avflt_trusted_find(tgid);
-    spin_unlock(&avflt_trusted_lock);
+    rcu_read_lock();
 
-    if (found)
-        return 1;
+    list_for_each_entry_rcu(trusted,
+            avflt_pid_hash(avflt_trusted_hash, tgid), hash) {
+        if (trusted->tgid == tgid) {
+            found = 1;
+            break;
+        }
+    }
 
-    return 0;
+    rcu_read_unlock();
+
+    return found;
 }
 
 static struct avflt_proc *avflt_proc_alloc(pid_t tgid)
@@ -127,6 +161,7 @@ static struct avflt_proc *avflt_proc_alloc(pid_t tgid)
         return ERR_PTR(-ENOMEM);
 
     INIT_LIST_HEAD(&proc->list);
+    INIT_LIST_HEAD(&proc->hash);
     INIT_LIST_HEAD(&proc->events);
     spin_lock_init(&proc->lock);
     atomic_set(&proc->count, 1);
@@ -136,6 +171,11 @@ static struct avflt_proc *avflt_proc_alloc(pid_t tgid)
     return proc;
 }
 
+static void avflt_proc_free_rcu(struct rcu_head *rcu)
+{
+    kfree(container_of(rcu, struct avflt_proc, rcu));
+}
+
 struct avflt_proc *avflt_proc_get(struct avflt_proc *proc)
 {
     if (!proc || IS_ERR(proc))
@@ -165,7 +205,7 @@ void avflt_proc_put(struct avflt_proc *proc)
         avflt_event_put(event);
     }
 
-    kfree(proc);
+    call_rcu(&proc->rcu, avflt_proc_free_rcu);
 }
 
 static struct avflt_proc *avflt_proc_find_nolock(pid_t tgid)
@@ -173,7 +213,7 @@ static struct avflt_proc *avflt_proc_find_nolock(pid_t tgid)
     struct avflt_proc *found = NULL;
     struct avflt_proc *proc;
 
-    list_for_each_entry(proc, &avflt_proc_list, list) {
+    list_for_each_entry(proc, avflt_pid_hash(avflt_proc_hash, tgid), hash) {
         if (proc->tgid == tgid) {
             found = avflt_proc_get(proc);
             break;
@@ -185,13 +225,25 @@ static struct avflt_proc *avflt_proc_find_nolock(pid_t tgid)
 
 struct avflt_proc *avflt_proc_find(pid_t tgid)
 {
+    struct avflt_proc *found = NULL;
     struct avflt_proc *proc;
 
-    spin_lock(&avflt_proc_lock);
-    proc = avflt_proc_find_nolock(tgid);
-    spin_unlock(&avflt_proc_lock);
+    rcu_read_lock();
 
-    return proc;
+    list_for_each_entry_rcu(proc, avflt_pid_hash(avflt_proc_hash, tgid),
+            hash) {
+        if (proc->tgid != tgid)
+            continue;
+
+        if (atomic_inc_not_zero(&proc->count))
+            found = proc;
+
+        break;
+    }
+
+    rcu_read_unlock();
+
+    return found;
 }
 
 struct avflt_proc *avflt_proc_add(pid_t tgid)
@@ -214,6 +266,7 @@ struct avflt_proc *avflt_proc_add(pid_t tgid)
     }
 
     list_add_tail(&proc->list, &avflt_proc_list);
+    list_add_rcu(&proc->hash, avflt_pid_hash(avflt_proc_hash, tgid));
     avflt_proc_get(proc);
 
     spin_unlock(&avflt_proc_lock);
@@ -235,10 +288,12 @@ void avflt_proc_rem(pid_t tgid)
 
     if (--proc->open) {
         spin_unlock(&avflt_proc_lock);
+        avflt_proc_put(proc);
         return;
     }
 
     list_del(&proc->list);
+    list_del_rcu(&proc->hash);
     spin_unlock(&avflt_proc_lock);
     avflt_proc_put(proc);
     avflt_proc_put(proc);
@@ -247,14 +302,21 @@ void avflt_proc_rem(pid_t tgid)
 int avflt_proc_allow(pid_t tgid)
 {
     struct avflt_proc *proc;
+    int found = 0;
 
-    proc = avflt_proc_find(tgid);
-    if (proc) {
-        avflt_proc_put(proc);
-        return 1;
+    rcu_read_lock();
+
+    list_for_each_entry_rcu(proc, avflt_pid_hash(avflt_proc_hash, tgid),
+            hash) {
+        if (proc->tgid == tgid) {
+            found = 1;
+            break;
+        }
     }
 
-    return 0;
+    rcu_read_unlock();
+
+    return found;
 }
 
 int avflt_proc_empty(void)
@@ -268,6 +330,21 @@ int avflt_proc_empty(void)
     return empty;
 }
 
+void avflt_proc_init(void)
+{
+    int i;
+
+    for (i = 0; i < AVFLT_PID_HASH_SIZE; i++) {
+        INIT_LIST_HEAD(&avflt_proc_hash[i]);
+        INIT_LIST_HEAD(&avflt_trusted_hash[i]);
+    }
+}
+
+void avflt_proc_exit(void)
+{
+    rcu_barrier();
+}
+
 void avflt_proc_add_event(struct avflt_proc *proc, struct avflt_event *event)
 {
     spin_lock(&proc->lock);
@@ -316,6 +393,28 @@ struct avflt_event *avflt_proc_get_event(struct avflt_proc *proc, int id)
     return found;
 }
 
+/*
+ * returns the event handed over to the process without removing it
+ */
+struct avflt_event *avflt_proc_find_event(struct avflt_proc *proc, int id)
+{
+    struct avflt_event *found = NULL;
+    struct avflt_event *event;
+
+    spin_lock(&proc->lock);
+
+    list_for_each_entry(event, &proc->events, proc_list) {
+        if (event->id == id) {
+            found = avflt_event_get(event);
+            break;
+        }
+    }
+
+    spin_unlock(&proc->lock);
+
+    return found;
+}
+
 ssize_t avflt_proc_get_info(char *buf, int size)
 {
     struct avflt_proc *proc;
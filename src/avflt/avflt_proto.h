@@ -0,0 +1,179 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _AVFLT_PROTO_H
+#define _AVFLT_PROTO_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * /dev/avflt protocol of the registered scanners, the layout is mirrored in
+ * libav.
+ *
+ * A connection starts with the text protocol, one "id:,type:,fd:,pid:,tgid:"
+ * event per read and zero terminated "id:,res:,cache:" replies. The
+ * AVFLT_IOC_SET_PROTO ioctl switches it to the binary protocol, a read then
+ * returns as many struct avflt_proto_event records as fit into the buffer
+ * and are pending, and a write carries an array of struct avflt_proto_reply
+ * records. AVFLT_IOC_GET_PROTO returns the current protocol.
+ *
+ * Independently of the protocol a connection can set up a shared ring with
+ * AVFLT_IOC_RING_SETUP, the argument is the number of entries (a power of
+ * two) and the return value the size to mmap. The mapping starts with struct
+ * avflt_ring_hdr followed by the event ring at ev_off and the reply ring at
+ * rep_off. The kernel produces events at ev_tail and the scanner consumes
+ * them at ev_head, the scanner produces replies at rep_tail and the kernel
+ * consumes them at rep_head. Each AVFLT_IOC_RING_ENTER call takes the posted
+ * replies and fills the free event slots with pending events, it returns the
+ * number of events added. The event fds are installed into the process which
+ * calls it. The argument is a mask of flags, with AVFLT_RING_ENTER_WAIT a
+ * call which added no event blocks as described below, without it the call
+ * never blocks, so replies can be posted without waiting for new events.
+ *
+ * Pending events are kept in several queues. Every connection is bound to
+ * one of them, it is served from it first and takes events from the other
+ * queues only when its own one is empty. AVFLT_IOC_GET_QUEUES returns the
+ * number of queues, AVFLT_IOC_SET_QUEUE binds the connection to the queue
+ * given as the argument and AVFLT_IOC_GET_QUEUE returns the bound queue.
+ *
+ * By default a read and AVFLT_IOC_RING_ENTER return at once when there is no
+ * event and the scanner waits in poll, which wakes up all polling scanners
+ * for each event. After AVFLT_IOC_SET_WAIT with a timeout in milliseconds (or
+ * AVFLT_WAIT_INFINITE) a read and AVFLT_IOC_RING_ENTER with
+ * AVFLT_RING_ENTER_WAIT block instead and every new event wakes up only one
+ * blocked scanner. They return no events when the timeout expires.
+ *
+ * Verdicts can be kept across module reloads and reboots in the persistent
+ * cache. A scanner enables it with AVFLT_IOC_SET_SIGVER, the argument is
+ * the version of its signatures, and loads the records saved before with
+ * AVFLT_IOC_PCACHE_LOAD. A record is used only if the file system uuid,
+ * inode number, generation and ctime of the file and the signature version
+ * still match. New verdicts are added to the cache and AVFLT_IOC_PCACHE_DUMP
+ * copies the records out so the scanner can save them again. Both ioctls
+ * take struct avflt_pcache_buf and return the number of records loaded or
+ * copied.
+ *
+ * AVFLT_IOC_SET_FLAGS changes how events are handed over. With
+ * AVFLT_FLAG_NOFD no fd is installed for the events and the fd field is -1,
+ * the scanner reads the content with AVFLT_IOC_PREAD by the event id and
+ * can still get an fd with AVFLT_IOC_GET_FD. With AVFLT_FLAG_PATH each
+ * event record returned by a binary read is followed by path_len bytes of
+ * the zero terminated file path, padded to a multiple of 8 bytes. Such a
+ * read returns at most size / (sizeof(struct avflt_proto_event) +
+ * AVFLT_PATH_MAX) events. The path is also available through
+ * AVFLT_IOC_GET_PATH. PREAD and GET_PATH take
+ * struct avflt_proto_read and return the number of bytes copied.
+ *
+ * AVFLT_IOC_WARM queues a background event for the file given by the fd
+ * argument if it has no valid verdict yet. It returns 0 if the event was
+ * queued, 1 if the file was skipped and -EAGAIN if too many such events are
+ * pending. Trusted connections can use it too.
+ */
+
+#define AVFLT_PROTO_TEXT    0
+#define AVFLT_PROTO_BINARY  1
+
+#define AVFLT_IOC_MAGIC         'A'
+#define AVFLT_IOC_SET_PROTO     _IO(AVFLT_IOC_MAGIC, 1)
+#define AVFLT_IOC_GET_PROTO     _IO(AVFLT_IOC_MAGIC, 2)
+#define AVFLT_IOC_RING_SETUP    _IO(AVFLT_IOC_MAGIC, 3)
+#define AVFLT_IOC_RING_ENTER    _IO(AVFLT_IOC_MAGIC, 4)
+#define AVFLT_IOC_SET_QUEUE     _IO(AVFLT_IOC_MAGIC, 5)
+#define AVFLT_IOC_GET_QUEUE     _IO(AVFLT_IOC_MAGIC, 6)
+#define AVFLT_IOC_GET_QUEUES    _IO(AVFLT_IOC_MAGIC, 7)
+#define AVFLT_IOC_SET_WAIT      _IO(AVFLT_IOC_MAGIC, 8)
+#define AVFLT_IOC_SET_SIGVER    _IO(AVFLT_IOC_MAGIC, 9)
+#define AVFLT_IOC_PCACHE_LOAD   _IOW(AVFLT_IOC_MAGIC, 10, struct avflt_pcache_buf)
+#define AVFLT_IOC_PCACHE_DUMP   _IOW(AVFLT_IOC_MAGIC, 11, struct avflt_pcache_buf)
+#define AVFLT_IOC_SET_FLAGS     _IO(AVFLT_IOC_MAGIC, 12)
+#define AVFLT_IOC_PREAD         _IOW(AVFLT_IOC_MAGIC, 13, struct avflt_proto_read)
+#define AVFLT_IOC_GET_FD        _IO(AVFLT_IOC_MAGIC, 14)
+#define AVFLT_IOC_GET_PATH      _IOW(AVFLT_IOC_MAGIC, 15, struct avflt_proto_read)
+#define AVFLT_IOC_WARM          _IO(AVFLT_IOC_MAGIC, 16)
+
+#define AVFLT_FLAG_NOFD         0x01
+#define AVFLT_FLAG_PATH         0x02
+#define AVFLT_FLAGS             (AVFLT_FLAG_NOFD | AVFLT_FLAG_PATH)
+
+#define AVFLT_PATH_MAX          4096
+
+#define AVFLT_WAIT_INFINITE     0xffffffffUL
+
+#define AVFLT_RING_ENTER_WAIT   0x01
+
+#define AVFLT_RING_MAX      4096
+
+struct avflt_proto_event {
+    __s32 id;
+    __s32 type;
+    __s32 fd;
+    __s32 pid;
+    __s32 tgid;
+    __u32 path_len;
+    __u32 reserved[2];
+};
+
+struct avflt_proto_reply {
+    __s32 id;
+    __s32 result;
+    __s32 cache;    /* 0 or 1, -1 keeps the default */
+    __u32 reserved;
+};
+
+struct avflt_proto_read {
+    __s32 id;
+    __u32 size;
+    __u64 offset;   /* 0 for AVFLT_IOC_GET_PATH */
+    __u64 buf;
+};
+
+struct avflt_pcache_rec {
+    __u8 uuid[16];
+    __u64 ino;
+    __s64 ctime_sec;
+    __u32 ctime_nsec;
+    __u32 generation;
+    __u32 sigver;
+    __s32 result;
+};
+
+struct avflt_pcache_buf {
+    __u64 recs;     /* struct avflt_pcache_rec array */
+    __u32 count;
+    __u32 reserved;
+};
+
+/* indexes are free running, entry = index & (entries - 1) */
+struct avflt_ring_hdr {
+    __u32 entries;
+    __u32 ev_off;
+    __u32 rep_off;
+    __u32 reserved[13];
+    __u32 ev_head;
+    __u32 pad1[15];
+    __u32 ev_tail;
+    __u32 pad2[15];
+    __u32 rep_head;
+    __u32 pad3[15];
+    __u32 rep_tail;
+    __u32 pad4[15];
+};
+
+#endif
@@ -33,6 +33,9 @@ static int avflt_should_check(struct file *file, int type)
 
     if (avflt_trusted_allow(current->tgid))
         return 0;
+
+    if (avflt_digest_self())
+        return 0;
     
     if (!file->f_dentry->d_inode)
         return 0;
@@ -46,62 +49,190 @@ static int avflt_should_check(struct file *file, int type)
     return 1;
 }
 
-static int avflt_check_cache(struct file *file, int type)
+static void avflt_track_writers(struct avflt_inode_data *inode_data,
+        struct file *file, int type)
+{
+    int wc;
+
+    wc = atomic_read(&file->f_dentry->d_inode->i_writecount);
+
+    if (wc == 1) {
+        if (!(file->f_mode & FMODE_WRITE))
+            inode_data->inode_cache_ver++;
+
+        else if (type == AVFLT_EVENT_CLOSE)
+            inode_data->inode_cache_ver++;
+
+    } else if (wc > 1)
+        inode_data->inode_cache_ver++;
+}
+
+/*
+ * Files are not checked while no scanner is registered, but writes are still
+ * tracked so the cached verdicts survive a scanner restart.
+ */
+static void avflt_track_file(struct file *file, int type)
+{
+    struct avflt_inode_data *inode_data;
+
+    if (!file->f_dentry->d_inode)
+        return;
+
+    inode_data = avflt_get_inode_data_inode(file->f_dentry->d_inode);
+    if (!inode_data)
+        return;
+
+    spin_lock(&inode_data->lock);
+    avflt_track_writers(inode_data, file, type);
+    spin_unlock(&inode_data->lock);
+    avflt_put_inode_data(inode_data);
+}
+
+/*
+ * A verdict from an older invalidation epoch is dropped if its file is below
+ * an invalidated directory. A verdict given with another signature version
+ * is stale, it is used and the file is rescanned in the background if
+ * revalidation is enabled, otherwise it is a miss.
+ */
+static int avflt_check_cache_tiers(struct file *file,
+        struct avflt_inode_data *inode_data, int epoch, unsigned int sigver,
+        int *stale)
+{
+    unsigned int cur_sigver;
+    int cur_epoch;
+
+    cur_epoch = avflt_inval_get_epoch();
+    if (epoch != cur_epoch) {
+        if (avflt_inval_check(file->f_dentry, epoch)) {
+            avflt_stats_inc(AVFLT_STAT_CACHE_INVALIDATED);
+            return 0;
+        }
+
+        spin_lock(&inode_data->lock);
+        if (inode_data->epoch == epoch)
+            inode_data->epoch = cur_epoch;
+        spin_unlock(&inode_data->lock);
+    }
+
+    cur_sigver = avflt_pcache_get_sigver();
+    if (!cur_sigver || sigver == cur_sigver) {
+        avflt_stats_inc(AVFLT_STAT_CACHE_HIT);
+        return 1;
+    }
+
+    avflt_stats_inc(AVFLT_STAT_CACHE_STALE);
+
+    if (!atomic_read(&avflt_revalidate))
+        return 0;
+
+    *stale = 1;
+    return 1;
+}
+
+static int avflt_check_cache(struct file *file, int type, int *stale)
 {
     struct avflt_root_data *root_data;
     struct avflt_inode_data *inode_data;
+    int stat = AVFLT_STAT_CACHE_NEW;
+    unsigned int sigver = 0;
     int state = 0;
-    int wc;
+    int epoch = 0;
 
-    if (!atomic_read(&avflt_cache_enabled))
+    if (!atomic_read(&avflt_cache_enabled)) {
+        avflt_stats_inc(AVFLT_STAT_CACHE_DISABLED);
         return 0;
+    }
 
     root_data = avflt_get_root_data_inode(file->f_dentry->d_inode);
-    if (!root_data)
+    if (!root_data) {
+        avflt_stats_inc(AVFLT_STAT_CACHE_DISABLED);
         return 0;
+    }
 
     if (!atomic_read(&root_data->cache_enabled)) {
+        avflt_stats_inc(AVFLT_STAT_CACHE_DISABLED);
         avflt_put_root_data(root_data);
         return 0;
     }
 
     inode_data = avflt_get_inode_data_inode(file->f_dentry->d_inode);
     if (!inode_data) {
+        avflt_stats_inc(AVFLT_STAT_CACHE_NEW);
         avflt_put_root_data(root_data);
         return 0;
     }
 
-    wc = atomic_read(&file->f_dentry->d_inode->i_writecount);
-
     spin_lock(&inode_data->lock);
 
-    if (wc == 1) {
-        if (!(file->f_mode & FMODE_WRITE))
-            inode_data->inode_cache_ver++;
-
-        else if (type == AVFLT_EVENT_CLOSE)
-            inode_data->inode_cache_ver++;
-
-    } else if (wc > 1)
-        inode_data->inode_cache_ver++;
+    avflt_track_writers(inode_data, file, type);
 
     if (inode_data->root_data != root_data)
         goto exit;
 
-    if (inode_data->root_cache_ver != atomic_read(&root_data->cache_ver))
+    if (inode_data->root_cache_ver != atomic_read(&root_data->cache_ver)) {
+        stat = AVFLT_STAT_CACHE_ROOT_VER;
         goto exit;
+    }
 
-    if (inode_data->cache_ver != inode_data->inode_cache_ver)
+    if (inode_data->cache_ver != inode_data->inode_cache_ver) {
+        stat = AVFLT_STAT_CACHE_INODE_VER;
         goto exit;
+    }
 
     state = inode_data->state;
+    epoch = inode_data->epoch;
+    sigver = inode_data->sigver;
 exit:
     spin_unlock(&inode_data->lock);
+
+    if (!state)
+        avflt_stats_inc(stat);
+    else if (!avflt_check_cache_tiers(file, inode_data, epoch, sigver, stale))
+        state = 0;
+
     avflt_put_inode_data(inode_data);
     avflt_put_root_data(root_data);
     return state;
 }
 
+static int avflt_check_pcache(struct file *file)
+{
+    struct inode *inode = file->f_dentry->d_inode;
+    struct avflt_root_data *root_data;
+    int writers;
+    int epoch;
+    int rv;
+
+    if (!atomic_read(&avflt_cache_enabled))
+        return 0;
+
+    writers = (file->f_mode & FMODE_WRITE) ? 1 : 0;
+    if (atomic_read(&inode->i_writecount) > writers)
+        return 0;
+
+    root_data = avflt_get_root_data_inode(inode);
+    if (!root_data)
+        return 0;
+
+    if (!atomic_read(&root_data->cache_enabled)) {
+        avflt_put_root_data(root_data);
+        return 0;
+    }
+
+    avflt_put_root_data(root_data);
+
+    rv = avflt_pcache_find(inode, &epoch);
+    if (!rv)
+        return 0;
+
+    if (avflt_inval_check(file->f_dentry, epoch))
+        return 0;
+
+    avflt_stats_inc(AVFLT_STAT_PCACHE_HIT);
+
+    return rv;
+}
+
 static enum redirfs_rv avflt_eval_res(int rv, struct redirfs_args *args)
 {
     if (rv < 0) {
@@ -117,18 +248,74 @@ static enum redirfs_rv avflt_eval_res(int rv, struct redirfs_args *args)
     return REDIRFS_CONTINUE;
 }
 
+/*
+ * result used for a file without a cached verdict when the access can not
+ * wait for the scanner, the reply timeout policy of its path
+ */
+static int avflt_nowait_policy(struct file *file)
+{
+    struct avflt_root_data *root_data;
+    int result = AVFLT_FILE_CLEAN;
+
+    root_data = avflt_get_root_data_inode(file->f_dentry->d_inode);
+    if (!root_data)
+        return result;
+
+    if (atomic_read(&root_data->policy) == AVFLT_POLICY_CLOSED)
+        result = AVFLT_FILE_INFECTED;
+
+    avflt_put_root_data(root_data);
+    return result;
+}
+
+/*
+ * An access which can not wait only gets a cached verdict, on a miss the
+ * file is queued for an asynchronous scan so the verdict is cached for the
+ * next access, and the access gets the timeout policy of its path.
+ */
 static enum redirfs_rv avflt_check_file(struct file *file, int type,
-        struct redirfs_args *args)
+        int can_wait, struct redirfs_args *args)
 {
+    int stale = 0;
     int rv;
 
+    if (avflt_is_stopped()) {
+        avflt_track_file(file, type);
+        return REDIRFS_CONTINUE;
+    }
+
     if (!avflt_should_check(file, type))
         return REDIRFS_CONTINUE;
 
-    rv = avflt_check_cache(file, type);
+    switch (avflt_rules_check(file, type)) {
+        case AVFLT_RULE_SKIP:
+            return REDIRFS_CONTINUE;
+        case AVFLT_RULE_DENY:
+            return avflt_eval_res(AVFLT_FILE_INFECTED, args);
+    }
+
+    rv = avflt_check_cache(file, type, &stale);
+    if (stale && can_wait)
+        avflt_process_request_async(file, type, AVFLT_CLASS_BACKGROUND);
+    else if (stale)
+        avflt_process_request_nowait(file, type, AVFLT_CLASS_BACKGROUND);
+
+    if (!rv)
+        rv = avflt_check_pcache(file);
+
     if (rv)
         return avflt_eval_res(rv, args);
 
+    if (!can_wait) {
+        avflt_process_request_nowait(file, type, -1);
+        return avflt_eval_res(avflt_nowait_policy(file), args);
+    }
+
+    if (type == AVFLT_EVENT_CLOSE && atomic_read(&avflt_async_close)) {
+        avflt_process_request_async(file, type, -1);
+        return REDIRFS_CONTINUE;
+    }
+
     rv = avflt_process_request(file, type);
     if (rv)
         return avflt_eval_res(rv, args);
@@ -136,12 +323,88 @@ static enum redirfs_rv avflt_check_file(struct file *file, int type,
     return REDIRFS_CONTINUE;
 }
 
+/*
+ * returns 0 if a background event was queued for the file and 1 if the file
+ * is not filtered, is skipped by the rules or already has a verdict
+ */
+int avflt_warm_file(struct file *file)
+{
+    struct inode *inode = file->f_dentry->d_inode;
+    struct avflt_root_data *root_data;
+    int stale = 0;
+
+    if (avflt_is_stopped())
+        return -ENXIO;
+
+    if (!inode || !S_ISREG(inode->i_mode) || !i_size_read(inode))
+        return 1;
+
+    root_data = avflt_get_root_data_inode(inode);
+    if (!root_data)
+        return 1;
+
+    avflt_put_root_data(root_data);
+
+    if (avflt_rules_check(file, AVFLT_EVENT_OPEN) != AVFLT_RULE_SCAN)
+        return 1;
+
+    if ((avflt_check_cache(file, AVFLT_EVENT_OPEN, &stale) && !stale) ||
+            avflt_check_pcache(file)) {
+        avflt_warm_skip();
+        return 1;
+    }
+
+    return avflt_process_request_warm(file);
+}
+
+/*
+ * In the exec only mode files are checked only when they are executed or
+ * mapped with PROT_EXEC, both are reported to scanners as open events. The
+ * mmap check can not wait for the scanner, so plain opens of files with an
+ * execute bit, e.g. shared libraries opened by the dynamic linker, are
+ * checked as well. Other plain opens and closes only track writes so cached
+ * verdicts of changed files are not used.
+ */
+static int avflt_exec_file(struct file *file)
+{
+    struct inode *inode = file->f_dentry->d_inode;
+
+    if (file->f_mode & FMODE_EXEC)
+        return 1;
+
+    return inode && S_ISREG(inode->i_mode) && (inode->i_mode & S_IXUGO);
+}
+
 static enum redirfs_rv avflt_pre_open(redirfs_context context,
         struct redirfs_args *args)
 {
     struct file *file = args->args.f_open.file;
 
-    return avflt_check_file(file, AVFLT_EVENT_OPEN, args);
+    if (atomic_read(&avflt_exec_only) && !avflt_exec_file(file)) {
+        avflt_track_file(file, AVFLT_EVENT_OPEN);
+        return REDIRFS_CONTINUE;
+    }
+
+    return avflt_check_file(file, AVFLT_EVENT_OPEN, 1, args);
+}
+
+/*
+ * The mmap_sem of the process is held for write here, so a scanner reading
+ * /proc/<pid>/maps or any fault of another thread of the process would
+ * block until the reply. Only cached verdicts are used, see
+ * avflt_check_file. Mappings made executable later by mprotect are not
+ * checked.
+ */
+static enum redirfs_rv avflt_pre_mmap(redirfs_context context,
+        struct redirfs_args *args)
+{
+    struct file *file = args->args.f_mmap.file;
+    struct vm_area_struct *vma = args->args.f_mmap.vma;
+
+    if (!atomic_read(&avflt_exec_only) || !(vma->vm_flags & VM_EXEC))
+        return REDIRFS_CONTINUE;
+
+    return avflt_check_file(file, AVFLT_EVENT_OPEN, 0, args);
 }
 
 static enum redirfs_rv avflt_post_release(redirfs_context context,
@@ -149,7 +412,12 @@ static enum redirfs_rv avflt_post_release(redirfs_context context,
 {
     struct file *file = args->args.f_release.file;
 
-    return avflt_check_file(file, AVFLT_EVENT_CLOSE, args);
+    if (atomic_read(&avflt_exec_only)) {
+        avflt_track_file(file, AVFLT_EVENT_CLOSE);
+        return REDIRFS_CONTINUE;
+    }
+
+    return avflt_check_file(file, AVFLT_EVENT_CLOSE, 1, args);
 }
 
 static int avflt_activate(void)
@@ -181,11 +449,47 @@ static int avflt_add_path(struct redirfs_path_info *info)
     return 0;
 }
 
+static int avflt_add_paths(struct redirfs_path_info *infos, int count)
+{
+    struct avflt_root_data *data;
+    redirfs_path *paths;
+    redirfs_root root;
+    int rv;
+    int i;
+
+    paths = kcalloc(count, sizeof(redirfs_path), GFP_KERNEL);
+    if (!paths)
+        return -ENOMEM;
+
+    rv = redirfs_add_paths(avflt, infos, count, paths);
+    if (rv) {
+        kfree(paths);
+        return rv;
+    }
+
+    for (i = 0; i < count; i++) {
+        root = redirfs_get_root_path(paths[i]);
+        redirfs_put_path(paths[i]);
+        if (!root)
+            continue;
+
+        data = avflt_attach_root_data(root);
+
+        redirfs_put_root(root);
+        avflt_put_root_data(data);
+    }
+
+    kfree(paths);
+
+    return 0;
+}
+
 redirfs_filter avflt;
 
 static struct redirfs_filter_operations avflt_ops = {
     .activate = avflt_activate,
-    .add_path = avflt_add_path
+    .add_path = avflt_add_path,
+    .add_paths = avflt_add_paths
 };
 
 static struct redirfs_filter_info avflt_info = {
@@ -199,6 +503,7 @@ static struct redirfs_filter_info avflt_info = {
 static struct redirfs_op_info avflt_op_info[] = {
     {REDIRFS_REG_FOP_OPEN, avflt_pre_open, NULL},
     {REDIRFS_REG_FOP_RELEASE, avflt_post_release, NULL},
+    {REDIRFS_REG_FOP_MMAP, avflt_pre_mmap, NULL},
     {REDIRFS_OP_END, NULL, NULL}
 };
 
@@ -0,0 +1,207 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include "avflt.h"
+
+/*
+ * The ring indexes owned by userspace are read once per call and checked,
+ * the kernel keeps its own copies of the indexes it owns so a scanner
+ * scribbling over the header can only confuse itself.
+ */
+#define avflt_ring_load(x) (*(volatile __u32 *)&(x))
+#define avflt_ring_store(x, v) (*(volatile __u32 *)&(x) = (v))
+
+struct avflt_ring *avflt_ring_alloc(unsigned long entries)
+{
+    struct avflt_ring *ring;
+    unsigned long ev_off;
+    unsigned long rep_off;
+    unsigned long size;
+
+    if (!entries || entries > AVFLT_RING_MAX || (entries & (entries - 1)))
+        return ERR_PTR(-EINVAL);
+
+    ev_off = ALIGN(sizeof(struct avflt_ring_hdr), 64);
+    rep_off = ev_off + entries * sizeof(struct avflt_proto_event);
+    size = PAGE_ALIGN(rep_off + entries * sizeof(struct avflt_proto_reply));
+
+    ring = kzalloc(sizeof(struct avflt_ring), GFP_KERNEL);
+    if (!ring)
+        return ERR_PTR(-ENOMEM);
+
+    ring->hdr = vmalloc_user(size);
+    if (!ring->hdr) {
+        kfree(ring);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    mutex_init(&ring->lock);
+    ring->entries = entries;
+    ring->size = size;
+    ring->events = (void *)ring->hdr + ev_off;
+    ring->replies = (void *)ring->hdr + rep_off;
+    ring->hdr->entries = entries;
+    ring->hdr->ev_off = ev_off;
+    ring->hdr->rep_off = rep_off;
+
+    return ring;
+}
+
+void avflt_ring_free(struct avflt_ring *ring)
+{
+    if (!ring)
+        return;
+
+    vfree(ring->hdr);
+    kfree(ring);
+}
+
+int avflt_ring_mmap(struct avflt_ring *ring, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff)
+        return -EINVAL;
+
+    if (vma->vm_end - vma->vm_start > ring->size)
+        return -EINVAL;
+
+    return remap_vmalloc_range(vma, ring->hdr, 0);
+}
+
+static int avflt_ring_replies(struct avflt_ring *ring)
+{
+    struct avflt_proto_reply rec;
+    struct avflt_event *event;
+    u32 tail;
+
+    tail = avflt_ring_load(ring->hdr->rep_tail);
+    if (tail - ring->rep_head > ring->entries)
+        return -EINVAL;
+
+    smp_rmb();
+
+    while (ring->rep_head != tail) {
+        memcpy(&rec, &ring->replies[ring->rep_head & (ring->entries - 1)],
+                sizeof(rec));
+        ring->rep_head++;
+
+        event = avflt_set_reply(rec.id, rec.result, rec.cache);
+        if (IS_ERR(event))
+            continue;
+
+        avflt_event_done(event);
+        avflt_event_put(event);
+    }
+
+    smp_mb();
+    avflt_ring_store(ring->hdr->rep_head, ring->rep_head);
+
+    return 0;
+}
+
+static int avflt_ring_events(struct avflt_ring *ring, struct avflt_proc *proc,
+        int queue, int nofd)
+{
+    struct avflt_event *events[AVFLT_PROTO_BATCH_MAX];
+    struct avflt_proto_event *rec;
+    u32 used;
+    int count;
+    int nr;
+    int i;
+    int rv = 0;
+
+    used = ring->ev_tail - avflt_ring_load(ring->hdr->ev_head);
+    if (used > ring->entries)
+        return -EINVAL;
+
+    count = min_t(int, ring->entries - used, AVFLT_PROTO_BATCH_MAX);
+    if (!count)
+        return 0;
+
+    /* the scanner is done reading the slots we are going to reuse */
+    smp_mb();
+
+    nr = avflt_get_requests(queue, events, count);
+
+    for (i = 0; i < nr; i++) {
+        rv = avflt_get_file(events[i], nofd);
+        if (rv)
+            break;
+
+        avflt_proc_add_event(proc, events[i]);
+        rec = &ring->events[(ring->ev_tail + i) & (ring->entries - 1)];
+        avflt_copy_event(rec, events[i]);
+        avflt_install_fd(events[i]);
+    }
+
+    count = i;
+
+    for (i = 0; i < nr; i++) {
+        if (i >= count) {
+            avflt_put_file(events[i]);
+            avflt_readd_request(events[i]);
+        }
+        avflt_event_put(events[i]);
+    }
+
+    smp_wmb();
+    ring->ev_tail += count;
+    avflt_ring_store(ring->hdr->ev_tail, ring->ev_tail);
+
+    return count ? count : rv;
+}
+
+/*
+ * Takes the replies posted by the scanner and moves pending events into the
+ * free event slots. The events can not be posted from the context of the
+ * process opening the file since the fd has to be installed into the
+ * scanner, so the ring is filled when the scanner enters.
+ */
+long avflt_ring_enter(struct avflt_ring *ring, int queue, int nofd)
+{
+    struct avflt_proc *proc;
+    long total = 0;
+    int rv;
+
+    proc = avflt_proc_find(current->tgid);
+    if (!proc)
+        return -ENOENT;
+
+    mutex_lock(&ring->lock);
+
+    rv = avflt_ring_replies(ring);
+
+    while (!rv) {
+        rv = avflt_ring_events(ring, proc, queue, nofd);
+        if (rv <= 0)
+            break;
+
+        total += rv;
+        rv = rv == AVFLT_PROTO_BATCH_MAX ? 0 : 1;
+    }
+
+    mutex_unlock(&ring->lock);
+    avflt_proc_put(proc);
+
+    if (total)
+        return total;
+
+    return rv < 0 ? rv : 0;
+}
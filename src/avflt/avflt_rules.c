@@ -0,0 +1,408 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/string.h>
+#include "avflt.h"
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,5,0)
+#include <linux/user_namespace.h>
+#endif
+
+/*
+ * Pre-filter rules decide in the kernel whether a file is skipped, sent to
+ * the scanner or denied, before any event is created. The rules are checked
+ * in order and the first matching one wins, a file matching no rule is
+ * scanned. The rule set is replaced as a whole on every change and read
+ * under rcu_read_lock, so checking it takes no lock.
+ *
+ * A rule is written as an action followed by the conditions, e.g.
+ *
+ *     skip name=*.log
+ *     skip size>=104857600 fs=nfs
+ *     deny name=*.scr event=open
+ */
+
+#define AVFLT_RULE_SIZE_MIN 0x01
+#define AVFLT_RULE_SIZE_MAX 0x02
+#define AVFLT_RULE_NAME     0x04
+#define AVFLT_RULE_FS       0x08
+#define AVFLT_RULE_UID      0x10
+#define AVFLT_RULE_EVENT    0x20
+
+#define AVFLT_RULE_NAME_LEN 64
+#define AVFLT_RULE_FS_LEN 32
+
+struct avflt_rule {
+    int action;
+    unsigned int flags;
+    long long size_min;
+    long long size_max;
+    char name[AVFLT_RULE_NAME_LEN];
+    char fs[AVFLT_RULE_FS_LEN];
+    unsigned int uid;
+    int event;
+};
+
+struct avflt_rules {
+    struct rcu_head rcu;
+    int nr;
+    struct avflt_rule rules[0];
+};
+
+static struct avflt_rules *avflt_rules = NULL;
+static DEFINE_MUTEX(avflt_rules_mutex);
+
+static const char *avflt_rule_actions[] = {
+    [AVFLT_RULE_SCAN] = "scan",
+    [AVFLT_RULE_SKIP] = "skip",
+    [AVFLT_RULE_DENY] = "deny"
+};
+
+static const char *avflt_rule_events[] = {
+    [AVFLT_EVENT_OPEN] = "open",
+    [AVFLT_EVENT_CLOSE] = "close"
+};
+
+/*
+ * shell like pattern with * and ? wildcards
+ */
+static int avflt_rule_glob(const char *pat, const char *str)
+{
+    const char *star = NULL;
+    const char *back = NULL;
+
+    while (*str) {
+        if (*pat == '*') {
+            star = ++pat;
+            back = str;
+            continue;
+        }
+
+        if (*pat == '?' || *pat == *str) {
+            pat++;
+            str++;
+            continue;
+        }
+
+        if (!star)
+            return 0;
+
+        pat = star;
+        str = ++back;
+    }
+
+    while (*pat == '*')
+        pat++;
+
+    return !*pat;
+}
+
+static int avflt_rule_name(struct avflt_rule *rule, struct dentry *dentry)
+{
+    int rv;
+
+    spin_lock(&dentry->d_lock);
+    rv = avflt_rule_glob(rule->name, (const char *)dentry->d_name.name);
+    spin_unlock(&dentry->d_lock);
+
+    return rv;
+}
+
+static unsigned int avflt_rule_uid(struct inode *inode)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,5,0)
+    return inode->i_uid;
+#else
+    return from_kuid(&init_user_ns, inode->i_uid);
+#endif
+}
+
+static int avflt_rule_match(struct avflt_rule *rule, struct file *file,
+        int type)
+{
+    struct dentry *dentry = file->f_dentry;
+    struct inode *inode = dentry->d_inode;
+    loff_t size;
+
+    if (rule->flags & AVFLT_RULE_EVENT && rule->event != type)
+        return 0;
+
+    if (rule->flags & (AVFLT_RULE_SIZE_MIN | AVFLT_RULE_SIZE_MAX)) {
+        size = i_size_read(inode);
+
+        if (rule->flags & AVFLT_RULE_SIZE_MIN && size < rule->size_min)
+            return 0;
+
+        if (rule->flags & AVFLT_RULE_SIZE_MAX && size > rule->size_max)
+            return 0;
+    }
+
+    if (rule->flags & AVFLT_RULE_UID && rule->uid != avflt_rule_uid(inode))
+        return 0;
+
+    if (rule->flags & AVFLT_RULE_FS &&
+            strcmp(rule->fs, inode->i_sb->s_type->name))
+        return 0;
+
+    if (rule->flags & AVFLT_RULE_NAME && !avflt_rule_name(rule, dentry))
+        return 0;
+
+    return 1;
+}
+
+int avflt_rules_check(struct file *file, int type)
+{
+    struct avflt_rules *rules;
+    int action = AVFLT_RULE_SCAN;
+    int i;
+
+    rcu_read_lock();
+
+    rules = rcu_dereference(avflt_rules);
+    if (!rules)
+        goto exit;
+
+    for (i = 0; i < rules->nr; i++) {
+        if (avflt_rule_match(&rules->rules[i], file, type)) {
+            action = rules->rules[i].action;
+            break;
+        }
+    }
+exit:
+    rcu_read_unlock();
+    return action;
+}
+
+static int avflt_rule_parse_cond(struct avflt_rule *rule, const char *cond)
+{
+    char event[8];
+    int i;
+
+    if (sscanf(cond, "size>=%lld", &rule->size_min) == 1) {
+        rule->flags |= AVFLT_RULE_SIZE_MIN;
+        return 0;
+    }
+
+    if (sscanf(cond, "size<=%lld", &rule->size_max) == 1) {
+        rule->flags |= AVFLT_RULE_SIZE_MAX;
+        return 0;
+    }
+
+    if (sscanf(cond, "uid=%u", &rule->uid) == 1) {
+        rule->flags |= AVFLT_RULE_UID;
+        return 0;
+    }
+
+    if (!strncmp(cond, "name=", 5)) {
+        if (strlen(cond + 5) >= AVFLT_RULE_NAME_LEN)
+            return -ENAMETOOLONG;
+
+        strcpy(rule->name, cond + 5);
+        rule->flags |= AVFLT_RULE_NAME;
+        return 0;
+    }
+
+    if (!strncmp(cond, "fs=", 3)) {
+        if (strlen(cond + 3) >= AVFLT_RULE_FS_LEN)
+            return -ENAMETOOLONG;
+
+        strcpy(rule->fs, cond + 3);
+        rule->flags |= AVFLT_RULE_FS;
+        return 0;
+    }
+
+    if (sscanf(cond, "event=%7s", event) == 1) {
+        for (i = AVFLT_EVENT_OPEN; i <= AVFLT_EVENT_CLOSE; i++) {
+            if (!strcmp(event, avflt_rule_events[i])) {
+                rule->event = i;
+                rule->flags |= AVFLT_RULE_EVENT;
+                return 0;
+            }
+        }
+    }
+
+    return -EINVAL;
+}
+
+static int avflt_rule_parse(struct avflt_rule *rule, const char *buf,
+        size_t size)
+{
+    char *str;
+    char *iter;
+    char *tok;
+    int rv = -EINVAL;
+    int i;
+
+    str = kmalloc(size + 1, GFP_KERNEL);
+    if (!str)
+        return -ENOMEM;
+
+    memcpy(str, buf, size);
+    str[size] = 0;
+
+    memset(rule, 0, sizeof(struct avflt_rule));
+    rule->action = -1;
+    iter = str;
+
+    while ((tok = strsep(&iter, " \t\n"))) {
+        if (!*tok)
+            continue;
+
+        if (rule->action != -1) {
+            rv = avflt_rule_parse_cond(rule, tok);
+            if (rv)
+                goto exit;
+
+            continue;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(avflt_rule_actions); i++) {
+            if (!strcmp(tok, avflt_rule_actions[i]))
+                rule->action = i;
+        }
+
+        if (rule->action == -1)
+            goto exit;
+
+        rv = 0;
+    }
+exit:
+    kfree(str);
+    return rv;
+}
+
+static void avflt_rules_free_rcu(struct rcu_head *rcu)
+{
+    kfree(container_of(rcu, struct avflt_rules, rcu));
+}
+
+static void avflt_rules_replace(struct avflt_rules *rules)
+{
+    struct avflt_rules *old = avflt_rules;
+
+    rcu_assign_pointer(avflt_rules, rules);
+
+    if (old)
+        call_rcu(&old->rcu, avflt_rules_free_rcu);
+}
+
+int avflt_rules_add(const char *buf, size_t size)
+{
+    struct avflt_rules *rules;
+    struct avflt_rule rule;
+    int nr = 0;
+    int rv;
+
+    rv = avflt_rule_parse(&rule, buf, size);
+    if (rv)
+        return rv;
+
+    mutex_lock(&avflt_rules_mutex);
+
+    if (avflt_rules)
+        nr = avflt_rules->nr;
+
+    if (nr == AVFLT_RULES_MAX) {
+        mutex_unlock(&avflt_rules_mutex);
+        return -ENOSPC;
+    }
+
+    rules = kmalloc(sizeof(struct avflt_rules) +
+            sizeof(struct avflt_rule) * (nr + 1), GFP_KERNEL);
+    if (!rules) {
+        mutex_unlock(&avflt_rules_mutex);
+        return -ENOMEM;
+    }
+
+    if (nr)
+        memcpy(rules->rules, avflt_rules->rules,
+                sizeof(struct avflt_rule) * nr);
+
+    rules->rules[nr] = rule;
+    rules->nr = nr + 1;
+    avflt_rules_replace(rules);
+
+    mutex_unlock(&avflt_rules_mutex);
+
+    return 0;
+}
+
+void avflt_rules_clear(void)
+{
+    mutex_lock(&avflt_rules_mutex);
+    avflt_rules_replace(NULL);
+    mutex_unlock(&avflt_rules_mutex);
+}
+
+/*
+ * scnprintf never goes past size, a rule which does not fit is truncated
+ */
+static int avflt_rule_print(struct avflt_rule *rule, char *buf, int size)
+{
+    int len;
+
+    len = scnprintf(buf, size, "%s", avflt_rule_actions[rule->action]);
+
+    if (rule->flags & AVFLT_RULE_SIZE_MIN)
+        len += scnprintf(buf + len, size - len, " size>=%lld",
+                rule->size_min);
+
+    if (rule->flags & AVFLT_RULE_SIZE_MAX)
+        len += scnprintf(buf + len, size - len, " size<=%lld",
+                rule->size_max);
+
+    if (rule->flags & AVFLT_RULE_NAME)
+        len += scnprintf(buf + len, size - len, " name=%s", rule->name);
+
+    if (rule->flags & AVFLT_RULE_FS)
+        len += scnprintf(buf + len, size - len, " fs=%s", rule->fs);
+
+    if (rule->flags & AVFLT_RULE_UID)
+        len += scnprintf(buf + len, size - len, " uid=%u", rule->uid);
+
+    if (rule->flags & AVFLT_RULE_EVENT)
+        len += scnprintf(buf + len, size - len, " event=%s",
+                avflt_rule_events[rule->event]);
+
+    return len;
+}
+
+ssize_t avflt_rules_get_info(char *buf, int size)
+{
+    struct avflt_rules *rules;
+    ssize_t len = 0;
+    int i;
+
+    mutex_lock(&avflt_rules_mutex);
+
+    rules = avflt_rules;
+
+    for (i = 0; rules && i < rules->nr && len < size; i++)
+        len += avflt_rule_print(&rules->rules[i], buf + len,
+                size - len) + 1;
+
+    mutex_unlock(&avflt_rules_mutex);
+
+    return len;
+}
+
+void avflt_rules_exit(void)
+{
+    avflt_rules_clear();
+    rcu_barrier();
+}
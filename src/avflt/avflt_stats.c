@@ -0,0 +1,181 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "avflt.h"
+#include <linux/percpu.h>
+
+/*
+ * Event counters and histograms of the time events spend in the queue and
+ * in the scanner. Histogram bucket i counts the events which took less than
+ * 2^i microseconds, the last bucket counts all longer ones. The counters are
+ * bumped for every access, so they are kept per CPU and summed when read.
+ */
+
+static const char *avflt_stat_names[AVFLT_STATS] = {
+    "enqueued",
+    "dequeued",
+    "cache_hit",
+    "cache_disabled",
+    "cache_new",
+    "cache_root_ver",
+    "cache_inode_ver",
+    "pcache_hit",
+    "digest_hit",
+    "coalesced",
+    "timeout",
+    "shed",
+    "cache_invalidated",
+    "cache_stale",
+    "limit_tgid",
+    "limit_cgroup",
+};
+
+struct avflt_stats_cpu {
+    long stats[AVFLT_STATS];
+    long wait[AVFLT_STATS_BUCKETS];
+    long service[AVFLT_STATS_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct avflt_stats_cpu, avflt_stats_cpu);
+
+void avflt_stats_inc(int stat)
+{
+    get_cpu_var(avflt_stats_cpu).stats[stat]++;
+    put_cpu_var(avflt_stats_cpu);
+}
+
+long avflt_stats_get(int stat)
+{
+    long sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        sum += per_cpu(avflt_stats_cpu, cpu).stats[stat];
+
+    return sum;
+}
+
+/*
+ * time is in nanoseconds
+ */
+static int avflt_stats_bucket(u64 time)
+{
+    int i = 0;
+
+    do_div(time, NSEC_PER_USEC);
+
+    while (i < AVFLT_STATS_BUCKETS - 1 && time >= (1ULL << i))
+        i++;
+
+    return i;
+}
+
+void avflt_stats_wait_time(u64 time)
+{
+    get_cpu_var(avflt_stats_cpu).wait[avflt_stats_bucket(time)]++;
+    put_cpu_var(avflt_stats_cpu);
+}
+
+void avflt_stats_service_time(u64 time)
+{
+    get_cpu_var(avflt_stats_cpu).service[avflt_stats_bucket(time)]++;
+    put_cpu_var(avflt_stats_cpu);
+}
+
+void avflt_stats_reset(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(&per_cpu(avflt_stats_cpu, cpu), 0,
+                sizeof(struct avflt_stats_cpu));
+}
+
+static void avflt_stats_sum(struct avflt_stats_cpu *sum)
+{
+    struct avflt_stats_cpu *stats;
+    int cpu;
+    int i;
+
+    memset(sum, 0, sizeof(struct avflt_stats_cpu));
+
+    for_each_possible_cpu(cpu) {
+        stats = &per_cpu(avflt_stats_cpu, cpu);
+
+        for (i = 0; i < AVFLT_STATS; i++)
+            sum->stats[i] += stats->stats[i];
+
+        for (i = 0; i < AVFLT_STATS_BUCKETS; i++) {
+            sum->wait[i] += stats->wait[i];
+            sum->service[i] += stats->service[i];
+        }
+    }
+}
+
+static ssize_t avflt_stats_get_hist(char *buf, int size, const char *name,
+        long *hist)
+{
+    ssize_t len = 0;
+    int i;
+
+    for (i = 0; i < AVFLT_STATS_BUCKETS && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%s:%d:%ld", name, i,
+                hist[i]) + 1;
+    }
+
+    return len;
+}
+
+ssize_t avflt_stats_get_info(char *buf, int size)
+{
+    struct avflt_stats_cpu *sum;
+    ssize_t len = 0;
+    int i;
+
+    sum = kmalloc(sizeof(struct avflt_stats_cpu), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+
+    avflt_stats_sum(sum);
+
+    for (i = 0; i < AVFLT_STATS && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%s:%ld",
+                avflt_stat_names[i], sum->stats[i]) + 1;
+    }
+
+    for (i = 0; i < avflt_queues_count() && len < size; i++) {
+        len += snprintf(buf + len, size - len, "queue:%d:%d", i,
+                avflt_get_queue_depth(i)) + 1;
+    }
+
+    if (len < size)
+        len += avflt_stats_get_hist(buf + len, size - len, "wait",
+                sum->wait);
+
+    if (len < size)
+        len += avflt_stats_get_hist(buf + len, size - len, "service",
+                sum->service);
+
+    kfree(sum);
+
+    if (len > size)
+        len = size;
+
+    return len;
+}
@@ -25,6 +25,10 @@
 
 atomic_t avflt_reply_timeout = ATOMIC_INIT(0);
 atomic_t avflt_cache_enabled = ATOMIC_INIT(1);
+atomic_t avflt_async_close = ATOMIC_INIT(0);
+atomic_t avflt_scanners = ATOMIC_INIT(0);
+atomic_t avflt_revalidate = ATOMIC_INIT(0);
+atomic_t avflt_exec_only = ATOMIC_INIT(0);
 
 static ssize_t avflt_timeout_show(redirfs_filter filter,
         struct redirfs_filter_attribute *attr, char *buf)
@@ -50,6 +54,130 @@ static ssize_t avflt_timeout_store(redirfs_filter filter,
     return count;
 }
 
+static ssize_t avflt_async_close_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%d",
+            atomic_read(&avflt_async_close));
+}
+
+static ssize_t avflt_async_close_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    int async;
+
+    if (sscanf(buf, "%d", &async) != 1)
+        return -EINVAL;
+
+    if (async != 0 && async != 1)
+        return -EINVAL;
+
+    atomic_set(&avflt_async_close, async);
+
+    return count;
+}
+
+static ssize_t avflt_classes_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return avflt_class_get_info(buf, PAGE_SIZE);
+}
+
+static ssize_t avflt_classes_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    int weights[AVFLT_CLASSES];
+    char type;
+    int class;
+    int id;
+    int rv;
+
+    if (sscanf(buf, "%c", &type) != 1)
+        return -EINVAL;
+
+    switch (type) {
+        case 'w':
+            if (sscanf(buf, "w:%d:%d:%d", &weights[0], &weights[1],
+                        &weights[2]) != 3)
+                return -EINVAL;
+
+            rv = avflt_class_set_weights(weights);
+            break;
+
+        case AVFLT_CLASS_RULE_PGRP:
+        case AVFLT_CLASS_RULE_TYPE:
+        case AVFLT_CLASS_RULE_CGROUP:
+            if (sscanf(buf, "%c:%d:%d", &type, &id, &class) != 3)
+                return -EINVAL;
+
+            rv = avflt_class_set_rule(type, id, class);
+            break;
+
+        case 'c':
+            avflt_class_clear_rules();
+            rv = 0;
+            break;
+
+        default:
+            return -EINVAL;
+    }
+
+    if (rv)
+        return rv;
+
+    return count;
+}
+
+static ssize_t avflt_rules_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return avflt_rules_get_info(buf, PAGE_SIZE);
+}
+
+static ssize_t avflt_rules_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    int rv;
+
+    if (count && buf[0] == 'c' && (count == 1 || buf[1] == '\n' ||
+                !buf[1])) {
+        avflt_rules_clear();
+        return count;
+    }
+
+    rv = avflt_rules_add(buf, count);
+    if (rv)
+        return rv;
+
+    return count;
+}
+
+static ssize_t avflt_digest_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%ld", avflt_digest_get_max());
+}
+
+static ssize_t avflt_digest_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    long max;
+    int rv;
+
+    if (sscanf(buf, "%ld", &max) != 1)
+        return -EINVAL;
+
+    rv = avflt_digest_set_max(max);
+    if (rv)
+        return rv;
+
+    return count;
+}
+
 static ssize_t avflt_cache_show(redirfs_filter filter,
         struct redirfs_filter_attribute *attr, char *buf)
 {
@@ -84,6 +212,8 @@ static ssize_t avflt_cache_store(redirfs_filter filter,
 
         case 'i':
             avflt_invalidate_cache();
+            avflt_pcache_flush();
+            avflt_inval_flush();
             break;
 
         default:
@@ -155,14 +285,17 @@ static ssize_t avflt_cache_paths_store(redirfs_filter filter,
         return -ENOENT;
 
     root = redirfs_get_root_path(path);
-    redirfs_put_path(path);
-    if (!root)
+    if (!root) {
+        redirfs_put_path(path);
         return -ENOENT;
+    }
 
     data = avflt_get_root_data_root(root);
     redirfs_put_root(root);
-    if (!data)
+    if (!data) {
+        redirfs_put_path(path);
         return -ENOENT;
+    }
 
     switch (cache) {
         case 'a':
@@ -174,15 +307,254 @@ static ssize_t avflt_cache_paths_store(redirfs_filter filter,
             break;
         case 'i':
             atomic_inc(&data->cache_ver);
+            avflt_inval_root(path);
             break;
 
         default:
             avflt_put_root_data(data);
+            redirfs_put_path(path);
             return -EINVAL;
 
     }
 
     avflt_put_root_data(data);
+    redirfs_put_path(path);
+
+    return count;
+}
+
+static ssize_t avflt_timeout_paths_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    struct avflt_root_data *data;
+    redirfs_path *paths;
+    redirfs_root root;
+    ssize_t size = 0;
+    int i = 0;
+
+    paths = redirfs_get_paths(avflt);
+    if (IS_ERR(paths))
+        return PTR_ERR(paths);
+
+    while (paths[i]) {
+        root = redirfs_get_root_path(paths[i]);
+        if (!root)
+            goto next;
+
+        data = avflt_get_root_data_root(root);
+        redirfs_put_root(root);
+        if (!data)
+            goto next;
+
+        size += snprintf(buf + size, PAGE_SIZE - size, "%d:%d:%c:%d",
+                redirfs_get_id_path(paths[i]),
+                atomic_read(&data->timeout),
+                atomic_read(&data->policy),
+                atomic_read(&data->shed)) + 1;
+
+        avflt_put_root_data(data);
+
+        if (size >= PAGE_SIZE)
+            break;
+next:
+        i++;
+    }
+
+    redirfs_put_paths(paths);
+    return size;
+}
+
+static ssize_t avflt_timeout_paths_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    struct avflt_root_data *data;
+    redirfs_path path;
+    redirfs_root root;
+    int timeout;
+    char policy;
+    int shed;
+    int id;
+
+    if (sscanf(buf, "%d:%d:%c:%d", &id, &timeout, &policy, &shed) != 4)
+        return -EINVAL;
+
+    if (timeout < -1)
+        return -EINVAL;
+
+    if (policy != AVFLT_POLICY_OPEN && policy != AVFLT_POLICY_CLOSED)
+        return -EINVAL;
+
+    path = redirfs_get_path_id(id);
+    if (!path)
+        return -ENOENT;
+
+    root = redirfs_get_root_path(path);
+    redirfs_put_path(path);
+    if (!root)
+        return -ENOENT;
+
+    data = avflt_get_root_data_root(root);
+    redirfs_put_root(root);
+    if (!data)
+        return -ENOENT;
+
+    atomic_set(&data->timeout, timeout);
+    atomic_set(&data->policy, policy);
+    atomic_set(&data->shed, shed ? 1 : 0);
+    avflt_put_root_data(data);
+
+    return count;
+}
+
+static ssize_t avflt_shed_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%ld:%d:%d",
+            avflt_stats_get(AVFLT_STAT_SHED),
+            avflt_get_service_time(),
+            avflt_get_queued());
+}
+
+static ssize_t avflt_stats_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return avflt_stats_get_info(buf, PAGE_SIZE);
+}
+
+static ssize_t avflt_stats_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    char cmd;
+
+    if (sscanf(buf, "%c", &cmd) != 1 || cmd != 'r')
+        return -EINVAL;
+
+    avflt_stats_reset();
+    return count;
+}
+
+static ssize_t avflt_revalidate_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%d", atomic_read(&avflt_revalidate));
+}
+
+static ssize_t avflt_revalidate_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    int revalidate;
+
+    if (sscanf(buf, "%d", &revalidate) != 1)
+        return -EINVAL;
+
+    atomic_set(&avflt_revalidate, revalidate ? 1 : 0);
+
+    return count;
+}
+
+static ssize_t avflt_exec_only_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%d", atomic_read(&avflt_exec_only));
+}
+
+static ssize_t avflt_exec_only_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    int exec_only;
+
+    if (sscanf(buf, "%d", &exec_only) != 1)
+        return -EINVAL;
+
+    if (exec_only != 0 && exec_only != 1)
+        return -EINVAL;
+
+    atomic_set(&avflt_exec_only, exec_only);
+
+    return count;
+}
+
+static ssize_t avflt_invalidate_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    int rv;
+
+    rv = avflt_inval_path(buf, count);
+    if (rv)
+        return rv;
+
+    return count;
+}
+
+static ssize_t avflt_warm_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return avflt_warm_get_info(buf, PAGE_SIZE);
+}
+
+static ssize_t avflt_warm_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    int limit;
+    int rv;
+
+    if (sscanf(buf, "%d", &limit) != 1)
+        return -EINVAL;
+
+    rv = avflt_warm_set_limit(limit);
+    if (rv)
+        return rv;
+
+    return count;
+}
+
+static ssize_t avflt_limits_show(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, char *buf)
+{
+    return avflt_limit_get_info(buf, PAGE_SIZE);
+}
+
+static ssize_t avflt_limits_store(redirfs_filter filter,
+        struct redirfs_filter_attribute *attr, const char *buf,
+        size_t count)
+{
+    char policy;
+    char type;
+    int burst;
+    int rate;
+    int rv;
+
+    if (sscanf(buf, "%c", &type) != 1)
+        return -EINVAL;
+
+    switch (type) {
+        case 'p':
+            if (sscanf(buf, "p:%c", &policy) != 1)
+                return -EINVAL;
+
+            rv = avflt_limit_set_policy(policy);
+            break;
+
+        case AVFLT_LIMIT_RULE_TGID:
+        case AVFLT_LIMIT_RULE_CGROUP:
+            if (sscanf(buf, "%c:%d:%d", &type, &rate, &burst) != 3)
+                return -EINVAL;
+
+            rv = avflt_limit_set_rule(type, rate, burst);
+            break;
+
+        default:
+            return -EINVAL;
+    }
+
+    if (rv)
+        return rv;
 
     return count;
 }
@@ -217,6 +589,51 @@ static struct redirfs_filter_attribute avflt_registered_attr =
 static struct redirfs_filter_attribute avflt_trusted_attr = 
     REDIRFS_FILTER_ATTRIBUTE(trusted, 0444, avflt_trusted_show, NULL);
 
+static struct redirfs_filter_attribute avflt_classes_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(classes, 0644, avflt_classes_show,
+            avflt_classes_store);
+
+static struct redirfs_filter_attribute avflt_async_close_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(async_close, 0644, avflt_async_close_show,
+            avflt_async_close_store);
+
+static struct redirfs_filter_attribute avflt_rules_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(rules, 0644, avflt_rules_show,
+            avflt_rules_store);
+
+static struct redirfs_filter_attribute avflt_digest_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(digest, 0644, avflt_digest_show,
+            avflt_digest_store);
+
+static struct redirfs_filter_attribute avflt_timeout_paths_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(timeout_paths, 0644, avflt_timeout_paths_show,
+            avflt_timeout_paths_store);
+
+static struct redirfs_filter_attribute avflt_shed_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(shed, 0444, avflt_shed_show, NULL);
+
+static struct redirfs_filter_attribute avflt_revalidate_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(revalidate, 0644, avflt_revalidate_show,
+            avflt_revalidate_store);
+
+static struct redirfs_filter_attribute avflt_invalidate_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(invalidate, 0200, NULL, avflt_invalidate_store);
+
+static struct redirfs_filter_attribute avflt_warm_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(warm, 0644, avflt_warm_show, avflt_warm_store);
+
+static struct redirfs_filter_attribute avflt_exec_only_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(exec_only, 0644, avflt_exec_only_show,
+            avflt_exec_only_store);
+
+static struct redirfs_filter_attribute avflt_limits_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(limits, 0644, avflt_limits_show,
+            avflt_limits_store);
+
+static struct redirfs_filter_attribute avflt_stats_attr = 
+    REDIRFS_FILTER_ATTRIBUTE(stats, 0644, avflt_stats_show,
+            avflt_stats_store);
+
 int avflt_sys_init(void)
 {
     int rv;
@@ -241,8 +658,80 @@ int avflt_sys_init(void)
     if (rv)
         goto err_trusted;
 
+    rv = redirfs_create_attribute(avflt, &avflt_async_close_attr);
+    if (rv)
+        goto err_async_close;
+
+    rv = redirfs_create_attribute(avflt, &avflt_classes_attr);
+    if (rv)
+        goto err_classes;
+
+    rv = redirfs_create_attribute(avflt, &avflt_rules_attr);
+    if (rv)
+        goto err_rules;
+
+    rv = redirfs_create_attribute(avflt, &avflt_digest_attr);
+    if (rv)
+        goto err_digest;
+
+    rv = redirfs_create_attribute(avflt, &avflt_timeout_paths_attr);
+    if (rv)
+        goto err_timeout_paths;
+
+    rv = redirfs_create_attribute(avflt, &avflt_shed_attr);
+    if (rv)
+        goto err_shed;
+
+    rv = redirfs_create_attribute(avflt, &avflt_stats_attr);
+    if (rv)
+        goto err_stats;
+
+    rv = redirfs_create_attribute(avflt, &avflt_revalidate_attr);
+    if (rv)
+        goto err_revalidate;
+
+    rv = redirfs_create_attribute(avflt, &avflt_invalidate_attr);
+    if (rv)
+        goto err_invalidate;
+
+    rv = redirfs_create_attribute(avflt, &avflt_warm_attr);
+    if (rv)
+        goto err_warm;
+
+    rv = redirfs_create_attribute(avflt, &avflt_exec_only_attr);
+    if (rv)
+        goto err_exec_only;
+
+    rv = redirfs_create_attribute(avflt, &avflt_limits_attr);
+    if (rv)
+        goto err_limits;
+
     return 0;
 
+err_limits:
+    redirfs_remove_attribute(avflt, &avflt_exec_only_attr);
+err_exec_only:
+    redirfs_remove_attribute(avflt, &avflt_warm_attr);
+err_warm:
+    redirfs_remove_attribute(avflt, &avflt_invalidate_attr);
+err_invalidate:
+    redirfs_remove_attribute(avflt, &avflt_revalidate_attr);
+err_revalidate:
+    redirfs_remove_attribute(avflt, &avflt_stats_attr);
+err_stats:
+    redirfs_remove_attribute(avflt, &avflt_shed_attr);
+err_shed:
+    redirfs_remove_attribute(avflt, &avflt_timeout_paths_attr);
+err_timeout_paths:
+    redirfs_remove_attribute(avflt, &avflt_digest_attr);
+err_digest:
+    redirfs_remove_attribute(avflt, &avflt_rules_attr);
+err_rules:
+    redirfs_remove_attribute(avflt, &avflt_classes_attr);
+err_classes:
+    redirfs_remove_attribute(avflt, &avflt_async_close_attr);
+err_async_close:
+    redirfs_remove_attribute(avflt, &avflt_trusted_attr);
 err_trusted:
     redirfs_remove_attribute(avflt, &avflt_registered_attr);
 err_registered:
@@ -261,5 +750,17 @@ void avflt_sys_exit(void)
     redirfs_remove_attribute(avflt, &avflt_pathcache_attr);
     redirfs_remove_attribute(avflt, &avflt_registered_attr);
     redirfs_remove_attribute(avflt, &avflt_trusted_attr);
+    redirfs_remove_attribute(avflt, &avflt_async_close_attr);
+    redirfs_remove_attribute(avflt, &avflt_classes_attr);
+    redirfs_remove_attribute(avflt, &avflt_rules_attr);
+    redirfs_remove_attribute(avflt, &avflt_digest_attr);
+    redirfs_remove_attribute(avflt, &avflt_timeout_paths_attr);
+    redirfs_remove_attribute(avflt, &avflt_shed_attr);
+    redirfs_remove_attribute(avflt, &avflt_stats_attr);
+    redirfs_remove_attribute(avflt, &avflt_revalidate_attr);
+    redirfs_remove_attribute(avflt, &avflt_invalidate_attr);
+    redirfs_remove_attribute(avflt, &avflt_warm_attr);
+    redirfs_remove_attribute(avflt, &avflt_exec_only_attr);
+    redirfs_remove_attribute(avflt, &avflt_limits_attr);
 }
 
@@ -0,0 +1,110 @@
+/*
+ * AVFlt: Anti-Virus Filter
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "avflt.h"
+
+/*
+ * Cache pre-warming. A user space crawler walks the included paths and
+ * passes each file with AVFLT_IOC_WARM, files without a valid verdict are
+ * queued as background events nobody waits for. At most avflt_warm_limit of
+ * them are pending at a time, the crawler gets -EAGAIN above it and backs
+ * off, so the scanners are never flooded. The rate is the number of warm
+ * events finished per second, measured over the last second.
+ */
+
+#define AVFLT_WARM_LIMIT 16
+
+static atomic_t avflt_warm_limit = ATOMIC_INIT(AVFLT_WARM_LIMIT);
+static atomic_t avflt_warm_pending = ATOMIC_INIT(0);
+static atomic_long_t avflt_warm_submitted = ATOMIC_LONG_INIT(0);
+static atomic_long_t avflt_warm_cached = ATOMIC_LONG_INIT(0);
+static atomic_long_t avflt_warm_done = ATOMIC_LONG_INIT(0);
+static DEFINE_SPINLOCK(avflt_warm_lock);
+static unsigned long avflt_warm_stamp = 0;
+static long avflt_warm_count = 0;
+static long avflt_warm_rate = 0;
+
+int avflt_warm_start(void)
+{
+    if (atomic_inc_return(&avflt_warm_pending) >
+            atomic_read(&avflt_warm_limit)) {
+        atomic_dec(&avflt_warm_pending);
+        return -EAGAIN;
+    }
+
+    atomic_long_inc(&avflt_warm_submitted);
+    return 0;
+}
+
+void avflt_warm_finish(void)
+{
+    unsigned long now = jiffies;
+
+    atomic_dec(&avflt_warm_pending);
+    atomic_long_inc(&avflt_warm_done);
+
+    spin_lock(&avflt_warm_lock);
+
+    if (time_after_eq(now, avflt_warm_stamp + HZ)) {
+        if (time_before(now, avflt_warm_stamp + 2 * HZ))
+            avflt_warm_rate = avflt_warm_count * HZ /
+                (long)(now - avflt_warm_stamp);
+        else
+            avflt_warm_rate = 0;
+
+        avflt_warm_stamp = now;
+        avflt_warm_count = 0;
+    }
+
+    avflt_warm_count++;
+
+    spin_unlock(&avflt_warm_lock);
+}
+
+void avflt_warm_skip(void)
+{
+    atomic_long_inc(&avflt_warm_cached);
+}
+
+int avflt_warm_set_limit(int limit)
+{
+    if (limit < 0)
+        return -EINVAL;
+
+    atomic_set(&avflt_warm_limit, limit);
+    return 0;
+}
+
+ssize_t avflt_warm_get_info(char *buf, int size)
+{
+    long rate;
+
+    spin_lock(&avflt_warm_lock);
+    rate = avflt_warm_rate;
+    if (time_after_eq(jiffies, avflt_warm_stamp + 2 * HZ))
+        rate = 0;
+    spin_unlock(&avflt_warm_lock);
+
+    return snprintf(buf, size, "%ld:%ld:%ld:%d:%d:%ld",
+            atomic_long_read(&avflt_warm_submitted),
+            atomic_long_read(&avflt_warm_cached),
+            atomic_long_read(&avflt_warm_done),
+            atomic_read(&avflt_warm_pending),
+            atomic_read(&avflt_warm_limit), rate);
+}
@@ -7,6 +7,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <avfltctl.h>
@@ -25,6 +27,17 @@
 #define CMD_CACHE_DISABLE    0x0800
 #define CMD_HELP        0x1000
 #define CMD_VERSION        0x2000
+#define CMD_ASYNC_CLOSE        0x4000
+#define CMD_CLASS        0x8000
+#define CMD_RULE        0x10000
+#define CMD_DIGEST        0x20000
+#define CMD_PATH_TIMEOUT    0x40000
+#define CMD_STATS        0x80000
+#define CMD_INVALIDATE        0x100000
+#define CMD_REVALIDATE        0x200000
+#define CMD_WARM        0x400000
+#define CMD_EXEC_ONLY        0x800000
+#define CMD_LIMIT        0x1000000
 
 static const char *version = "0.2";
 
@@ -47,7 +60,44 @@ static const char *help_avflt =
 "                                without [id] enable global cache\n"
 "-f[id], --cache-disable=[id]    disable cache for path specifed by [id]\n"
 "                                without [id] disable global cache\n"
-"-t, --timeout                   set request timeout in millisecond";
+"-I, --invalidate <path>         invalidate cached verdicts of file or\n"
+"                                directory <path>\n"
+"-l, --revalidate <0|1>          use verdicts given with older signatures\n"
+"                                and rescan the files in the background\n"
+"-w, --warm <limit>              set the most background scans queued by\n"
+"                                cache pre-warming at a time\n"
+"-x, --exec-only <0|1>           check files only when they are executed or\n"
+"                                mapped executable\n"
+"-L, --limit <rule>              limit scan requests, <rule> is\n"
+"                                t:<rate>:<burst> per process or\n"
+"                                c:<rate>:<burst> per cgroup in requests\n"
+"                                per second (rate 0 disables), or p:b|o|d\n"
+"                                to put requests over the limit into the\n"
+"                                background class, allow them unscanned or\n"
+"                                delay them\n"
+"-t, --timeout                   set request timeout in millisecond\n"
+"-T, --path-timeout <setting>    set timeout of path specified by <id>,\n"
+"                                <setting> is <id>:<timeout>:o|c:<shed>,\n"
+"                                timeout -1 uses the global one, o lets\n"
+"                                and c denies access when it expires,\n"
+"                                shed 1 answers early when the scanners\n"
+"                                cannot reply in time\n"
+"-y, --async-close <0|1>         do not wait for close scans\n"
+"-S[r], --stats=[r]              show event, cache and latency statistics\n"
+"                                with r reset them\n"
+"-g, --digest <size>             share verdicts of files with the same\n"
+"                                content up to <size> bytes, 0 disables\n"
+"-p, --class <rule>              set event priority classes, <rule> is\n"
+"                                w:<interactive>:<normal>:<background>\n"
+"                                weights, g:<pgid>:<class>,\n"
+"                                u:<cgroup inode>:<class> or\n"
+"                                t:<event type>:<class> rule (class -1\n"
+"                                removes it) or c to remove all rules\n"
+"-R, --rule <rule>               append pre-filter rule, <rule> is\n"
+"                                skip|scan|deny followed by size>=<n>,\n"
+"                                size<=<n>, name=<pattern>, fs=<type>,\n"
+"                                uid=<uid> or event=open|close conditions,\n"
+"                                or c to remove all rules";
 
 static const char *usage =
 "avfltctl [-a | -d | -c | -u | -s | -h | -v]\n"
@@ -55,7 +105,7 @@ static const char *usage =
 "         [-n | -o | -f] [id]\n"
 "         -r <id>";
 
-static const char *sopts = "si:e:r:cadut:n::o::f::hv";
+static const char *sopts = "si:e:r:cadut:n::o::f::hvy:p:R:g:T:S::I:l:w:x:L:";
 
 static struct option lopts[] = {
     {"show", 0, 0, 's'},
@@ -72,6 +122,17 @@ static struct option lopts[] = {
     {"cache-disable", 2, 0, 'f'},
     {"help", 0, 0, 'h'},
     {"version", 0, 0, 'v'},
+    {"async-close", 1, 0, 'y'},
+    {"class", 1, 0, 'p'},
+    {"rule", 1, 0, 'R'},
+    {"digest", 1, 0, 'g'},
+    {"path-timeout", 1, 0, 'T'},
+    {"stats", 2, 0, 'S'},
+    {"invalidate", 1, 0, 'I'},
+    {"revalidate", 1, 0, 'l'},
+    {"warm", 1, 0, 'w'},
+    {"exec-only", 1, 0, 'x'},
+    {"limit", 1, 0, 'L'},
     {0, 0, 0, 0}
 };
 
@@ -79,6 +140,16 @@ static char *path = NULL;
 static int cmd = 0;
 static int id = -1;
 static int timeout = 0;
+static int async_close = 0;
+static char *class_rule = NULL;
+static char *rule = NULL;
+static long digest = 0;
+static char *path_timeout = NULL;
+static int stats_reset = 0;
+static int revalidate = 0;
+static int warm = 0;
+static int exec_only = 0;
+static char *limit_rule = NULL;
 
 static void parse_cmdl(int argc, char *argv[])
 {
@@ -126,6 +197,65 @@ static void parse_cmdl(int argc, char *argv[])
                 cmd = CMD_TIMEOUT;
                 break;
 
+            case 'y':
+                async_close = atoi(optarg);
+                cmd = CMD_ASYNC_CLOSE;
+                break;
+
+            case 'p':
+                class_rule = optarg;
+                cmd = CMD_CLASS;
+                break;
+
+            case 'R':
+                rule = optarg;
+                cmd = CMD_RULE;
+                break;
+
+            case 'g':
+                digest = atol(optarg);
+                cmd = CMD_DIGEST;
+                break;
+
+            case 'T':
+                path_timeout = optarg;
+                cmd = CMD_PATH_TIMEOUT;
+                break;
+
+            case 'S':
+                if (optarg && strcmp(optarg, "r")) {
+                    cmd = 0;
+                    return;
+                }
+                stats_reset = optarg ? 1 : 0;
+                cmd = CMD_STATS;
+                break;
+
+            case 'I':
+                path = optarg;
+                cmd = CMD_INVALIDATE;
+                break;
+
+            case 'l':
+                revalidate = atoi(optarg);
+                cmd = CMD_REVALIDATE;
+                break;
+
+            case 'w':
+                warm = atoi(optarg);
+                cmd = CMD_WARM;
+                break;
+
+            case 'x':
+                exec_only = atoi(optarg);
+                cmd = CMD_EXEC_ONLY;
+                break;
+
+            case 'L':
+                limit_rule = optarg;
+                cmd = CMD_LIMIT;
+                break;
+
             case 'n':
                 if (optarg)
                     id = atoi(optarg);
@@ -177,6 +307,17 @@ static int check_cmdl(void)
         case CMD_EXCLUDE:
         case CMD_REMOVE:
         case CMD_TIMEOUT:
+        case CMD_ASYNC_CLOSE:
+        case CMD_CLASS:
+        case CMD_RULE:
+        case CMD_DIGEST:
+        case CMD_PATH_TIMEOUT:
+        case CMD_STATS:
+        case CMD_INVALIDATE:
+        case CMD_REVALIDATE:
+        case CMD_WARM:
+        case CMD_EXEC_ONLY:
+        case CMD_LIMIT:
         case CMD_CACHE_INVALIDATE:
         case CMD_CACHE_ENABLE:
         case CMD_CACHE_DISABLE:
@@ -204,6 +345,33 @@ static int cmd_show(void)
     printf("status     : %s\n", flt->active ? "active" : "inactive");
     printf("cache      : %s\n", flt->cache ? "active" : "inactive");
     printf("timeout    : %d\n", flt->timeout);
+    printf("async close: %s\n", flt->async_close ? "on" : "off");
+    printf("digest     : %ld\n", flt->digest);
+    printf("revalidate : %s\n", flt->revalidate ? "on" : "off");
+    printf("exec only  : %s\n", flt->exec_only ? "on" : "off");
+    printf("limits     : process %d/s burst %d, cgroup %d/s burst %d, "
+            "policy %c\n", flt->limit_tgid_rate, flt->limit_tgid_burst,
+            flt->limit_cgroup_rate, flt->limit_cgroup_burst,
+            flt->limit_policy);
+    printf("warm       : %ld queued, %ld cached, %ld done, %d/%d pending, "
+            "%ld/s\n", flt->warm_submitted, flt->warm_cached, flt->warm_done,
+            flt->warm_pending, flt->warm_limit, flt->warm_rate);
+    printf("shed       : %ld\n", flt->shed);
+    printf("service    : %d us, %d queued\n", flt->service_time, flt->queued);
+    printf("classes    : %d:%d:%d\n", flt->class_weights[0],
+            flt->class_weights[1], flt->class_weights[2]);
+
+    for (i = 0; flt->class_rules[i].type; i++) {
+        printf("             %c:%d:%d\n", flt->class_rules[i].type,
+                flt->class_rules[i].id, flt->class_rules[i].cls);
+    }
+
+    printf("rules      :");
+    for (i = 0; flt->rules[i]; i++) {
+        printf("%s%s\n", i ? "             " : " ", flt->rules[i]);
+    }
+    if (!i)
+        printf("\n");
 
     printf("registered :");
     for (i = 0; flt->registered[i] != -1; i++) {
@@ -229,7 +397,12 @@ static int cmd_show(void)
 
         printf("             type : %s\n", type);
         type = flt->paths[i]->cache ? "active" : "inactive";
-        printf("             cache: %s\n\n", type);
+        printf("             cache: %s\n", type);
+        type = flt->paths[i]->policy == AVFLTCTL_POLICY_CLOSED ?
+            "closed" : "open";
+        printf("             reply: %d ms, fail %s, shed %s\n\n",
+                flt->paths[i]->timeout, type,
+                flt->paths[i]->shed ? "on" : "off");
     }
 
     avfltctl_put_filter(flt);
@@ -237,6 +410,59 @@ static int cmd_show(void)
     return 0;
 }
 
+static void print_hist(const char *name, long *hist)
+{
+    int i;
+
+    printf("%-11s:", name);
+    for (i = 0; i < AVFLTCTL_STATS_BUCKETS; i++) {
+        printf(" %ld", hist[i]);
+    }
+    printf("\n");
+}
+
+static int cmd_stats(int reset)
+{
+    struct avfltctl_stats *stats;
+    int i;
+
+    if (reset)
+        return avfltctl_reset_stats();
+
+    stats = avfltctl_get_stats();
+    if (!stats)
+        return -1;
+
+    printf("enqueued   : %ld\n", stats->enqueued);
+    printf("dequeued   : %ld\n", stats->dequeued);
+    printf("coalesced  : %ld\n", stats->coalesced);
+    printf("timeout    : %ld\n", stats->timeout);
+    printf("shed       : %ld\n", stats->shed);
+    printf("cache hit  : %ld\n", stats->cache_hit);
+    printf("cache miss : disabled %ld, new %ld, root %ld, inode %ld, "
+            "invalidated %ld\n", stats->cache_disabled, stats->cache_new,
+            stats->cache_root_ver, stats->cache_inode_ver,
+            stats->cache_invalidated);
+    printf("cache stale: %ld\n", stats->cache_stale);
+    printf("pcache hit : %ld\n", stats->pcache_hit);
+    printf("digest hit : %ld\n", stats->digest_hit);
+    printf("limit hit  : process %ld, cgroup %ld\n", stats->limit_tgid,
+            stats->limit_cgroup);
+
+    printf("queues     :");
+    for (i = 0; stats->queues[i] != -1; i++) {
+        printf(" %d", stats->queues[i]);
+    }
+    printf("\n");
+
+    print_hist("wait", stats->wait);
+    print_hist("service", stats->service);
+
+    avfltctl_put_stats(stats);
+
+    return 0;
+}
+
 static void print_usage(void)
 {
     printf("%s\n", usage);
@@ -294,6 +520,99 @@ static int cmd_timeout(int timeout)
     return avfltctl_set_timeout(timeout);
 }
 
+static int cmd_async_close(int async)
+{
+    return avfltctl_set_async_close(async);
+}
+
+static int cmd_class(const char *rule)
+{
+    int weights[3];
+    char type;
+    int id;
+    int cls;
+
+    if (!strcmp(rule, "c"))
+        return avfltctl_clear_class_rules();
+
+    if (sscanf(rule, "w:%d:%d:%d", &weights[0], &weights[1],
+                &weights[2]) == 3)
+        return avfltctl_set_class_weights(weights[0], weights[1],
+                weights[2]);
+
+    if (sscanf(rule, "%c:%d:%d", &type, &id, &cls) == 3)
+        return avfltctl_set_class_rule(type, id, cls);
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int cmd_digest(long max)
+{
+    return avfltctl_set_digest(max);
+}
+
+static int cmd_path_timeout(const char *setting)
+{
+    int timeout;
+    char policy;
+    int shed;
+    int id;
+
+    if (sscanf(setting, "%d:%d:%c:%d", &id, &timeout, &policy,
+                &shed) != 4) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return avfltctl_set_path_timeout(id, timeout, policy, shed);
+}
+
+static int cmd_invalidate(void)
+{
+    return avfltctl_invalidate(path);
+}
+
+static int cmd_revalidate(int revalidate)
+{
+    return avfltctl_set_revalidate(revalidate);
+}
+
+static int cmd_warm(int limit)
+{
+    return avfltctl_set_warm_limit(limit);
+}
+
+static int cmd_exec_only(int exec_only)
+{
+    return avfltctl_set_exec_only(exec_only);
+}
+
+static int cmd_limit(const char *rule)
+{
+    char policy;
+    char type;
+    int rate;
+    int burst;
+
+    if (sscanf(rule, "p:%c", &policy) == 1)
+        return avfltctl_set_limit_policy(policy);
+
+    if (sscanf(rule, "%c:%d:%d", &type, &rate, &burst) == 3)
+        return avfltctl_set_limit(type, rate, burst);
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int cmd_rule(const char *rule)
+{
+    if (!strcmp(rule, "c"))
+        return avfltctl_clear_rules();
+
+    return avfltctl_add_rule(rule);
+}
+
 static int cmd_cache_invalidate(int id)
 {
     if (id == -1)
@@ -367,6 +686,50 @@ static int process_cmdl(void)
             rv = cmd_timeout(timeout);
             break;
 
+        case CMD_ASYNC_CLOSE:
+            rv = cmd_async_close(async_close);
+            break;
+
+        case CMD_CLASS:
+            rv = cmd_class(class_rule);
+            break;
+
+        case CMD_RULE:
+            rv = cmd_rule(rule);
+            break;
+
+        case CMD_DIGEST:
+            rv = cmd_digest(digest);
+            break;
+
+        case CMD_PATH_TIMEOUT:
+            rv = cmd_path_timeout(path_timeout);
+            break;
+
+        case CMD_STATS:
+            rv = cmd_stats(stats_reset);
+            break;
+
+        case CMD_INVALIDATE:
+            rv = cmd_invalidate();
+            break;
+
+        case CMD_REVALIDATE:
+            rv = cmd_revalidate(revalidate);
+            break;
+
+        case CMD_WARM:
+            rv = cmd_warm(warm);
+            break;
+
+        case CMD_EXEC_ONLY:
+            rv = cmd_exec_only(exec_only);
+            break;
+
+        case CMD_LIMIT:
+            rv = cmd_limit(limit_rule);
+            break;
+
         case CMD_CACHE_INVALIDATE:
             rv = cmd_cache_invalidate(id);
             break;
@@ -5,127 +5,780 @@
  *          http://www.boost.org/LICENSE_1_0.txt)
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <pthread.h>
+#include <getopt.h>
 #include <limits.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <av.h>
+#include <avfltctl.h>
 
 #define THREADS_COUNT 10
+#define BATCH_SIZE 8
 
-static const char *version = "0.1";
+/*
+ * Open latency histogram, every power of two is split into HIST_SUB buckets
+ * so the percentiles are accurate to 1/HIST_SUB.
+ */
+#define HIST_SHIFT 3
+#define HIST_SUB (1 << HIST_SHIFT)
+#define HIST_BUCKETS (HIST_SUB * 40)
+
+#define FORMAT_CSV 0
+#define FORMAT_JSON 1
+
+static const char *version = "0.2";
+
+static const char *help =
+"-d, --dir <dir>         run the benchmark in a scratch tree created under\n"
+"                        <dir>, without it the events are just printed\n"
+"-n, --files <n>         number of files in the scratch tree(1000)\n"
+"-z, --size <bytes>      size of each file(4096)\n"
+"-c, --clients <n>       number of load processes(4)\n"
+"-T, --time <s>          benchmark duration in seconds(10)\n"
+"-i, --interval <ms>     sampling interval of the timeline(1000)\n"
+"-w, --write <pct>       percentage of opens which write the file(0)\n"
+"-t, --threads <n>       number of scanner threads, 0 one per CPU(10)\n"
+"-b, --batch <n>         events taken by a scanner at once(8)\n"
+"-s, --service <us>      simulated scan time in microseconds(0)\n"
+"-r, --read              scanners read the whole file\n"
+"-f, --format csv|json   output format(csv)\n"
+"-k, --keep              keep the scratch tree\n"
+"-h, --help              print this help\n"
+"-v, --version           print version";
+
+static const char *sopts = "d:n:z:c:T:i:w:t:b:s:rf:khv";
+
+static struct option lopts[] = {
+    {"dir", 1, 0, 'd'},
+    {"files", 1, 0, 'n'},
+    {"size", 1, 0, 'z'},
+    {"clients", 1, 0, 'c'},
+    {"time", 1, 0, 'T'},
+    {"interval", 1, 0, 'i'},
+    {"write", 1, 0, 'w'},
+    {"threads", 1, 0, 't'},
+    {"batch", 1, 0, 'b'},
+    {"service", 1, 0, 's'},
+    {"read", 0, 0, 'r'},
+    {"format", 1, 0, 'f'},
+    {"keep", 0, 0, 'k'},
+    {"help", 0, 0, 'h'},
+    {"version", 0, 0, 'v'},
+    {0, 0, 0, 0}
+};
 
-static struct av_connection av_conn;
-static int stop = 0;
+struct client {
+    unsigned long opens;
+    unsigned long denied;
+    unsigned long errors;
+    unsigned long max;
+    unsigned long hist[HIST_BUCKETS];
+};
+
+struct sample {
+    double time;
+    double opens;
+    double events;
+    double hit_ratio;
+    int depth;
+    int gap;
+};
+
+struct avflt_counters {
+    long hits;
+    long misses;
+};
+
+static char *dir = NULL;
+static char tree[PATH_MAX - 16];
+static int files = 1000;
+static int size = 4096;
+static int clients = 4;
+static int duration = 10;
+static int interval = 1000;
+static int write_pct = 0;
+static int threads = THREADS_COUNT;
+static int batch = BATCH_SIZE;
+static int service = 0;
+static int read_file = 0;
+static int format = FORMAT_CSV;
+static int keep = 0;
 
 static void sighandler(int sig)
 {
-    stop = 1;
 }
 
-static int check(void)
+static unsigned long usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static int hist_index(unsigned long us)
+{
+    int e;
+    int i;
+
+    if (us < HIST_SUB)
+        return us;
+
+    e = sizeof(unsigned long) * CHAR_BIT - 1 - __builtin_clzl(us);
+    i = (e - HIST_SHIFT + 1) * HIST_SUB +
+        ((us >> (e - HIST_SHIFT)) & (HIST_SUB - 1));
+
+    return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+static unsigned long hist_value(int i)
+{
+    if (i < HIST_SUB)
+        return i;
+
+    return (unsigned long)(HIST_SUB + i % HIST_SUB) <<
+        (i / HIST_SUB - 1);
+}
+
+static unsigned long hist_percentile(unsigned long *hist, unsigned long count,
+        double pct)
+{
+    unsigned long rank;
+    unsigned long sum = 0;
+    int i;
+
+    if (!count)
+        return 0;
+
+    rank = (unsigned long)(count * pct / 100.0);
+    if (rank >= count)
+        rank = count - 1;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        sum += hist[i];
+        if (sum > rank)
+            return hist_value(i);
+    }
+
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+static int check(struct av_connection *conn, struct av_event *event,
+        void *data)
 {
-    struct av_event av_event;
     char fn[PATH_MAX];
 
-    while (!stop) {
-        if (av_request(&av_conn, &av_event, 500)) {
-            if (errno == ETIMEDOUT)
-                continue;
-            perror("av_request failed");
-            continue;
-        }
+    if (av_get_filename(event, fn, PATH_MAX)) {
+        perror("av_get_filename failed");
+        return -1;
+    }
 
-        if (av_get_filename(&av_event, fn, PATH_MAX)) {
-            perror("av_get_filename failed");
-            return -1;
-        }
+    printf("thread[%lu]: id: %d, type: %d, fd: %d, pid: %d, "
+            "tgid: %d, fn: %s\n", pthread_self(), event->id, event->type,
+            event->fd, event->pid, event->tgid, fn);
+
+    return AV_ACCESS_ALLOW;
+}
 
-        if (av_set_result(&av_event, AV_ACCESS_ALLOW)) {
-            perror("av_set_result failed");
+static int scan(struct av_connection *conn, struct av_event *event,
+        void *data)
+{
+    char buf[65536];
+    off_t off = 0;
+    ssize_t rv;
+
+    if (read_file) {
+        while ((rv = pread(event->fd, buf, sizeof(buf), off)) > 0)
+            off += rv;
+
+        if (rv == -1)
             return -1;
+    }
+
+    if (service)
+        usleep(service);
+
+    return AV_ACCESS_ALLOW;
+}
+
+static void file_name(char *buf, int i)
+{
+    snprintf(buf, PATH_MAX, "%s/f%07d", tree, i);
+}
+
+static int tree_create(void)
+{
+    char fn[PATH_MAX];
+    char *buf;
+    int fd;
+    int rv = 0;
+    int i;
+
+    snprintf(tree, sizeof(tree), "%s/avtest.%d", dir, getpid());
+
+    if (mkdir(tree, 0700))
+        return -1;
+
+    buf = malloc(size + 1);
+    if (!buf)
+        return -1;
+
+    memset(buf, 'a', size + 1);
+
+    for (i = 0; i < files && !rv; i++) {
+        file_name(fn, i);
+
+        fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) {
+            rv = -1;
+            break;
         }
 
-        printf("thread[%lu]: id: %d, type: %d, fd: %d, pid: %d, "
-                "tgid: %d, res: %d, fn: %s\n", pthread_self(),
-                av_event.id, av_event.type, av_event.fd,
-                av_event.pid, av_event.tgid, av_event.res, fn);
+        if (write(fd, buf, size) != size)
+            rv = -1;
 
-        if (av_reply(&av_conn, &av_event)) {
-            perror("av_reply failed");
-            return -1;
+        if (close(fd))
+            rv = -1;
+    }
+
+    free(buf);
+    return rv;
+}
+
+static void tree_remove(void)
+{
+    char fn[PATH_MAX];
+    int i;
+
+    for (i = 0; i < files; i++) {
+        file_name(fn, i);
+        unlink(fn);
+    }
+
+    rmdir(tree);
+}
+
+/*
+ * Load process, opens random files of the tree until the deadline and
+ * records the time each open takes.
+ */
+static void client_run(struct client *client, unsigned long deadline)
+{
+    char fn[PATH_MAX];
+    char buf[4096];
+    unsigned int seed = getpid();
+    unsigned long start;
+    unsigned long lat;
+    int wr;
+    int fd;
+
+    while (usecs() < deadline) {
+        file_name(fn, rand_r(&seed) % files);
+        wr = write_pct && (int)(rand_r(&seed) % 100) < write_pct;
+
+        start = usecs();
+        fd = open(fn, wr ? O_WRONLY : O_RDONLY);
+        lat = usecs() - start;
+
+        if (fd == -1) {
+            if (errno == EPERM)
+                client->denied++;
+            else
+                client->errors++;
+            continue;
         }
 
+        client->hist[hist_index(lat)]++;
+        if (lat > client->max)
+            client->max = lat;
+
+        if (wr) {
+            if (pwrite(fd, "b", 1, 0) != 1)
+                client->errors++;
+
+        } else if (read(fd, buf, sizeof(buf)) == -1)
+            client->errors++;
+
+        close(fd);
+        client->opens++;
+    }
+}
+
+static int avflt_counters(struct avflt_counters *cnt, int *depth)
+{
+    struct avfltctl_stats *stats;
+    int i;
+
+    stats = avfltctl_get_stats();
+    if (!stats)
+        return -1;
+
+    cnt->hits = stats->cache_hit + stats->pcache_hit + stats->digest_hit +
+        stats->coalesced;
+    cnt->misses = stats->enqueued;
+
+    if (depth) {
+        *depth = 0;
+        for (i = 0; stats->queues[i] != -1; i++)
+            *depth += stats->queues[i];
     }
 
+    avfltctl_put_stats(stats);
     return 0;
 }
 
-static void *check_thread(void *data)
+static double hit_ratio(struct avflt_counters *old, struct avflt_counters *new)
 {
-    sigset_t sigmask;
+    long hits = new->hits - old->hits;
+    long misses = new->misses - old->misses;
 
-    sigemptyset(&sigmask);
-    sigaddset(&sigmask, SIGINT);
-    sigaddset(&sigmask, SIGTERM);
-    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+    if (hits + misses <= 0)
+        return 0;
 
-    if (check())
-        fprintf(stderr, "thread[%lu] unexpectedly stopped, %s\n",
-                pthread_self(), strerror(errno));
+    return (double)hits / (hits + misses);
+}
 
-    return NULL;
+static unsigned long clients_opens(struct client *cls)
+{
+    unsigned long opens = 0;
+    int i;
+
+    for (i = 0; i < clients; i++)
+        opens += cls[i].opens;
+
+    return opens;
 }
 
-int main(int argc, char *argv[])
+static void print_results(struct sample *samples, int nr, struct client *cls,
+        struct av_pool_stats *pstats, double elapsed, double ratio,
+        int have_avflt, int gaps)
 {
+    unsigned long hist[HIST_BUCKETS];
+    unsigned long opens = 0;
+    unsigned long denied = 0;
+    unsigned long errors = 0;
+    unsigned long max = 0;
+    unsigned long scan_avg;
+    double pcts[] = {50, 90, 99, 99.9};
+    const char *names[] = {"p50", "p90", "p99", "p999"};
+    int i;
+    int j;
 
-    pthread_t threads[THREADS_COUNT];
-    struct sigaction sa;
+    memset(hist, 0, sizeof(hist));
+
+    for (i = 0; i < clients; i++) {
+        opens += cls[i].opens;
+        denied += cls[i].denied;
+        errors += cls[i].errors;
+        if (cls[i].max > max)
+            max = cls[i].max;
+
+        for (j = 0; j < HIST_BUCKETS; j++)
+            hist[j] += cls[i].hist[j];
+    }
+
+    scan_avg = pstats->events ? pstats->scan_time / pstats->events : 0;
+
+    if (format == FORMAT_CSV) {
+        printf("time,opens_per_sec,events_per_sec,cache_hit_ratio,"
+                "queue_depth\n");
+
+        for (i = 0; i < nr; i++) {
+            printf("%.2f,%.1f,%.1f,", samples[i].time, samples[i].opens,
+                    samples[i].events);
+            if (have_avflt && !samples[i].gap)
+                printf("%.3f,%d\n", samples[i].hit_ratio, samples[i].depth);
+            else
+                printf(",\n");
+        }
+
+        printf("\nmetric,value\n");
+        printf("files,%d\nsize,%d\nclients,%d\nthreads,%d\nbatch,%d\n"
+                "service_us,%d\nwrite_pct,%d\n", files, size, clients,
+                threads, batch, service, write_pct);
+        printf("duration,%.2f\nopens,%lu\nopens_per_sec,%.1f\n"
+                "denied,%lu\nerrors,%lu\n", elapsed, opens, opens / elapsed,
+                denied, errors);
+        printf("events,%lu\nevents_per_sec,%.1f\nbatches,%lu\n"
+                "scan_avg_us,%lu\nscan_max_us,%lu\n", pstats->events,
+                pstats->events / elapsed, pstats->batches, scan_avg,
+                pstats->scan_max);
+
+        for (i = 0; i < 4; i++)
+            printf("open_%s_us,%lu\n", names[i],
+                    hist_percentile(hist, opens, pcts[i]));
+
+        printf("open_max_us,%lu\n", max);
+        if (have_avflt && ratio >= 0)
+            printf("cache_hit_ratio,%.3f\n", ratio);
+        else if (have_avflt)
+            printf("cache_hit_ratio,\n");
+
+        if (have_avflt)
+            printf("avflt_gaps,%d\n", gaps);
+
+        return;
+    }
+
+    printf("{\n  \"config\": {\"files\": %d, \"size\": %d, \"clients\": %d, "
+            "\"threads\": %d, \"batch\": %d, \"service_us\": %d, "
+            "\"write_pct\": %d},\n", files, size, clients, threads, batch,
+            service, write_pct);
+
+    printf("  \"timeline\": [");
+    for (i = 0; i < nr; i++) {
+        printf("%s\n    {\"time\": %.2f, \"opens_per_sec\": %.1f, "
+                "\"events_per_sec\": %.1f", i ? "," : "", samples[i].time,
+                samples[i].opens, samples[i].events);
+        if (have_avflt && !samples[i].gap)
+            printf(", \"cache_hit_ratio\": %.3f, \"queue_depth\": %d",
+                    samples[i].hit_ratio, samples[i].depth);
+        else if (have_avflt)
+            printf(", \"cache_hit_ratio\": null, \"queue_depth\": null");
+        printf("}");
+    }
+    printf("\n  ],\n");
+
+    printf("  \"summary\": {\"duration\": %.2f, \"opens\": %lu, "
+            "\"opens_per_sec\": %.1f, \"denied\": %lu, \"errors\": %lu, "
+            "\"events\": %lu, \"events_per_sec\": %.1f, \"batches\": %lu, "
+            "\"scan_avg_us\": %lu, \"scan_max_us\": %lu", elapsed, opens,
+            opens / elapsed, denied, errors, pstats->events,
+            pstats->events / elapsed, pstats->batches, scan_avg,
+            pstats->scan_max);
+
+    for (i = 0; i < 4; i++)
+        printf(", \"open_%s_us\": %lu", names[i],
+                hist_percentile(hist, opens, pcts[i]));
+
+    printf(", \"open_max_us\": %lu", max);
+    if (have_avflt && ratio >= 0)
+        printf(", \"cache_hit_ratio\": %.3f", ratio);
+    else if (have_avflt)
+        printf(", \"cache_hit_ratio\": null");
+
+    if (have_avflt)
+        printf(", \"avflt_gaps\": %d", gaps);
+
+    printf("}\n}\n");
+}
+
+/*
+ * The load processes are forked before the scanners register, so they do
+ * not inherit the avflt connections, and wait on a pipe until the scanners
+ * are ready, they quit if the pipe is closed without a start byte. Accesses
+ * of the registered benchmark process itself are not checked.
+ */
+static int bench(void)
+{
+    struct avflt_counters first;
+    struct avflt_counters last;
+    struct avflt_counters cur;
+    struct av_pool_stats pstats;
+    struct sample *samples = NULL;
+    struct sample *tmp;
+    struct client *cls;
+    struct av_pool *pool = NULL;
+    unsigned long start;
+    unsigned long prev;
+    unsigned long now;
+    unsigned long opens;
+    unsigned long prev_opens = 0;
+    unsigned long prev_events = 0;
+    double secs;
+    double ratio;
+    int have_avflt;
+    int gaps = 0;
+    int running;
+    int nr = 0;
+    int rv = -1;
+    int pfd[2];
+    pid_t pid;
+    char c;
     int i;
-    int rv;
 
-    printf("avtest: version %s\n", version);
-    memset(&sa, 0, sizeof(struct sigaction));
-    sa.sa_handler = sighandler;
-    sigemptyset(&sa.sa_mask);
-    sigaddset(&sa.sa_mask, SIGTERM);
-    sigaddset(&sa.sa_mask, SIGINT);
-    sigaction(SIGTERM, &sa, NULL);
-    sigaction(SIGINT, &sa, NULL);
+    fprintf(stderr, "avtest: creating %d files of %d bytes\n", files, size);
 
-    if (av_register(&av_conn)) {
-        perror("av_register_trusted failed");
-        exit(EXIT_FAILURE);
+    if (tree_create()) {
+        perror("tree creation failed");
+        goto exit;
+    }
+
+    cls = mmap(NULL, sizeof(struct client) * clients,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cls == MAP_FAILED) {
+        perror("mmap failed");
+        goto exit;
     }
 
-    for (i = 0; i < THREADS_COUNT; i++) {
-        rv = pthread_create(&threads[i], NULL, check_thread, NULL);
-        if (rv) {
-            fprintf(stderr, "pthread_create failed: %d\n", rv);
-            exit(EXIT_FAILURE);
+    memset(cls, 0, sizeof(struct client) * clients);
+
+    if (pipe(pfd)) {
+        perror("pipe failed");
+        goto err_cls;
+    }
+
+    for (i = 0; i < clients; i++) {
+        pid = fork();
+        if (pid == -1) {
+            perror("fork failed");
+            close(pfd[1]);
+            close(pfd[0]);
+            goto reap;
+        }
+
+        if (!pid) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            close(pfd[1]);
+            if (read(pfd[0], &c, 1) == 1)
+                client_run(&cls[i], usecs() + duration * 1000000UL);
+            _exit(0);
         }
     }
 
+    close(pfd[0]);
+
+    pool = av_pool_create(threads, batch, 0, scan, NULL);
+    if (!pool) {
+        perror("av_pool_create failed");
+        close(pfd[1]);
+        goto reap;
+    }
+
+    memset(&first, 0, sizeof(first));
+    have_avflt = !avflt_counters(&first, NULL);
+    last = first;
+
+    fprintf(stderr, "avtest: running %d clients for %d s\n", clients,
+            duration);
+
+    start = prev = usecs();
+    for (i = 0; i < clients; i++) {
+        if (write(pfd[1], "s", 1) != 1)
+            break;
+    }
+    close(pfd[1]);
+    running = clients;
+
+    while (running) {
+        usleep(interval * 1000);
+
+        while (running && waitpid(-1, NULL, WNOHANG) > 0)
+            running--;
+
+        now = usecs();
+        secs = (now - prev) / 1000000.0;
+        opens = clients_opens(cls);
+        av_pool_get_stats(pool, &pstats);
+
+        tmp = realloc(samples, sizeof(struct sample) * (nr + 1));
+        if (!tmp) {
+            perror("realloc failed");
+            goto reap;
+        }
+
+        samples = tmp;
+        samples[nr].time = (now - start) / 1000000.0;
+        samples[nr].opens = (opens - prev_opens) / secs;
+        samples[nr].events = (pstats.events - prev_events) / secs;
+        samples[nr].hit_ratio = 0;
+        samples[nr].depth = 0;
+        samples[nr].gap = 0;
+
+        /*
+         * A sample without the avflt counters is marked as a gap, the hit
+         * ratio of the next one covers the gap as well.
+         */
+        if (have_avflt && !avflt_counters(&cur, &samples[nr].depth)) {
+            samples[nr].hit_ratio = hit_ratio(&last, &cur);
+            last = cur;
+
+        } else if (have_avflt) {
+            samples[nr].gap = 1;
+            gaps++;
+        }
+
+        prev = now;
+        prev_opens = opens;
+        prev_events = pstats.events;
+        nr++;
+    }
+
+    secs = (usecs() - start) / 1000000.0;
+    av_pool_get_stats(pool, &pstats);
+
+    /*
+     * The hit ratio of the run is taken from the counters at its end, it is
+     * left out if they can not be read.
+     */
+    ratio = -1;
+    if (have_avflt && !avflt_counters(&cur, NULL))
+        ratio = hit_ratio(&first, &cur);
+
+    if (gaps)
+        fprintf(stderr, "avtest: avflt counters unavailable in %d samples\n",
+                gaps);
+
+    print_results(samples, nr, cls, &pstats, secs, ratio, have_avflt, gaps);
+
+    rv = 0;
+reap:
+    while (wait(NULL) > 0)
+        ;
+
+    if (pool)
+        av_pool_destroy(pool);
+err_cls:
+    munmap(cls, sizeof(struct client) * clients);
+exit:
+    free(samples);
+
+    if (!keep)
+        tree_remove();
+
+    return rv;
+}
+
+static int monitor(void)
+{
+    struct av_pool *pool;
+
+    pool = av_pool_create(threads, batch, 0, check, NULL);
+    if (!pool) {
+        perror("av_pool_create failed");
+        return -1;
+    }
+
     pause();
 
-    for (i = 0; i < THREADS_COUNT; i++) {
-        rv = pthread_join(threads[i], NULL);
-        if (rv) {
-            fprintf(stderr, "pthread_join failed: %d\n", rv);
-            exit(EXIT_FAILURE);
+    if (av_pool_destroy(pool)) {
+        perror("av_pool_destroy failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_cmdl(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
+        switch (c) {
+            case 'd':
+                dir = optarg;
+                break;
+
+            case 'n':
+                files = atoi(optarg);
+                break;
+
+            case 'z':
+                size = atoi(optarg);
+                break;
+
+            case 'c':
+                clients = atoi(optarg);
+                break;
+
+            case 'T':
+                duration = atoi(optarg);
+                break;
+
+            case 'i':
+                interval = atoi(optarg);
+                break;
+
+            case 'w':
+                write_pct = atoi(optarg);
+                break;
+
+            case 't':
+                threads = atoi(optarg);
+                break;
+
+            case 'b':
+                batch = atoi(optarg);
+                break;
+
+            case 's':
+                service = atoi(optarg);
+                break;
+
+            case 'r':
+                read_file = 1;
+                break;
+
+            case 'f':
+                if (!strcmp(optarg, "csv"))
+                    format = FORMAT_CSV;
+                else if (!strcmp(optarg, "json"))
+                    format = FORMAT_JSON;
+                else
+                    return -1;
+                break;
+
+            case 'k':
+                keep = 1;
+                break;
+
+            case 'h':
+                printf("%s\n", help);
+                exit(EXIT_SUCCESS);
+
+            case 'v':
+                printf("avtest: version %s\n", version);
+                exit(EXIT_SUCCESS);
+
+            default:
+                return -1;
         }
     }
 
-    if (av_unregister(&av_conn)) {
-        perror("av_unregister failed");
+    if (files < 1 || size < 0 || clients < 1 || duration < 1 ||
+            interval < 1 || write_pct < 0 || write_pct > 100 ||
+            threads < 0 || batch < 1 || batch > AV_BATCH_MAX || service < 0)
+        return -1;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    int rv;
+
+    if (parse_cmdl(argc, argv)) {
+        fprintf(stderr, "%s\n", help);
         exit(EXIT_FAILURE);
     }
 
-    exit(EXIT_SUCCESS);
-}
+    memset(&sa, 0, sizeof(struct sigaction));
+    sa.sa_handler = sighandler;
+    sigemptyset(&sa.sa_mask);
+    sigaddset(&sa.sa_mask, SIGTERM);
+    sigaddset(&sa.sa_mask, SIGINT);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
 
+    if (dir)
+        rv = bench();
+    else {
+        printf("avtest: version %s\n", version);
+        rv = monitor();
+    }
+
+    exit(rv ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -24,6 +24,11 @@ static int av_open_conn(struct av_connection *conn, int flags)
     if ((conn->fd = open("/dev/avflt", flags)) == -1)
         return -1;
 
+    conn->proto = AV_PROTO_TEXT;
+    conn->wait = AV_WAIT_UNSET;
+    conn->flags = 0;
+    conn->ring = NULL;
+
     return 0;
 }
 
@@ -39,6 +44,9 @@ int av_unregister(struct av_connection *conn)
         return -1;
     }
 
+    if (av_ring_destroy(conn) == -1)
+        return -1;
+
     if (close(conn->fd) == -1)
         return -1;
 
@@ -55,6 +63,99 @@ int av_unregister_trusted(struct av_connection *conn)
     return av_unregister(conn);
 }
 
+int av_set_protocol(struct av_connection *conn, int proto)
+{
+    if (!conn || (proto != AV_PROTO_TEXT && proto != AV_PROTO_BINARY)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ioctl(conn->fd, AV_IOC_SET_PROTO, (unsigned long)proto) == -1)
+        return -1;
+
+    conn->proto = proto;
+
+    return 0;
+}
+
+int av_set_flags(struct av_connection *conn, int flags)
+{
+    if (!conn || (flags & ~(AV_FLAG_NOFD | AV_FLAG_PATH))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ioctl(conn->fd, AV_IOC_SET_FLAGS, (unsigned long)flags) == -1)
+        return -1;
+
+    conn->flags = flags;
+
+    return 0;
+}
+
+ssize_t av_pread(struct av_connection *conn, struct av_event *event,
+        void *buf, size_t size, off_t offset)
+{
+    struct av_proto_read req;
+
+    if (!conn || !event || !buf || offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.id = event->id;
+    req.size = size > 0x7fffffff ? 0x7fffffff : size;
+    req.offset = offset;
+    req.buf = (uint64_t)(unsigned long)buf;
+
+    return ioctl(conn->fd, AV_IOC_PREAD, &req);
+}
+
+int av_get_fd(struct av_connection *conn, struct av_event *event)
+{
+    int fd;
+
+    if (!conn || !event) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (event->fd >= 0)
+        return event->fd;
+
+    fd = ioctl(conn->fd, AV_IOC_GET_FD, (unsigned long)event->id);
+    if (fd == -1)
+        return -1;
+
+    event->fd = fd;
+
+    return fd;
+}
+
+int av_get_queues(struct av_connection *conn)
+{
+    if (!conn) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ioctl(conn->fd, AV_IOC_GET_QUEUES);
+}
+
+int av_set_queue(struct av_connection *conn, int queue)
+{
+    if (!conn || queue < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ioctl(conn->fd, AV_IOC_SET_QUEUE, (unsigned long)queue) == -1)
+        return -1;
+
+    return 0;
+}
+
 int av_set_result(struct av_event *event, int res)
 {
     if (!event) {
@@ -100,6 +201,12 @@ int av_get_filename(struct av_event *event, char *buf, int size)
 
     memset(fn, 0, 256);
     memset(buf, 0, size);
+
+    if (event->path) {
+        strncpy(buf, event->path, size - 1);
+        return 0;
+    }
+
     snprintf(fn, 255, "/proc/%d/fd/%d", getpid(), event->fd);
 
     if (readlink(fn, buf, size - 1) == -1)
@@ -116,6 +223,9 @@ ssize_t av_parse_request_from_buf(struct av_event *event, const char* buf, size_
         errno = EINVAL;
         return -1;
     }
+    event->res = 0;
+    event->cache = AV_CACHE_ENABLE;
+    event->path = NULL;
     delimeter = memchr(buf, '\0', size);
     if (!delimeter) {
         errno = EINVAL;
@@ -9,6 +9,8 @@
 #define __AV_H__
 
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <stdint.h>
 
 #define AV_EVENT_OPEN  1
 #define AV_EVENT_CLOSE 2
@@ -19,8 +21,122 @@
 #define AV_CACHE_DISABLE 0
 #define AV_CACHE_ENABLE  1
 
+#define AV_PROTO_TEXT   0
+#define AV_PROTO_BINARY 1
+
+/* the most events returned by one binary read */
+#define AV_BATCH_MAX 64
+
+/* mirrors avflt_proto.h */
+#define AV_IOC_MAGIC        'A'
+#define AV_IOC_SET_PROTO    _IO(AV_IOC_MAGIC, 1)
+#define AV_IOC_GET_PROTO    _IO(AV_IOC_MAGIC, 2)
+#define AV_IOC_RING_SETUP   _IO(AV_IOC_MAGIC, 3)
+#define AV_IOC_RING_ENTER   _IO(AV_IOC_MAGIC, 4)
+#define AV_IOC_SET_QUEUE    _IO(AV_IOC_MAGIC, 5)
+#define AV_IOC_GET_QUEUE    _IO(AV_IOC_MAGIC, 6)
+#define AV_IOC_GET_QUEUES   _IO(AV_IOC_MAGIC, 7)
+#define AV_IOC_SET_WAIT     _IO(AV_IOC_MAGIC, 8)
+#define AV_IOC_SET_SIGVER   _IO(AV_IOC_MAGIC, 9)
+#define AV_IOC_PCACHE_LOAD  _IOW(AV_IOC_MAGIC, 10, struct av_pcache_buf)
+#define AV_IOC_PCACHE_DUMP  _IOW(AV_IOC_MAGIC, 11, struct av_pcache_buf)
+#define AV_IOC_SET_FLAGS    _IO(AV_IOC_MAGIC, 12)
+#define AV_IOC_PREAD        _IOW(AV_IOC_MAGIC, 13, struct av_proto_read)
+#define AV_IOC_GET_FD       _IO(AV_IOC_MAGIC, 14)
+#define AV_IOC_GET_PATH     _IOW(AV_IOC_MAGIC, 15, struct av_proto_read)
+#define AV_IOC_WARM         _IO(AV_IOC_MAGIC, 16)
+
+/* events are handed over without an fd, see av_pread and av_get_fd */
+#define AV_FLAG_NOFD 0x01
+/* binary events carry the file path in av_event.path */
+#define AV_FLAG_PATH 0x02
+
+/* room for one path in a binary read with AV_FLAG_PATH */
+#define AV_PATH_MAX 4096
+
+#define AV_WAIT_INFINITE    0xffffffffUL
+#define AV_WAIT_UNSET       -1
+#define AV_WAIT_UNSUPPORTED -2
+
+#define AV_RING_ENTER_WAIT  0x01
+
+#define AV_RING_MAX 4096
+
+/* the most records kept by the avflt persistent cache */
+#define AV_PCACHE_MAX 65536
+
+struct av_proto_event {
+    int32_t id;
+    int32_t type;
+    int32_t fd;
+    int32_t pid;
+    int32_t tgid;
+    uint32_t path_len;
+    uint32_t reserved[2];
+};
+
+struct av_proto_read {
+    int32_t id;
+    uint32_t size;
+    uint64_t offset;
+    uint64_t buf;
+};
+
+struct av_proto_reply {
+    int32_t id;
+    int32_t result;
+    int32_t cache;
+    uint32_t reserved;
+};
+
+struct av_pcache_rec {
+    uint8_t uuid[16];
+    uint64_t ino;
+    int64_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t generation;
+    uint32_t sigver;
+    int32_t result;
+};
+
+struct av_pcache_buf {
+    uint64_t recs;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct av_ring_hdr {
+    uint32_t entries;
+    uint32_t ev_off;
+    uint32_t rep_off;
+    uint32_t reserved[13];
+    uint32_t ev_head;
+    uint32_t pad1[15];
+    uint32_t ev_tail;
+    uint32_t pad2[15];
+    uint32_t rep_head;
+    uint32_t pad3[15];
+    uint32_t rep_tail;
+    uint32_t pad4[15];
+};
+
+struct av_ring {
+    void *mem;
+    size_t size;
+    struct av_ring_hdr *hdr;
+    struct av_proto_event *events;
+    struct av_proto_reply *replies;
+    uint32_t entries;
+    uint32_t ev_head;
+    uint32_t rep_tail;
+};
+
 struct av_connection {
     int fd;
+    int proto;
+    int wait;
+    int flags;
+    struct av_ring *ring;
 };
 
 struct av_event {
@@ -31,6 +147,26 @@ struct av_event {
     pid_t tgid;
     int res;
     int cache;
+    char *path;
+};
+
+/* scan time histogram buckets, bucket i counts scans under 2^i us */
+#define AV_POOL_HIST 24
+
+struct av_pool;
+
+/* returns AV_ACCESS_ALLOW or AV_ACCESS_DENY, anything else is an error */
+typedef int (*av_scan_fn)(struct av_connection *conn, struct av_event *event,
+        void *data);
+
+struct av_pool_stats {
+    unsigned long events;
+    unsigned long denied;
+    unsigned long errors;
+    unsigned long batches;
+    unsigned long scan_time;
+    unsigned long scan_max;
+    unsigned long hist[AV_POOL_HIST];
 };
 
 #ifdef __cplusplus
@@ -48,6 +184,28 @@ int av_reply(struct av_connection *conn, struct av_event *event);
 int av_set_result(struct av_event *event, int res);
 int av_set_cache(struct av_event *event, int cache);
 int av_get_filename(struct av_event *event, char *buf, int size);
+int av_set_protocol(struct av_connection *conn, int proto);
+int av_request_batch(struct av_connection *conn, struct av_event *events,
+        int count, int timeout);
+int av_reply_batch(struct av_connection *conn, struct av_event *events,
+        int count);
+int av_get_queues(struct av_connection *conn);
+int av_set_queue(struct av_connection *conn, int queue);
+int av_ring_setup(struct av_connection *conn, unsigned int entries);
+int av_ring_destroy(struct av_connection *conn);
+int av_set_sigver(struct av_connection *conn, unsigned int sigver);
+int av_cache_load(struct av_connection *conn, const char *path);
+int av_cache_save(struct av_connection *conn, const char *path);
+int av_set_flags(struct av_connection *conn, int flags);
+ssize_t av_pread(struct av_connection *conn, struct av_event *event,
+        void *buf, size_t size, off_t offset);
+int av_get_fd(struct av_connection *conn, struct av_event *event);
+int av_warm(struct av_connection *conn, const char *path);
+long av_warm_tree(struct av_connection *conn, const char *root, int rate);
+struct av_pool *av_pool_create(int threads, int batch, int flags,
+        av_scan_fn fn, void *data);
+int av_pool_destroy(struct av_pool *pool);
+int av_pool_get_stats(struct av_pool *pool, struct av_pool_stats *stats);
 
 #ifdef __cplusplus
 }
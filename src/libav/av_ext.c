@@ -6,25 +6,55 @@
  */
 
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <fcntl.h>
+#include <fts.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include "av.h"
 
-int av_request(struct av_connection *conn, struct av_event *event, int timeout)
+/*
+ * Lets the next read or RING_ENTER block in the avflt, which wakes up only
+ * one blocked scanner per event. Returns 1 when the avflt supports it.
+ */
+static int av_set_wait(struct av_connection *conn, int timeout)
+{
+    unsigned long wait;
+
+    if (conn->wait == AV_WAIT_UNSUPPORTED)
+        return 0;
+
+    if (conn->wait == timeout)
+        return 1;
+
+    wait = timeout ? (unsigned long)timeout : AV_WAIT_INFINITE;
+
+    if (ioctl(conn->fd, AV_IOC_SET_WAIT, wait) == -1) {
+        if (errno != ENOTTY)
+            return -1;
+
+        conn->wait = AV_WAIT_UNSUPPORTED;
+        return 0;
+    }
+
+    conn->wait = timeout;
+    return 1;
+}
+
+static int av_wait(struct av_connection *conn, int timeout)
 {
     struct timeval tv;
     struct timeval *ptv;
-    char buf[256];
     fd_set rfds;
-    int rv = 0;
+    int rv;
 
-    if (!conn || !event || timeout < 0) {
-        errno = EINVAL;
-        return -1;
-    }
+    rv = av_set_wait(conn, timeout);
+    if (rv)
+        return rv == 1 ? 0 : -1;
 
     FD_ZERO(&rfds);
     FD_SET(conn->fd, &rfds);
@@ -36,26 +66,396 @@ int av_request(struct av_connection *conn, struct av_event *event, int timeout)
     } else
         ptv = NULL;
 
+    rv = select(conn->fd + 1, &rfds, NULL, NULL, ptv);
+    if (rv == 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (rv == -1)
+        return -1;
+
+    return 0;
+}
+
+/* a blocking read which returned nothing has already waited for timeout */
+static int av_timed_out(struct av_connection *conn, int timeout)
+{
+    if (conn->wait < 0 || !timeout)
+        return 0;
+
+    errno = ETIMEDOUT;
+    return 1;
+}
+
+static void av_fill_event(struct av_event *event,
+        const struct av_proto_event *rec)
+{
+    event->id = rec->id;
+    event->type = rec->type;
+    event->fd = rec->fd;
+    event->pid = rec->pid;
+    event->tgid = rec->tgid;
+    event->res = 0;
+    event->cache = AV_CACHE_ENABLE;
+    event->path = NULL;
+}
+
+/*
+ * closes the fd and frees the path once the event was replied
+ */
+static int av_release_event(struct av_event *event)
+{
+    int rv = 0;
+
+    if (event->fd >= 0 && close(event->fd) == -1)
+        rv = -1;
+
+    free(event->path);
+    event->path = NULL;
+    event->fd = -1;
+
+    return rv;
+}
+
+/*
+ * With AV_FLAG_PATH every record is followed by its path padded to 8 bytes.
+ */
+static int av_read_paths(struct av_connection *conn, struct av_event *events,
+        int count, int timeout)
+{
+    struct av_proto_event *rec;
+    size_t size;
+    size_t off;
+    ssize_t rv = 0;
+    char *buf;
+    int nr = 0;
+
+    size = (sizeof(struct av_proto_event) + AV_PATH_MAX) * count;
+    buf = malloc(size);
+    if (!buf)
+        return -1;
+
     while (!rv) {
-        rv = select(conn->fd + 1, &rfds, NULL, NULL, ptv);
-        if (rv == 0) {
-            errno = ETIMEDOUT;
+        if (av_wait(conn, timeout))
+            goto error;
+
+        rv = read(conn->fd, buf, size);
+        if (rv == -1)
+            goto error;
+
+        if (!rv && av_timed_out(conn, timeout))
+            goto error;
+    }
+
+    for (off = 0; off + sizeof(struct av_proto_event) <= (size_t)rv &&
+            nr < count; nr++) {
+        rec = (struct av_proto_event *)(buf + off);
+        av_fill_event(&events[nr], rec);
+        off += sizeof(struct av_proto_event);
+
+        if (rec->path_len) {
+            events[nr].path = strndup(buf + off, rec->path_len);
+            off += (rec->path_len + 7) & ~7;
+        }
+    }
+
+    free(buf);
+    return nr;
+error:
+    free(buf);
+    return -1;
+}
+
+#define av_ring_load(x) (*(volatile uint32_t *)&(x))
+#define av_ring_store(x, v) (*(volatile uint32_t *)&(x) = (v))
+
+int av_ring_setup(struct av_connection *conn, unsigned int entries)
+{
+    struct av_ring *ring;
+    int size;
+
+    if (!conn || conn->ring) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ring = malloc(sizeof(struct av_ring));
+    if (!ring)
+        return -1;
+
+    size = ioctl(conn->fd, AV_IOC_RING_SETUP, (unsigned long)entries);
+    if (size == -1)
+        goto error;
+
+    ring->mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            conn->fd, 0);
+    if (ring->mem == MAP_FAILED)
+        goto error;
+
+    ring->size = size;
+    ring->hdr = ring->mem;
+    ring->events = (struct av_proto_event *)((char *)ring->mem +
+            ring->hdr->ev_off);
+    ring->replies = (struct av_proto_reply *)((char *)ring->mem +
+            ring->hdr->rep_off);
+    ring->entries = ring->hdr->entries;
+    ring->ev_head = av_ring_load(ring->hdr->ev_head);
+    ring->rep_tail = av_ring_load(ring->hdr->rep_tail);
+    conn->ring = ring;
+
+    return 0;
+error:
+    free(ring);
+    return -1;
+}
+
+int av_ring_destroy(struct av_connection *conn)
+{
+    if (!conn) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!conn->ring)
+        return 0;
+
+    if (munmap(conn->ring->mem, conn->ring->size) == -1)
+        return -1;
+
+    free(conn->ring);
+    conn->ring = NULL;
+
+    return 0;
+}
+
+static int av_ring_request(struct av_connection *conn, struct av_event *events,
+        int count, int timeout)
+{
+    struct av_ring *ring = conn->ring;
+    uint32_t tail;
+    int blocking;
+    int nr;
+    int rv;
+
+    blocking = av_set_wait(conn, timeout);
+    if (blocking == -1)
+        return -1;
+
+    for (;;) {
+        tail = av_ring_load(ring->hdr->ev_tail);
+        if (tail != ring->ev_head)
+            break;
+
+        rv = ioctl(conn->fd, AV_IOC_RING_ENTER,
+                blocking ? AV_RING_ENTER_WAIT : 0);
+        if (rv == -1)
+            return -1;
+
+        if (rv)
+            continue;
+
+        if (blocking) {
+            if (av_timed_out(conn, timeout))
+                return -1;
+        } else if (av_wait(conn, timeout))
             return -1;
+    }
+
+    __sync_synchronize();
+
+    for (nr = 0; nr < count && ring->ev_head != tail; nr++) {
+        av_fill_event(&events[nr],
+                &ring->events[ring->ev_head & (ring->entries - 1)]);
+        ring->ev_head++;
+    }
+
+    __sync_synchronize();
+    av_ring_store(ring->hdr->ev_head, ring->ev_head);
+
+    return nr;
+}
+
+/*
+ * The replies are handed over by one RING_ENTER call which also refills the
+ * event ring, so a busy scanner needs one system call per av_reply_batch.
+ * The call never blocks. The events are always released, replies which
+ * stay posted in the ring are taken by the next RING_ENTER, and an error is
+ * returned only if the avflt did not take them.
+ */
+static int av_ring_reply(struct av_connection *conn, struct av_event *events,
+        int count)
+{
+    struct av_ring *ring = conn->ring;
+    struct av_proto_reply *rec;
+    int rv = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (ring->rep_tail - av_ring_load(ring->hdr->rep_head) ==
+                ring->entries) {
+            __sync_synchronize();
+            av_ring_store(ring->hdr->rep_tail, ring->rep_tail);
+            ioctl(conn->fd, AV_IOC_RING_ENTER, 0);
+            if (ring->rep_tail - av_ring_load(ring->hdr->rep_head) ==
+                    ring->entries) {
+                count = i;
+                rv = -1;
+                break;
+            }
         }
+
+        rec = &ring->replies[ring->rep_tail & (ring->entries - 1)];
+        memset(rec, 0, sizeof(struct av_proto_reply));
+        rec->id = events[i].id;
+        rec->result = events[i].res;
+        rec->cache = events[i].cache;
+        ring->rep_tail++;
+    }
+
+    __sync_synchronize();
+    av_ring_store(ring->hdr->rep_tail, ring->rep_tail);
+
+    if (ioctl(conn->fd, AV_IOC_RING_ENTER, 0) == -1 &&
+            av_ring_load(ring->hdr->rep_head) != ring->rep_tail)
+        rv = -1;
+
+    for (i = 0; i < count; i++) {
+        if (av_release_event(&events[i]))
+            rv = -1;
+    }
+
+    return rv;
+}
+
+int av_request_batch(struct av_connection *conn, struct av_event *events,
+        int count, int timeout)
+{
+    struct av_proto_event recs[AV_BATCH_MAX];
+    ssize_t rv = 0;
+    int nr;
+    int i;
+
+    if (!conn || !events || count <= 0 || timeout < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (conn->ring)
+        return av_ring_request(conn, events, count, timeout);
+
+    if (conn->proto != AV_PROTO_BINARY) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (count > AV_BATCH_MAX)
+        count = AV_BATCH_MAX;
+
+    if (conn->flags & AV_FLAG_PATH)
+        return av_read_paths(conn, events, count, timeout);
+
+    while (!rv) {
+        if (av_wait(conn, timeout))
+            return -1;
+
+        rv = read(conn->fd, recs, sizeof(struct av_proto_event) * count);
         if (rv == -1)
             return -1;
 
+        if (!rv && av_timed_out(conn, timeout))
+            return -1;
+    }
+
+    nr = rv / sizeof(struct av_proto_event);
+
+    for (i = 0; i < nr; i++)
+        av_fill_event(&events[i], &recs[i]);
+
+    return nr;
+}
+
+int av_reply_batch(struct av_connection *conn, struct av_event *events,
+        int count)
+{
+    struct av_proto_reply recs[AV_BATCH_MAX];
+    ssize_t rv;
+    int done;
+    int nr;
+    int i;
+
+    if (!conn || !events || count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (conn->ring)
+        return av_ring_reply(conn, events, count);
+
+    if (conn->proto != AV_PROTO_BINARY) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (done = 0; done < count; done += nr) {
+        nr = count - done;
+        if (nr > AV_BATCH_MAX)
+            nr = AV_BATCH_MAX;
+
+        memset(recs, 0, sizeof(struct av_proto_reply) * nr);
+
+        for (i = 0; i < nr; i++) {
+            recs[i].id = events[done + i].id;
+            recs[i].result = events[done + i].res;
+            recs[i].cache = events[done + i].cache;
+        }
+
+        rv = write(conn->fd, recs, sizeof(struct av_proto_reply) * nr);
+        if (rv == -1)
+            return -1;
+
+        if (rv != (ssize_t)(sizeof(struct av_proto_reply) * nr)) {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    rv = 0;
+    for (i = 0; i < count; i++) {
+        if (av_release_event(&events[i]))
+            rv = -1;
+    }
+
+    return rv;
+}
+
+int av_request(struct av_connection *conn, struct av_event *event, int timeout)
+{
+    char buf[256];
+    int rv = 0;
+
+    if (!conn || !event || timeout < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (conn->proto == AV_PROTO_BINARY || conn->ring)
+        return av_request_batch(conn, event, 1, timeout) == 1 ? 0 : -1;
+
+    while (!rv) {
+        if (av_wait(conn, timeout))
+            return -1;
+
         rv = read(conn->fd, buf, 256);
         if (rv == -1)
             return -1;
+
+        if (!rv && av_timed_out(conn, timeout))
+            return -1;
     }
 
     if (av_parse_request_from_buf(event, buf, sizeof(buf))<0)
        return -1;
 
-    event->res = 0;
-    event->cache = AV_CACHE_ENABLE;
-
     return 0;
 }
 
@@ -69,6 +469,9 @@ int av_reply(struct av_connection *conn, struct av_event *event)
         return -1;
     }
 
+    if (conn->proto == AV_PROTO_BINARY || conn->ring)
+        return av_reply_batch(conn, event, 1);
+
     len = av_set_reply_to_buf(buf, sizeof(buf), event);
     if (len < 0)
        return -1;
@@ -76,8 +479,246 @@ int av_reply(struct av_connection *conn, struct av_event *event)
     if (write(conn->fd, buf, len) == -1)
         return -1;
 
-    if (close(event->fd) == -1)
+    if (av_release_event(event))
         return -1;
 
     return 0;
 }
+
+int av_set_sigver(struct av_connection *conn, unsigned int sigver)
+{
+    if (!conn) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ioctl(conn->fd, AV_IOC_SET_SIGVER, (unsigned long)sigver) == -1)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * The cache file starts with struct av_cache_hdr followed by the records in
+ * the avflt layout.
+ */
+#define AV_CACHE_MAGIC   0x43505641 /* "AVPC" */
+#define AV_CACHE_VERSION 1
+
+struct av_cache_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+int av_cache_load(struct av_connection *conn, const char *path)
+{
+    struct av_pcache_rec *recs = NULL;
+    struct av_pcache_buf buf;
+    struct av_cache_hdr hdr;
+    FILE *file;
+    int rv = -1;
+
+    if (!conn || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    file = fopen(path, "r");
+    if (!file)
+        return -1;
+
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1)
+        goto einval;
+
+    if (hdr.magic != AV_CACHE_MAGIC || hdr.version != AV_CACHE_VERSION ||
+            hdr.count > AV_PCACHE_MAX)
+        goto einval;
+
+    if (hdr.count) {
+        recs = malloc(sizeof(struct av_pcache_rec) * hdr.count);
+        if (!recs)
+            goto exit;
+
+        if (fread(recs, sizeof(struct av_pcache_rec), hdr.count, file) !=
+                hdr.count)
+            goto einval;
+    }
+
+    buf.recs = (uint64_t)(unsigned long)recs;
+    buf.count = hdr.count;
+    buf.reserved = 0;
+
+    rv = ioctl(conn->fd, AV_IOC_PCACHE_LOAD, &buf);
+    goto exit;
+einval:
+    errno = EINVAL;
+exit:
+    free(recs);
+    fclose(file);
+    return rv;
+}
+
+int av_cache_save(struct av_connection *conn, const char *path)
+{
+    struct av_pcache_rec *recs;
+    struct av_pcache_buf buf;
+    struct av_cache_hdr hdr;
+    char *tmp;
+    FILE *file;
+    int count;
+
+    if (!conn || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    recs = malloc(sizeof(struct av_pcache_rec) * AV_PCACHE_MAX);
+    if (!recs)
+        return -1;
+
+    buf.recs = (uint64_t)(unsigned long)recs;
+    buf.count = AV_PCACHE_MAX;
+    buf.reserved = 0;
+
+    count = ioctl(conn->fd, AV_IOC_PCACHE_DUMP, &buf);
+    if (count == -1)
+        goto err_recs;
+
+    tmp = malloc(strlen(path) + 5);
+    if (!tmp)
+        goto err_recs;
+
+    sprintf(tmp, "%s.tmp", path);
+
+    file = fopen(tmp, "w");
+    if (!file)
+        goto err_tmp;
+
+    hdr.magic = AV_CACHE_MAGIC;
+    hdr.version = AV_CACHE_VERSION;
+    hdr.count = count;
+    hdr.reserved = 0;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+            fwrite(recs, sizeof(struct av_pcache_rec), count, file) !=
+            (size_t)count) {
+        fclose(file);
+        goto err_file;
+    }
+
+    if (fclose(file))
+        goto err_file;
+
+    if (rename(tmp, path))
+        goto err_file;
+
+    free(tmp);
+    free(recs);
+    return count;
+
+err_file:
+    unlink(tmp);
+err_tmp:
+    free(tmp);
+err_recs:
+    free(recs);
+    return -1;
+}
+
+/*
+ * Returns 0 if a background scan of the file was queued, 1 if the file
+ * already has a verdict or is not scanned and -1 with errno EAGAIN if too
+ * many background scans are pending.
+ */
+int av_warm(struct av_connection *conn, const char *path)
+{
+    int saved;
+    int fd;
+    int rv;
+
+    if (!conn || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd == -1)
+        return -1;
+
+    rv = ioctl(conn->fd, AV_IOC_WARM, (unsigned long)fd);
+    saved = errno;
+    close(fd);
+    errno = saved;
+
+    return rv;
+}
+
+static long av_usecs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+/*
+ * Walks the tree under root without crossing file systems and passes its
+ * regular files to av_warm, at most rate files per second or as fast as the
+ * avflt takes them with rate 0. Files which can not be opened are skipped.
+ * Returns the number of queued scans.
+ */
+long av_warm_tree(struct av_connection *conn, const char *root, int rate)
+{
+    char *roots[2];
+    FTSENT *ent;
+    long queued = 0;
+    long files = 0;
+    long start;
+    long wait;
+    FTS *fts;
+    int rv;
+
+    if (!conn || !root || rate < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    roots[0] = (char *)root;
+    roots[1] = NULL;
+
+    fts = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, NULL);
+    if (!fts)
+        return -1;
+
+    start = av_usecs();
+
+    while ((ent = fts_read(fts))) {
+        if (ent->fts_info != FTS_F)
+            continue;
+
+        while ((rv = av_warm(conn, ent->fts_path)) == -1 &&
+                errno == EAGAIN)
+            usleep(10000);
+
+        if (rv == -1 && (errno == ENXIO || errno == EBADF ||
+                    errno == ENOTTY)) {
+            fts_close(fts);
+            return -1;
+        }
+
+        if (!rv)
+            queued++;
+
+        if (!rate)
+            continue;
+
+        wait = start + ++files * 1000000L / rate - av_usecs();
+        if (wait > 0)
+            usleep(wait);
+    }
+
+    fts_close(fts);
+    return queued;
+}
@@ -0,0 +1,320 @@
+/*
+ *          Copyright Frantisek Hrbata 2008 - 2010.
+ * Distributed under the Boost Software License, Version 1.0.
+ *    (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "av.h"
+
+/*
+ * Worker pool. Every worker registers its own connection, binds it to one of
+ * the avflt queues and uses the shared ring, the binary protocol or the text
+ * protocol, whichever the avflt supports first. A worker takes up to batch
+ * events, passes them to the callback and replies to all of them at once
+ * before it takes more, so events are never buffered in the application and
+ * the avflt timeouts, load shedding and priority classes keep working when
+ * the scanners fall behind.
+ */
+
+#define AV_POOL_POLL 200
+#define AV_POOL_RING 256
+
+struct av_pool_worker {
+    struct av_pool *pool;
+    struct av_connection conn;
+    struct av_pool_stats stats;
+    pthread_t thread;
+    int batch;
+};
+
+struct av_pool {
+    struct av_pool_worker *workers;
+    av_scan_fn fn;
+    void *data;
+    int threads;
+    int stop;
+};
+
+/*
+ * Only the worker writes its counters, av_pool_get_stats reads them while
+ * the worker runs, so both sides use relaxed atomic accesses.
+ */
+static void av_pool_add(unsigned long *counter, unsigned long val)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) +
+            val, __ATOMIC_RELAXED);
+}
+
+static unsigned long av_pool_read(unsigned long *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static unsigned long av_pool_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void av_pool_account(struct av_pool_stats *stats, unsigned long time)
+{
+    int i = 0;
+
+    while (i < AV_POOL_HIST - 1 && time >= (1UL << i))
+        i++;
+
+    av_pool_add(&stats->hist[i], 1);
+    av_pool_add(&stats->scan_time, time);
+
+    if (time > av_pool_read(&stats->scan_max))
+        __atomic_store_n(&stats->scan_max, time, __ATOMIC_RELAXED);
+}
+
+/*
+ * A failed callback allows the access without caching the verdict, the
+ * file is scanned again on its next access.
+ */
+static void av_pool_scan(struct av_pool_worker *worker, struct av_event *event)
+{
+    struct av_pool *pool = worker->pool;
+    unsigned long start;
+    int res;
+
+    start = av_pool_usecs();
+    res = pool->fn(&worker->conn, event, pool->data);
+    av_pool_account(&worker->stats, av_pool_usecs() - start);
+
+    av_pool_add(&worker->stats.events, 1);
+
+    if (res == AV_ACCESS_DENY)
+        av_pool_add(&worker->stats.denied, 1);
+
+    else if (res != AV_ACCESS_ALLOW) {
+        av_pool_add(&worker->stats.errors, 1);
+        res = AV_ACCESS_ALLOW;
+        event->cache = AV_CACHE_DISABLE;
+    }
+
+    event->res = res;
+}
+
+static void *av_pool_worker_fn(void *data)
+{
+    struct av_pool_worker *worker = data;
+    struct av_event events[AV_BATCH_MAX];
+    int nr;
+    int i;
+
+    while (!__atomic_load_n(&worker->pool->stop, __ATOMIC_ACQUIRE)) {
+        if (worker->batch == 1)
+            nr = av_request(&worker->conn, events, AV_POOL_POLL) ? -1 : 1;
+        else
+            nr = av_request_batch(&worker->conn, events, worker->batch,
+                    AV_POOL_POLL);
+
+        if (nr == -1) {
+            if (errno != ETIMEDOUT && errno != EINTR) {
+                av_pool_add(&worker->stats.errors, 1);
+                usleep(AV_POOL_POLL * 1000);
+            }
+            continue;
+        }
+
+        for (i = 0; i < nr; i++)
+            av_pool_scan(worker, &events[i]);
+
+        av_pool_add(&worker->stats.batches, 1);
+
+        if (nr == 1) {
+            if (av_reply(&worker->conn, events))
+                av_pool_add(&worker->stats.errors, 1);
+
+        } else if (av_reply_batch(&worker->conn, events, nr))
+            av_pool_add(&worker->stats.errors, 1);
+    }
+
+    return NULL;
+}
+
+/*
+ * Sets up the fastest protocol the avflt offers, an older avflt without the
+ * binary protocol gets one event at a time.
+ */
+static int av_pool_connect(struct av_pool_worker *worker, int idx, int flags)
+{
+    struct av_connection *conn = &worker->conn;
+    int queues;
+
+    if (av_register(conn))
+        return -1;
+
+    queues = av_get_queues(conn);
+    if (queues > 0 && av_set_queue(conn, idx % queues))
+        goto error;
+
+    if (flags && av_set_flags(conn, flags))
+        goto error;
+
+    if (!(flags & AV_FLAG_PATH) && !av_ring_setup(conn, AV_POOL_RING))
+        return 0;
+
+    if (!av_set_protocol(conn, AV_PROTO_BINARY))
+        return 0;
+
+    if (errno != ENOTTY)
+        goto error;
+
+    worker->batch = 1;
+    return 0;
+error:
+    av_unregister(conn);
+    return -1;
+}
+
+static void av_pool_stop(struct av_pool *pool, int started)
+{
+    int i;
+
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    for (i = 0; i < pool->threads; i++)
+        av_unregister(&pool->workers[i].conn);
+
+    free(pool->workers);
+    free(pool);
+}
+
+/*
+ * Starts threads workers, 0 starts one per online CPU, which is also one per
+ * avflt queue. The workers block all signals, they are left to the
+ * application threads.
+ */
+struct av_pool *av_pool_create(int threads, int batch, int flags,
+        av_scan_fn fn, void *data)
+{
+    struct av_pool *pool;
+    sigset_t sigmask;
+    sigset_t oldmask;
+    int rv = 0;
+    int i;
+
+    if (threads < 0 || batch < 1 || batch > AV_BATCH_MAX || !fn) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (!threads)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads < 1)
+        threads = 1;
+
+    pool = malloc(sizeof(struct av_pool));
+    if (!pool)
+        return NULL;
+
+    pool->workers = calloc(threads, sizeof(struct av_pool_worker));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->fn = fn;
+    pool->data = data;
+    pool->threads = 0;
+    pool->stop = 0;
+
+    for (i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].batch = batch;
+
+        if (av_pool_connect(&pool->workers[i], i, flags)) {
+            av_pool_stop(pool, 0);
+            return NULL;
+        }
+
+        pool->threads++;
+    }
+
+    sigfillset(&sigmask);
+    pthread_sigmask(SIG_SETMASK, &sigmask, &oldmask);
+
+    for (i = 0; i < threads; i++) {
+        rv = pthread_create(&pool->workers[i].thread, NULL,
+                av_pool_worker_fn, &pool->workers[i]);
+        if (rv)
+            break;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+    if (rv) {
+        av_pool_stop(pool, i);
+        errno = rv;
+        return NULL;
+    }
+
+    return pool;
+}
+
+int av_pool_destroy(struct av_pool *pool)
+{
+    if (!pool) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    av_pool_stop(pool, pool->threads);
+    return 0;
+}
+
+/*
+ * The counters are summed over the workers while they run, each one is read
+ * atomically but they are not a snapshot taken at one instant, e.g. events
+ * may already count a scan whose hist bucket does not yet.
+ */
+int av_pool_get_stats(struct av_pool *pool, struct av_pool_stats *stats)
+{
+    struct av_pool_stats *ws;
+    unsigned long max;
+    int i;
+    int j;
+
+    if (!pool || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(struct av_pool_stats));
+
+    for (i = 0; i < pool->threads; i++) {
+        ws = &pool->workers[i].stats;
+        stats->events += av_pool_read(&ws->events);
+        stats->denied += av_pool_read(&ws->denied);
+        stats->errors += av_pool_read(&ws->errors);
+        stats->batches += av_pool_read(&ws->batches);
+        stats->scan_time += av_pool_read(&ws->scan_time);
+
+        max = av_pool_read(&ws->scan_max);
+        if (max > stats->scan_max)
+            stats->scan_max = max;
+
+        for (j = 0; j < AV_POOL_HIST; j++)
+            stats->hist[j] += av_pool_read(&ws->hist[j]);
+    }
+
+    return 0;
+}
@@ -150,6 +150,9 @@ static struct avfltctl_path *avfltctl_get_path(struct rfsctl_path *rpath)
     path->type = rpath->type;
     path->id = rpath->id;
     path->name = fn;
+    path->timeout = -1;
+    path->policy = AVFLTCTL_POLICY_OPEN;
+    path->shed = 0;
 
     return path;
 }
@@ -184,6 +187,8 @@ static struct avfltctl_filter *avfltctl_alloc_filter(struct rfsctl_filter *rflt)
     }
 
     flt->paths = NULL;
+    flt->class_rules = NULL;
+    flt->rules = NULL;
     flt->registered = NULL;
     flt->trusted = NULL;
     flt->name = fn;
@@ -204,6 +209,15 @@ static void avfltctl_free_filter(struct avfltctl_filter *flt)
     }
 
     free(flt->paths);
+    free(flt->class_rules);
+
+    if (flt->rules) {
+        for (i = 0; flt->rules[i]; i++) {
+            free(flt->rules[i]);
+        }
+    }
+
+    free(flt->rules);
     free(flt->registered);
     free(flt->trusted);
     free(flt->name);
@@ -279,6 +293,72 @@ static int avfltctl_set_filter_paths(struct avfltctl_filter *flt,
     return 0;
 }
 
+static void avfltctl_set_path_timeout_info(struct avfltctl_filter *flt,
+        const char *buf)
+{
+    int timeout;
+    char policy;
+    int shed;
+    int id;
+    int i;
+
+    if (sscanf(buf, "%d:%d:%c:%d", &id, &timeout, &policy, &shed) != 4)
+        return;
+
+    for (i = 0; flt->paths[i]; i++) {
+        if (flt->paths[i]->id != id)
+            continue;
+
+        flt->paths[i]->timeout = timeout;
+        flt->paths[i]->policy = policy;
+        flt->paths[i]->shed = shed;
+        return;
+    }
+}
+
+static int avfltctl_set_filter_path_timeouts(struct avfltctl_filter *flt)
+{
+    long page_size;
+    char *buf;
+    int off = 0;
+    int rb;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    buf = malloc(sizeof(char) * page_size);
+    if (!buf)
+        return -1;
+
+    rb = rfsctl_read_data(flt->name, "timeout_paths", buf, page_size);
+    if (rb == -1) {
+        free(buf);
+        return -1;
+    }
+
+    while (off < rb) {
+        avfltctl_set_path_timeout_info(flt, buf + off);
+        off += strlen(buf + off) + 1;
+    }
+
+    free(buf);
+    return 0;
+}
+
+static int avfltctl_set_filter_shed(struct avfltctl_filter *flt)
+{
+    char buf[256];
+    int rv;
+
+    rv = rfsctl_read_data(flt->name, "shed", buf, 256);
+    if (rv == -1)
+        return rv;
+
+    if (sscanf(buf, "%ld:%d:%d", &flt->shed, &flt->service_time,
+                &flt->queued) != 3)
+        return -1;
+
+    return 0;
+}
+
 static int avfltctl_set_filter_timeout(struct avfltctl_filter *flt)
 {
     char buf[256];
@@ -294,6 +374,230 @@ static int avfltctl_set_filter_timeout(struct avfltctl_filter *flt)
     return 0;
 }
 
+static int avfltctl_set_filter_async_close(struct avfltctl_filter *flt)
+{
+    char buf[256];
+    int rv;
+
+    rv = rfsctl_read_data(flt->name, "async_close", buf, 256);
+    if (rv == -1)
+        return rv;
+
+    if (sscanf(buf, "%d", &flt->async_close) != 1)
+        return -1;
+
+    return 0;
+}
+
+static int avfltctl_set_filter_revalidate(struct avfltctl_filter *flt)
+{
+    char buf[256];
+    int rv;
+
+    rv = rfsctl_read_data(flt->name, "revalidate", buf, 256);
+    if (rv == -1)
+        return rv;
+
+    if (sscanf(buf, "%d", &flt->revalidate) != 1)
+        return -1;
+
+    return 0;
+}
+
+static int avfltctl_set_filter_exec_only(struct avfltctl_filter *flt)
+{
+    char buf[256];
+    int rv;
+
+    rv = rfsctl_read_data(flt->name, "exec_only", buf, 256);
+    if (rv == -1)
+        return rv;
+
+    if (sscanf(buf, "%d", &flt->exec_only) != 1)
+        return -1;
+
+    return 0;
+}
+
+static int avfltctl_set_filter_limits(struct avfltctl_filter *flt)
+{
+    char buf[256];
+    char type;
+    int rate;
+    int burst;
+    int rb;
+    int off = 0;
+
+    rb = rfsctl_read_data(flt->name, "limits", buf, 256);
+    if (rb == -1)
+        return rb;
+
+    while (off < rb && buf[off]) {
+        if (buf[off] == 'p') {
+            if (sscanf(buf + off, "p:%c", &flt->limit_policy) != 1)
+                return -1;
+
+        } else {
+            if (sscanf(buf + off, "%c:%d:%d", &type, &rate, &burst) != 3)
+                return -1;
+
+            if (type == 't') {
+                flt->limit_tgid_rate = rate;
+                flt->limit_tgid_burst = burst;
+            } else {
+                flt->limit_cgroup_rate = rate;
+                flt->limit_cgroup_burst = burst;
+            }
+        }
+
+        off += strlen(buf + off) + 1;
+    }
+
+    return 0;
+}
+
+static int avfltctl_set_filter_warm(struct avfltctl_filter *flt)
+{
+    char buf[256];
+    int rv;
+
+    rv = rfsctl_read_data(flt->name, "warm", buf, 256);
+    if (rv == -1)
+        return rv;
+
+    if (sscanf(buf, "%ld:%ld:%ld:%d:%d:%ld", &flt->warm_submitted,
+                &flt->warm_cached, &flt->warm_done, &flt->warm_pending,
+                &flt->warm_limit, &flt->warm_rate) != 6)
+        return -1;
+
+    return 0;
+}
+
+static int avfltctl_set_filter_digest(struct avfltctl_filter *flt)
+{
+    char buf[256];
+    int rv;
+
+    rv = rfsctl_read_data(flt->name, "digest", buf, 256);
+    if (rv == -1)
+        return rv;
+
+    if (sscanf(buf, "%ld", &flt->digest) != 1)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * The classes file contains the class weights followed by the class rules,
+ * the rules array is terminated by a zero type.
+ */
+static int avfltctl_set_filter_classes(struct avfltctl_filter *flt)
+{
+    struct avfltctl_class_rule *rules;
+    struct avfltctl_class_rule *rules_new;
+    char *buf;
+    long page_size;
+    int rb;
+    int off;
+    int i = 0;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    buf = malloc(sizeof(char) * page_size);
+    if (!buf)
+        return -1;
+
+    rb = rfsctl_read_data(flt->name, "classes", buf, page_size);
+    if (rb == -1)
+        goto err_buf;
+
+    if (sscanf(buf, "w:%d:%d:%d", &flt->class_weights[0],
+                &flt->class_weights[1], &flt->class_weights[2]) != 3)
+        goto err_buf;
+
+    rules = malloc(sizeof(struct avfltctl_class_rule));
+    if (!rules)
+        goto err_buf;
+
+    rules[0].type = 0;
+    off = strlen(buf) + 1;
+
+    while (off < rb) {
+        rules_new = realloc(rules,
+                sizeof(struct avfltctl_class_rule) * (i + 2));
+        if (!rules_new)
+            goto err_rules;
+
+        rules = rules_new;
+
+        if (sscanf(buf + off, "%c:%d:%d", &rules[i].type, &rules[i].id,
+                    &rules[i].cls) != 3)
+            goto err_rules;
+
+        rules[++i].type = 0;
+        off += strlen(buf + off) + 1;
+    }
+
+    flt->class_rules = rules;
+    free(buf);
+    return 0;
+
+err_rules:
+    free(rules);
+err_buf:
+    free(buf);
+    return -1;
+}
+
+/*
+ * The rules file contains one zero terminated pre-filter rule per entry, the
+ * rules array is terminated by NULL.
+ */
+static int avfltctl_set_filter_rules(struct avfltctl_filter *flt)
+{
+    char **rules;
+    char *buf;
+    long page_size;
+    int rb;
+    int off = 0;
+    int i = 0;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    buf = malloc(sizeof(char) * page_size);
+    if (!buf)
+        return -1;
+
+    rb = rfsctl_read_data(flt->name, "rules", buf, page_size);
+    if (rb == -1)
+        goto error;
+
+    flt->rules = malloc(sizeof(char *));
+    if (!flt->rules)
+        goto error;
+
+    flt->rules[0] = NULL;
+
+    while (off < rb) {
+        rules = realloc(flt->rules, sizeof(char *) * (i + 2));
+        if (!rules)
+            goto error;
+
+        flt->rules = rules;
+        flt->rules[i] = strdup(buf + off);
+        if (!flt->rules[i])
+            goto error;
+
+        flt->rules[++i] = NULL;
+        off += strlen(buf + off) + 1;
+    }
+
+    free(buf);
+    return 0;
+error:
+    free(buf);
+    return -1;
+}
+
 static int avfltctl_set_filter_cache(struct avfltctl_filter *flt)
 {
     char buf[256];
@@ -401,14 +705,54 @@ struct avfltctl_filter *avfltctl_get_filter(void)
     if (rv)
         goto error;
 
+    rv = avfltctl_set_filter_path_timeouts(flt);
+    if (rv)
+        goto error;
+
     rv = avfltctl_set_filter_timeout(flt);
     if (rv)
         goto error;
 
+    rv = avfltctl_set_filter_shed(flt);
+    if (rv)
+        goto error;
+
     rv = avfltctl_set_filter_cache(flt);
     if (rv)
         goto error;
 
+    rv = avfltctl_set_filter_async_close(flt);
+    if (rv)
+        goto error;
+
+    rv = avfltctl_set_filter_digest(flt);
+    if (rv)
+        goto error;
+
+    rv = avfltctl_set_filter_revalidate(flt);
+    if (rv)
+        goto error;
+
+    rv = avfltctl_set_filter_warm(flt);
+    if (rv)
+        goto error;
+
+    rv = avfltctl_set_filter_exec_only(flt);
+    if (rv)
+        goto error;
+
+    rv = avfltctl_set_filter_limits(flt);
+    if (rv)
+        goto error;
+
+    rv = avfltctl_set_filter_classes(flt);
+    if (rv)
+        goto error;
+
+    rv = avfltctl_set_filter_rules(flt);
+    if (rv)
+        goto error;
+
     rv = avfltctl_set_filter_registered(flt);
     if (rv)
         goto error;
@@ -556,3 +900,385 @@ int avfltctl_set_timeout(int timeout)
     return 0;
 }
 
+int avfltctl_set_async_close(int async)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%d", async);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "async_close", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_class_weights(int interactive, int normal, int background)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "w:%d:%d:%d", interactive, normal,
+            background);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "classes", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_class_rule(char type, int id, int cls)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%c:%d:%d", type, id, cls);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "classes", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_clear_class_rules(void)
+{
+    char buf[] = "c";
+
+    if (rfsctl_write_data("avflt", "classes", buf, sizeof(buf)) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_add_rule(const char *rule)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%s", rule);
+    if (size < 0 || size >= 256) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "rules", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_clear_rules(void)
+{
+    char buf[] = "c";
+
+    if (rfsctl_write_data("avflt", "rules", buf, sizeof(buf)) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_digest(long max)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%ld", max);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "digest", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_path_timeout(int id, int timeout, char policy, int shed)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%d:%d:%c:%d", id, timeout, policy, shed);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "timeout_paths", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+static long *avfltctl_stats_counter(struct avfltctl_stats *stats,
+        const char *name)
+{
+    static const char *names[] = {
+        "enqueued", "dequeued", "cache_hit", "cache_disabled", "cache_new",
+        "cache_root_ver", "cache_inode_ver", "pcache_hit", "digest_hit",
+        "coalesced", "timeout", "shed", "cache_invalidated", "cache_stale",
+        "limit_tgid", "limit_cgroup", NULL
+    };
+    long *counters[] = {
+        &stats->enqueued, &stats->dequeued, &stats->cache_hit,
+        &stats->cache_disabled, &stats->cache_new, &stats->cache_root_ver,
+        &stats->cache_inode_ver, &stats->pcache_hit, &stats->digest_hit,
+        &stats->coalesced, &stats->timeout, &stats->shed,
+        &stats->cache_invalidated, &stats->cache_stale, &stats->limit_tgid,
+        &stats->limit_cgroup
+    };
+    int i;
+
+    for (i = 0; names[i]; i++) {
+        if (!strcmp(names[i], name))
+            return counters[i];
+    }
+
+    return NULL;
+}
+
+static int avfltctl_set_stats_queue(struct avfltctl_stats *stats, int queue,
+        int depth)
+{
+    int *queues;
+    int i = 0;
+
+    if (queue < 0)
+        return -1;
+
+    while (stats->queues[i] != -1)
+        i++;
+
+    if (queue >= i) {
+        queues = realloc(stats->queues, sizeof(int) * (queue + 2));
+        if (!queues)
+            return -1;
+
+        stats->queues = queues;
+        while (i <= queue)
+            stats->queues[i++] = 0;
+
+        stats->queues[i] = -1;
+    }
+
+    stats->queues[queue] = depth;
+    return 0;
+}
+
+/*
+ * The stats file contains name:value counters followed by queue:<n>:<depth>
+ * queue depths and wait:<i>:<count> and service:<i>:<count> histograms.
+ */
+static int avfltctl_set_stats(struct avfltctl_stats *stats, const char *buf)
+{
+    char name[32];
+    long *counter;
+    long value;
+    int i;
+
+    if (sscanf(buf, "queue:%d:%ld", &i, &value) == 2)
+        return avfltctl_set_stats_queue(stats, i, (int)value);
+
+    if (sscanf(buf, "wait:%d:%ld", &i, &value) == 2) {
+        if (i >= 0 && i < AVFLTCTL_STATS_BUCKETS)
+            stats->wait[i] = value;
+        return 0;
+    }
+
+    if (sscanf(buf, "service:%d:%ld", &i, &value) == 2) {
+        if (i >= 0 && i < AVFLTCTL_STATS_BUCKETS)
+            stats->service[i] = value;
+        return 0;
+    }
+
+    if (sscanf(buf, "%31[^:]:%ld", name, &value) != 2)
+        return -1;
+
+    counter = avfltctl_stats_counter(stats, name);
+    if (counter)
+        *counter = value;
+
+    return 0;
+}
+
+struct avfltctl_stats *avfltctl_get_stats(void)
+{
+    struct avfltctl_stats *stats;
+    long page_size;
+    char *buf;
+    int off = 0;
+    int rb;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    buf = malloc(sizeof(char) * page_size);
+    if (!buf)
+        return NULL;
+
+    rb = rfsctl_read_data("avflt", "stats", buf, page_size);
+    if (rb == -1)
+        goto err_buf;
+
+    stats = calloc(1, sizeof(struct avfltctl_stats));
+    if (!stats)
+        goto err_buf;
+
+    stats->queues = malloc(sizeof(int));
+    if (!stats->queues)
+        goto err_stats;
+
+    stats->queues[0] = -1;
+
+    while (off < rb) {
+        if (avfltctl_set_stats(stats, buf + off))
+            goto err_stats;
+
+        off += strlen(buf + off) + 1;
+    }
+
+    free(buf);
+    return stats;
+
+err_stats:
+    avfltctl_put_stats(stats);
+err_buf:
+    free(buf);
+    return NULL;
+}
+
+void avfltctl_put_stats(struct avfltctl_stats *stats)
+{
+    if (!stats)
+        return;
+
+    free(stats->queues);
+    free(stats);
+}
+
+int avfltctl_reset_stats(void)
+{
+    char buf[] = "r";
+
+    if (rfsctl_write_data("avflt", "stats", buf, sizeof(buf)) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_invalidate(const char *path)
+{
+    if (rfsctl_write_data("avflt", "invalidate", (char *)path,
+                strlen(path) + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_invalidate_list(const char **paths)
+{
+    int i;
+
+    for (i = 0; paths[i]; i++) {
+        if (avfltctl_invalidate(paths[i]))
+            return -1;
+    }
+
+    return 0;
+}
+
+int avfltctl_set_revalidate(int revalidate)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%d", revalidate);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "revalidate", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_warm_limit(int limit)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%d", limit);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "warm", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_exec_only(int exec_only)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%d", exec_only);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "exec_only", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_limit(char type, int rate, int burst)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "%c:%d:%d", type, rate, burst);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "limits", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
+
+int avfltctl_set_limit_policy(char policy)
+{
+    char buf[256];
+    int size;
+
+    size = snprintf(buf, 256, "p:%c", policy);
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_write_data("avflt", "limits", buf, size + 1) == -1)
+        return -1;
+
+    return 0;
+}
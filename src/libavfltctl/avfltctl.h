@@ -13,11 +13,56 @@
 #define AVFLTCTL_PATH_INCLUDE RFSCTL_PATH_INCLUDE
 #define AVFLTCTL_PATH_EXCLUDE RFSCTL_PATH_EXCLUDE
 
+#define AVFLTCTL_CLASS_INTERACTIVE 0
+#define AVFLTCTL_CLASS_NORMAL      1
+#define AVFLTCTL_CLASS_BACKGROUND  2
+#define AVFLTCTL_CLASSES           3
+
+#define AVFLTCTL_POLICY_OPEN   'o'
+#define AVFLTCTL_POLICY_CLOSED 'c'
+
+#define AVFLTCTL_CLASS_RULE_PGRP 'g'
+#define AVFLTCTL_CLASS_RULE_TYPE 't'
+#define AVFLTCTL_CLASS_RULE_CGROUP 'u'
+
+struct avfltctl_class_rule {
+    char type;
+    int id;
+    int cls;
+};
+
 struct avfltctl_path {
     int type;
     int id;
     char *name;
     int cache;
+    int timeout;
+    char policy;
+    int shed;
+};
+
+#define AVFLTCTL_STATS_BUCKETS 24
+
+struct avfltctl_stats {
+    long enqueued;
+    long dequeued;
+    long cache_hit;
+    long cache_disabled;
+    long cache_new;
+    long cache_root_ver;
+    long cache_inode_ver;
+    long pcache_hit;
+    long digest_hit;
+    long coalesced;
+    long timeout;
+    long shed;
+    long cache_invalidated;
+    long cache_stale;
+    long limit_tgid;
+    long limit_cgroup;
+    int *queues;
+    long wait[AVFLTCTL_STATS_BUCKETS];
+    long service[AVFLTCTL_STATS_BUCKETS];
 };
 
 struct avfltctl_filter {
@@ -29,6 +74,27 @@ struct avfltctl_filter {
     int active;
     int timeout;
     int cache;
+    int async_close;
+    long digest;
+    int revalidate;
+    int exec_only;
+    int limit_tgid_rate;
+    int limit_tgid_burst;
+    int limit_cgroup_rate;
+    int limit_cgroup_burst;
+    char limit_policy;
+    long warm_submitted;
+    long warm_cached;
+    long warm_done;
+    int warm_pending;
+    int warm_limit;
+    long warm_rate;
+    long shed;
+    int service_time;
+    int queued;
+    int class_weights[AVFLTCTL_CLASSES];
+    struct avfltctl_class_rule *class_rules;
+    char **rules;
 };
 
 #ifdef __cplusplus
@@ -50,6 +116,24 @@ int avfltctl_invalidate_path_cache(int id);
 int avfltctl_enable_path_cache(int id);
 int avfltctl_disable_path_cache(int id);
 int avfltctl_set_timeout(int timeout);
+int avfltctl_set_async_close(int async);
+int avfltctl_set_class_weights(int interactive, int normal, int background);
+int avfltctl_set_class_rule(char type, int id, int cls);
+int avfltctl_clear_class_rules(void);
+int avfltctl_add_rule(const char *rule);
+int avfltctl_clear_rules(void);
+int avfltctl_set_digest(long max);
+int avfltctl_set_path_timeout(int id, int timeout, char policy, int shed);
+struct avfltctl_stats *avfltctl_get_stats(void);
+void avfltctl_put_stats(struct avfltctl_stats *stats);
+int avfltctl_reset_stats(void);
+int avfltctl_invalidate(const char *path);
+int avfltctl_invalidate_list(const char **paths);
+int avfltctl_set_revalidate(int revalidate);
+int avfltctl_set_warm_limit(int limit);
+int avfltctl_set_exec_only(int exec_only);
+int avfltctl_set_limit(char type, int rate, int burst);
+int avfltctl_set_limit_policy(char policy);
 
 #ifdef __cplusplus
 }
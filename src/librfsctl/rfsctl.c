@@ -15,9 +15,55 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
 #include "rfsctl.h"
 
 static const char *rfsctl_dir = "/sys/fs/redirfs/filters";
+static const char *rfsctl_info_dir = "/sys/fs/redirfs/info";
+static const char *rfsctl_snapshot = "/sys/fs/redirfs/info/snapshot";
+
+/*
+ * binary snapshot layout, has to match redirfs/rfs_snapshot.h
+ */
+#define RFSCTL_SNAPSHOT_MAGIC 0x53534652
+#define RFSCTL_SNAPSHOT_VERSION 1
+#define RFSCTL_SNAPSHOT_RETRIES 8
+
+struct rfsctl_snapshot_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t flt_nr;
+    uint32_t path_nr;
+    uint32_t cnt_nr;
+    uint64_t gen;
+};
+
+struct rfsctl_snapshot_flt {
+    uint32_t size;
+    int32_t priority;
+    uint32_t active;
+    uint32_t paths_nr;
+    char name[];
+};
+
+struct rfsctl_snapshot_path {
+    uint32_t size;
+    int32_t id;
+    uint32_t flags;
+    uint32_t reserved;
+    char name[];
+};
+
+struct rfsctl_snapshot_cnt {
+    uint32_t size;
+    uint32_t reserved;
+    uint64_t value;
+    char name[];
+};
 
 static struct rfsctl_path *rfsctl_get_path(const char *buf)
 {
@@ -298,8 +344,270 @@ exit:
     return rv;
 }
 
+static char *rfsctl_read_snapshot(int *size)
+{
+    struct rfsctl_snapshot_hdr *hdr;
+    uint64_t gen;
+    char *buf = NULL;
+    char *tmp;
+    int bufsize = 0;
+    int len;
+    int rb;
+    int fd;
+    int i;
+
+    for (i = 0; i < RFSCTL_SNAPSHOT_RETRIES; i++) {
+        fd = open(rfsctl_snapshot, O_RDONLY);
+        if (fd == -1)
+            goto error;
+
+        len = 0;
+        do {
+            if (len == bufsize) {
+                tmp = realloc(buf, bufsize + 16384);
+                if (!tmp) {
+                    close(fd);
+                    goto error;
+                }
+                buf = tmp;
+                bufsize += 16384;
+            }
+
+            rb = read(fd, buf + len, bufsize - len);
+            if (rb == -1) {
+                close(fd);
+                goto error;
+            }
+
+            len += rb;
+        } while (rb);
+
+        close(fd);
+
+        hdr = (struct rfsctl_snapshot_hdr *)buf;
+        if (len < sizeof(*hdr) + sizeof(gen) ||
+            hdr->magic != RFSCTL_SNAPSHOT_MAGIC ||
+            hdr->version != RFSCTL_SNAPSHOT_VERSION) {
+            errno = EPROTO;
+            goto error;
+        }
+
+        /* raced with another reader, the snapshot was rebuilt */
+        memcpy(&gen, buf + len - sizeof(gen), sizeof(gen));
+        if (hdr->size != len || gen != hdr->gen)
+            continue;
+
+        *size = len;
+        return buf;
+    }
+
+    errno = EAGAIN;
+error:
+    free(buf);
+    return NULL;
+}
+
+static struct rfsctl_filter *rfsctl_snapshot_get_filter(char *buf, int size,
+        int *off)
+{
+    struct rfsctl_snapshot_flt *sflt;
+    struct rfsctl_snapshot_path *spath;
+    struct rfsctl_filter *flt;
+    struct rfsctl_path *path;
+    unsigned int i;
+
+    sflt = (struct rfsctl_snapshot_flt *)(buf + *off);
+    if (*off + sizeof(*sflt) > size || sflt->size < sizeof(*sflt) ||
+        *off + sflt->size > size)
+        goto eproto;
+
+    flt = rfsctl_alloc_filter(sflt->name);
+    if (!flt)
+        return NULL;
+
+    flt->priority = sflt->priority;
+    flt->active = sflt->active;
+    flt->paths = calloc(sflt->paths_nr + 1, sizeof(struct rfsctl_path *));
+    if (!flt->paths)
+        goto error;
+
+    *off += sflt->size;
+
+    for (i = 0; i < sflt->paths_nr; i++) {
+        spath = (struct rfsctl_snapshot_path *)(buf + *off);
+        if (*off + sizeof(*spath) > size || spath->size < sizeof(*spath) ||
+            *off + spath->size > size) {
+            errno = EPROTO;
+            goto error;
+        }
+
+        path = malloc(sizeof(struct rfsctl_path));
+        if (!path)
+            goto error;
+
+        path->name = strdup(spath->name);
+        if (!path->name) {
+            free(path);
+            goto error;
+        }
+
+        path->id = spath->id;
+        if (spath->flags == RFSCTL_PATH_INCLUDE)
+            path->type = RFSCTL_PATH_INCLUDE;
+        else
+            path->type = RFSCTL_PATH_EXCLUDE;
+
+        flt->paths[i] = path;
+        *off += spath->size;
+    }
+
+    return flt;
+error:
+    rfsctl_free_filter(flt);
+    return NULL;
+eproto:
+    errno = EPROTO;
+    return NULL;
+}
+
+/*
+ * returns all filters or the one with the name, the list is empty if
+ * the named filter does not exist
+ */
+static struct rfsctl_filter **rfsctl_snapshot_get_filters(const char *name)
+{
+    struct rfsctl_snapshot_hdr *hdr;
+    struct rfsctl_filter **flts;
+    struct rfsctl_filter *flt;
+    unsigned int i;
+    char *buf;
+    int size;
+    int off;
+    int nr = 0;
+
+    buf = rfsctl_read_snapshot(&size);
+    if (!buf)
+        return NULL;
+
+    hdr = (struct rfsctl_snapshot_hdr *)buf;
+
+    flts = calloc(hdr->flt_nr + 1, sizeof(struct rfsctl_filter *));
+    if (!flts) {
+        free(buf);
+        return NULL;
+    }
+
+    off = sizeof(*hdr);
+
+    for (i = 0; i < hdr->flt_nr; i++) {
+        flt = rfsctl_snapshot_get_filter(buf, size, &off);
+        if (!flt) {
+            rfsctl_put_filters(flts);
+            free(buf);
+            return NULL;
+        }
+
+        if (name && strcmp(flt->name, name)) {
+            rfsctl_free_filter(flt);
+            continue;
+        }
+
+        flts[nr++] = flt;
+    }
+
+    free(buf);
+    return flts;
+}
+
+struct rfsctl_counter **rfsctl_get_counters(void)
+{
+    struct rfsctl_snapshot_hdr *hdr;
+    struct rfsctl_snapshot_flt *sflt;
+    struct rfsctl_snapshot_cnt *scnt;
+    struct rfsctl_counter **cnts;
+    struct rfsctl_counter *cnt;
+    unsigned int i;
+    char *buf;
+    int size;
+    int off;
+
+    buf = rfsctl_read_snapshot(&size);
+    if (!buf)
+        return NULL;
+
+    hdr = (struct rfsctl_snapshot_hdr *)buf;
+    off = sizeof(*hdr);
+
+    /* skip the filter and path records */
+    for (i = 0; i < hdr->flt_nr + hdr->path_nr; i++) {
+        sflt = (struct rfsctl_snapshot_flt *)(buf + off);
+        if (off + sizeof(uint32_t) > size || !sflt->size)
+            goto eproto;
+
+        off += sflt->size;
+    }
+
+    cnts = calloc(hdr->cnt_nr + 1, sizeof(struct rfsctl_counter *));
+    if (!cnts) {
+        free(buf);
+        return NULL;
+    }
+
+    for (i = 0; i < hdr->cnt_nr; i++) {
+        scnt = (struct rfsctl_snapshot_cnt *)(buf + off);
+        if (off + sizeof(*scnt) > size || scnt->size < sizeof(*scnt) ||
+            off + scnt->size > size) {
+            rfsctl_put_counters(cnts);
+            goto eproto;
+        }
+
+        cnt = malloc(sizeof(struct rfsctl_counter));
+        if (!cnt) {
+            rfsctl_put_counters(cnts);
+            free(buf);
+            return NULL;
+        }
+
+        cnt->name = strdup(scnt->name);
+        cnt->value = scnt->value;
+        if (!cnt->name) {
+            free(cnt);
+            rfsctl_put_counters(cnts);
+            free(buf);
+            return NULL;
+        }
+
+        cnts[i] = cnt;
+        off += scnt->size;
+    }
+
+    free(buf);
+    return cnts;
+eproto:
+    free(buf);
+    errno = EPROTO;
+    return NULL;
+}
+
+void rfsctl_put_counters(struct rfsctl_counter **counters)
+{
+    int i = 0;
+
+    if (!counters)
+        return;
+
+    while (counters[i]) {
+        free(counters[i]->name);
+        free(counters[i]);
+        i++;
+    }
+
+    free(counters);
+}
+
 struct rfsctl_filter *rfsctl_get_filter(const char *name)
 {
+    struct rfsctl_filter **flts;
     struct rfsctl_filter *flt;
     int rv = 0;
 
@@ -308,6 +616,19 @@ struct rfsctl_filter *rfsctl_get_filter(const char *name)
         return NULL;
     }
 
+    flts = rfsctl_snapshot_get_filters(name);
+    if (flts) {
+        flt = flts[0];
+        free(flts);
+        if (!flt)
+            errno = ENOENT;
+        return flt;
+    }
+
+    /* older redirfs without the snapshot interface */
+    if (errno != ENOENT && errno != EPROTO)
+        return NULL;
+
     flt = rfsctl_alloc_filter(name);
     if (!flt)
         return NULL;
@@ -346,6 +667,14 @@ struct rfsctl_filter **rfsctl_get_filters(void)
     DIR *dir;
     int i = 0;
 
+    flts = rfsctl_snapshot_get_filters(NULL);
+    if (flts)
+        return flts;
+
+    /* older redirfs without the snapshot interface */
+    if (errno != ENOENT && errno != EPROTO)
+        return NULL;
+
     dir = opendir(rfsctl_dir);
     if (!dir) 
         return NULL;
@@ -548,3 +877,983 @@ int rfsctl_deactivate(const char *name)
     return 0;
 }
 
+
+static int rfsctl_read_info(const char *filename, char *buf, int size)
+{
+    char fn[256];
+    int fd;
+    int rb;
+
+    snprintf(fn, sizeof(fn), "%s/%s", rfsctl_info_dir, filename);
+
+    fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    memset(buf, 0, size);
+    rb = read(fd, buf, size - 1);
+
+    close(fd);
+    return rb;
+}
+
+static int rfsctl_write_info(const char *filename, const char *buf)
+{
+    char fn[256];
+    int fd;
+    int wb;
+
+    snprintf(fn, sizeof(fn), "%s/%s", rfsctl_info_dir, filename);
+
+    fd = open(fn, O_WRONLY);
+    if (fd == -1)
+        return -1;
+
+    wb = write(fd, buf, strlen(buf) + 1);
+
+    close(fd);
+    return wb;
+}
+
+int rfsctl_get_sampling(unsigned int *period, unsigned long long *threshold)
+{
+    char buf[256];
+
+    if (!period || !threshold) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rfsctl_read_info("sample_period", buf, 256) == -1)
+        return -1;
+
+    if (sscanf(buf, "%u", period) != 1)
+        return -1;
+
+    if (rfsctl_read_info("sample_threshold", buf, 256) == -1)
+        return -1;
+
+    if (sscanf(buf, "%llu", threshold) != 1)
+        return -1;
+
+    return 0;
+}
+
+int rfsctl_set_sampling(unsigned int period, unsigned long long threshold)
+{
+    char buf[256];
+
+    snprintf(buf, 256, "%u", period);
+    if (rfsctl_write_info("sample_period", buf) == -1)
+        return -1;
+
+    snprintf(buf, 256, "%llu", threshold);
+    if (rfsctl_write_info("sample_threshold", buf) == -1)
+        return -1;
+
+    return 0;
+}
+
+static int rfsctl_get_sample(const char *buf, struct rfsctl_sample *sample)
+{
+    int off = 0;
+
+    if (sscanf(buf, "%d %llu %7s %31s %7s %31s %d %lu %llu %n",
+                &sample->cpu, &sample->time, sample->itype, sample->op,
+                sample->call, sample->filter, &sample->pid, &sample->ino,
+                &sample->duration, &off) != 9)
+        return -1;
+
+    /* the command name can contain spaces */
+    strncpy(sample->comm, buf + off, sizeof(sample->comm) - 1);
+    sample->comm[sizeof(sample->comm) - 1] = '\0';
+
+    return 0;
+}
+
+/*
+ * each read drains the samples which fit into one page from the kernel,
+ * samples which do not fit into the samples array and samples lost in the
+ * kernel since the last read are added to lost
+ */
+int rfsctl_read_samples(struct rfsctl_sample *samples, int count,
+        unsigned long *lost)
+{
+    unsigned long l;
+    char *buf;
+    char *line;
+    char *next;
+    long page_size;
+    int rb;
+    int i = 0;
+
+    if (!samples || count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    buf = malloc(sizeof(char) * (page_size + 1));
+    if (!buf)
+        return -1;
+
+    rb = rfsctl_read_info("samples", buf, page_size + 1);
+    if (rb == -1) {
+        free(buf);
+        return -1;
+    }
+
+    for (line = buf; *line; line = next) {
+        next = strchr(line, '\n');
+        if (!next)
+            break;
+
+        *next++ = '\0';
+
+        if (sscanf(line, "lost %lu", &l) == 1) {
+            if (lost)
+                *lost += l;
+            continue;
+        }
+
+        if (i == count) {
+            if (lost)
+                (*lost)++;
+            continue;
+        }
+
+        if (!rfsctl_get_sample(line, &samples[i]))
+            i++;
+    }
+
+    free(buf);
+    return i;
+}
+
+/*
+ * generic netlink client, the protocol has to match redirfs/rfs_nl.h
+ */
+#define RFSCTL_NL_FAMILY "redirfs"
+#define RFSCTL_NL_VERSION 1
+#define RFSCTL_NL_EVENTS_GROUP "events"
+#define RFSCTL_NL_BUFSIZE 32768
+
+/*
+ * every ack is a separate skb, more requests in flight would overflow the
+ * default socket receive buffer and the lost acks could not be detected
+ */
+#define RFSCTL_NL_BATCH 64
+
+enum {
+    RFSCTL_NL_C_UNSPEC,
+    RFSCTL_NL_C_PATH_ADD,
+    RFSCTL_NL_C_PATH_REM,
+    RFSCTL_NL_C_ACTIVATE,
+    RFSCTL_NL_C_DEACTIVATE,
+    RFSCTL_NL_C_GET_FILTER,
+    RFSCTL_NL_C_GET_PATH,
+    RFSCTL_NL_C_GET_COUNTER,
+    RFSCTL_NL_C_EV_FLT_REGISTER,
+    RFSCTL_NL_C_EV_FLT_UNREGISTER,
+    RFSCTL_NL_C_EV_FLT_ACTIVATE,
+    RFSCTL_NL_C_EV_FLT_DEACTIVATE,
+    RFSCTL_NL_C_EV_WALK_START,
+    RFSCTL_NL_C_EV_PATH_ADD,
+    RFSCTL_NL_C_EV_PATH_REM,
+    RFSCTL_NL_C_PATHS_ADD
+};
+
+enum {
+    RFSCTL_NL_A_UNSPEC,
+    RFSCTL_NL_A_FILTER,
+    RFSCTL_NL_A_PRIORITY,
+    RFSCTL_NL_A_ACTIVE,
+    RFSCTL_NL_A_PATH,
+    RFSCTL_NL_A_PATH_ID,
+    RFSCTL_NL_A_PATH_FLAGS,
+    RFSCTL_NL_A_COUNTER_NAME,
+    RFSCTL_NL_A_COUNTER_VALUE,
+    RFSCTL_NL_A_PAD,
+    RFSCTL_NL_A_PATHS,
+    RFSCTL_NL_A_PATH_ENTRY,
+    RFSCTL_NL_A_MAX
+};
+
+struct rfsctl_nl {
+    int fd;
+    uint16_t family;
+    uint32_t group;
+    uint32_t seq;
+    char *buf;
+};
+
+static struct nlmsghdr *rfsctl_nl_msg(char *buf, int *len, uint16_t type,
+        uint16_t flags, uint32_t seq, uint8_t cmd)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)(buf + *len);
+    struct genlmsghdr *genlh;
+
+    memset(nlh, 0, NLMSG_HDRLEN + GENL_HDRLEN);
+    nlh->nlmsg_len = NLMSG_HDRLEN + GENL_HDRLEN;
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = flags;
+    nlh->nlmsg_seq = seq;
+
+    genlh = NLMSG_DATA(nlh);
+    genlh->cmd = cmd;
+    genlh->version = RFSCTL_NL_VERSION;
+
+    return nlh;
+}
+
+static void rfsctl_nl_put(struct nlmsghdr *nlh, uint16_t type,
+        const void *data, int size)
+{
+    struct nlattr *nla;
+
+    nla = (struct nlattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + size;
+    memcpy((char *)nla + NLA_HDRLEN, data, size);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+static struct nlattr *rfsctl_nl_nest_start(struct nlmsghdr *nlh, uint16_t type)
+{
+    struct nlattr *nla;
+
+    nla = (struct nlattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    nla->nla_type = type | NLA_F_NESTED;
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_HDRLEN;
+
+    return nla;
+}
+
+static void rfsctl_nl_nest_end(struct nlmsghdr *nlh, struct nlattr *nla)
+{
+    nla->nla_len = (char *)nlh + nlh->nlmsg_len - (char *)nla;
+}
+
+static void rfsctl_nl_put_u32(struct nlmsghdr *nlh, uint16_t type,
+        uint32_t value)
+{
+    rfsctl_nl_put(nlh, type, &value, sizeof(value));
+}
+
+static void rfsctl_nl_put_str(struct nlmsghdr *nlh, uint16_t type,
+        const char *str)
+{
+    rfsctl_nl_put(nlh, type, str, strlen(str) + 1);
+}
+
+/*
+ * fills attrs indexed by the attribute type, the attributes start at off
+ * bytes from the netlink header
+ */
+static void rfsctl_nl_parse(struct nlmsghdr *nlh, int off,
+        struct nlattr **attrs, int max)
+{
+    struct nlattr *nla;
+    int len;
+
+    memset(attrs, 0, sizeof(struct nlattr *) * max);
+
+    nla = (struct nlattr *)((char *)NLMSG_DATA(nlh) + NLA_ALIGN(off));
+    len = nlh->nlmsg_len - NLMSG_HDRLEN - NLA_ALIGN(off);
+
+    while (len >= (int)NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN &&
+           nla->nla_len <= len) {
+        if ((nla->nla_type & NLA_TYPE_MASK) < max)
+            attrs[nla->nla_type & NLA_TYPE_MASK] = nla;
+
+        len -= NLA_ALIGN(nla->nla_len);
+        nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+}
+
+static void *rfsctl_nl_data(struct nlattr *nla)
+{
+    return (char *)nla + NLA_HDRLEN;
+}
+
+static uint32_t rfsctl_nl_get_u32(struct nlattr *nla)
+{
+    uint32_t value = 0;
+
+    if (nla && nla->nla_len >= NLA_HDRLEN + sizeof(value))
+        memcpy(&value, rfsctl_nl_data(nla), sizeof(value));
+
+    return value;
+}
+
+static uint64_t rfsctl_nl_get_u64(struct nlattr *nla)
+{
+    uint64_t value = 0;
+
+    if (nla && nla->nla_len >= NLA_HDRLEN + sizeof(value))
+        memcpy(&value, rfsctl_nl_data(nla), sizeof(value));
+
+    return value;
+}
+
+static void rfsctl_nl_get_str(struct nlattr *nla, char *buf, int size)
+{
+    int len;
+
+    buf[0] = '\0';
+    if (!nla)
+        return;
+
+    len = nla->nla_len - NLA_HDRLEN;
+    if (len >= size)
+        len = size - 1;
+
+    memcpy(buf, rfsctl_nl_data(nla), len);
+    buf[len] = '\0';
+}
+
+static int rfsctl_nl_send_buf(struct rfsctl_nl *nl, const char *buf, int len)
+{
+    struct sockaddr_nl addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    if (sendto(nl->fd, buf, len, 0, (struct sockaddr *)&addr,
+                sizeof(addr)) != len)
+        return -1;
+
+    return 0;
+}
+
+static int rfsctl_nl_send(struct rfsctl_nl *nl, int len)
+{
+    return rfsctl_nl_send_buf(nl, nl->buf, len);
+}
+
+static int rfsctl_nl_recv(struct rfsctl_nl *nl)
+{
+    int len;
+
+    do {
+        len = recv(nl->fd, nl->buf, RFSCTL_NL_BUFSIZE, 0);
+    } while (len == -1 && errno == EINTR);
+
+    return len;
+}
+
+static int rfsctl_nl_resolve(struct rfsctl_nl *nl)
+{
+    struct nlattr *attrs[CTRL_ATTR_MAX + 1];
+    struct nlattr *grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+    struct nlattr *nla;
+    struct nlmsghdr *nlh;
+    char name[GENL_NAMSIZ];
+    int len = 0;
+    int rem;
+
+    nlh = rfsctl_nl_msg(nl->buf, &len, GENL_ID_CTRL, NLM_F_REQUEST,
+            ++nl->seq, CTRL_CMD_GETFAMILY);
+    rfsctl_nl_put_str(nlh, CTRL_ATTR_FAMILY_NAME, RFSCTL_NL_FAMILY);
+
+    if (rfsctl_nl_send(nl, nlh->nlmsg_len))
+        return -1;
+
+    len = rfsctl_nl_recv(nl);
+    if (len == -1)
+        return -1;
+
+    nlh = (struct nlmsghdr *)nl->buf;
+    if (!NLMSG_OK(nlh, len))
+        goto eproto;
+
+    if (nlh->nlmsg_type == NLMSG_ERROR) {
+        errno = -((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+        /* the module is not loaded or does not support netlink */
+        if (errno == ENOENT)
+            errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    rfsctl_nl_parse(nlh, GENL_HDRLEN, attrs, CTRL_ATTR_MAX + 1);
+    if (!attrs[CTRL_ATTR_FAMILY_ID])
+        goto eproto;
+
+    memcpy(&nl->family, rfsctl_nl_data(attrs[CTRL_ATTR_FAMILY_ID]),
+            sizeof(nl->family));
+
+    nla = attrs[CTRL_ATTR_MCAST_GROUPS];
+    if (!nla)
+        return 0;
+
+    rem = nla->nla_len - NLA_HDRLEN;
+    nla = rfsctl_nl_data(nla);
+
+    while (rem >= (int)NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN &&
+           nla->nla_len <= rem) {
+        struct nlattr *a = rfsctl_nl_data(nla);
+        int alen = nla->nla_len - NLA_HDRLEN;
+
+        memset(grp, 0, sizeof(grp));
+        while (alen >= (int)NLA_HDRLEN && a->nla_len >= NLA_HDRLEN &&
+               a->nla_len <= alen) {
+            if (a->nla_type <= CTRL_ATTR_MCAST_GRP_MAX)
+                grp[a->nla_type] = a;
+
+            alen -= NLA_ALIGN(a->nla_len);
+            a = (struct nlattr *)((char *)a + NLA_ALIGN(a->nla_len));
+        }
+
+        rfsctl_nl_get_str(grp[CTRL_ATTR_MCAST_GRP_NAME], name, sizeof(name));
+        if (!strcmp(name, RFSCTL_NL_EVENTS_GROUP))
+            nl->group = rfsctl_nl_get_u32(grp[CTRL_ATTR_MCAST_GRP_ID]);
+
+        rem -= NLA_ALIGN(nla->nla_len);
+        nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+    }
+
+    return 0;
+eproto:
+    errno = EPROTO;
+    return -1;
+}
+
+struct rfsctl_nl *rfsctl_nl_open(void)
+{
+    struct sockaddr_nl addr;
+    struct rfsctl_nl *nl;
+    int err;
+
+    nl = calloc(1, sizeof(struct rfsctl_nl));
+    if (!nl)
+        return NULL;
+
+    nl->buf = malloc(RFSCTL_NL_BUFSIZE);
+    if (!nl->buf) {
+        free(nl);
+        return NULL;
+    }
+
+    nl->fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+    if (nl->fd == -1)
+        goto error;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    if (bind(nl->fd, (struct sockaddr *)&addr, sizeof(addr)))
+        goto error;
+
+    if (rfsctl_nl_resolve(nl))
+        goto error;
+
+    return nl;
+error:
+    err = errno;
+    rfsctl_nl_close(nl);
+    errno = err;
+    return NULL;
+}
+
+void rfsctl_nl_close(struct rfsctl_nl *nl)
+{
+    if (!nl)
+        return;
+
+    if (nl->fd != -1)
+        close(nl->fd);
+
+    free(nl->buf);
+    free(nl);
+}
+
+int rfsctl_nl_fd(struct rfsctl_nl *nl)
+{
+    return nl->fd;
+}
+
+static int rfsctl_nl_req_cmd(struct rfsctl_nl_req *req)
+{
+    switch (req->cmd) {
+        case RFSCTL_NL_PATH_ADD:
+            if (!req->path || (req->type != RFSCTL_PATH_INCLUDE &&
+                        req->type != RFSCTL_PATH_EXCLUDE))
+                return -1;
+            return RFSCTL_NL_C_PATH_ADD;
+
+        case RFSCTL_NL_PATH_REM:
+            if (req->id < 0 && !req->path)
+                return -1;
+            return RFSCTL_NL_C_PATH_REM;
+
+        case RFSCTL_NL_ACTIVATE:
+            return RFSCTL_NL_C_ACTIVATE;
+
+        case RFSCTL_NL_DEACTIVATE:
+            return RFSCTL_NL_C_DEACTIVATE;
+    }
+
+    return -1;
+}
+
+/*
+ * appends the request to the buffer, returns -1 if it does not fit
+ */
+static int rfsctl_nl_req_put(struct rfsctl_nl *nl, int *len,
+        struct rfsctl_nl_req *req, int cmd, uint32_t seq)
+{
+    struct nlmsghdr *nlh;
+    int size;
+
+    size = NLMSG_HDRLEN + GENL_HDRLEN + 3 * NLA_HDRLEN + 2 * sizeof(uint32_t) +
+        NLA_ALIGN(strlen(req->filter) + 1) +
+        (req->path ? NLA_ALIGN(strlen(req->path) + 1) : 0);
+
+    if (*len + size > RFSCTL_NL_BUFSIZE)
+        return -1;
+
+    nlh = rfsctl_nl_msg(nl->buf, len, nl->family,
+            NLM_F_REQUEST | NLM_F_ACK, seq, cmd);
+    rfsctl_nl_put_str(nlh, RFSCTL_NL_A_FILTER, req->filter);
+
+    if (cmd == RFSCTL_NL_C_PATH_ADD) {
+        rfsctl_nl_put_str(nlh, RFSCTL_NL_A_PATH, req->path);
+        rfsctl_nl_put_u32(nlh, RFSCTL_NL_A_PATH_FLAGS, req->type);
+
+    } else if (cmd == RFSCTL_NL_C_PATH_REM) {
+        if (req->id >= 0)
+            rfsctl_nl_put_u32(nlh, RFSCTL_NL_A_PATH_ID, req->id);
+        else
+            rfsctl_nl_put_str(nlh, RFSCTL_NL_A_PATH, req->path);
+    }
+
+    *len += NLMSG_ALIGN(nlh->nlmsg_len);
+
+    return 0;
+}
+
+/*
+ * waits for the acks of the requests with sequence numbers in the
+ * [first, first + count) range and stores their results
+ */
+static int rfsctl_nl_req_acks(struct rfsctl_nl *nl, struct rfsctl_nl_req *reqs,
+        uint32_t first, int count)
+{
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    int acked = 0;
+    int len;
+
+    while (acked < count) {
+        len = rfsctl_nl_recv(nl);
+        if (len == -1)
+            return -1;
+
+        for (nlh = (struct nlmsghdr *)nl->buf; NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR)
+                continue;
+
+            if (nlh->nlmsg_seq - first >= count)
+                continue;
+
+            err = NLMSG_DATA(nlh);
+            reqs[nlh->nlmsg_seq - first].error = -err->error;
+            acked++;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Sends the requests in as few messages as possible, the kernel processes
+ * them in order and acks each one. Returns the number of failed requests,
+ * the error of each request is stored in its error field, or -1 if the
+ * communication with the kernel failed.
+ */
+int rfsctl_nl_batch(struct rfsctl_nl *nl, struct rfsctl_nl_req *reqs,
+        int count)
+{
+    uint32_t first;
+    int failed = 0;
+    int start;
+    int cmd;
+    int len;
+    int i;
+
+    if (!nl || !reqs || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        reqs[i].error = 0;
+        if (!reqs[i].filter || rfsctl_nl_req_cmd(&reqs[i]) == -1) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    i = 0;
+    while (i < count) {
+        start = i;
+        first = nl->seq + 1;
+        len = 0;
+
+        for (; i < count && i - start < RFSCTL_NL_BATCH; i++) {
+            cmd = rfsctl_nl_req_cmd(&reqs[i]);
+            if (rfsctl_nl_req_put(nl, &len, &reqs[i], cmd, first + i - start))
+                break;
+        }
+
+        /* a single request larger than the buffer */
+        if (i == start) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        nl->seq += i - start;
+
+        if (rfsctl_nl_send(nl, len))
+            return -1;
+
+        if (rfsctl_nl_req_acks(nl, reqs + start, first, i - start))
+            return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (reqs[i].error)
+            failed++;
+    }
+
+    return failed;
+}
+
+int rfsctl_nl_subscribe(struct rfsctl_nl *nl)
+{
+    if (!nl) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!nl->group) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    return setsockopt(nl->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+            &nl->group, sizeof(nl->group));
+}
+
+static int rfsctl_nl_event_type(int cmd)
+{
+    switch (cmd) {
+        case RFSCTL_NL_C_EV_FLT_REGISTER:
+            return RFSCTL_EV_FLT_REGISTER;
+        case RFSCTL_NL_C_EV_FLT_UNREGISTER:
+            return RFSCTL_EV_FLT_UNREGISTER;
+        case RFSCTL_NL_C_EV_FLT_ACTIVATE:
+            return RFSCTL_EV_FLT_ACTIVATE;
+        case RFSCTL_NL_C_EV_FLT_DEACTIVATE:
+            return RFSCTL_EV_FLT_DEACTIVATE;
+        case RFSCTL_NL_C_EV_WALK_START:
+            return RFSCTL_EV_WALK_START;
+        case RFSCTL_NL_C_EV_PATH_ADD:
+            return RFSCTL_EV_PATH_ADD;
+        case RFSCTL_NL_C_EV_PATH_REM:
+            return RFSCTL_EV_PATH_REM;
+    }
+
+    return 0;
+}
+
+/*
+ * Blocks until an event is received on a subscribed handle. Events which
+ * did not fit into the socket buffer are lost, in that case -1 is returned
+ * with errno set to ENOBUFS and the caller should resync its state.
+ */
+int rfsctl_nl_read_event(struct rfsctl_nl *nl, struct rfsctl_event *event)
+{
+    struct nlattr *attrs[RFSCTL_NL_A_MAX];
+    struct genlmsghdr *genlh;
+    struct nlmsghdr *nlh;
+    int len;
+
+    if (!nl || !event) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (;;) {
+        len = rfsctl_nl_recv(nl);
+        if (len == -1)
+            return -1;
+
+        /* one event per datagram */
+        nlh = (struct nlmsghdr *)nl->buf;
+        if (!NLMSG_OK(nlh, len) || nlh->nlmsg_type != nl->family)
+            continue;
+
+        genlh = NLMSG_DATA(nlh);
+        memset(event, 0, sizeof(*event));
+        event->type = rfsctl_nl_event_type(genlh->cmd);
+        if (!event->type)
+            continue;
+
+        rfsctl_nl_parse(nlh, GENL_HDRLEN, attrs, RFSCTL_NL_A_MAX);
+        rfsctl_nl_get_str(attrs[RFSCTL_NL_A_FILTER], event->filter,
+                sizeof(event->filter));
+        rfsctl_nl_get_str(attrs[RFSCTL_NL_A_PATH], event->path,
+                sizeof(event->path));
+        event->priority = rfsctl_nl_get_u32(attrs[RFSCTL_NL_A_PRIORITY]);
+        event->active = rfsctl_nl_get_u32(attrs[RFSCTL_NL_A_ACTIVE]);
+        event->id = attrs[RFSCTL_NL_A_PATH_ID] ?
+            (int)rfsctl_nl_get_u32(attrs[RFSCTL_NL_A_PATH_ID]) : -1;
+        event->path_type = rfsctl_nl_get_u32(attrs[RFSCTL_NL_A_PATH_FLAGS]);
+
+        return 0;
+    }
+}
+
+/*
+ * counters read with a multipart dump, the same result as
+ * rfsctl_get_counters without going through sysfs
+ */
+struct rfsctl_counter **rfsctl_nl_get_counters(struct rfsctl_nl *nl)
+{
+    struct nlattr *attrs[RFSCTL_NL_A_MAX];
+    struct rfsctl_counter **cnts = NULL;
+    struct rfsctl_counter **tmp;
+    struct rfsctl_counter *cnt;
+    struct nlmsghdr *nlh;
+    char name[256];
+    uint32_t seq;
+    int nr = 0;
+    int len = 0;
+
+    if (!nl) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    seq = ++nl->seq;
+    nlh = rfsctl_nl_msg(nl->buf, &len, nl->family,
+            NLM_F_REQUEST | NLM_F_DUMP, seq, RFSCTL_NL_C_GET_COUNTER);
+
+    if (rfsctl_nl_send(nl, nlh->nlmsg_len))
+        return NULL;
+
+    for (;;) {
+        len = rfsctl_nl_recv(nl);
+        if (len == -1)
+            goto error;
+
+        for (nlh = (struct nlmsghdr *)nl->buf; NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_seq != seq)
+                continue;
+
+            if (nlh->nlmsg_type == NLMSG_DONE)
+                goto done;
+
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                errno = -((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+                goto error;
+            }
+
+            rfsctl_nl_parse(nlh, GENL_HDRLEN, attrs, RFSCTL_NL_A_MAX);
+            if (!attrs[RFSCTL_NL_A_COUNTER_NAME])
+                continue;
+
+            tmp = realloc(cnts, sizeof(struct rfsctl_counter *) * (nr + 2));
+            if (!tmp)
+                goto error;
+
+            cnts = tmp;
+            cnts[nr] = NULL;
+
+            cnt = malloc(sizeof(struct rfsctl_counter));
+            if (!cnt)
+                goto error;
+
+            rfsctl_nl_get_str(attrs[RFSCTL_NL_A_COUNTER_NAME], name,
+                    sizeof(name));
+            cnt->name = strdup(name);
+            cnt->value = rfsctl_nl_get_u64(attrs[RFSCTL_NL_A_COUNTER_VALUE]);
+            if (!cnt->name) {
+                free(cnt);
+                goto error;
+            }
+
+            cnts[nr++] = cnt;
+            cnts[nr] = NULL;
+        }
+    }
+
+done:
+    if (!cnts)
+        cnts = calloc(1, sizeof(struct rfsctl_counter *));
+
+    return cnts;
+error:
+    rfsctl_put_counters(cnts);
+    return NULL;
+}
+
+int rfsctl_nl_add_paths(struct rfsctl_nl *nl, const char *name,
+        const char **paths, const int *types, int count)
+{
+    struct nlattr *list;
+    struct nlattr *entry;
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    char *buf;
+    size_t size;
+    uint32_t seq;
+    int sndbuf;
+    int len = 0;
+    int i;
+
+    if (!nl || !name || !paths || !types || count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size = NLMSG_HDRLEN + GENL_HDRLEN + 2 * NLA_HDRLEN +
+        NLA_ALIGN(strlen(name) + 1);
+
+    for (i = 0; i < count; i++) {
+        if (!paths[i] || (types[i] != RFSCTL_PATH_INCLUDE &&
+                    types[i] != RFSCTL_PATH_EXCLUDE)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        size += 3 * NLA_HDRLEN + sizeof(uint32_t) +
+            NLA_ALIGN(strlen(paths[i]) + 1);
+    }
+
+    buf = malloc(size);
+    if (!buf)
+        return -1;
+
+    seq = ++nl->seq;
+    nlh = rfsctl_nl_msg(buf, &len, nl->family, NLM_F_REQUEST | NLM_F_ACK,
+            seq, RFSCTL_NL_C_PATHS_ADD);
+    rfsctl_nl_put_str(nlh, RFSCTL_NL_A_FILTER, name);
+
+    list = rfsctl_nl_nest_start(nlh, RFSCTL_NL_A_PATHS);
+    for (i = 0; i < count; i++) {
+        entry = rfsctl_nl_nest_start(nlh, RFSCTL_NL_A_PATH_ENTRY);
+        rfsctl_nl_put_str(nlh, RFSCTL_NL_A_PATH, paths[i]);
+        rfsctl_nl_put_u32(nlh, RFSCTL_NL_A_PATH_FLAGS, types[i]);
+        rfsctl_nl_nest_end(nlh, entry);
+    }
+    rfsctl_nl_nest_end(nlh, list);
+
+    /* the whole batch is one message, it has to fit the send buffer */
+    sndbuf = nlh->nlmsg_len * 2;
+    setsockopt(nl->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    if (rfsctl_nl_send_buf(nl, buf, nlh->nlmsg_len)) {
+        free(buf);
+        return -1;
+    }
+
+    free(buf);
+
+    for (;;) {
+        len = rfsctl_nl_recv(nl);
+        if (len == -1)
+            return -1;
+
+        for (nlh = (struct nlmsghdr *)nl->buf; NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR || nlh->nlmsg_seq != seq)
+                continue;
+
+            err = NLMSG_DATA(nlh);
+            if (!err->error)
+                return 0;
+
+            errno = -err->error;
+            return -1;
+        }
+    }
+}
+
+static int rfsctl_add_paths_sysfs(const char *name, const char **paths,
+        const int *types, int count)
+{
+    long page_size;
+    char *buf;
+    int size;
+    int len;
+    int i;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    buf = malloc(page_size);
+    if (!buf)
+        return -1;
+
+    len = snprintf(buf, page_size, "A:");
+
+    for (i = 0; i < count; i++) {
+        size = snprintf(buf + len, page_size - len, "\n%c:%s",
+                types[i] == RFSCTL_PATH_INCLUDE ? 'i' : 'e', paths[i]);
+        if (size >= page_size - len) {
+            free(buf);
+            errno = E2BIG;
+            return -1;
+        }
+
+        len += size;
+    }
+
+    if (rfsctl_write_data(name, "paths", buf, len + 1) == -1) {
+        free(buf);
+        return -1;
+    }
+
+    free(buf);
+    return 0;
+}
+
+/*
+ * Adds all paths or none of them. Uses netlink when the module supports
+ * it, otherwise the paths have to fit into one sysfs write.
+ */
+int rfsctl_add_paths(const char *name, const char **paths, const int *types,
+        int count)
+{
+    struct rfsctl_nl *nl;
+    int rv;
+    int i;
+
+    if (!name || !paths || !types || count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!paths[i] || (types[i] != RFSCTL_PATH_INCLUDE &&
+                    types[i] != RFSCTL_PATH_EXCLUDE)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    nl = rfsctl_nl_open();
+    if (!nl) {
+        if (errno != EOPNOTSUPP && errno != EPROTONOSUPPORT)
+            return -1;
+
+        return rfsctl_add_paths_sysfs(name, paths, types, count);
+    }
+
+    rv = rfsctl_nl_add_paths(nl, name, paths, types, count);
+    rfsctl_nl_close(nl);
+
+    return rv;
+}
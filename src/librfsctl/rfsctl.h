@@ -24,6 +24,58 @@ struct rfsctl_filter {
     int active;
 };
 
+struct rfsctl_counter {
+    char *name;
+    unsigned long long value;
+};
+
+struct rfsctl_sample {
+    int cpu;
+    unsigned long long time;
+    char itype[8];
+    char op[32];
+    char call[8];
+    char filter[32];
+    int pid;
+    unsigned long ino;
+    unsigned long long duration;
+    char comm[16];
+};
+
+#define RFSCTL_NL_PATH_ADD      1
+#define RFSCTL_NL_PATH_REM      2
+#define RFSCTL_NL_ACTIVATE      3
+#define RFSCTL_NL_DEACTIVATE    4
+
+struct rfsctl_nl;
+
+struct rfsctl_nl_req {
+    int cmd;
+    const char *filter;
+    const char *path;   /* RFSCTL_NL_PATH_ADD, RFSCTL_NL_PATH_REM if id < 0 */
+    int type;           /* RFSCTL_PATH_INCLUDE or RFSCTL_PATH_EXCLUDE */
+    int id;             /* RFSCTL_NL_PATH_REM */
+    int error;          /* set by rfsctl_nl_batch, 0 or errno */
+};
+
+#define RFSCTL_EV_FLT_REGISTER      1
+#define RFSCTL_EV_FLT_UNREGISTER    2
+#define RFSCTL_EV_FLT_ACTIVATE      3
+#define RFSCTL_EV_FLT_DEACTIVATE    4
+#define RFSCTL_EV_WALK_START        5
+#define RFSCTL_EV_PATH_ADD          6
+#define RFSCTL_EV_PATH_REM          7
+
+struct rfsctl_event {
+    int type;
+    char filter[256];
+    int priority;
+    int active;
+    char path[4096];
+    int id;             /* -1 for RFSCTL_EV_WALK_START */
+    int path_type;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -33,6 +85,8 @@ void rfsctl_put_filter(struct rfsctl_filter *filter);
 struct rfsctl_filter **rfsctl_get_filters(void);
 void rfsctl_put_filters(struct rfsctl_filter **filters);
 int rfsctl_add_path(const char *name, const char *path, int type);
+int rfsctl_add_paths(const char *name, const char **paths, const int *types,
+        int count);
 int rfsctl_rem_path(const char *name, int id);
 int rfsctl_rem_path_name(const char *name, const char *path);
 int rfsctl_del_paths(const char *name);
@@ -43,6 +97,22 @@ int rfsctl_read_data(const char *fltname, const char *filename, char *buf,
         int size);
 int rfsctl_write_data(const char *fltname, const char *filename, char *buf,
         int size);
+struct rfsctl_counter **rfsctl_get_counters(void);
+void rfsctl_put_counters(struct rfsctl_counter **counters);
+int rfsctl_get_sampling(unsigned int *period, unsigned long long *threshold);
+int rfsctl_set_sampling(unsigned int period, unsigned long long threshold);
+int rfsctl_read_samples(struct rfsctl_sample *samples, int count,
+        unsigned long *lost);
+struct rfsctl_nl *rfsctl_nl_open(void);
+void rfsctl_nl_close(struct rfsctl_nl *nl);
+int rfsctl_nl_fd(struct rfsctl_nl *nl);
+int rfsctl_nl_batch(struct rfsctl_nl *nl, struct rfsctl_nl_req *reqs,
+        int count);
+int rfsctl_nl_subscribe(struct rfsctl_nl *nl);
+int rfsctl_nl_read_event(struct rfsctl_nl *nl, struct rfsctl_event *event);
+struct rfsctl_counter **rfsctl_nl_get_counters(struct rfsctl_nl *nl);
+int rfsctl_nl_add_paths(struct rfsctl_nl *nl, const char *name,
+        const char **paths, const int *types, int count);
 
 #ifdef __cplusplus
 }
@@ -1026,6 +1026,7 @@ struct redirfs_filter_operations {
     int (*rem_path)(redirfs_path);
     int (*unregister)(void);
     int (*rem_paths)(void);
+    int (*add_paths)(struct redirfs_path_info *, int);
     void (*move_begin)(void);
     void (*move_end)(void);
     int (*dentry_moved)(redirfs_root, redirfs_root, struct dentry *);
@@ -1066,6 +1067,8 @@ int redirfs_remove_attribute(redirfs_filter filter,
 struct kobject *redirfs_filter_kobject(redirfs_filter filter);
 redirfs_path redirfs_add_path(redirfs_filter filter,
         struct redirfs_path_info *info);
+int redirfs_add_paths(redirfs_filter filter, struct redirfs_path_info *infos,
+        int count, redirfs_path *paths);
 int redirfs_rem_path(redirfs_filter filter, redirfs_path path);
 int redirfs_get_id_path(redirfs_path path);
 redirfs_path redirfs_get_path_id(int id);
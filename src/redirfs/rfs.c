@@ -40,6 +40,7 @@ int rfs_precall_flts(struct rfs_chain *rchain, struct rfs_context *rcont,
     enum redirfs_rv      rv;
     enum rfs_inode_type  it;
     enum rfs_op_id       op_id;
+    u64                  start = 0;
 
     if (!rchain)
         return 0;
@@ -54,6 +55,9 @@ int rfs_precall_flts(struct rfs_chain *rchain, struct rfs_context *rcont,
 
     rcont->idx = rcont->idx_start;
 
+    if (unlikely(rfs_prof_enabled()))
+        rcont->prof = rfs_prof_begin(rcont);
+
     for (; rcont->idx < rchain->rflts_nr; rcont->idx++) {
         if (!atomic_read(&rchain->rflts[rcont->idx]->active))
             continue;
@@ -62,7 +66,14 @@ int rfs_precall_flts(struct rfs_chain *rchain, struct rfs_context *rcont,
         if (!rop)
             continue;
 
+        if (unlikely(rcont->prof))
+            start = rfs_prof_clock();
+
         rv = rop(rcont, rargs);
+
+        if (unlikely(rcont->prof))
+            rfs_prof_record(rcont, rchain->rflts[rcont->idx], rargs, start);
+
         if (rv == REDIRFS_STOP)
             return -1;
     }
@@ -78,6 +89,7 @@ void rfs_postcall_flts(struct rfs_chain *rchain, struct rfs_context *rcont,
     enum redirfs_rv      (*rop)(redirfs_context, struct redirfs_args *);
     enum rfs_inode_type  it;
     enum rfs_op_id       op_id;
+    u64                  start = 0;
 
     if (!rchain)
         return;
@@ -95,11 +107,22 @@ void rfs_postcall_flts(struct rfs_chain *rchain, struct rfs_context *rcont,
             continue;
 
         rop = rchain->rflts[rcont->idx]->cbs[it][op_id].post_cb;
-        if (rop) 
-            rop(rcont, rargs);
+        if (!rop)
+            continue;
+
+        if (unlikely(rcont->prof))
+            start = rfs_prof_clock();
+
+        rop(rcont, rargs);
+
+        if (unlikely(rcont->prof))
+            rfs_prof_record(rcont, rchain->rflts[rcont->idx], rargs, start);
     }
 
     rcont->idx++;
+
+    if (unlikely(rcont->prof))
+        rfs_prof_record(rcont, NULL, rargs, rcont->prof_start);
 }
 
 enum rfs_inode_type  rfs_imode_to_type(umode_t i_mode, bool is_dentry)
@@ -152,9 +175,15 @@ static int __init rfs_init(void)
 
     rfs_object_susbsystem_init();
 
+    rv = rfs_prof_init();
+    if (rv)
+        return rv;
+
     rfs_info_none = rfs_info_alloc(NULL, NULL);
-    if (IS_ERR(rfs_info_none))
+    if (IS_ERR(rfs_info_none)) {
+        rfs_prof_exit();
         return PTR_ERR(rfs_info_none);
+    }
 
     rv = rfs_dentry_cache_create();
     if (rv)
@@ -172,11 +201,17 @@ static int __init rfs_init(void)
     if (rv)
         goto err_sysfs;
 
+    rv = rfs_nl_init();
+    if (rv)
+        goto err_nl;
+
     printk(KERN_INFO "Redirecting File System Framework Version "
             REDIRFS_VERSION " <www.redirfs.org>\n");
 
     return 0;
 
+err_nl:
+    rfs_sysfs_delete();
 err_sysfs:
     rfs_file_cache_destory();
 err_file_cache:
@@ -185,17 +220,20 @@ err_inode_cache:
     rfs_dentry_cache_destory();
 err_dentry_cache:
     rfs_info_put(rfs_info_none);
+    rfs_prof_exit();
     return rv;
 }
 
 static void __exit rfs_exit(void)
 {
+    rfs_nl_exit();
     rfs_sysfs_delete();
     rfs_file_cache_destory();
     rfs_inode_cache_destroy();
     rfs_dentry_cache_destory();
     if (rfs_info_none)
         rfs_info_put(rfs_info_none);
+    rfs_prof_exit();
 }
 
 module_init(rfs_init);
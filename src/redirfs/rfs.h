@@ -40,6 +40,7 @@
 #include "redirfs.h"
 #include "rfs_object.h"
 #include "rfs_dbg.h"
+#include "rfs_nl.h"
 
 #ifndef f_dentry
     #define f_dentry    f_path.dentry
@@ -290,11 +291,12 @@ struct rfs_file;
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,16))
 
-    #define rfs_mutex_t semaphore
-    #define RFS_DEFINE_MUTEX(mutex) DECLARE_MUTEX(mutex)
-    #define rfs_mutex_init(mutex) init_MUTEX(mutex)
-    #define rfs_mutex_lock(mutex) down(mutex)
-    #define rfs_mutex_unlock(mutex) up(mutex)
+    #define rfs_raw_mutex_t semaphore
+    #define RFS_RAW_MUTEX_INITIALIZER(mutex) __SEMAPHORE_INITIALIZER(mutex, 1)
+    #define rfs_raw_mutex_init(mutex) init_MUTEX(mutex)
+    #define rfs_raw_mutex_lock(mutex) down(mutex)
+    #define rfs_raw_mutex_trylock(mutex) (!down_trylock(mutex))
+    #define rfs_raw_mutex_unlock(mutex) up(mutex)
 
     inline static void rfs_inode_mutex_lock(struct inode *inode)
     {
@@ -307,11 +309,12 @@ struct rfs_file;
 
 #elif (LINUX_VERSION_CODE < KERNEL_VERSION(4,7,0))
 
-    #define rfs_mutex_t mutex
-    #define RFS_DEFINE_MUTEX(mutex) DEFINE_MUTEX(mutex)
-    #define rfs_mutex_init(mutex) mutex_init(mutex)
-    #define rfs_mutex_lock(mutex) mutex_lock(mutex)
-    #define rfs_mutex_unlock(mutex) mutex_unlock(mutex)
+    #define rfs_raw_mutex_t mutex
+    #define RFS_RAW_MUTEX_INITIALIZER(mutex) __MUTEX_INITIALIZER(mutex)
+    #define rfs_raw_mutex_init(mutex) mutex_init(mutex)
+    #define rfs_raw_mutex_lock(mutex) mutex_lock(mutex)
+    #define rfs_raw_mutex_trylock(mutex) mutex_trylock(mutex)
+    #define rfs_raw_mutex_unlock(mutex) mutex_unlock(mutex)
 
     inline static void rfs_inode_mutex_lock(struct inode *inode)
     {
@@ -324,11 +327,12 @@ struct rfs_file;
 
 #else
 
-    #define rfs_mutex_t rw_semaphore
-    #define RFS_DEFINE_MUTEX(mutex) DECLARE_RWSEM(mutex)
-    #define rfs_mutex_init(mutex) init_rwsem(mutex)
-    #define rfs_mutex_lock(mutex) down_write(mutex)
-    #define rfs_mutex_unlock(mutex) up_write(mutex)
+    #define rfs_raw_mutex_t rw_semaphore
+    #define RFS_RAW_MUTEX_INITIALIZER(mutex) __RWSEM_INITIALIZER(mutex)
+    #define rfs_raw_mutex_init(mutex) init_rwsem(mutex)
+    #define rfs_raw_mutex_lock(mutex) down_write(mutex)
+    #define rfs_raw_mutex_trylock(mutex) down_write_trylock(mutex)
+    #define rfs_raw_mutex_unlock(mutex) up_write(mutex)
 
     inline static void rfs_inode_mutex_lock(struct inode *inode)
     {
@@ -340,6 +344,68 @@ struct rfs_file;
     }
 #endif
 
+/*
+ * redirfs mutexes are tagged with a lock class, the class is used only
+ * by the RFS_LOCK_STAT instrumentation, see rfs_lock.h
+ */
+#ifdef RFS_LOCK_STAT
+
+    struct rfs_stat_mutex {
+        struct rfs_raw_mutex_t  mutex;
+        enum rfs_lock_class     lclass;
+        u64                     acquired;
+    };
+
+    #define rfs_mutex_t rfs_stat_mutex
+    #define RFS_DEFINE_MUTEX(name, class) \
+        struct rfs_stat_mutex name = { \
+            .mutex = RFS_RAW_MUTEX_INITIALIZER(name.mutex), \
+            .lclass = class, \
+            .acquired = 0, \
+        }
+
+    static inline void rfs_mutex_init(struct rfs_stat_mutex *m,
+            enum rfs_lock_class lclass)
+    {
+        rfs_raw_mutex_init(&m->mutex);
+        m->lclass = lclass;
+        m->acquired = 0;
+    }
+
+    static inline void rfs_mutex_lock(struct rfs_stat_mutex *m)
+    {
+        u64 start = 0;
+
+        if (!rfs_raw_mutex_trylock(&m->mutex)) {
+            start = rfs_lock_stat_clock();
+            rfs_raw_mutex_lock(&m->mutex);
+        }
+
+        m->acquired = rfs_lock_stat_clock();
+        rfs_lock_stat_acquired(m->lclass, start ? m->acquired - start : 0,
+                start != 0);
+    }
+
+    static inline void rfs_mutex_unlock(struct rfs_stat_mutex *m)
+    {
+        u64 hold = rfs_lock_stat_clock() - m->acquired;
+        enum rfs_lock_class lclass = m->lclass;
+
+        rfs_raw_mutex_unlock(&m->mutex);
+        rfs_lock_stat_released(lclass, hold);
+    }
+
+#else /* RFS_LOCK_STAT */
+
+    #define rfs_mutex_t rfs_raw_mutex_t
+    #define RFS_DEFINE_MUTEX(name, class) \
+        struct rfs_raw_mutex_t name = RFS_RAW_MUTEX_INITIALIZER(name)
+    #define rfs_mutex_init(mutex, class) rfs_raw_mutex_init(mutex)
+    #define rfs_mutex_lock(mutex) rfs_raw_mutex_lock(mutex)
+    #define rfs_mutex_unlock(mutex) rfs_raw_mutex_unlock(mutex)
+
+#endif /* !RFS_LOCK_STAT */
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,15))
     #define rfs_kmem_cache_t kmem_cache_t
 #else
@@ -359,7 +425,7 @@ struct rfs_flt {
     char *name;
     int priority;
     int paths_nr;
-    spinlock_t lock;
+    rfs_spinlock_t lock;
     atomic_t active;
     atomic_t count;
     struct redirfs_filter_operations *ops;
@@ -368,6 +434,7 @@ struct rfs_flt {
 void rfs_flt_put(struct rfs_flt *rflt);
 struct rfs_flt *rfs_flt_get(struct rfs_flt *rflt);
 void rfs_flt_release(struct kobject *kobj);
+struct rfs_flt *rfs_flt_find(const char *name);
 
 struct rfs_path {
     struct list_head list;
@@ -405,7 +472,7 @@ struct rfs_root {
     struct rfs_info *rinfo;
     struct dentry *dentry;
     int paths_nr;
-    spinlock_t lock;
+    rfs_spinlock_t lock;
     atomic_t count;
 };
 
@@ -517,7 +584,7 @@ struct rfs_dentry {
 #endif /* !RFS_PER_OBJECT_OPS */
     struct rfs_inode *rinode;
     struct rfs_info *rinfo;
-    spinlock_t lock;
+    rfs_spinlock_t lock;
 }; 
 
 struct rfs_dentry* rfs_dentry_find(const struct dentry *dentry);
@@ -573,7 +640,7 @@ struct rfs_inode {
 #endif
     struct rfs_info *rinfo;
     struct rfs_mutex_t mutex;
-    spinlock_t lock;
+    rfs_spinlock_t lock;
     atomic_t nlink;
     int rdentries_nr; /* mutex */
 };
@@ -630,7 +697,7 @@ struct rfs_file {
 #ifdef RFS_PER_OBJECT_OPS 
     struct file_operations op_new;
 #endif /* RFS_PER_OBJECT_OPS */
-    spinlock_t lock;
+    rfs_spinlock_t lock;
 };
 
 struct rfs_file* rfs_file_find(struct file *file);
@@ -705,6 +772,8 @@ struct rfs_context {
     struct list_head data;
     int idx;
     int idx_start;
+    int prof;
+    u64 prof_start;
 };
 
 void rfs_context_init(struct rfs_context *rcont, int start);
@@ -715,12 +784,38 @@ int rfs_precall_flts(struct rfs_chain *rchain, struct rfs_context *rcont,
 void rfs_postcall_flts(struct rfs_chain *rchain, struct rfs_context *rcont,
         struct redirfs_args *rargs);
 
+#define RFS_PROF_OFF 0
+#define RFS_PROF_TIMED 1 /* recorded only if slower than the threshold */
+#define RFS_PROF_SAMPLED 2
+#define RFS_PROF_CALL_ALL -1 /* sample for the whole hooked call */
+
+extern unsigned int rfs_prof_period;
+extern u64 rfs_prof_threshold;
+
+#define rfs_prof_enabled() (rfs_prof_period || rfs_prof_threshold)
+
+int rfs_prof_begin(struct rfs_context *rcont);
+void rfs_prof_record(struct rfs_context *rcont, struct rfs_flt *rflt,
+        struct redirfs_args *rargs, u64 start);
+u64 rfs_prof_clock(void);
+ssize_t rfs_prof_get_samples(char *buf, ssize_t size);
+void rfs_prof_set_period(unsigned int period);
+void rfs_prof_set_threshold(u64 threshold);
+int rfs_prof_init(void);
+void rfs_prof_exit(void);
+
 enum rfs_inode_type rfs_imode_to_type(umode_t i_mode, bool is_dentry);
 enum redirfs_op_idc rfs_inode_to_idc(struct inode* inode, enum rfs_op_id id);
 
 #define rfs_kobj_to_rflt(__kobj) container_of(__kobj, struct rfs_flt, kobj)
 int rfs_flt_sysfs_init(struct rfs_flt *rflt);
 void rfs_flt_sysfs_exit(struct rfs_flt *rflt);
+int rfs_flt_ctl_activate(struct rfs_flt *rflt, int act);
+int rfs_flt_ctl_add_path(struct rfs_flt *rflt, const char *path, int flags);
+int rfs_flt_ctl_add_paths(struct rfs_flt *rflt, const char **paths,
+        const int *flags, int count);
+int rfs_flt_ctl_rem_path_id(struct rfs_flt *rflt, int id);
+int rfs_flt_ctl_rem_path_name(struct rfs_flt *rflt, const char *path);
 void rfs_kobject_init(struct kobject *kobj);
 
 int rfs_sysfs_create(void);
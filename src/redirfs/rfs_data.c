@@ -112,8 +112,8 @@ struct redirfs_data *redirfs_attach_data_file(redirfs_filter filter,
     if (!rfile)
         return NULL;
 
-    spin_lock(&rfile->rdentry->lock);
-    spin_lock(&rfile->lock);
+    rfs_spin_lock(&rfile->rdentry->lock);
+    rfs_spin_lock(&rfile->lock);
 
     if (rfs_chain_find(rfile->rdentry->rinfo->rchain, filter) == -1)
         goto exit;
@@ -126,8 +126,8 @@ struct redirfs_data *redirfs_attach_data_file(redirfs_filter filter,
     redirfs_get_data(data);
     rv = redirfs_get_data(data);
 exit:
-    spin_unlock(&rfile->lock);
-    spin_unlock(&rfile->rdentry->lock);
+    rfs_spin_unlock(&rfile->lock);
+    rfs_spin_unlock(&rfile->rdentry->lock);
     rfs_file_put(rfile);
     return rv;
 }
@@ -145,13 +145,13 @@ struct redirfs_data *redirfs_detach_data_file(redirfs_filter filter,
     if (!rfile)
         return NULL;
 
-    spin_lock(&rfile->lock);
+    rfs_spin_lock(&rfile->lock);
 
     data = rfs_find_data(&rfile->data, filter);
     if (data)
         list_del(&data->list);
 
-    spin_unlock(&rfile->lock);
+    rfs_spin_unlock(&rfile->lock);
     redirfs_put_data(data);
     rfs_file_put(rfile);
     return data;
@@ -170,11 +170,11 @@ struct redirfs_data *redirfs_get_data_file(redirfs_filter filter,
     if (!rfile)
         return NULL;
 
-    spin_lock(&rfile->lock);
+    rfs_spin_lock(&rfile->lock);
 
     data = rfs_find_data(&rfile->data, filter);
 
-    spin_unlock(&rfile->lock);
+    rfs_spin_unlock(&rfile->lock);
     rfs_file_put(rfile);
     return data;
 }
@@ -192,7 +192,7 @@ struct redirfs_data *redirfs_attach_data_dentry(redirfs_filter filter,
     if (!rdentry)
         return NULL;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
 
     if (rfs_chain_find(rdentry->rinfo->rchain, filter) == -1)
         goto exit;
@@ -205,7 +205,7 @@ struct redirfs_data *redirfs_attach_data_dentry(redirfs_filter filter,
     redirfs_get_data(data);
     rv = redirfs_get_data(data);
 exit:
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
     rfs_dentry_put(rdentry);
     return rv;
 }
@@ -223,13 +223,13 @@ struct redirfs_data *redirfs_detach_data_dentry(redirfs_filter filter,
     if (!rdentry)
         return NULL;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
 
     data = rfs_find_data(&rdentry->data, filter);
     if (data)
         list_del(&data->list);
 
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
     redirfs_put_data(data);
     rfs_dentry_put(rdentry);
     return data;
@@ -248,11 +248,11 @@ struct redirfs_data *redirfs_get_data_dentry(redirfs_filter filter,
     if (!rdentry)
         return NULL;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
 
     data = rfs_find_data(&rdentry->data, filter);
 
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
     rfs_dentry_put(rdentry);
     return data;
 }
@@ -270,7 +270,7 @@ struct redirfs_data *redirfs_attach_data_inode(redirfs_filter filter,
     if (!rinode)
         return NULL;
 
-    spin_lock(&rinode->lock);
+    rfs_spin_lock(&rinode->lock);
 
     if (rfs_chain_find(rinode->rinfo->rchain, filter) == -1)
         goto exit;
@@ -283,7 +283,7 @@ struct redirfs_data *redirfs_attach_data_inode(redirfs_filter filter,
     redirfs_get_data(data);
     rv = redirfs_get_data(data);
 exit:
-    spin_unlock(&rinode->lock);
+    rfs_spin_unlock(&rinode->lock);
     rfs_inode_put(rinode);
     return rv;
 }
@@ -301,13 +301,13 @@ struct redirfs_data *redirfs_detach_data_inode(redirfs_filter filter,
     if (!rinode)
         return NULL;
 
-    spin_lock(&rinode->lock);
+    rfs_spin_lock(&rinode->lock);
 
     data = rfs_find_data(&rinode->data, filter);
     if (data)
         list_del(&data->list);
 
-    spin_unlock(&rinode->lock);
+    rfs_spin_unlock(&rinode->lock);
     redirfs_put_data(data);
     rfs_inode_put(rinode);
     return data;
@@ -326,11 +326,11 @@ struct redirfs_data *redirfs_get_data_inode(redirfs_filter filter,
     if (!rinode)
         return NULL;
 
-    spin_lock(&rinode->lock);
+    rfs_spin_lock(&rinode->lock);
 
     data = rfs_find_data(&rinode->data, filter);
 
-    spin_unlock(&rinode->lock);
+    rfs_spin_unlock(&rinode->lock);
     rfs_inode_put(rinode);
     return data;
 }
@@ -340,6 +340,8 @@ void rfs_context_init(struct rfs_context *rcont, int start)
     INIT_LIST_HEAD(&rcont->data);
     rcont->idx_start = start;
     rcont->idx = 0;
+    rcont->prof = RFS_PROF_OFF;
+    rcont->prof_start = 0;
 }
 
 void rfs_context_deinit(struct rfs_context *rcont)
@@ -407,7 +409,7 @@ struct redirfs_data *redirfs_attach_data_root(redirfs_filter filter,
     if (!filter || IS_ERR(filter) || !root || !data)
         return NULL;
 
-    spin_lock(&rroot->lock);
+    rfs_spin_lock(&rroot->lock);
 
     if (rfs_chain_find(rroot->rinch, filter) != -1)
         found = 1;
@@ -426,7 +428,7 @@ struct redirfs_data *redirfs_attach_data_root(redirfs_filter filter,
     redirfs_get_data(data);
     rv = redirfs_get_data(data);
 exit:
-    spin_unlock(&rroot->lock);
+    rfs_spin_unlock(&rroot->lock);
     return rv;
 }
 
@@ -439,13 +441,13 @@ struct redirfs_data *redirfs_detach_data_root(redirfs_filter filter,
     if (!filter || IS_ERR(filter) || !root)
         return NULL;
 
-    spin_lock(&rroot->lock);
+    rfs_spin_lock(&rroot->lock);
 
     data = rfs_find_data(&rroot->data, filter);
     if (data)
         list_del(&data->list);
 
-    spin_unlock(&rroot->lock);
+    rfs_spin_unlock(&rroot->lock);
     redirfs_put_data(data);
 
     return data;
@@ -460,11 +462,11 @@ struct redirfs_data *redirfs_get_data_root(redirfs_filter filter,
     if (!filter || IS_ERR(filter) || !root)
         return NULL;
 
-    spin_lock(&rroot->lock);
+    rfs_spin_lock(&rroot->lock);
 
     data = rfs_find_data(&rroot->data, filter);
 
-    spin_unlock(&rroot->lock);
+    rfs_spin_unlock(&rroot->lock);
 
     return data;
 }
@@ -51,7 +51,8 @@ static struct rfs_object_type rfs_dentry_type = {
 
 struct rfs_radix_tree   rfs_dentry_radix_tree = {
     .root = RADIX_TREE_INIT(GFP_ATOMIC),
-    .lock = __SPIN_LOCK_INITIALIZER(rfs_dentry_radix_tree.lock),
+    .lock = RFS_SPIN_LOCK_INITIALIZER(rfs_dentry_radix_tree.lock,
+                                      RFS_LOCK_RADIX_DENTRY),
     .rfs_type = RFS_TYPE_RDENTRY,
     };
 
@@ -109,7 +110,7 @@ static struct rfs_dentry *rfs_dentry_alloc(struct dentry *dentry)
     INIT_LIST_HEAD(&rdentry->data);
     rdentry->dentry = dentry;
     rdentry->op_old = dentry->d_op;
-    spin_lock_init(&rdentry->lock);
+    rfs_spin_lock_init(&rdentry->lock, RFS_LOCK_RDENTRY);
     
 #ifdef RFS_PER_OBJECT_OPS
 
@@ -296,17 +297,17 @@ int rfs_dentry_add_rinode(struct rfs_dentry *rdentry, struct rfs_info *rinfo)
     if (IS_ERR(rinode))
         return PTR_ERR(rinode);
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
     {
         if (rdentry->rinode) {
-            spin_unlock(&rdentry->lock);
+            rfs_spin_unlock(&rdentry->lock);
             rfs_inode_del(rinode);
             rfs_inode_put(rinode);
             return 0;
         }
         rdentry->rinode = rfs_inode_get(rinode);
     }
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
 
     rfs_inode_add_rdentry(rinode, rdentry);
     rfs_inode_put(rinode);
@@ -328,11 +329,11 @@ struct rfs_info *rfs_dentry_get_rinfo(struct rfs_dentry *rdentry)
 {
     struct rfs_info *rinfo;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
     {
         rinfo = rfs_info_get(rdentry->rinfo);
     }
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
 
     return rinfo;
 }
@@ -341,12 +342,12 @@ void rfs_dentry_set_rinfo(struct rfs_dentry *rdentry, struct rfs_info *rinfo)
 {
     struct rfs_info *rinfo_old;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
     {
         rinfo_old = rdentry->rinfo;
         rdentry->rinfo = rfs_info_get(rinfo);
     }
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
 
     rfs_info_put(rinfo_old);
 }
@@ -355,11 +356,11 @@ void rfs_dentry_add_rfile(struct rfs_dentry *rdentry, struct rfs_file *rfile)
 {
     rfs_file_get(rfile);
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
     {
         list_add_tail(&rfile->rdentry_list, &rdentry->rfiles);
     }
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
 }
 
 void rfs_dentry_rem_rfile(struct rfs_file *rfile)
@@ -367,11 +368,11 @@ void rfs_dentry_rem_rfile(struct rfs_file *rfile)
     if (list_empty(&rfile->rdentry_list))
         return;
 
-    spin_lock(&rfile->rdentry->lock);
+    rfs_spin_lock(&rfile->rdentry->lock);
     {
         list_del_init(&rfile->rdentry_list);
     }
-    spin_unlock(&rfile->rdentry->lock);
+    rfs_spin_unlock(&rfile->rdentry->lock);
 
     rfs_file_put(rfile);
 }
@@ -920,7 +921,7 @@ void rfs_dentry_set_ops(struct rfs_dentry *rdentry)
     struct rfs_file *rfile;
     umode_t mode;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
     {
         enum rfs_inode_type itype;
 
@@ -945,7 +946,7 @@ void rfs_dentry_set_ops(struct rfs_dentry *rdentry)
 
         if (!rdentry->rinode) {
             rfs_dentry_set_ops_none(rdentry);
-            spin_unlock(&rdentry->lock);
+            rfs_spin_unlock(&rdentry->lock);
             return;
         }
 
@@ -976,7 +977,7 @@ void rfs_dentry_set_ops(struct rfs_dentry *rdentry)
         else if (S_ISSOCK(mode))
             rfs_dentry_set_ops_sock(rdentry);
     }
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
     
 #ifndef RFS_PER_OBJECT_OPS
     spin_lock(&rdentry->dentry->d_lock);
@@ -1008,7 +1009,7 @@ void rfs_dentry_rem_data(struct dentry *dentry, struct rfs_flt *rflt)
     if (!rdentry)
         return;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
 
     list_for_each_entry(rfile, &rdentry->rfiles, rdentry_list) {
         data = redirfs_detach_data_file(rflt, rfile->file);
@@ -1017,7 +1018,7 @@ void rfs_dentry_rem_data(struct dentry *dentry, struct rfs_flt *rflt)
         redirfs_put_data(data);
     }
 
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
 
     if (!dentry->d_inode) {
         rfs_dentry_put(rdentry);
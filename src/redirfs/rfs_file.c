@@ -70,7 +70,8 @@ static struct rfs_object_table rfs_file_table = {
 
 struct rfs_radix_tree   rfs_file_radix_tree = {
     .root = RADIX_TREE_INIT(GFP_ATOMIC),
-    .lock = __SPIN_LOCK_INITIALIZER(rfs_file_radix_tree.lock),
+    .lock = RFS_SPIN_LOCK_INITIALIZER(rfs_file_radix_tree.lock,
+                                      RFS_LOCK_RADIX_FILE),
     .rfs_type = RFS_TYPE_RFILE,
     };
 
@@ -215,7 +216,7 @@ static struct rfs_file *rfs_file_alloc(struct file *file)
     INIT_LIST_HEAD(&rfile->rdentry_list);
     INIT_LIST_HEAD(&rfile->data);
     rfile->file = file;
-    spin_lock_init(&rfile->lock);
+    rfs_spin_lock_init(&rfile->lock, RFS_LOCK_RFILE);
 
     rfile->op_old = fops_get(file->f_op);
     DBG_BUG_ON(!rfile->op_old);
@@ -325,11 +326,11 @@ struct rfs_file *rfs_file_add(struct file *file)
     file->f_op = &rfile->op_new;
 #endif /* RFS_PER_OBJECT_OPS */
 
-    spin_lock(&rfile->rdentry->lock);
+    rfs_spin_lock(&rfile->rdentry->lock);
     {
         rfs_file_set_ops(rfile);
     }
-    spin_unlock(&rfile->rdentry->lock);
+    rfs_spin_unlock(&rfile->rdentry->lock);
     
 #ifndef RFS_PER_OBJECT_OPS
     rfs_keep_operations(rfile->f_rhops);
@@ -25,6 +25,7 @@
  */
 
 #include "rfs.h"
+#include "rfs_snapshot.h"
 
 #ifdef RFS_DBG
     #pragma GCC push_options
@@ -32,7 +33,7 @@
 #endif // RFS_DBG
 
 static LIST_HEAD(rfs_flt_list);
-RFS_DEFINE_MUTEX(rfs_flt_list_mutex);
+RFS_DEFINE_MUTEX(rfs_flt_list_mutex, RFS_LOCK_FLT_LIST_MUTEX);
 
 struct rfs_flt *rfs_flt_alloc(struct redirfs_filter_info *flt_info)
 {
@@ -59,7 +60,7 @@ struct rfs_flt *rfs_flt_alloc(struct redirfs_filter_info *flt_info)
     rflt->owner = flt_info->owner;
     rflt->ops = flt_info->ops;
     atomic_set(&rflt->count, 1);
-    spin_lock_init(&rflt->lock);
+    rfs_spin_lock_init(&rflt->lock, RFS_LOCK_RFLT);
     //try_module_get(rflt->owner);
 
     if (flt_info->active)
@@ -151,9 +152,73 @@ redirfs_filter redirfs_register_filter(struct redirfs_filter_info *info)
 
     rfs_mutex_unlock(&rfs_flt_list_mutex);
 
+    rfs_nl_event_flt(RFS_NL_C_EV_FLT_REGISTER, rflt);
+
     return (redirfs_filter)rflt;
 }
 
+/*
+ * returns a new reference to a registered filter, filters which are being
+ * unregistered are skipped the same way as in the sysfs interface
+ */
+struct rfs_flt *rfs_flt_find(const char *name)
+{
+    struct rfs_flt *found = ERR_PTR(-ENOENT);
+    struct rfs_flt *rflt;
+
+    rfs_mutex_lock(&rfs_flt_list_mutex);
+
+    list_for_each_entry(rflt, &rfs_flt_list, list) {
+        if (strcmp(rflt->name, name))
+            continue;
+
+        rfs_spin_lock(&rflt->lock);
+        if (atomic_read(&rflt->count) >= 3)
+            found = rfs_flt_get(rflt);
+        rfs_spin_unlock(&rflt->lock);
+        break;
+    }
+
+    rfs_mutex_unlock(&rfs_flt_list_mutex);
+
+    return found;
+}
+
+/*
+ * called with rfs_snapshot_mutex, takes rfs_path_mutex for each filter
+ */
+int rfs_flt_snapshot(struct rfs_snapshot *snap, u32 *path_nr)
+{
+    struct rfs_snapshot_flt *rec;
+    struct rfs_flt *rflt;
+    size_t size;
+    int paths_nr;
+    int flt_nr = 0;
+
+    rfs_mutex_lock(&rfs_flt_list_mutex);
+
+    list_for_each_entry(rflt, &rfs_flt_list, list) {
+        size = rfs_snapshot_rec_size(sizeof(*rec), rflt->name);
+        rec = rfs_snapshot_reserve(snap, size);
+        paths_nr = rfs_path_snapshot(snap, rflt);
+
+        if (rec) {
+            rec->size = size;
+            rec->priority = rflt->priority;
+            rec->active = atomic_read(&rflt->active);
+            rec->paths_nr = paths_nr;
+            strcpy(rec->name, rflt->name);
+        }
+
+        *path_nr += paths_nr;
+        flt_nr++;
+    }
+
+    rfs_mutex_unlock(&rfs_flt_list_mutex);
+
+    return flt_nr;
+}
+
 int redirfs_unregister_filter(redirfs_filter filter)
 {
     struct rfs_flt *rflt = (struct rfs_flt *)filter;
@@ -165,13 +230,13 @@ int redirfs_unregister_filter(redirfs_filter filter)
 
     synchronize_rcu();
 
-    spin_lock(&rflt->lock);
+    rfs_spin_lock(&rflt->lock);
 
     /*
      * Check if the unregistration is already in progress.
      */
     if (atomic_read(&rflt->count) < 3) {
-        spin_unlock(&rflt->lock);
+        rfs_spin_unlock(&rflt->lock);
         return 0;
     }
 
@@ -184,17 +249,19 @@ int redirfs_unregister_filter(redirfs_filter filter)
      *    - handler returned to filter after registration
      */
     if (atomic_read(&rflt->count) != 3) {
-        spin_unlock(&rflt->lock);
+        rfs_spin_unlock(&rflt->lock);
         return -EBUSY;
     }
 
     rfs_flt_put(rflt);
-    spin_unlock(&rflt->lock);
+    rfs_spin_unlock(&rflt->lock);
 
     rfs_mutex_lock(&rfs_flt_list_mutex);
     list_del_init(&rflt->list);
     rfs_mutex_unlock(&rfs_flt_list_mutex);
 
+    rfs_nl_event_flt(RFS_NL_C_EV_FLT_UNREGISTER, rflt);
+
     module_put(rflt->owner);
 
     return 0;
@@ -278,7 +345,8 @@ int redirfs_activate_filter(redirfs_filter filter)
     if (!rflt || IS_ERR(rflt))
         return -EINVAL;
 
-    atomic_set(&rflt->active, 1);
+    if (!atomic_xchg(&rflt->active, 1))
+        rfs_nl_event_flt(RFS_NL_C_EV_FLT_ACTIVATE, rflt);
 
     return 0;
 }
@@ -290,7 +358,8 @@ int redirfs_deactivate_filter(redirfs_filter filter)
     if (!rflt || IS_ERR(rflt))
         return -EINVAL;
 
-    atomic_set(&rflt->active, 0);
+    if (atomic_xchg(&rflt->active, 0))
+        rfs_nl_event_flt(RFS_NL_C_EV_FLT_DEACTIVATE, rflt);
 
     return 0;
 }
@@ -152,12 +152,12 @@ static void rfs_info_rdentry_rem(struct dentry *dentry)
     if (!rdentry)
         return;
 
-    spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rdentry->lock);
     {
         rinfo_old = rdentry->rinfo;
         rdentry->rinfo = rfs_info_get(rfs_info_none);
     }
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rdentry->lock);
 
     rfs_info_put(rinfo_old);
     rfs_dentry_put(rdentry);
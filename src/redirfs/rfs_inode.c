@@ -42,7 +42,8 @@
 
 struct rfs_radix_tree   rfs_inode_radix_tree = {
     .root = RADIX_TREE_INIT(GFP_ATOMIC),
-    .lock = __SPIN_LOCK_INITIALIZER(rfs_inode_radix_tree.lock),
+    .lock = RFS_SPIN_LOCK_INITIALIZER(rfs_inode_radix_tree.lock,
+                                      RFS_LOCK_RADIX_INODE),
     .rfs_type = RFS_TYPE_RINODE,
     };
 
@@ -130,8 +131,8 @@ static struct rfs_inode *rfs_inode_alloc(struct inode *inode)
     rinode->op_old = inode->i_op;
     rinode->f_op_old = inode->i_fop;
     rinode->a_op_old = inode->i_mapping ? inode->i_mapping->a_ops : NULL;
-    spin_lock_init(&rinode->lock);
-    rfs_mutex_init(&rinode->mutex);
+    rfs_spin_lock_init(&rinode->lock, RFS_LOCK_RINODE);
+    rfs_mutex_init(&rinode->mutex, RFS_LOCK_RINODE_MUTEX);
     atomic_set(&rinode->nlink, 1);
     rinode->rdentries_nr = 0;
 
@@ -428,9 +429,9 @@ static struct rfs_chain *rfs_inode_join_rchains(struct rfs_inode *rinode)
     struct rfs_chain *rchain_old = NULL;
 
     list_for_each_entry(rdentry, &rinode->rdentries, rinode_list) {
-        spin_lock(&rdentry->lock);
+        rfs_spin_lock(&rdentry->lock);
         rinfo = rfs_info_get(rdentry->rinfo);
-        spin_unlock(&rdentry->lock);
+        rfs_spin_unlock(&rdentry->lock);
 
         rchain = rfs_chain_join(rinfo->rchain, rchain_old);
 
@@ -459,14 +460,14 @@ static int rfs_inode_set_rinfo_fast(struct rfs_inode *rinode)
 
     rdentry = list_entry(rinode->rdentries.next, struct rfs_dentry, rinode_list);
 
-    spin_lock(&rdentry->lock);
-    spin_lock(&rinode->lock);
+    rfs_spin_lock(&rdentry->lock);
+    rfs_spin_lock(&rinode->lock);
     {
         rinfo_old = rinode->rinfo;
         rinode->rinfo = rfs_info_get(rdentry->rinfo);
     }
-    spin_unlock(&rinode->lock);
-    spin_unlock(&rdentry->lock);
+    rfs_spin_unlock(&rinode->lock);
+    rfs_spin_unlock(&rdentry->lock);
 
     rfs_info_put(rinfo_old);
 
@@ -477,11 +478,11 @@ struct rfs_info *rfs_inode_get_rinfo(struct rfs_inode *rinode)
 {
     struct rfs_info *rinfo;
 
-    spin_lock(&rinode->lock);
+    rfs_spin_lock(&rinode->lock);
     {
         rinfo = rfs_info_get(rinode->rinfo);
     }
-    spin_unlock(&rinode->lock);
+    rfs_spin_unlock(&rinode->lock);
 
     return rinfo;
 }
@@ -539,12 +540,12 @@ int rfs_inode_set_rinfo(struct rfs_inode *rinode)
         }
 
         rfs_chain_ops(rinfo->rchain, rinfo->rops);
-        spin_lock(&rinode->lock);
+        rfs_spin_lock(&rinode->lock);
         { // start of the lock
             rinfo_old = rinode->rinfo;
             rinode->rinfo = rinfo;
         } // end of the lock
-        spin_unlock(&rinode->lock);
+        rfs_spin_unlock(&rinode->lock);
     } // end of the mutex lock
     rfs_mutex_unlock(&rinode->mutex);
 
@@ -1849,7 +1850,7 @@ void rfs_inode_set_ops(struct rfs_inode *rinode)
 {
     umode_t mode = rinode->inode->i_mode;
 
-    spin_lock(&rinode->lock);
+    rfs_spin_lock(&rinode->lock);
     {
         if (S_ISREG(mode)) {
             rfs_inode_set_ops_reg(rinode);
@@ -1891,7 +1892,7 @@ void rfs_inode_set_ops(struct rfs_inode *rinode)
 
     #endif /* !RFS_PER_OBJECT_OPS */
     }
-    spin_unlock(&rinode->lock);
+    rfs_spin_unlock(&rinode->lock);
     
 #ifndef RFS_PER_OBJECT_OPS
     spin_lock(&rinode->inode->i_lock);
@@ -0,0 +1,225 @@
+/*
+ * RedirFS: Redirecting File System
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/sched.h>
+#include "rfs_lock.h"
+#include "rfs_dbg.h"
+
+#ifdef RFS_DBG
+    #pragma GCC push_options
+    #pragma GCC optimize ("O0")
+#endif // RFS_DBG
+
+#ifdef RFS_LOCK_STAT
+
+struct rfs_lock_stat {
+    u64 acquired;
+    u64 contended;
+    u64 wait_total;
+    u64 wait_max;
+    u64 hold_total;
+    u64 hold_max;
+    u64 wait_hist[RFS_LOCK_HIST_SIZE];
+    u64 hold_hist[RFS_LOCK_HIST_SIZE];
+};
+
+static DEFINE_PER_CPU(struct rfs_lock_stat, rfs_lock_stats[RFS_LOCK_MAX]);
+
+static const char *rfs_lock_class_to_string[RFS_LOCK_MAX] = {
+    [RFS_LOCK_PATH_MUTEX] = "rfs_path_mutex",
+    [RFS_LOCK_FLT_LIST_MUTEX] = "rfs_flt_list_mutex",
+    [RFS_LOCK_SNAPSHOT_MUTEX] = "rfs_snapshot_mutex",
+    [RFS_LOCK_RINODE_MUTEX] = "rinode->mutex",
+    [RFS_LOCK_RINODE] = "rinode->lock",
+    [RFS_LOCK_RDENTRY] = "rdentry->lock",
+    [RFS_LOCK_RFILE] = "rfile->lock",
+    [RFS_LOCK_RROOT] = "rroot->lock",
+    [RFS_LOCK_RADIX_INODE] = "rfs_inode_radix_tree.lock",
+    [RFS_LOCK_RADIX_DENTRY] = "rfs_dentry_radix_tree.lock",
+    [RFS_LOCK_RADIX_FILE] = "rfs_file_radix_tree.lock",
+    [RFS_LOCK_RADIX_OPS] = "rfs_hoperations_radix_tree.lock",
+    [RFS_LOCK_TABLE_ENTRY] = "rfs_object_table_entry->lock",
+    [RFS_LOCK_RFLT] = "rflt->lock",
+};
+
+/*---------------------------------------------------------------------------*/
+
+u64 rfs_lock_stat_clock(void)
+{
+    return local_clock();
+}
+
+/* bucket 0 is < 1024ns, bucket i is [2^(i+9), 2^(i+10)) ns */
+static inline int rfs_lock_hist_idx(u64 ns)
+{
+    int idx = fls64(ns >> 10);
+
+    return min(idx, RFS_LOCK_HIST_SIZE - 1);
+}
+
+void rfs_lock_stat_acquired(enum rfs_lock_class lclass, u64 wait,
+        bool contended)
+{
+    struct rfs_lock_stat *stat;
+
+    DBG_BUG_ON(lclass >= RFS_LOCK_MAX);
+
+    stat = &get_cpu_var(rfs_lock_stats)[lclass];
+    {
+        stat->acquired++;
+        if (contended) {
+            stat->contended++;
+            stat->wait_total += wait;
+            if (wait > stat->wait_max)
+                stat->wait_max = wait;
+            stat->wait_hist[rfs_lock_hist_idx(wait)]++;
+        }
+    }
+    put_cpu_var(rfs_lock_stats);
+}
+
+void rfs_lock_stat_released(enum rfs_lock_class lclass, u64 hold)
+{
+    struct rfs_lock_stat *stat;
+
+    DBG_BUG_ON(lclass >= RFS_LOCK_MAX);
+
+    stat = &get_cpu_var(rfs_lock_stats)[lclass];
+    {
+        stat->hold_total += hold;
+        if (hold > stat->hold_max)
+            stat->hold_max = hold;
+        stat->hold_hist[rfs_lock_hist_idx(hold)]++;
+    }
+    put_cpu_var(rfs_lock_stats);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void rfs_lock_stat_sum(enum rfs_lock_class lclass,
+        struct rfs_lock_stat *sum)
+{
+    struct rfs_lock_stat *stat;
+    int cpu;
+    int i;
+
+    memset(sum, 0, sizeof(*sum));
+
+    for_each_possible_cpu(cpu) {
+        stat = &per_cpu(rfs_lock_stats, cpu)[lclass];
+        sum->acquired += stat->acquired;
+        sum->contended += stat->contended;
+        sum->wait_total += stat->wait_total;
+        sum->hold_total += stat->hold_total;
+        sum->wait_max = max(sum->wait_max, stat->wait_max);
+        sum->hold_max = max(sum->hold_max, stat->hold_max);
+        for (i = 0; i < RFS_LOCK_HIST_SIZE; i++) {
+            sum->wait_hist[i] += stat->wait_hist[i];
+            sum->hold_hist[i] += stat->hold_hist[i];
+        }
+    }
+}
+
+static ssize_t rfs_lock_stat_hist(char *buf, ssize_t size, const char *name,
+        u64 *hist)
+{
+    ssize_t bytes;
+    int i;
+
+    bytes = snprintf(buf, size, "  %s:", name);
+
+    for (i = 0; i < RFS_LOCK_HIST_SIZE && bytes < size; i++) {
+        if (!hist[i])
+            continue;
+
+        bytes += snprintf(buf + bytes, size - bytes, " %d:%llu", i,
+                (unsigned long long)hist[i]);
+    }
+
+    if (bytes < size)
+        bytes += snprintf(buf + bytes, size - bytes, "\n");
+
+    return bytes;
+}
+
+/*
+ * the output is one line per lock class with times in nanoseconds
+ *
+ *     <class> <acquired> <contended> <wait total> <wait max>
+ *             <hold total> <hold max>
+ *
+ * followed by the non empty wait and hold histogram buckets as
+ * <bucket>:<count> pairs, bucket 0 counts times below 1us and bucket i
+ * times in the [2^(i-1), 2^i) us range
+ */
+ssize_t rfs_lock_stat_get(char *buf, ssize_t size)
+{
+    struct rfs_lock_stat sum;
+    ssize_t bytes = 0;
+    int i;
+
+    if (!size)
+        return 0;
+
+    buf[0] = '\0';
+    for (i = 0; i < RFS_LOCK_MAX && bytes < size; i++) {
+        rfs_lock_stat_sum(i, &sum);
+
+        bytes += snprintf(buf + bytes, size - bytes,
+                "%s %llu %llu %llu %llu %llu %llu\n",
+                rfs_lock_class_to_string[i],
+                (unsigned long long)sum.acquired,
+                (unsigned long long)sum.contended,
+                (unsigned long long)sum.wait_total,
+                (unsigned long long)sum.wait_max,
+                (unsigned long long)sum.hold_total,
+                (unsigned long long)sum.hold_max);
+
+        if (!sum.acquired || bytes >= size)
+            continue;
+
+        bytes += rfs_lock_stat_hist(buf + bytes, size - bytes, "wait",
+                sum.wait_hist);
+        if (bytes >= size)
+            continue;
+
+        bytes += rfs_lock_stat_hist(buf + bytes, size - bytes, "hold",
+                sum.hold_hist);
+    }
+
+    return min(bytes, size);
+}
+
+void rfs_lock_stat_reset(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu(rfs_lock_stats, cpu), 0,
+                sizeof(struct rfs_lock_stat) * RFS_LOCK_MAX);
+}
+
+#endif /* RFS_LOCK_STAT */
+
+#ifdef RFS_DBG
+    #pragma GCC pop_options
+#endif // RFS_DBG
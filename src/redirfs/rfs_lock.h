@@ -0,0 +1,132 @@
+/*
+ * RedirFS: Redirecting File System
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RFS_LOCK_H
+#define _RFS_LOCK_H
+
+#include <linux/types.h>
+#include <linux/version.h>
+#include <linux/spinlock.h>
+
+#ifndef __SPIN_LOCK_INITIALIZER
+#define __SPIN_LOCK_INITIALIZER(lockname)  __SPIN_LOCK_UNLOCKED(lockname)
+#endif
+
+/*
+ * lock classes accounted by the RFS_LOCK_STAT instrumentation, see
+ * doc/redirfs/locking.txt for the lock ordering
+ */
+enum rfs_lock_class {
+    RFS_LOCK_PATH_MUTEX,        /* rfs_path_mutex */
+    RFS_LOCK_FLT_LIST_MUTEX,    /* rfs_flt_list_mutex */
+    RFS_LOCK_SNAPSHOT_MUTEX,    /* rfs_snapshot_mutex */
+    RFS_LOCK_RINODE_MUTEX,      /* rfs_inode->mutex */
+    RFS_LOCK_RINODE,            /* rfs_inode->lock */
+    RFS_LOCK_RDENTRY,           /* rfs_dentry->lock */
+    RFS_LOCK_RFILE,             /* rfs_file->lock */
+    RFS_LOCK_RROOT,             /* rfs_root->lock */
+    RFS_LOCK_RADIX_INODE,       /* rfs_inode_radix_tree.lock */
+    RFS_LOCK_RADIX_DENTRY,      /* rfs_dentry_radix_tree.lock */
+    RFS_LOCK_RADIX_FILE,        /* rfs_file_radix_tree.lock */
+    RFS_LOCK_RADIX_OPS,         /* rfs_*_hoperations_radix_tree.lock */
+    RFS_LOCK_TABLE_ENTRY,       /* rfs_object_table_entry->lock */
+    RFS_LOCK_RFLT,              /* rfs_flt->lock */
+
+    RFS_LOCK_MAX
+};
+
+#ifdef RFS_LOCK_STAT
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25))
+    #error "RFS_LOCK_STAT requires the sysfs info directory, 2.6.25+"
+#endif
+
+/*
+ * the lock statistics are kept in per-CPU counters, the wait time is
+ * measured only when the fast trylock path fails, the hold time is
+ * measured from the acquisition timestamp stored in the lock itself,
+ * it is written only by the lock owner
+ */
+
+#define RFS_LOCK_HIST_SIZE 24 /* log2 buckets, the first one is < 1us */
+
+u64 rfs_lock_stat_clock(void);
+void rfs_lock_stat_acquired(enum rfs_lock_class lclass, u64 wait,
+        bool contended);
+void rfs_lock_stat_released(enum rfs_lock_class lclass, u64 hold);
+ssize_t rfs_lock_stat_get(char *buf, ssize_t size);
+void rfs_lock_stat_reset(void);
+
+typedef struct rfs_stat_spinlock {
+    spinlock_t          lock;
+    enum rfs_lock_class lclass;
+    u64                 acquired;
+} rfs_spinlock_t;
+
+#define RFS_SPIN_LOCK_INITIALIZER(lockname, class) \
+    { \
+        .lock = __SPIN_LOCK_INITIALIZER(lockname.lock), \
+        .lclass = class, \
+        .acquired = 0, \
+    }
+
+#define rfs_spin_lock_init(l, class) \
+    do { \
+        spin_lock_init(&(l)->lock); \
+        (l)->lclass = (class); \
+        (l)->acquired = 0; \
+    } while (0)
+
+static inline void rfs_spin_lock(rfs_spinlock_t *l)
+{
+    u64 start = 0;
+
+    if (!spin_trylock(&l->lock)) {
+        start = rfs_lock_stat_clock();
+        spin_lock(&l->lock);
+    }
+
+    l->acquired = rfs_lock_stat_clock();
+    rfs_lock_stat_acquired(l->lclass, start ? l->acquired - start : 0,
+            start != 0);
+}
+
+static inline void rfs_spin_unlock(rfs_spinlock_t *l)
+{
+    u64 hold = rfs_lock_stat_clock() - l->acquired;
+    enum rfs_lock_class lclass = l->lclass;
+
+    spin_unlock(&l->lock);
+    rfs_lock_stat_released(lclass, hold);
+}
+
+#else /* RFS_LOCK_STAT */
+
+typedef spinlock_t rfs_spinlock_t;
+
+#define RFS_SPIN_LOCK_INITIALIZER(lockname, class) \
+    __SPIN_LOCK_INITIALIZER(lockname)
+
+#define rfs_spin_lock_init(l, class) spin_lock_init(l)
+#define rfs_spin_lock(l) spin_lock(l)
+#define rfs_spin_unlock(l) spin_unlock(l)
+
+#endif /* !RFS_LOCK_STAT */
+
+#endif /* _RFS_LOCK_H */
@@ -0,0 +1,574 @@
+/*
+ * RedirFS: Redirecting File System
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rfs.h"
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0))
+
+#include <net/genetlink.h>
+#include <linux/vmalloc.h>
+#include "rfs_snapshot.h"
+
+#ifdef RFS_DBG
+    #pragma GCC push_options
+    #pragma GCC optimize ("O0")
+#endif // RFS_DBG
+
+/*
+ * cb->args of the dump callbacks
+ */
+enum {
+    RFS_NL_DUMP_SNAP,       /* private snapshot, see rfs_snapshot_alloc */
+    RFS_NL_DUMP_OFF,        /* offset of the next record */
+    RFS_NL_DUMP_FLT_NR,     /* filter records left */
+    RFS_NL_DUMP_PATH_NR,    /* path records left for the current filter */
+    RFS_NL_DUMP_CNT_NR,     /* counter records left */
+    RFS_NL_DUMP_FLT         /* offset of the current filter record */
+};
+
+static const struct nla_policy rfs_nl_policy[RFS_NL_A_MAX + 1] = {
+    [RFS_NL_A_FILTER] = { .type = NLA_NUL_STRING },
+    [RFS_NL_A_PRIORITY] = { .type = NLA_U32 },
+    [RFS_NL_A_ACTIVE] = { .type = NLA_U32 },
+    [RFS_NL_A_PATH] = { .type = NLA_NUL_STRING, .len = PATH_MAX - 1 },
+    [RFS_NL_A_PATH_ID] = { .type = NLA_U32 },
+    [RFS_NL_A_PATH_FLAGS] = { .type = NLA_U32 },
+    [RFS_NL_A_COUNTER_NAME] = { .type = NLA_NUL_STRING },
+    [RFS_NL_A_COUNTER_VALUE] = { .type = NLA_U64 },
+    [RFS_NL_A_PATHS] = { .type = NLA_NESTED },
+};
+
+static const struct genl_multicast_group rfs_nl_mcgrps[] = {
+    { .name = RFS_NL_EVENTS_GROUP },
+};
+
+static int rfs_nl_put_u64(struct sk_buff *skb, int attr, u64 value)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,7,0))
+    return nla_put_u64_64bit(skb, attr, value, RFS_NL_A_PAD);
+#else
+    return nla_put_u64(skb, attr, value);
+#endif
+}
+
+static struct rfs_flt *rfs_nl_flt_get(struct genl_info *info)
+{
+    if (!info->attrs[RFS_NL_A_FILTER])
+        return ERR_PTR(-EINVAL);
+
+    return rfs_flt_find(nla_data(info->attrs[RFS_NL_A_FILTER]));
+}
+
+static int rfs_nl_path_add(struct sk_buff *skb, struct genl_info *info)
+{
+    struct rfs_flt *rflt;
+    int rv;
+
+    if (!info->attrs[RFS_NL_A_PATH] || !info->attrs[RFS_NL_A_PATH_FLAGS])
+        return -EINVAL;
+
+    rflt = rfs_nl_flt_get(info);
+    if (IS_ERR(rflt))
+        return PTR_ERR(rflt);
+
+    rv = rfs_flt_ctl_add_path(rflt, nla_data(info->attrs[RFS_NL_A_PATH]),
+            nla_get_u32(info->attrs[RFS_NL_A_PATH_FLAGS]));
+
+    rfs_flt_put(rflt);
+
+    return rv;
+}
+
+static const char *rfs_nl_get_str(struct nlattr *nla)
+{
+    char *str = nla_data(nla);
+    int len = nla_len(nla);
+
+    if (!len || str[len - 1])
+        return NULL;
+
+    return str;
+}
+
+static int rfs_nl_get_entry(struct nlattr *entry, const char **path,
+        int *flags)
+{
+    struct nlattr *nla;
+    int rem;
+
+    *path = NULL;
+    *flags = 0;
+
+    nla_for_each_nested(nla, entry, rem) {
+        if (nla_type(nla) == RFS_NL_A_PATH)
+            *path = rfs_nl_get_str(nla);
+
+        else if (nla_type(nla) == RFS_NL_A_PATH_FLAGS &&
+                nla_len(nla) >= sizeof(u32))
+            *flags = nla_get_u32(nla);
+    }
+
+    if (!*path || !*flags)
+        return -EINVAL;
+
+    return 0;
+}
+
+static int rfs_nl_paths_add(struct sk_buff *skb, struct genl_info *info)
+{
+    struct nlattr *paths_attr = info->attrs[RFS_NL_A_PATHS];
+    struct rfs_flt *rflt;
+    struct nlattr *nla;
+    const char **paths;
+    int *flags;
+    int nr = 0;
+    int rem;
+    int rv = 0;
+
+    if (!paths_attr)
+        return -EINVAL;
+
+    nla_for_each_nested(nla, paths_attr, rem)
+        nr++;
+
+    if (!nr)
+        return -EINVAL;
+
+    paths = vmalloc(sizeof(*paths) * nr);
+    flags = vmalloc(sizeof(*flags) * nr);
+    if (!paths || !flags) {
+        rv = -ENOMEM;
+        goto exit;
+    }
+
+    nr = 0;
+    nla_for_each_nested(nla, paths_attr, rem) {
+        if (nla_type(nla) != RFS_NL_A_PATH_ENTRY) {
+            rv = -EINVAL;
+            goto exit;
+        }
+
+        rv = rfs_nl_get_entry(nla, &paths[nr], &flags[nr]);
+        if (rv)
+            goto exit;
+
+        nr++;
+    }
+
+    rflt = rfs_nl_flt_get(info);
+    if (IS_ERR(rflt)) {
+        rv = PTR_ERR(rflt);
+        goto exit;
+    }
+
+    rv = rfs_flt_ctl_add_paths(rflt, paths, flags, nr);
+
+    rfs_flt_put(rflt);
+exit:
+    vfree(flags);
+    vfree(paths);
+    return rv;
+}
+
+static int rfs_nl_path_rem(struct sk_buff *skb, struct genl_info *info)
+{
+    struct rfs_flt *rflt;
+    int rv;
+
+    rflt = rfs_nl_flt_get(info);
+    if (IS_ERR(rflt))
+        return PTR_ERR(rflt);
+
+    if (info->attrs[RFS_NL_A_PATH_ID])
+        rv = rfs_flt_ctl_rem_path_id(rflt,
+                nla_get_u32(info->attrs[RFS_NL_A_PATH_ID]));
+
+    else if (info->attrs[RFS_NL_A_PATH])
+        rv = rfs_flt_ctl_rem_path_name(rflt,
+                nla_data(info->attrs[RFS_NL_A_PATH]));
+
+    else
+        rv = -EINVAL;
+
+    rfs_flt_put(rflt);
+
+    return rv;
+}
+
+static int rfs_nl_activate(struct sk_buff *skb, struct genl_info *info)
+{
+    struct rfs_flt *rflt;
+    int rv;
+
+    rflt = rfs_nl_flt_get(info);
+    if (IS_ERR(rflt))
+        return PTR_ERR(rflt);
+
+    rv = rfs_flt_ctl_activate(rflt,
+            info->genlhdr->cmd == RFS_NL_C_ACTIVATE);
+
+    rfs_flt_put(rflt);
+
+    return rv;
+}
+
+static int rfs_nl_put_flt(struct sk_buff *skb, struct rfs_snapshot_flt *flt)
+{
+    if (nla_put_string(skb, RFS_NL_A_FILTER, flt->name) ||
+        nla_put_u32(skb, RFS_NL_A_PRIORITY, flt->priority) ||
+        nla_put_u32(skb, RFS_NL_A_ACTIVE, flt->active))
+        return -EMSGSIZE;
+
+    return 0;
+}
+
+static int rfs_nl_put_path(struct sk_buff *skb, const char *flt,
+        struct rfs_snapshot_path *path)
+{
+    if (nla_put_string(skb, RFS_NL_A_FILTER, flt) ||
+        nla_put_u32(skb, RFS_NL_A_PATH_ID, path->id) ||
+        nla_put_u32(skb, RFS_NL_A_PATH_FLAGS, path->flags) ||
+        nla_put_string(skb, RFS_NL_A_PATH, path->name))
+        return -EMSGSIZE;
+
+    return 0;
+}
+
+static int rfs_nl_put_cnt(struct sk_buff *skb, struct rfs_snapshot_cnt *cnt)
+{
+    if (nla_put_string(skb, RFS_NL_A_COUNTER_NAME, cnt->name) ||
+        rfs_nl_put_u64(skb, RFS_NL_A_COUNTER_VALUE, cnt->value))
+        return -EMSGSIZE;
+
+    return 0;
+}
+
+static struct genl_family rfs_nl_family;
+
+/*
+ * The dumps walk a private snapshot so the state stays consistent across
+ * the callbacks and no redirfs lock is held while the messages are built.
+ * Each record is sent as one NLM_F_MULTI message of the dumped type.
+ */
+static int rfs_nl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+    struct rfs_snapshot *snap = (struct rfs_snapshot *)cb->args[RFS_NL_DUMP_SNAP];
+    struct rfs_snapshot_hdr *hdr;
+    struct rfs_snapshot_flt *flt;
+    int cmd = ((struct genlmsghdr *)nlmsg_data(cb->nlh))->cmd;
+    int msgs = 0;
+    void *data;
+    void *msg;
+    u32 *size;
+    int rv;
+
+    if (!snap) {
+        snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+        if (!snap)
+            return -ENOMEM;
+
+        rv = rfs_snapshot_alloc(snap);
+        if (rv) {
+            kfree(snap);
+            return rv;
+        }
+
+        hdr = (struct rfs_snapshot_hdr *)snap->buf;
+        cb->args[RFS_NL_DUMP_SNAP] = (long)snap;
+        cb->args[RFS_NL_DUMP_OFF] = ALIGN(sizeof(*hdr), 8);
+        cb->args[RFS_NL_DUMP_FLT_NR] = hdr->flt_nr;
+        cb->args[RFS_NL_DUMP_CNT_NR] = hdr->cnt_nr;
+    }
+
+    for (;;) {
+        if (cb->args[RFS_NL_DUMP_OFF] >= snap->len)
+            break;
+
+        data = snap->buf + cb->args[RFS_NL_DUMP_OFF];
+        size = data;
+        flt = (struct rfs_snapshot_flt *)(snap->buf +
+                cb->args[RFS_NL_DUMP_FLT]);
+
+        if (cb->args[RFS_NL_DUMP_PATH_NR]) {
+            if (cmd != RFS_NL_C_GET_PATH)
+                goto next;
+
+        } else if (cb->args[RFS_NL_DUMP_FLT_NR]) {
+            if (cmd != RFS_NL_C_GET_FILTER)
+                goto next;
+
+        } else if (cb->args[RFS_NL_DUMP_CNT_NR]) {
+            if (cmd != RFS_NL_C_GET_COUNTER)
+                goto next;
+
+        } else
+            break;
+
+        msg = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+                cb->nlh->nlmsg_seq, &rfs_nl_family, NLM_F_MULTI, cmd);
+        if (!msg)
+            goto full;
+
+        if (cmd == RFS_NL_C_GET_PATH)
+            rv = rfs_nl_put_path(skb, flt->name, data);
+        else if (cmd == RFS_NL_C_GET_FILTER)
+            rv = rfs_nl_put_flt(skb, data);
+        else
+            rv = rfs_nl_put_cnt(skb, data);
+
+        if (rv) {
+            genlmsg_cancel(skb, msg);
+            goto full;
+        }
+
+        genlmsg_end(skb, msg);
+        msgs++;
+next:
+        if (cb->args[RFS_NL_DUMP_PATH_NR])
+            cb->args[RFS_NL_DUMP_PATH_NR]--;
+
+        else if (cb->args[RFS_NL_DUMP_FLT_NR]) {
+            cb->args[RFS_NL_DUMP_FLT] = cb->args[RFS_NL_DUMP_OFF];
+            cb->args[RFS_NL_DUMP_PATH_NR] =
+                ((struct rfs_snapshot_flt *)data)->paths_nr;
+            cb->args[RFS_NL_DUMP_FLT_NR]--;
+
+        } else
+            cb->args[RFS_NL_DUMP_CNT_NR]--;
+
+        cb->args[RFS_NL_DUMP_OFF] += *size;
+    }
+
+    return skb->len;
+
+full:
+    /* a single record does not fit into an empty skb */
+    if (!msgs)
+        return -EMSGSIZE;
+
+    return skb->len;
+}
+
+static int rfs_nl_dump_done(struct netlink_callback *cb)
+{
+    struct rfs_snapshot *snap = (struct rfs_snapshot *)cb->args[RFS_NL_DUMP_SNAP];
+
+    if (!snap)
+        return 0;
+
+    rfs_snapshot_release(snap);
+    kfree(snap);
+
+    return 0;
+}
+
+static const struct genl_ops rfs_nl_ops[] = {
+    {
+        .cmd = RFS_NL_C_PATH_ADD,
+        .flags = GENL_ADMIN_PERM,
+        .policy = rfs_nl_policy,
+        .doit = rfs_nl_path_add,
+    },
+    {
+        .cmd = RFS_NL_C_PATH_REM,
+        .flags = GENL_ADMIN_PERM,
+        .policy = rfs_nl_policy,
+        .doit = rfs_nl_path_rem,
+    },
+    {
+        .cmd = RFS_NL_C_ACTIVATE,
+        .flags = GENL_ADMIN_PERM,
+        .policy = rfs_nl_policy,
+        .doit = rfs_nl_activate,
+    },
+    {
+        .cmd = RFS_NL_C_DEACTIVATE,
+        .flags = GENL_ADMIN_PERM,
+        .policy = rfs_nl_policy,
+        .doit = rfs_nl_activate,
+    },
+    {
+        .cmd = RFS_NL_C_PATHS_ADD,
+        .flags = GENL_ADMIN_PERM,
+        .policy = rfs_nl_policy,
+        .doit = rfs_nl_paths_add,
+    },
+    {
+        .cmd = RFS_NL_C_GET_FILTER,
+        .policy = rfs_nl_policy,
+        .dumpit = rfs_nl_dump,
+        .done = rfs_nl_dump_done,
+    },
+    {
+        .cmd = RFS_NL_C_GET_PATH,
+        .policy = rfs_nl_policy,
+        .dumpit = rfs_nl_dump,
+        .done = rfs_nl_dump_done,
+    },
+    {
+        .cmd = RFS_NL_C_GET_COUNTER,
+        .policy = rfs_nl_policy,
+        .dumpit = rfs_nl_dump,
+        .done = rfs_nl_dump_done,
+    },
+};
+
+/*
+ * Adding paths walks the dcache and may take long, so the operations do not
+ * run under the global genl_mutex. The filters and paths are protected by
+ * the redirfs locks and each dump works on its own snapshot.
+ */
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0))
+
+static struct genl_family rfs_nl_family = {
+    .id = GENL_ID_GENERATE,
+    .name = RFS_NL_FAMILY,
+    .version = RFS_NL_VERSION,
+    .maxattr = RFS_NL_A_MAX,
+    .parallel_ops = true,
+};
+
+int rfs_nl_init(void)
+{
+    return genl_register_family_with_ops_groups(&rfs_nl_family, rfs_nl_ops,
+            rfs_nl_mcgrps);
+}
+
+#else
+
+static struct genl_family rfs_nl_family = {
+    .name = RFS_NL_FAMILY,
+    .version = RFS_NL_VERSION,
+    .maxattr = RFS_NL_A_MAX,
+    .parallel_ops = true,
+    .module = THIS_MODULE,
+    .ops = rfs_nl_ops,
+    .n_ops = ARRAY_SIZE(rfs_nl_ops),
+    .mcgrps = rfs_nl_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(rfs_nl_mcgrps),
+};
+
+int rfs_nl_init(void)
+{
+    return genl_register_family(&rfs_nl_family);
+}
+
+#endif
+
+void rfs_nl_exit(void)
+{
+    genl_unregister_family(&rfs_nl_family);
+}
+
+static struct sk_buff *rfs_nl_event_new(int cmd, void **msg)
+{
+    struct sk_buff *skb;
+
+    skb = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+    if (!skb)
+        return NULL;
+
+    *msg = genlmsg_put(skb, 0, 0, &rfs_nl_family, 0, cmd);
+    if (!*msg) {
+        nlmsg_free(skb);
+        return NULL;
+    }
+
+    return skb;
+}
+
+/*
+ * events are best effort, they are dropped when there is no listener or
+ * the message cannot be allocated
+ */
+static void rfs_nl_event_send(struct sk_buff *skb, void *msg, int err)
+{
+    if (err) {
+        nlmsg_free(skb);
+        return;
+    }
+
+    genlmsg_end(skb, msg);
+    genlmsg_multicast(&rfs_nl_family, skb, 0, 0, GFP_KERNEL);
+}
+
+void rfs_nl_event_flt(int cmd, struct rfs_flt *rflt)
+{
+    struct sk_buff *skb;
+    void *msg;
+    int err;
+
+    might_sleep();
+
+    skb = rfs_nl_event_new(cmd, &msg);
+    if (!skb)
+        return;
+
+    err = nla_put_string(skb, RFS_NL_A_FILTER, rflt->name) ||
+        nla_put_u32(skb, RFS_NL_A_PRIORITY, rflt->priority) ||
+        nla_put_u32(skb, RFS_NL_A_ACTIVE, atomic_read(&rflt->active));
+
+    rfs_nl_event_send(skb, msg, err);
+}
+
+void rfs_nl_event_path(int cmd, struct rfs_flt *rflt, struct rfs_path *rpath,
+        int flags)
+{
+    struct sk_buff *skb;
+    void *msg;
+    int err;
+
+    might_sleep();
+
+    skb = rfs_nl_event_new(cmd, &msg);
+    if (!skb)
+        return;
+
+    err = nla_put_string(skb, RFS_NL_A_FILTER, rflt->name) ||
+        nla_put_u32(skb, RFS_NL_A_PATH_ID, rpath->id) ||
+        nla_put_u32(skb, RFS_NL_A_PATH_FLAGS, flags) ||
+        nla_put_string(skb, RFS_NL_A_PATH, rpath->pathname);
+
+    rfs_nl_event_send(skb, msg, err);
+}
+
+void rfs_nl_event_walk(struct rfs_flt *rflt, const char *pathname, int flags)
+{
+    struct sk_buff *skb;
+    void *msg;
+    int err;
+
+    might_sleep();
+
+    skb = rfs_nl_event_new(RFS_NL_C_EV_WALK_START, &msg);
+    if (!skb)
+        return;
+
+    err = nla_put_string(skb, RFS_NL_A_FILTER, rflt->name) ||
+        nla_put_u32(skb, RFS_NL_A_PATH_FLAGS, flags) ||
+        nla_put_string(skb, RFS_NL_A_PATH, pathname);
+
+    rfs_nl_event_send(skb, msg, err);
+}
+
+#ifdef RFS_DBG
+    #pragma GCC pop_options
+#endif // RFS_DBG
+
+#endif /* LINUX_VERSION_CODE >= 3.13 */
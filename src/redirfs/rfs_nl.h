@@ -0,0 +1,145 @@
+/*
+ * RedirFS: Redirecting File System
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RFS_NL_H
+#define _RFS_NL_H
+
+/*
+ * Generic netlink family "redirfs", the protocol is mirrored in librfsctl,
+ * bump RFS_NL_VERSION on incompatible changes.
+ *
+ * Requests
+ *
+ *     PATH_ADD       FILTER, PATH, PATH_FLAGS
+ *     PATH_REM       FILTER, PATH_ID or PATH
+ *     PATHS_ADD      FILTER, PATHS, all or none of the paths are added
+ *     ACTIVATE       FILTER
+ *     DEACTIVATE     FILTER
+ *     GET_FILTER     dump, FILTER, PRIORITY, ACTIVE per message
+ *     GET_PATH       dump, FILTER, PATH_ID, PATH_FLAGS, PATH per message
+ *     GET_COUNTER    dump, COUNTER_NAME, COUNTER_VALUE per message
+ *
+ * Every request can be sent with NLM_F_ACK and many requests can be sent
+ * in one message buffer, the requests are processed in order.
+ *
+ * Events, multicast to the "events" group
+ *
+ *     EV_FLT_REGISTER, EV_FLT_UNREGISTER       FILTER
+ *     EV_FLT_ACTIVATE, EV_FLT_DEACTIVATE       FILTER
+ *     EV_WALK_START                            FILTER, PATH, PATH_FLAGS
+ *     EV_PATH_ADD, EV_PATH_REM                 FILTER, PATH_ID, PATH_FLAGS,
+ *                                              PATH
+ *
+ * EV_WALK_START is sent before the dcache of a new path is walked and
+ * EV_PATH_ADD once the walk finished.
+ */
+
+#define RFS_NL_FAMILY "redirfs"
+#define RFS_NL_VERSION 1
+#define RFS_NL_EVENTS_GROUP "events"
+
+enum rfs_nl_cmd {
+    RFS_NL_C_UNSPEC,
+    RFS_NL_C_PATH_ADD,
+    RFS_NL_C_PATH_REM,
+    RFS_NL_C_ACTIVATE,
+    RFS_NL_C_DEACTIVATE,
+    RFS_NL_C_GET_FILTER,
+    RFS_NL_C_GET_PATH,
+    RFS_NL_C_GET_COUNTER,
+    RFS_NL_C_EV_FLT_REGISTER,
+    RFS_NL_C_EV_FLT_UNREGISTER,
+    RFS_NL_C_EV_FLT_ACTIVATE,
+    RFS_NL_C_EV_FLT_DEACTIVATE,
+    RFS_NL_C_EV_WALK_START,
+    RFS_NL_C_EV_PATH_ADD,
+    RFS_NL_C_EV_PATH_REM,
+    RFS_NL_C_PATHS_ADD,
+
+    __RFS_NL_C_MAX
+};
+
+#define RFS_NL_C_MAX (__RFS_NL_C_MAX - 1)
+
+enum rfs_nl_attr {
+    RFS_NL_A_UNSPEC,
+    RFS_NL_A_FILTER,        /* string */
+    RFS_NL_A_PRIORITY,      /* u32 */
+    RFS_NL_A_ACTIVE,        /* u32 */
+    RFS_NL_A_PATH,          /* string */
+    RFS_NL_A_PATH_ID,       /* u32 */
+    RFS_NL_A_PATH_FLAGS,    /* u32, REDIRFS_PATH_INCLUDE or _EXCLUDE */
+    RFS_NL_A_COUNTER_NAME,  /* string */
+    RFS_NL_A_COUNTER_VALUE, /* u64 */
+    RFS_NL_A_PAD,
+    RFS_NL_A_PATHS,         /* nested PATH_ENTRY list */
+    RFS_NL_A_PATH_ENTRY,    /* nested PATH and PATH_FLAGS */
+
+    __RFS_NL_A_MAX
+};
+
+#define RFS_NL_A_MAX (__RFS_NL_A_MAX - 1)
+
+#ifdef __KERNEL__
+
+#include <linux/version.h>
+
+struct rfs_flt;
+struct rfs_path;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0))
+
+int rfs_nl_init(void);
+void rfs_nl_exit(void);
+void rfs_nl_event_flt(int cmd, struct rfs_flt *rflt);
+void rfs_nl_event_path(int cmd, struct rfs_flt *rflt, struct rfs_path *rpath,
+        int flags);
+void rfs_nl_event_walk(struct rfs_flt *rflt, const char *pathname,
+        int flags);
+
+#else
+
+static inline int rfs_nl_init(void)
+{
+    return 0;
+}
+
+static inline void rfs_nl_exit(void)
+{
+}
+
+static inline void rfs_nl_event_flt(int cmd, struct rfs_flt *rflt)
+{
+}
+
+static inline void rfs_nl_event_path(int cmd, struct rfs_flt *rflt,
+        struct rfs_path *rpath, int flags)
+{
+}
+
+static inline void rfs_nl_event_walk(struct rfs_flt *rflt,
+        const char *pathname, int flags)
+{
+}
+
+#endif
+
+#endif /* __KERNEL__ */
+
+#endif /* _RFS_NL_H */
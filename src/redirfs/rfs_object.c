@@ -25,6 +25,7 @@
 #include <linux/gfp.h>
 #include "rfs_object.h"
 #include "rfs_dbg.h"
+#include "rfs_snapshot.h"
 
 #ifdef RFS_DBG
     #pragma GCC push_options
@@ -97,7 +98,7 @@ rfs_object_table_init(
 
     for (i=0; i < table->array_size; ++i) {
         INIT_LIST_HEAD_RCU(&table->array[i].hash_list_head);
-        spin_lock_init(&table->array[i].lock);
+        rfs_spin_lock_init(&table->array[i].lock, RFS_LOCK_TABLE_ENTRY);
     }
 }
 
@@ -188,7 +189,7 @@ int rfs_insert_object(
     /* spin_lock can't synchronize user context with softirq */
     DBG_BUG_ON(rfs_in_softirq());
 
-    spin_lock(&table_entry->lock);
+    rfs_spin_lock(&table_entry->lock);
     { /* start of the lock */
 
 #ifdef RFS_DBG
@@ -216,7 +217,7 @@ int rfs_insert_object(
         }
 
     } /* end of the lock */
-    spin_unlock(&table_entry->lock);
+    rfs_spin_unlock(&table_entry->lock);
 
     /* undo in case of error */
     if (error)
@@ -250,11 +251,11 @@ rfs_remove_object(
     /* spin_lock can't synchronize user context with softirq */
     DBG_BUG_ON(rfs_in_softirq());
 
-    spin_lock(&table_entry->lock);
+    rfs_spin_lock(&table_entry->lock);
     { /* start of the lock */
         list_del_rcu(&rfs_object->hash_list_entry);
     } /* end of the lock */
-    spin_unlock(&table_entry->lock);
+    rfs_spin_unlock(&table_entry->lock);
 
     rfs_object->object_table = NULL;
 
@@ -315,13 +316,13 @@ int rfs_insert_object(
                 /* spin_lock can't synchronize user context with softirq */
                 DBG_BUG_ON(rfs_in_softirq());
 
-                spin_lock(&radix_tree->lock);
+                rfs_spin_lock(&radix_tree->lock);
                 {
                     err = radix_tree_insert(&radix_tree->root,
                                             (long)rfs_object->system_object,
                                             rfs_object);
                 }
-                spin_unlock(&radix_tree->lock);
+                rfs_spin_unlock(&radix_tree->lock);
 
                 if (err)
                 {
@@ -386,12 +387,12 @@ rfs_remove_object(
         /* spin_lock can't synchronize user context with softirq */
         DBG_BUG_ON(rfs_in_softirq());
 
-        spin_lock(&radix_tree->lock);
+        rfs_spin_lock(&radix_tree->lock);
         {
             removed = (rfs_object == radix_tree_delete(&radix_tree->root,
                                                        (long)rfs_object->system_object));
         }
-        spin_unlock(&radix_tree->lock);
+        rfs_spin_unlock(&radix_tree->lock);
 
         DBG_BUG_ON(!removed);
 
@@ -567,6 +568,17 @@ ssize_t rfs_get_stat(char *buf, ssize_t size)
 }
 #endif /* #if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,25)) */
 
+int rfs_object_snapshot(struct rfs_snapshot *snap)
+{
+    int i;
+
+    for (i = 0; i < RFS_TYPE_MAX; ++i)
+        rfs_snapshot_cnt(snap, rfs_type_to_string[i],
+                atomic_read(&rfs_objects_debug_info[i].objects_count));
+
+    return RFS_TYPE_MAX;
+}
+
 /*---------------------------------------------------------------------------*/
 
 #ifdef RFS_DBG
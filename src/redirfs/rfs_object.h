@@ -27,10 +27,7 @@
 #include <linux/list.h>
 
 #include <linux/spinlock.h>
-
-#ifndef __SPIN_LOCK_INITIALIZER
-#define __SPIN_LOCK_INITIALIZER(lockname)  __SPIN_LOCK_UNLOCKED(lockname)
-#endif
+#include "rfs_lock.h"
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0))
 #include <linux/refcount.h>
@@ -82,7 +79,7 @@ enum rfs_type {
 
 struct rfs_object_table_entry {
     struct list_head   hash_list_head;
-    spinlock_t         lock;
+    rfs_spinlock_t     lock;
 };
 
 struct rfs_object_table {
@@ -96,7 +93,7 @@ struct rfs_object_table {
 
 struct rfs_radix_tree {
     struct radix_tree_root    root;
-    spinlock_t                lock;
+    rfs_spinlock_t            lock;
     enum rfs_type             rfs_type; /* objects type in the table, might be RFS_TYPE_UNKNOWN*/
 };
 
@@ -24,7 +24,10 @@
  * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
 #include "rfs.h"
+#include "rfs_snapshot.h"
 
 #ifdef RFS_DBG
     #pragma GCC push_options
@@ -32,7 +35,7 @@
 #endif // RFS_DBG
 
 static LIST_HEAD(rfs_path_list);
-RFS_DEFINE_MUTEX(rfs_path_mutex);
+RFS_DEFINE_MUTEX(rfs_path_mutex, RFS_LOCK_PATH_MUTEX);
 
 static struct rfs_path *rfs_path_alloc(struct vfsmount *mnt,
         struct dentry *dentry)
@@ -429,6 +432,8 @@ redirfs_path redirfs_add_path(redirfs_filter filter,
     if (IS_ERR(rpath))
         goto exit;
 
+    rfs_nl_event_walk(filter, rpath->pathname, info->flags);
+
     if (info->flags == REDIRFS_PATH_INCLUDE)
         rv = rfs_path_add_include(rpath, filter);
 
@@ -447,12 +452,251 @@ redirfs_path redirfs_add_path(redirfs_filter filter,
 exit:
     rfs_mutex_unlock(&rfs_path_mutex);
     rfs_rename_unlock(info->dentry->d_inode->i_sb);
+
+    if (!IS_ERR(rpath))
+        rfs_nl_event_path(RFS_NL_C_EV_PATH_ADD, filter, rpath, info->flags);
+
     return rpath;
 }
 
+struct rfs_path_bulk {
+    struct redirfs_path_info *info;
+    struct super_block *sb;
+    struct rfs_path *rpath;
+    int depth;
+    int added;
+    int idx;
+};
+
+static int rfs_path_bulk_cmp_sb(const void *a, const void *b)
+{
+    const struct rfs_path_bulk *e1 = a;
+    const struct rfs_path_bulk *e2 = b;
+
+    if (e1->sb != e2->sb)
+        return e1->sb < e2->sb ? -1 : 1;
+
+    return e1->idx - e2->idx;
+}
+
+/*
+ * deeper paths first, the walk of a parent path then skips the subtrees
+ * which already became roots, so every dentry is visited once per batch
+ */
+static int rfs_path_bulk_cmp_depth(const void *a, const void *b)
+{
+    const struct rfs_path_bulk *e1 = a;
+    const struct rfs_path_bulk *e2 = b;
+
+    if (e1->depth != e2->depth)
+        return e2->depth - e1->depth;
+
+    return e1->idx - e2->idx;
+}
+
+static int rfs_path_bulk_depth(struct dentry *dentry)
+{
+    int depth = 0;
+
+    while (!IS_ROOT(dentry)) {
+        dentry = dentry->d_parent;
+        depth++;
+    }
+
+    return depth;
+}
+
+/*
+ * called with the rename lock and rfs_path_mutex, undoes the entries which
+ * were added by this batch in the reverse order
+ */
+static void rfs_path_bulk_undo(struct rfs_path_bulk *entries, int nr,
+        struct rfs_flt *rflt)
+{
+    struct rfs_path_bulk *e;
+    int i;
+
+    for (i = nr - 1; i >= 0; i--) {
+        e = &entries[i];
+        if (!e->rpath)
+            continue;
+
+        if (e->added) {
+            if (e->info->flags == REDIRFS_PATH_INCLUDE)
+                rfs_path_rem_include(e->rpath, rflt);
+            else
+                rfs_path_rem_exclude(e->rpath, rflt);
+        }
+
+        rfs_path_rem(e->rpath);
+        rfs_path_put(e->rpath);
+        e->rpath = NULL;
+        e->added = 0;
+    }
+}
+
+static int rfs_path_bulk_apply(struct rfs_path_bulk *entries, int nr,
+        struct rfs_flt *rflt)
+{
+    struct rfs_path_bulk *e;
+    struct rfs_path *rpath;
+    int rv = 0;
+    int i;
+
+    for (i = 0; i < nr; i++)
+        entries[i].depth = rfs_path_bulk_depth(entries[i].info->dentry);
+
+    sort(entries, nr, sizeof(*entries), rfs_path_bulk_cmp_depth, NULL);
+
+    for (i = 0; i < nr; i++) {
+        e = &entries[i];
+
+        rpath = rfs_path_add(e->info->mnt, e->info->dentry);
+        if (IS_ERR(rpath)) {
+            rv = PTR_ERR(rpath);
+            break;
+        }
+
+        e->rpath = rpath;
+
+        if (e->info->flags == REDIRFS_PATH_INCLUDE) {
+            if (rfs_chain_find(rpath->rinch, rflt) != -1)
+                continue;
+
+            rfs_nl_event_walk(rflt, rpath->pathname, e->info->flags);
+            rv = rfs_path_add_include(rpath, rflt);
+
+        } else {
+            if (rfs_chain_find(rpath->rexch, rflt) != -1)
+                continue;
+
+            rfs_nl_event_walk(rflt, rpath->pathname, e->info->flags);
+            rv = rfs_path_add_exclude(rpath, rflt);
+        }
+
+        if (rv)
+            break;
+
+        e->added = 1;
+    }
+
+    if (rv)
+        rfs_path_bulk_undo(entries, nr, rflt);
+
+    return rv;
+}
+
+/*
+ * Adds a set of include and exclude paths with all-or-nothing semantics,
+ * either all paths are added or the state is left as it was. The paths are
+ * applied per super block under one rename lock and rfs_path_mutex hold,
+ * deeper paths first. If paths is not NULL it receives a reference to each
+ * added path in the order of infos, release them with redirfs_put_path.
+ */
+int redirfs_add_paths(redirfs_filter filter, struct redirfs_path_info *infos,
+        int count, redirfs_path *paths)
+{
+    struct rfs_flt *rflt = (struct rfs_flt *)filter;
+    struct rfs_path_bulk *entries;
+    struct super_block *sb;
+    int start;
+    int rv = 0;
+    int i;
+    int j;
+
+    might_sleep();
+
+    if (!rflt || IS_ERR(rflt) || !infos || count <= 0)
+        return -EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if (!infos[i].mnt || !infos[i].dentry)
+            return -EINVAL;
+
+        if (infos[i].flags != REDIRFS_PATH_INCLUDE &&
+            infos[i].flags != REDIRFS_PATH_EXCLUDE)
+            return -EINVAL;
+
+        if (rfs_path_check_fs(infos[i].dentry->d_inode->i_sb->s_type))
+            return -EPERM;
+
+        /* the same path can not be included and excluded in one batch */
+        for (j = 0; j < i; j++) {
+            if (infos[j].dentry == infos[i].dentry &&
+                infos[j].mnt == infos[i].mnt &&
+                infos[j].flags != infos[i].flags)
+                return -EEXIST;
+        }
+    }
+
+    entries = vmalloc(sizeof(*entries) * count);
+    if (!entries)
+        return -ENOMEM;
+
+    memset(entries, 0, sizeof(*entries) * count);
+
+    for (i = 0; i < count; i++) {
+        entries[i].info = &infos[i];
+        entries[i].sb = infos[i].dentry->d_inode->i_sb;
+        entries[i].idx = i;
+    }
+
+    sort(entries, count, sizeof(*entries), rfs_path_bulk_cmp_sb, NULL);
+
+    for (start = 0; start < count; start = i) {
+        sb = entries[start].sb;
+        for (i = start; i < count && entries[i].sb == sb; i++)
+            ;
+
+        rfs_rename_lock(sb);
+        rfs_mutex_lock(&rfs_path_mutex);
+        rv = rfs_path_bulk_apply(entries + start, i - start, rflt);
+        rfs_mutex_unlock(&rfs_path_mutex);
+        rfs_rename_unlock(sb);
+
+        if (rv)
+            break;
+    }
+
+    /* roll back the super blocks which were already applied */
+    if (rv) {
+        while (start > 0) {
+            i = start;
+            sb = entries[i - 1].sb;
+            for (start = i; start > 0 && entries[start - 1].sb == sb; start--)
+                ;
+
+            rfs_rename_lock(sb);
+            rfs_mutex_lock(&rfs_path_mutex);
+            rfs_path_bulk_undo(entries + start, i - start, rflt);
+            rfs_mutex_unlock(&rfs_path_mutex);
+            rfs_rename_unlock(sb);
+        }
+
+        vfree(entries);
+        return rv;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (entries[i].added)
+            rfs_nl_event_path(RFS_NL_C_EV_PATH_ADD, rflt, entries[i].rpath,
+                    entries[i].info->flags);
+
+        if (paths)
+            paths[entries[i].idx] = entries[i].rpath;
+        else
+            rfs_path_put(entries[i].rpath);
+    }
+
+    vfree(entries);
+
+    return 0;
+}
+
 int redirfs_rem_path(redirfs_filter filter, redirfs_path path)
 {
     struct rfs_path *rpath = (struct rfs_path *)path;
+    int flags = 0;
     int rv;
 
     might_sleep();
@@ -463,13 +707,15 @@ int redirfs_rem_path(redirfs_filter filter, redirfs_path path)
     rfs_rename_lock(rpath->dentry->d_inode->i_sb);
     rfs_mutex_lock(&rfs_path_mutex);
 
-    if (rfs_chain_find(rpath->rinch, filter) != -1)
+    if (rfs_chain_find(rpath->rinch, filter) != -1) {
+        flags = REDIRFS_PATH_INCLUDE;
         rv = rfs_path_rem_include(path, filter);
 
-    else if (rfs_chain_find(rpath->rexch, filter) != -1)
+    } else if (rfs_chain_find(rpath->rexch, filter) != -1) {
+        flags = REDIRFS_PATH_EXCLUDE;
         rv = rfs_path_rem_exclude(path, filter);
 
-    else
+    } else
         rv = -EINVAL;
 
     rfs_path_rem(rpath);
@@ -477,6 +723,9 @@ int redirfs_rem_path(redirfs_filter filter, redirfs_path path)
     rfs_mutex_unlock(&rfs_path_mutex);
     rfs_rename_unlock(rpath->dentry->d_inode->i_sb);
 
+    if (!rv)
+        rfs_nl_event_path(RFS_NL_C_EV_PATH_REM, filter, rpath, flags);
+
     return rv;
 }
 
@@ -707,6 +956,43 @@ int rfs_path_get_info(struct rfs_flt *rflt, char *buf, int size)
     return len;
 }
 
+int rfs_path_snapshot(struct rfs_snapshot *snap, struct rfs_flt *rflt)
+{
+    struct rfs_snapshot_path *rec;
+    struct rfs_path *rpath;
+    size_t size;
+    int flags;
+    int nr = 0;
+
+    rfs_mutex_lock(&rfs_path_mutex);
+
+    list_for_each_entry(rpath, &rfs_path_list, list) {
+        if (rfs_chain_find(rpath->rinch, rflt) != -1)
+            flags = REDIRFS_PATH_INCLUDE;
+
+        else if (rfs_chain_find(rpath->rexch, rflt) != -1)
+            flags = REDIRFS_PATH_EXCLUDE;
+
+        else
+            continue;
+
+        size = rfs_snapshot_rec_size(sizeof(*rec), rpath->pathname);
+        rec = rfs_snapshot_reserve(snap, size);
+        if (rec) {
+            rec->size = size;
+            rec->id = rpath->id;
+            rec->flags = flags;
+            strcpy(rec->name, rpath->pathname);
+        }
+
+        nr++;
+    }
+
+    rfs_mutex_unlock(&rfs_path_mutex);
+
+    return nr;
+}
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25))
 
 int redirfs_get_filename(struct vfsmount *mnt, struct dentry *dentry, char *buf,
@@ -1044,6 +1330,7 @@ EXPORT_SYMBOL(redirfs_put_paths);
 EXPORT_SYMBOL(redirfs_get_path_info);
 EXPORT_SYMBOL(redirfs_put_path_info);
 EXPORT_SYMBOL(redirfs_add_path);
+EXPORT_SYMBOL(redirfs_add_paths);
 EXPORT_SYMBOL(redirfs_rem_path);
 EXPORT_SYMBOL(redirfs_rem_paths);
 EXPORT_SYMBOL(redirfs_get_filename);
@@ -0,0 +1,511 @@
+/*
+ * RedirFS: Redirecting File System
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include "rfs.h"
+
+#ifdef RFS_DBG
+    #pragma GCC push_options
+    #pragma GCC optimize ("O0")
+#endif // RFS_DBG
+
+/*
+ * Sampling profiler of the filters' callbacks. A hooked call is sampled
+ * if it is the N-th call on the CPU (sample_period) or if any of its
+ * callbacks is slower than sample_threshold. A sampled call produces one
+ * sample per called filter callback plus one sample for the whole call
+ * including the original operation. Samples are kept in per-CPU rings,
+ * the oldest samples are overwritten if the rings are not drained fast
+ * enough.
+ */
+
+#define RFS_PROF_RING_SIZE 128 /* power of 2 */
+#define RFS_PROF_NAME_LEN 32
+
+struct rfs_prof_sample {
+    u64 time;
+    u64 duration;
+    unsigned long ino;
+    enum redirfs_op_idc idc;
+    int call;
+    pid_t pid;
+    char flt[RFS_PROF_NAME_LEN];
+    char comm[TASK_COMM_LEN];
+};
+
+struct rfs_prof_ring {
+    spinlock_t lock;
+    unsigned int head;
+    unsigned int tail;
+    unsigned long lost;
+    unsigned int count;
+    struct rfs_prof_sample samples[RFS_PROF_RING_SIZE];
+};
+
+static struct rfs_prof_ring *rfs_prof_rings;
+
+unsigned int rfs_prof_period;
+u64 rfs_prof_threshold;
+
+static const char *rfs_prof_itype_names[RFS_INODE_MAX] = {
+    [RFS_INODE_DNONE] = "dnone",
+    [RFS_INODE_DSOCK] = "dsock",
+    [RFS_INODE_DLINK] = "dlink",
+    [RFS_INODE_DREG] = "dreg",
+    [RFS_INODE_DBULK] = "dblk",
+    [RFS_INODE_DDIR] = "ddir",
+    [RFS_INODE_DCHAR] = "dchr",
+    [RFS_INODE_DFIFO] = "dfifo",
+    [RFS_INODE_SOCK] = "sock",
+    [RFS_INODE_LINK] = "link",
+    [RFS_INODE_REG] = "reg",
+    [RFS_INODE_BULK] = "blk",
+    [RFS_INODE_DIR] = "dir",
+    [RFS_INODE_CHAR] = "chr",
+    [RFS_INODE_FIFO] = "fifo",
+};
+
+#define RFS_PROF_OP_NAME(op) [RFS_OP_##op] = #op
+
+static const char *rfs_prof_op_names[RFS_OP_MAX] = {
+    RFS_PROF_OP_NAME(d_revalidate),
+    RFS_PROF_OP_NAME(d_weak_revalidate),
+    RFS_PROF_OP_NAME(d_hash),
+    RFS_PROF_OP_NAME(d_compare),
+    RFS_PROF_OP_NAME(d_delete),
+    RFS_PROF_OP_NAME(d_init),
+    RFS_PROF_OP_NAME(d_release),
+    RFS_PROF_OP_NAME(d_prune),
+    RFS_PROF_OP_NAME(d_iput),
+    RFS_PROF_OP_NAME(d_dname),
+    RFS_PROF_OP_NAME(d_automount),
+    RFS_PROF_OP_NAME(d_manage),
+    RFS_PROF_OP_NAME(d_real),
+    RFS_PROF_OP_NAME(i_lookup),
+    RFS_PROF_OP_NAME(i_get_link),
+    RFS_PROF_OP_NAME(i_permission),
+    RFS_PROF_OP_NAME(i_get_acl),
+    RFS_PROF_OP_NAME(i_readlink),
+    RFS_PROF_OP_NAME(i_create),
+    RFS_PROF_OP_NAME(i_link),
+    RFS_PROF_OP_NAME(i_unlink),
+    RFS_PROF_OP_NAME(i_symlink),
+    RFS_PROF_OP_NAME(i_mkdir),
+    RFS_PROF_OP_NAME(i_rmdir),
+    RFS_PROF_OP_NAME(i_mknod),
+    RFS_PROF_OP_NAME(i_rename),
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)) && (LINUX_VERSION_CODE < KERNEL_VERSION(4,9,0))
+    RFS_PROF_OP_NAME(i_rename2),
+#endif
+    RFS_PROF_OP_NAME(i_setattr),
+    RFS_PROF_OP_NAME(i_getattr),
+    RFS_PROF_OP_NAME(i_listxattr),
+    RFS_PROF_OP_NAME(i_fiemap),
+    RFS_PROF_OP_NAME(i_update_time),
+    RFS_PROF_OP_NAME(i_atomic_open),
+    RFS_PROF_OP_NAME(i_tmpfile),
+    RFS_PROF_OP_NAME(i_set_acl),
+    RFS_PROF_OP_NAME(f_llseek),
+    RFS_PROF_OP_NAME(f_read),
+    RFS_PROF_OP_NAME(f_write),
+    RFS_PROF_OP_NAME(f_read_iter),
+    RFS_PROF_OP_NAME(f_write_iter),
+    RFS_PROF_OP_NAME(f_readdir),
+    RFS_PROF_OP_NAME(f_iterate),
+    RFS_PROF_OP_NAME(f_iterate_shared),
+    RFS_PROF_OP_NAME(f_poll),
+    RFS_PROF_OP_NAME(f_unlocked_ioctl),
+    RFS_PROF_OP_NAME(f_compat_ioctl),
+    RFS_PROF_OP_NAME(f_mmap),
+    RFS_PROF_OP_NAME(f_open),
+    RFS_PROF_OP_NAME(f_flush),
+    RFS_PROF_OP_NAME(f_release),
+    RFS_PROF_OP_NAME(f_fsync),
+    RFS_PROF_OP_NAME(f_fasync),
+    RFS_PROF_OP_NAME(f_lock),
+    RFS_PROF_OP_NAME(f_sendpage),
+    RFS_PROF_OP_NAME(f_get_unmapped_area),
+    RFS_PROF_OP_NAME(f_check_flags),
+    RFS_PROF_OP_NAME(f_flock),
+    RFS_PROF_OP_NAME(f_splice_write),
+    RFS_PROF_OP_NAME(f_splice_read),
+    RFS_PROF_OP_NAME(f_setlease),
+    RFS_PROF_OP_NAME(f_fallocate),
+    RFS_PROF_OP_NAME(f_show_fdinfo),
+    RFS_PROF_OP_NAME(f_copy_file_range),
+    RFS_PROF_OP_NAME(f_clone_file_range),
+    RFS_PROF_OP_NAME(f_dedupe_file_range),
+    RFS_PROF_OP_NAME(a_writepage),
+    RFS_PROF_OP_NAME(a_readpage),
+    RFS_PROF_OP_NAME(a_writepages),
+    RFS_PROF_OP_NAME(a_set_page_dirty),
+    RFS_PROF_OP_NAME(a_readpages),
+    RFS_PROF_OP_NAME(a_write_begin),
+    RFS_PROF_OP_NAME(a_write_end),
+    RFS_PROF_OP_NAME(a_bmap),
+    RFS_PROF_OP_NAME(a_invalidatepage),
+    RFS_PROF_OP_NAME(a_releasepage),
+    RFS_PROF_OP_NAME(a_direct_IO),
+    RFS_PROF_OP_NAME(a_migratepage),
+    RFS_PROF_OP_NAME(a_isolate_page),
+    RFS_PROF_OP_NAME(a_putback_page),
+    RFS_PROF_OP_NAME(a_launder_page),
+    RFS_PROF_OP_NAME(a_is_partially_uptodate),
+    RFS_PROF_OP_NAME(a_is_dirty_writeback),
+    RFS_PROF_OP_NAME(a_error_remove_page),
+    RFS_PROF_OP_NAME(a_swap_activate),
+    RFS_PROF_OP_NAME(a_swap_deactivate),
+};
+
+u64 rfs_prof_clock(void)
+{
+    return ktime_to_ns(ktime_get());
+}
+
+/*---------------------------------------------------------------------------*/
+
+static inline unsigned long rfs_prof_dentry_ino(const struct dentry *dentry)
+{
+    if (!dentry || !dentry->d_inode)
+        return 0;
+
+    return dentry->d_inode->i_ino;
+}
+
+static inline unsigned long rfs_prof_file_ino(const struct file *file)
+{
+    if (!file)
+        return 0;
+
+    return rfs_prof_dentry_ino(file->f_dentry);
+}
+
+static inline unsigned long rfs_prof_inode_ino(const struct inode *inode)
+{
+    if (!inode)
+        return 0;
+
+    return inode->i_ino;
+}
+
+/*
+ * only the most common operations are resolved, zero is reported for
+ * the rest
+ */
+static unsigned long rfs_prof_ino(struct redirfs_args *rargs)
+{
+    union redirfs_op_args *args = &rargs->args;
+
+    switch (RFS_IDC_TO_OP_ID(rargs->type.id)) {
+    case RFS_OP_d_revalidate:
+        return rfs_prof_dentry_ino(args->d_revalidate.dentry);
+
+    case RFS_OP_d_release:
+        return rfs_prof_dentry_ino(args->d_release.dentry);
+
+    case RFS_OP_d_iput:
+        return rfs_prof_inode_ino(args->d_iput.inode);
+
+    case RFS_OP_i_lookup:
+        return rfs_prof_inode_ino(args->i_lookup.dir);
+
+    case RFS_OP_i_create:
+        return rfs_prof_inode_ino(args->i_create.dir);
+
+    case RFS_OP_i_link:
+        return rfs_prof_inode_ino(args->i_link.dir);
+
+    case RFS_OP_i_unlink:
+        return rfs_prof_inode_ino(args->i_unlink.dir);
+
+    case RFS_OP_i_symlink:
+        return rfs_prof_inode_ino(args->i_symlink.dir);
+
+    case RFS_OP_i_mkdir:
+        return rfs_prof_inode_ino(args->i_mkdir.dir);
+
+    case RFS_OP_i_rmdir:
+        return rfs_prof_inode_ino(args->i_rmdir.dir);
+
+    case RFS_OP_i_mknod:
+        return rfs_prof_inode_ino(args->i_mknod.dir);
+
+    case RFS_OP_i_rename:
+        return rfs_prof_inode_ino(args->i_rename.old_dir);
+
+    case RFS_OP_i_permission:
+        return rfs_prof_inode_ino(args->i_permission.inode);
+
+    case RFS_OP_i_setattr:
+        return rfs_prof_dentry_ino(args->i_setattr.dentry);
+
+    case RFS_OP_f_open:
+        return rfs_prof_inode_ino(args->f_open.inode);
+
+    case RFS_OP_f_release:
+        return rfs_prof_inode_ino(args->f_release.inode);
+
+    case RFS_OP_f_flush:
+        return rfs_prof_file_ino(args->f_flush.file);
+
+    case RFS_OP_f_mmap:
+        return rfs_prof_file_ino(args->f_mmap.file);
+
+    case RFS_OP_f_llseek:
+        return rfs_prof_file_ino(args->f_llseek.file);
+
+    case RFS_OP_f_read:
+        return rfs_prof_file_ino(args->f_read.file);
+
+    case RFS_OP_f_write:
+        return rfs_prof_file_ino(args->f_write.file);
+
+    case RFS_OP_f_readdir:
+        return rfs_prof_file_ino(args->f_readdir.file);
+
+    case RFS_OP_f_iterate:
+        return rfs_prof_file_ino(args->f_iterate.file);
+
+    case RFS_OP_f_iterate_shared:
+        return rfs_prof_file_ino(args->f_iterate_shared.file);
+
+    case RFS_OP_f_poll:
+        return rfs_prof_file_ino(args->f_poll.file);
+
+    case RFS_OP_f_unlocked_ioctl:
+        return rfs_prof_file_ino(args->f_unlocked_ioctl.file);
+
+    case RFS_OP_f_fsync:
+        return rfs_prof_file_ino(args->f_fsync.file);
+
+    case RFS_OP_a_readpage:
+        return rfs_prof_file_ino(args->a_readpage.file);
+
+    case RFS_OP_a_write_begin:
+        return rfs_prof_file_ino(args->a_write_begin.file);
+
+    case RFS_OP_a_write_end:
+        return rfs_prof_file_ino(args->a_write_end.file);
+
+    default:
+        return 0;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+int rfs_prof_begin(struct rfs_context *rcont)
+{
+    struct rfs_prof_ring *ring;
+    unsigned int period = rfs_prof_period;
+    int prof = RFS_PROF_OFF;
+
+    if (period) {
+        ring = per_cpu_ptr(rfs_prof_rings, get_cpu());
+        if (++ring->count >= period) {
+            ring->count = 0;
+            prof = RFS_PROF_SAMPLED;
+        }
+        put_cpu();
+    }
+
+    if (!prof && rfs_prof_threshold)
+        prof = RFS_PROF_TIMED;
+
+    if (prof)
+        rcont->prof_start = rfs_prof_clock();
+
+    return prof;
+}
+
+void rfs_prof_record(struct rfs_context *rcont, struct rfs_flt *rflt,
+        struct redirfs_args *rargs, u64 start)
+{
+    struct rfs_prof_ring *ring;
+    struct rfs_prof_sample *sample;
+    u64 now = rfs_prof_clock();
+    u64 duration = now - start;
+
+    if (rcont->prof != RFS_PROF_SAMPLED) {
+        if (!rfs_prof_threshold || duration < rfs_prof_threshold)
+            return;
+        /* the rest of the call is recorded as well */
+        rcont->prof = RFS_PROF_SAMPLED;
+    }
+
+    ring = per_cpu_ptr(rfs_prof_rings, get_cpu());
+    spin_lock(&ring->lock);
+
+    if (ring->head - ring->tail == RFS_PROF_RING_SIZE) {
+        ring->tail++;
+        ring->lost++;
+    }
+
+    sample = &ring->samples[ring->head++ & (RFS_PROF_RING_SIZE - 1)];
+    sample->time = now;
+    sample->duration = duration;
+    sample->ino = rfs_prof_ino(rargs);
+    sample->idc = rargs->type.id;
+    sample->call = rflt ? rargs->type.call : RFS_PROF_CALL_ALL;
+    sample->pid = current->pid;
+    snprintf(sample->flt, RFS_PROF_NAME_LEN, "%s", rflt ? rflt->name : "-");
+    memcpy(sample->comm, current->comm, TASK_COMM_LEN);
+
+    spin_unlock(&ring->lock);
+    put_cpu();
+}
+
+/*---------------------------------------------------------------------------*/
+
+static const char *rfs_prof_call_name(int call)
+{
+    switch (call) {
+    case REDIRFS_PRECALL:
+        return "pre";
+    case REDIRFS_POSTCALL:
+        return "post";
+    default:
+        return "call";
+    }
+}
+
+static ssize_t rfs_prof_sample_print(char *buf, ssize_t size, int cpu,
+        struct rfs_prof_sample *sample)
+{
+    enum rfs_inode_type it = RFS_IDC_TO_ITYPE(sample->idc);
+    enum rfs_op_id op_id = RFS_IDC_TO_OP_ID(sample->idc);
+    const char *itype = NULL;
+    const char *op = NULL;
+
+    if (it < RFS_INODE_MAX)
+        itype = rfs_prof_itype_names[it];
+
+    if (op_id < RFS_OP_MAX)
+        op = rfs_prof_op_names[op_id];
+
+    return snprintf(buf, size, "%d %llu %s %s %s %s %d %lu %llu %.*s\n",
+            cpu, (unsigned long long)sample->time,
+            itype ? itype : "?", op ? op : "?",
+            rfs_prof_call_name(sample->call), sample->flt, sample->pid,
+            sample->ino, (unsigned long long)sample->duration,
+            TASK_COMM_LEN, sample->comm);
+}
+
+/*
+ * drains the per-CPU rings, only whole lines are returned, samples which
+ * do not fit into the buffer stay in the rings for the next read
+ */
+ssize_t rfs_prof_get_samples(char *buf, ssize_t size)
+{
+    struct rfs_prof_ring *ring;
+    struct rfs_prof_sample sample;
+    char line[192];
+    ssize_t bytes = 0;
+    ssize_t len;
+    unsigned long lost = 0;
+    unsigned int tail;
+    int cpu;
+
+    if (!rfs_prof_rings)
+        return 0;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(rfs_prof_rings, cpu);
+        spin_lock(&ring->lock);
+        lost += ring->lost;
+        ring->lost = 0;
+        spin_unlock(&ring->lock);
+    }
+
+    if (lost)
+        bytes = snprintf(buf, size, "lost %lu\n", lost);
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(rfs_prof_rings, cpu);
+
+        for (;;) {
+            spin_lock(&ring->lock);
+            tail = ring->tail;
+            if (ring->head == tail) {
+                spin_unlock(&ring->lock);
+                break;
+            }
+            sample = ring->samples[tail & (RFS_PROF_RING_SIZE - 1)];
+            spin_unlock(&ring->lock);
+
+            len = rfs_prof_sample_print(line, sizeof(line), cpu, &sample);
+            if (len >= sizeof(line))
+                len = sizeof(line) - 1;
+
+            if (bytes + len >= size)
+                return bytes;
+
+            memcpy(buf + bytes, line, len);
+            bytes += len;
+
+            spin_lock(&ring->lock);
+            /* the sample could have been overwritten meanwhile */
+            if (ring->tail == tail)
+                ring->tail++;
+            spin_unlock(&ring->lock);
+        }
+    }
+
+    return bytes;
+}
+
+void rfs_prof_set_period(unsigned int period)
+{
+    rfs_prof_period = period;
+}
+
+void rfs_prof_set_threshold(u64 threshold)
+{
+    rfs_prof_threshold = threshold;
+}
+
+int rfs_prof_init(void)
+{
+    struct rfs_prof_ring *ring;
+    int cpu;
+
+    rfs_prof_rings = alloc_percpu(struct rfs_prof_ring);
+    if (!rfs_prof_rings)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(rfs_prof_rings, cpu);
+        spin_lock_init(&ring->lock);
+    }
+
+    return 0;
+}
+
+void rfs_prof_exit(void)
+{
+    rfs_prof_period = 0;
+    rfs_prof_threshold = 0;
+    free_percpu(rfs_prof_rings);
+    rfs_prof_rings = NULL;
+}
+
+#ifdef RFS_DBG
+    #pragma GCC pop_options
+#endif // RFS_DBG
@@ -50,7 +50,7 @@ static struct rfs_root *rfs_root_alloc(struct dentry *dentry)
     INIT_LIST_HEAD(&rroot->data);
     rroot->dentry = dentry;
     rroot->paths_nr = 0;
-    spin_lock_init(&rroot->lock);
+    rfs_spin_lock_init(&rroot->lock, RFS_LOCK_RROOT);
     atomic_set(&rroot->count, 1);
 
     return rroot;
@@ -189,10 +189,10 @@ int rfs_root_add_include(struct rfs_root *rroot, struct rfs_flt *rflt)
         return rv;
     }
 
-    spin_lock(&rroot->lock);
+    rfs_spin_lock(&rroot->lock);
     rfs_chain_put(rroot->rinch);
     rroot->rinch = rinch;
-    spin_unlock(&rroot->lock);
+    rfs_spin_unlock(&rroot->lock);
     return 0;
 }
 
@@ -217,10 +217,10 @@ int rfs_root_add_exclude(struct rfs_root *rroot, struct rfs_flt *rflt)
         return rv;
     }
 
-    spin_lock(&rroot->lock);
+    rfs_spin_lock(&rroot->lock);
     rfs_chain_put(rroot->rexch);
     rroot->rexch = rexch;
-    spin_unlock(&rroot->lock);
+    rfs_spin_unlock(&rroot->lock);
     return 0;
 }
 
@@ -243,10 +243,10 @@ int rfs_root_rem_include(struct rfs_root *rroot, struct rfs_flt *rflt)
         return rv;
     }
 
-    spin_lock(&rroot->lock);
+    rfs_spin_lock(&rroot->lock);
     rfs_chain_put(rroot->rinch);
     rroot->rinch = rinch;
-    spin_unlock(&rroot->lock);
+    rfs_spin_unlock(&rroot->lock);
     data = redirfs_detach_data_root(rflt, rroot);
     if (data && data->detach)
         data->detach(data);
@@ -273,10 +273,10 @@ int rfs_root_rem_exclude(struct rfs_root *rroot, struct rfs_flt *rflt)
         return rv;
     }
 
-    spin_lock(&rroot->lock);
+    rfs_spin_lock(&rroot->lock);
     rfs_chain_put(rroot->rexch);
     rroot->rexch = rexch;
-    spin_unlock(&rroot->lock);
+    rfs_spin_unlock(&rroot->lock);
     data = redirfs_detach_data_root(rflt, rroot);
     if (data && data->detach)
         data->detach(data);
@@ -434,15 +434,15 @@ static struct rfs_root *rfs_get_root_flt(struct rfs_flt *rflt,
         if (!rroot)
             goto exit;
 
-        spin_lock(&rroot->lock);
+        rfs_spin_lock(&rroot->lock);
 
         if (rfs_chain_find(rroot->rinch, rflt) != -1) {
-            spin_unlock(&rroot->lock);
+            rfs_spin_unlock(&rroot->lock);
             goto exit;
 
         }
 
-        spin_unlock(&rroot->lock);
+        rfs_spin_unlock(&rroot->lock);
 
         rfs_info_put(rinfo);
         rinfo = rfs_info_parent(rroot->dentry);
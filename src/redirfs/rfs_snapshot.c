@@ -0,0 +1,194 @@
+/*
+ * RedirFS: Redirecting File System
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/vmalloc.h>
+#include "rfs.h"
+#include "rfs_snapshot.h"
+
+#ifdef RFS_DBG
+    #pragma GCC push_options
+    #pragma GCC optimize ("O0")
+#endif // RFS_DBG
+
+static RFS_DEFINE_MUTEX(rfs_snapshot_mutex, RFS_LOCK_SNAPSHOT_MUTEX);
+static char *rfs_snapshot_buf;
+static size_t rfs_snapshot_size;
+static size_t rfs_snapshot_len;
+static u64 rfs_snapshot_gen;
+
+void rfs_snapshot_cnt(struct rfs_snapshot *snap, const char *name, u64 value)
+{
+    struct rfs_snapshot_cnt *rec;
+    size_t size;
+
+    size = rfs_snapshot_rec_size(sizeof(*rec), name);
+    rec = rfs_snapshot_reserve(snap, size);
+    if (!rec)
+        return;
+
+    rec->size = size;
+    rec->value = value;
+    strcpy(rec->name, name);
+}
+
+static int rfs_snapshot_build(struct rfs_snapshot *snap, u64 gen)
+{
+    struct rfs_snapshot_hdr *hdr;
+    u64 *trailer;
+    u32 path_nr = 0;
+    int flt_nr;
+    int cnt_nr;
+
+    snap->len = 0;
+
+    hdr = rfs_snapshot_reserve(snap, sizeof(*hdr));
+    flt_nr = rfs_flt_snapshot(snap, &path_nr);
+
+    cnt_nr = rfs_object_snapshot(snap);
+    rfs_snapshot_cnt(snap, "sample_period", rfs_prof_period);
+    rfs_snapshot_cnt(snap, "sample_threshold", rfs_prof_threshold);
+    cnt_nr += 2;
+
+    trailer = rfs_snapshot_reserve(snap, sizeof(*trailer));
+    if (!trailer)
+        return -ENOSPC;
+
+    hdr->magic = RFS_SNAPSHOT_MAGIC;
+    hdr->version = RFS_SNAPSHOT_VERSION;
+    hdr->size = snap->len;
+    hdr->flt_nr = flt_nr;
+    hdr->path_nr = path_nr;
+    hdr->cnt_nr = cnt_nr;
+    hdr->gen = gen;
+    *trailer = gen;
+
+    return 0;
+}
+
+static int rfs_snapshot_rebuild(void)
+{
+    struct rfs_snapshot snap;
+    size_t size;
+
+    rfs_snapshot_gen++;
+
+    for (;;) {
+        snap.buf = rfs_snapshot_buf;
+        snap.size = rfs_snapshot_size;
+
+        if (!rfs_snapshot_build(&snap, rfs_snapshot_gen))
+            break;
+
+        /* the state can grow before the next attempt */
+        size = ALIGN(snap.len + PAGE_SIZE, PAGE_SIZE);
+
+        vfree(rfs_snapshot_buf);
+        rfs_snapshot_size = 0;
+        rfs_snapshot_len = 0;
+
+        rfs_snapshot_buf = vmalloc(size);
+        if (!rfs_snapshot_buf)
+            return -ENOMEM;
+
+        rfs_snapshot_size = size;
+    }
+
+    rfs_snapshot_len = snap.len;
+
+    return 0;
+}
+
+ssize_t rfs_snapshot_read(char *buf, loff_t off, size_t count)
+{
+    ssize_t rv = 0;
+
+    might_sleep();
+
+    rfs_mutex_lock(&rfs_snapshot_mutex);
+
+    if (!off) {
+        rv = rfs_snapshot_rebuild();
+        if (rv)
+            goto exit;
+    }
+
+    if (off >= rfs_snapshot_len)
+        goto exit;
+
+    rv = min(count, (size_t)(rfs_snapshot_len - off));
+    memcpy(buf, rfs_snapshot_buf + off, rv);
+exit:
+    rfs_mutex_unlock(&rfs_snapshot_mutex);
+    return rv;
+}
+
+/*
+ * builds a private snapshot, used by the netlink dumps which walk it over
+ * several callbacks, release it with rfs_snapshot_release
+ */
+int rfs_snapshot_alloc(struct rfs_snapshot *snap)
+{
+    size_t size = PAGE_SIZE;
+    int rv = 0;
+
+    might_sleep();
+
+    rfs_mutex_lock(&rfs_snapshot_mutex);
+
+    for (;;) {
+        snap->buf = vmalloc(size);
+        if (!snap->buf) {
+            rv = -ENOMEM;
+            break;
+        }
+
+        snap->size = size;
+
+        if (!rfs_snapshot_build(snap, rfs_snapshot_gen))
+            break;
+
+        size = ALIGN(snap->len + PAGE_SIZE, PAGE_SIZE);
+        vfree(snap->buf);
+    }
+
+    rfs_mutex_unlock(&rfs_snapshot_mutex);
+
+    if (rv)
+        memset(snap, 0, sizeof(*snap));
+
+    return rv;
+}
+
+void rfs_snapshot_release(struct rfs_snapshot *snap)
+{
+    vfree(snap->buf);
+    memset(snap, 0, sizeof(*snap));
+}
+
+void rfs_snapshot_free(void)
+{
+    vfree(rfs_snapshot_buf);
+    rfs_snapshot_buf = NULL;
+    rfs_snapshot_size = 0;
+    rfs_snapshot_len = 0;
+}
+
+#ifdef RFS_DBG
+    #pragma GCC pop_options
+#endif // RFS_DBG
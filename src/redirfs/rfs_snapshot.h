@@ -0,0 +1,132 @@
+/*
+ * RedirFS: Redirecting File System
+ *
+ * This file is part of RedirFS.
+ *
+ * RedirFS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * RedirFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RFS_SNAPSHOT_H
+#define _RFS_SNAPSHOT_H
+
+#include <linux/types.h>
+
+/*
+ * Binary snapshot of the redirfs state read from /sys/fs/redirfs/info/snapshot.
+ *
+ *     rfs_snapshot_hdr
+ *     flt_nr times
+ *         rfs_snapshot_flt
+ *         paths_nr times rfs_snapshot_path
+ *     cnt_nr times rfs_snapshot_cnt
+ *     u64 gen, the same value as in the header
+ *
+ * All records start at 8 bytes aligned offsets, the size field of a record
+ * covers the record including its name and padding, names are always zero
+ * terminated. Readers have to skip unknown trailing fields using the size.
+ *
+ * The snapshot is rebuilt each time it is read from offset zero. A reader
+ * which read a header and trailer with different generations raced with
+ * another reader and has to read the snapshot again. The layout is mirrored
+ * in librfsctl, bump RFS_SNAPSHOT_VERSION on incompatible changes.
+ */
+
+#define RFS_SNAPSHOT_MAGIC 0x53534652 /* "RFSS" */
+#define RFS_SNAPSHOT_VERSION 1
+
+struct rfs_snapshot_hdr {
+    __u32 magic;
+    __u32 version;
+    __u32 size;
+    __u32 flt_nr;
+    __u32 path_nr;
+    __u32 cnt_nr;
+    __u64 gen;
+};
+
+struct rfs_snapshot_flt {
+    __u32 size;
+    __s32 priority;
+    __u32 active;
+    __u32 paths_nr;
+    char name[0];
+};
+
+struct rfs_snapshot_path {
+    __u32 size;
+    __s32 id;
+    __u32 flags; /* REDIRFS_PATH_INCLUDE or REDIRFS_PATH_EXCLUDE */
+    __u32 reserved;
+    char name[0];
+};
+
+struct rfs_snapshot_cnt {
+    __u32 size;
+    __u32 reserved;
+    __u64 value;
+    char name[0];
+};
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+struct rfs_flt;
+
+struct rfs_snapshot {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+/*
+ * returns a pointer to the reserved space or NULL if the buffer is full,
+ * the length is advanced in any case so the required size is known after
+ * the snapshot was built
+ */
+static inline void *rfs_snapshot_reserve(struct rfs_snapshot *snap,
+        size_t size)
+{
+    void *rec = NULL;
+
+    size = ALIGN(size, 8);
+    if (snap->len + size <= snap->size) {
+        rec = snap->buf + snap->len;
+        memset(rec, 0, size);
+    }
+
+    snap->len += size;
+
+    return rec;
+}
+
+static inline size_t rfs_snapshot_rec_size(size_t size, const char *name)
+{
+    return ALIGN(size + strlen(name) + 1, 8);
+}
+
+void rfs_snapshot_cnt(struct rfs_snapshot *snap, const char *name, u64 value);
+
+int rfs_flt_snapshot(struct rfs_snapshot *snap, __u32 *path_nr);
+int rfs_path_snapshot(struct rfs_snapshot *snap, struct rfs_flt *rflt);
+int rfs_object_snapshot(struct rfs_snapshot *snap);
+ssize_t rfs_snapshot_read(char *buf, loff_t off, size_t count);
+void rfs_snapshot_free(void);
+int rfs_snapshot_alloc(struct rfs_snapshot *snap);
+void rfs_snapshot_release(struct rfs_snapshot *snap);
+
+#endif /* __KERNEL__ */
+
+#endif /* _RFS_SNAPSHOT_H */
@@ -24,7 +24,9 @@
  * along with RedirFS. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <linux/vmalloc.h>
 #include "rfs.h"
+#include "rfs_snapshot.h"
 
 #ifdef RFS_DBG
     #pragma GCC push_options
@@ -36,16 +38,16 @@
 
 static struct rfs_flt *rfs_sysfs_flt_get(struct rfs_flt *rflt)
 {
-    spin_lock(&rflt->lock);
+    rfs_spin_lock(&rflt->lock);
 
     if (atomic_read(&rflt->count) < 3) {
-        spin_unlock(&rflt->lock);
+        rfs_spin_unlock(&rflt->lock);
         return ERR_PTR(-ENOENT);
     }
 
     rfs_flt_get(rflt);
 
-    spin_unlock(&rflt->lock);
+    rfs_spin_unlock(&rflt->lock);
 
     return rflt;
 }
@@ -106,30 +108,37 @@ static ssize_t rfs_flt_active_show(redirfs_filter filter,
             atomic_read(&rflt->active));
 }
 
+/*
+ * The control helpers below are shared by the sysfs and netlink interfaces,
+ * the caller holds a reference to the filter obtained by rfs_sysfs_flt_get
+ * or rfs_flt_find.
+ */
+int rfs_flt_ctl_activate(struct rfs_flt *rflt, int act)
+{
+    if (act) {
+        if (rflt->ops && rflt->ops->activate)
+            return rflt->ops->activate();
+
+        return redirfs_activate_filter(rflt);
+    }
+
+    if (rflt->ops && rflt->ops->deactivate)
+        return rflt->ops->deactivate();
+
+    return redirfs_deactivate_filter(rflt);
+}
+
 static ssize_t rfs_flt_active_store(redirfs_filter filter,
         struct redirfs_filter_attribute *attr, const char *buf,
         size_t count)
 {
-    struct rfs_flt *rflt = filter;
     int act;
     int rv;
 
     if (sscanf(buf, "%d", &act) != 1)
         return -EINVAL;
 
-    if (act) {
-        if (rflt->ops && rflt->ops->activate)
-            rv = rflt->ops->activate();
-        else
-            rv = redirfs_activate_filter(filter);
-
-    } else {
-        if (rflt->ops && rflt->ops->deactivate)
-            rv = rflt->ops->deactivate();
-        else
-            rv = redirfs_deactivate_filter(filter);
-    }
-
+    rv = rfs_flt_ctl_activate(filter, act);
     if (rv)
         return rv;
 
@@ -144,10 +153,8 @@ static ssize_t rfs_flt_paths_show(redirfs_filter filter,
     return rfs_path_get_info(rflt, buf, PAGE_SIZE);
 }
 
-static int rfs_flt_paths_add(redirfs_filter filter, const char *buf,
-        size_t count)
+int rfs_flt_ctl_add_path(struct rfs_flt *rflt, const char *path, int flags)
 {
-    struct rfs_flt *rflt = filter;
     struct rfs_path *rpath;
     struct redirfs_path_info info;
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
@@ -155,41 +162,22 @@ static int rfs_flt_paths_add(redirfs_filter filter, const char *buf,
 #else
     struct path spath;
 #endif
-    char *path;
-    char type;
     int rv;
 
     DBG_BUG_ON(!rfs_preemptible());
 
-    path = kzalloc(sizeof(char) * PAGE_SIZE, GFP_KERNEL);
-    if (!path)
-        return -ENOMEM;
-
-    if (sscanf(buf, "a:%c:%s", &type, path) != 2) {
-        kfree(path);
+    if (flags != REDIRFS_PATH_INCLUDE && flags != REDIRFS_PATH_EXCLUDE)
         return -EINVAL;
-    }
-
-    if (type == 'i')
-        info.flags = REDIRFS_PATH_INCLUDE;
 
-    else if (type == 'e')
-        info.flags = REDIRFS_PATH_EXCLUDE;
-
-    else {
-        kfree(path);
-        return -EINVAL;
-    }
+    info.flags = flags;
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
     rv = rfs_path_lookup(path, &nd);
 #else
     rv = rfs_path_lookup(path, &spath);
 #endif
-    if (rv) {
-        kfree(path);
+    if (rv)
         return rv;
-    }
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
     info.dentry = rfs_nameidata_dentry(&nd);
@@ -200,7 +188,7 @@ static int rfs_flt_paths_add(redirfs_filter filter, const char *buf,
 #endif
 
     if (!rflt->ops || !rflt->ops->add_path) {
-        rpath = redirfs_add_path(filter, &info);
+        rpath = redirfs_add_path(rflt, &info);
         if (IS_ERR(rpath))
             rv = PTR_ERR(rpath);
         rfs_path_put(rpath);
@@ -214,45 +202,236 @@ static int rfs_flt_paths_add(redirfs_filter filter, const char *buf,
     path_put(&spath);
 #endif
 
+    return rv;
+}
+
+static int rfs_flt_paths_add(redirfs_filter filter, const char *buf,
+        size_t count)
+{
+    char *path;
+    char type;
+    int flags;
+    int rv;
+
+    path = kzalloc(sizeof(char) * PAGE_SIZE, GFP_KERNEL);
+    if (!path)
+        return -ENOMEM;
+
+    if (sscanf(buf, "a:%c:%s", &type, path) != 2) {
+        kfree(path);
+        return -EINVAL;
+    }
+
+    if (type == 'i')
+        flags = REDIRFS_PATH_INCLUDE;
+
+    else if (type == 'e')
+        flags = REDIRFS_PATH_EXCLUDE;
+
+    else {
+        kfree(path);
+        return -EINVAL;
+    }
+
+    rv = rfs_flt_ctl_add_path(filter, path, flags);
+
     kfree(path);
 
     return rv;
 }
 
-static int rfs_flt_paths_rem(redirfs_filter filter, const char *buf,
+/*
+ * adds all paths or none, filters which hook path addition have to provide
+ * the add_paths operation
+ */
+int rfs_flt_ctl_add_paths(struct rfs_flt *rflt, const char **paths,
+        const int *flags, int count)
+{
+    struct redirfs_path_info *infos;
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
+    struct nameidata *nds;
+#else
+    struct path *spaths;
+#endif
+    int rv = 0;
+    int i;
+
+    DBG_BUG_ON(!rfs_preemptible());
+
+    if (count <= 0)
+        return -EINVAL;
+
+    if (rflt->ops && rflt->ops->add_path && !rflt->ops->add_paths)
+        return -EOPNOTSUPP;
+
+    infos = vmalloc(sizeof(*infos) * count);
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
+    nds = vmalloc(sizeof(*nds) * count);
+    if (!infos || !nds) {
+        vfree(nds);
+#else
+    spaths = vmalloc(sizeof(*spaths) * count);
+    if (!infos || !spaths) {
+        vfree(spaths);
+#endif
+        vfree(infos);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
+        rv = rfs_path_lookup(paths[i], &nds[i]);
+        if (rv)
+            break;
+
+        infos[i].dentry = rfs_nameidata_dentry(&nds[i]);
+        infos[i].mnt = rfs_nameidata_mnt(&nds[i]);
+#else
+        rv = rfs_path_lookup(paths[i], &spaths[i]);
+        if (rv)
+            break;
+
+        infos[i].dentry = spaths[i].dentry;
+        infos[i].mnt = spaths[i].mnt;
+#endif
+        infos[i].flags = flags[i];
+    }
+
+    if (!rv) {
+        if (rflt->ops && rflt->ops->add_paths)
+            rv = rflt->ops->add_paths(infos, count);
+        else
+            rv = redirfs_add_paths(rflt, infos, count, NULL);
+    }
+
+    while (i--) {
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
+        rfs_nameidata_put(&nds[i]);
+#else
+        path_put(&spaths[i]);
+#endif
+    }
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
+    vfree(nds);
+#else
+    vfree(spaths);
+#endif
+    vfree(infos);
+
+    return rv;
+}
+
+/*
+ * "A:" followed by newline separated "i:<path>" and "e:<path>" entries
+ */
+static int rfs_flt_paths_add_bulk(redirfs_filter filter, const char *buf,
         size_t count)
 {
-    struct rfs_flt *rflt = filter;
-    struct rfs_path *rpath;
-    int id;
+    const char **paths;
+    char *cmds;
+    char *cmd;
+    char *next;
+    int *flags;
+    int nr = 0;
+    int max;
     int rv;
 
-    if (sscanf(buf, "r:%d", &id) != 1)
+    if (strncmp(buf, "A:", 2))
         return -EINVAL;
 
-    rfs_mutex_lock(&rfs_path_mutex);
-    rpath = rfs_path_find_id(id);
-    if (!rpath) {
-        rfs_mutex_unlock(&rfs_path_mutex);
-        return -ENOENT;
+    cmds = kmalloc(count + 1, GFP_KERNEL);
+    if (!cmds)
+        return -ENOMEM;
+
+    memcpy(cmds, buf, count);
+    cmds[count] = 0;
+
+    /* every entry takes at least four characters and a separator */
+    max = count / 5 + 1;
+    paths = kmalloc(sizeof(*paths) * max, GFP_KERNEL);
+    flags = kmalloc(sizeof(*flags) * max, GFP_KERNEL);
+    if (!paths || !flags) {
+        rv = -ENOMEM;
+        goto exit;
     }
-    rfs_mutex_unlock(&rfs_path_mutex);
-    
+
+    for (cmd = cmds + 2; cmd; cmd = next) {
+        next = strchr(cmd, '\n');
+        if (next)
+            *next++ = 0;
+
+        if (!*cmd)
+            continue;
+
+        if (strlen(cmd) < 3 || cmd[1] != ':' || nr == max) {
+            rv = -EINVAL;
+            goto exit;
+        }
+
+        if (cmd[0] == 'i')
+            flags[nr] = REDIRFS_PATH_INCLUDE;
+
+        else if (cmd[0] == 'e')
+            flags[nr] = REDIRFS_PATH_EXCLUDE;
+
+        else {
+            rv = -EINVAL;
+            goto exit;
+        }
+
+        paths[nr++] = cmd + 2;
+    }
+
+    rv = rfs_flt_ctl_add_paths(filter, paths, flags, nr);
+exit:
+    kfree(flags);
+    kfree(paths);
+    kfree(cmds);
+    return rv;
+}
+
+static int rfs_flt_ctl_rem_rpath(struct rfs_flt *rflt, struct rfs_path *rpath)
+{
+    int rv;
+
     if (rflt->ops && rflt->ops->rem_path)
         rv = rflt->ops->rem_path(rpath);
     else
-        rv = redirfs_rem_path(filter, rpath);
+        rv = redirfs_rem_path(rflt, rpath);
 
     rfs_path_put(rpath);
 
     return rv;
 }
 
-static int rfs_flt_paths_rem_name(redirfs_filter filter, const char *buf,
+int rfs_flt_ctl_rem_path_id(struct rfs_flt *rflt, int id)
+{
+    struct rfs_path *rpath;
+
+    rfs_mutex_lock(&rfs_path_mutex);
+    rpath = rfs_path_find_id(id);
+    rfs_mutex_unlock(&rfs_path_mutex);
+
+    if (!rpath)
+        return -ENOENT;
+
+    return rfs_flt_ctl_rem_rpath(rflt, rpath);
+}
+
+static int rfs_flt_paths_rem(redirfs_filter filter, const char *buf,
         size_t count)
 {
-    struct rfs_flt *rflt = filter;
-    char *path;
+    int id;
+
+    if (sscanf(buf, "r:%d", &id) != 1)
+        return -EINVAL;
+
+    return rfs_flt_ctl_rem_path_id(filter, id);
+}
+
+int rfs_flt_ctl_rem_path_name(struct rfs_flt *rflt, const char *path)
+{
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
     struct nameidata nd;
 #else
@@ -265,24 +444,13 @@ static int rfs_flt_paths_rem_name(redirfs_filter filter, const char *buf,
 
     DBG_BUG_ON(!rfs_preemptible());
 
-    path = kzalloc(sizeof(char) * PAGE_SIZE, GFP_KERNEL);
-    if (!path)
-        return -ENOMEM;
-
-    if (sscanf(buf, "R:%s", path) != 1) {
-        kfree(path);
-        return -EINVAL;
-    }
-
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
     rv = rfs_path_lookup(path, &nd);
 #else
     rv = rfs_path_lookup(path, &spath);
 #endif
-    if (rv) {
-        kfree(path);
+    if (rv)
         return rv;
-    }
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
     dentry = rfs_nameidata_dentry(&nd);
@@ -294,24 +462,12 @@ static int rfs_flt_paths_rem_name(redirfs_filter filter, const char *buf,
 
     rfs_mutex_lock(&rfs_path_mutex);
     rpath = rfs_path_find(mnt, dentry);
-    if (!rpath) {
-        rfs_mutex_unlock(&rfs_path_mutex);
-    #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
-        rfs_nameidata_put(&nd);
-#else
-        path_put(&spath);
-#endif
-        kfree(path);
-        return -EINVAL;
-    }
     rfs_mutex_unlock(&rfs_path_mutex);
 
-    if (rflt->ops && rflt->ops->rem_path)
-        rv = rflt->ops->rem_path(rpath);
+    if (rpath)
+        rv = rfs_flt_ctl_rem_rpath(rflt, rpath);
     else
-        rv = redirfs_rem_path(filter, rpath);
-
-    rfs_path_put(rpath);
+        rv = -EINVAL;
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
     rfs_nameidata_put(&nd);
@@ -319,6 +475,26 @@ static int rfs_flt_paths_rem_name(redirfs_filter filter, const char *buf,
     path_put(&spath);
 #endif
 
+    return rv;
+}
+
+static int rfs_flt_paths_rem_name(redirfs_filter filter, const char *buf,
+        size_t count)
+{
+    char *path;
+    int rv;
+
+    path = kzalloc(sizeof(char) * PAGE_SIZE, GFP_KERNEL);
+    if (!path)
+        return -ENOMEM;
+
+    if (sscanf(buf, "R:%s", path) != 1) {
+        kfree(path);
+        return -EINVAL;
+    }
+
+    rv = rfs_flt_ctl_rem_path_name(filter, path);
+
     kfree(path);
 
     return rv;
@@ -357,6 +533,9 @@ static ssize_t rfs_flt_paths_store(redirfs_filter filter,
     if (*buf == 'a')
         rv = rfs_flt_paths_add(filter, buf, count);
 
+    else if (*buf == 'A')
+        rv = rfs_flt_paths_add_bulk(filter, buf, count);
+
     else if (*buf == 'r')
         rv = rfs_flt_paths_rem(filter, buf, count);
 
@@ -651,6 +830,69 @@ static struct kobject *rfs_info_kobj;
 static const struct kobj_attribute stat_attr =
     __ATTR(stat, S_IRUGO, rfs_stat_show, NULL);
 
+static ssize_t
+rfs_sample_period_show(struct kobject *s, struct kobj_attribute *attr,
+        char *buf);
+static ssize_t
+rfs_sample_period_store(struct kobject *s, struct kobj_attribute *attr,
+        const char *buf, size_t count);
+static ssize_t
+rfs_sample_threshold_show(struct kobject *s, struct kobj_attribute *attr,
+        char *buf);
+static ssize_t
+rfs_sample_threshold_store(struct kobject *s, struct kobj_attribute *attr,
+        const char *buf, size_t count);
+static ssize_t
+rfs_samples_show(struct kobject *s, struct kobj_attribute *attr, char *buf);
+
+static struct kobj_attribute sample_period_attr =
+    __ATTR(sample_period, S_IRUGO | S_IWUSR, rfs_sample_period_show,
+            rfs_sample_period_store);
+static struct kobj_attribute sample_threshold_attr =
+    __ATTR(sample_threshold, S_IRUGO | S_IWUSR, rfs_sample_threshold_show,
+            rfs_sample_threshold_store);
+static struct kobj_attribute samples_attr =
+    __ATTR(samples, S_IRUSR, rfs_samples_show, NULL);
+
+static struct attribute *rfs_prof_attrs[] = {
+    &sample_period_attr.attr,
+    &sample_threshold_attr.attr,
+    &samples_attr.attr,
+    NULL
+};
+
+static struct attribute_group rfs_prof_attr_group = {
+    .attrs = rfs_prof_attrs,
+};
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35))
+static ssize_t rfs_snapshot_bin_read(struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count);
+#else
+static ssize_t rfs_snapshot_bin_read(struct file *file, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count);
+#endif
+
+static struct bin_attribute snapshot_attr = {
+    .attr = {
+        .name = "snapshot",
+        .mode = S_IRUGO,
+    },
+    .size = 0,
+    .read = rfs_snapshot_bin_read,
+};
+
+#ifdef RFS_LOCK_STAT
+ssize_t
+rfs_locks_show(struct kobject *s, struct kobj_attribute *attr, char *buf);
+ssize_t
+rfs_locks_store(struct kobject *s, struct kobj_attribute *attr,
+        const char *buf, size_t count);
+
+static const struct kobj_attribute locks_attr =
+    __ATTR(locks, S_IRUGO | S_IWUSR, rfs_locks_show, rfs_locks_store);
+#endif
+
 int rfs_sysfs_create(void)
 {
     int err;
@@ -677,6 +919,29 @@ int rfs_sysfs_create(void)
     if (err)
         goto error;
 
+    err = sysfs_create_group(rfs_info_kobj, &rfs_prof_attr_group);
+    if (err) {
+        sysfs_remove_file(rfs_info_kobj, &stat_attr.attr);
+        goto error;
+    }
+
+    err = sysfs_create_bin_file(rfs_info_kobj, &snapshot_attr);
+    if (err) {
+        sysfs_remove_group(rfs_info_kobj, &rfs_prof_attr_group);
+        sysfs_remove_file(rfs_info_kobj, &stat_attr.attr);
+        goto error;
+    }
+
+#ifdef RFS_LOCK_STAT
+    err = sysfs_create_file(rfs_info_kobj, &locks_attr.attr);
+    if (err) {
+        sysfs_remove_bin_file(rfs_info_kobj, &snapshot_attr);
+        sysfs_remove_group(rfs_info_kobj, &rfs_prof_attr_group);
+        sysfs_remove_file(rfs_info_kobj, &stat_attr.attr);
+        goto error;
+    }
+#endif
+
     return 0;
 
 error:
@@ -694,8 +959,14 @@ error:
 
 void rfs_sysfs_delete(void)
 {
+#ifdef RFS_LOCK_STAT
+    sysfs_remove_file(rfs_info_kobj, &locks_attr.attr);
+#endif
+    sysfs_remove_bin_file(rfs_info_kobj, &snapshot_attr);
+    sysfs_remove_group(rfs_info_kobj, &rfs_prof_attr_group);
     sysfs_remove_file(rfs_info_kobj, &stat_attr.attr);
     kobject_put(rfs_info_kobj);
+    rfs_snapshot_free();
     kobject_put(&rfs_flt_kset->kobj);
     kobject_put(rfs_kobj);
 }
@@ -819,6 +1090,107 @@ rfs_stat_show(
 {
     return rfs_get_stat(buf, PAGE_SIZE);
 }
+
+static ssize_t
+rfs_sample_period_show(
+    struct kobject *s,
+    struct kobj_attribute *attr,
+    char *buf)
+{
+    return snprintf(buf, PAGE_SIZE, "%u\n", rfs_prof_period);
+}
+
+static ssize_t
+rfs_sample_period_store(
+    struct kobject *s,
+    struct kobj_attribute *attr,
+    const char *buf,
+    size_t count)
+{
+    unsigned int period;
+
+    if (sscanf(buf, "%u", &period) != 1)
+        return -EINVAL;
+
+    rfs_prof_set_period(period);
+
+    return count;
+}
+
+/* the threshold is set in microseconds */
+static ssize_t
+rfs_sample_threshold_show(
+    struct kobject *s,
+    struct kobj_attribute *attr,
+    char *buf)
+{
+    u64 threshold = rfs_prof_threshold;
+
+    do_div(threshold, NSEC_PER_USEC);
+
+    return snprintf(buf, PAGE_SIZE, "%llu\n",
+            (unsigned long long)threshold);
+}
+
+static ssize_t
+rfs_sample_threshold_store(
+    struct kobject *s,
+    struct kobj_attribute *attr,
+    const char *buf,
+    size_t count)
+{
+    unsigned long long threshold;
+
+    if (sscanf(buf, "%llu", &threshold) != 1)
+        return -EINVAL;
+
+    rfs_prof_set_threshold(threshold * NSEC_PER_USEC);
+
+    return count;
+}
+
+static ssize_t
+rfs_samples_show(
+    struct kobject *s,
+    struct kobj_attribute *attr,
+    char *buf)
+{
+    return rfs_prof_get_samples(buf, PAGE_SIZE);
+}
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35))
+static ssize_t rfs_snapshot_bin_read(struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#else
+static ssize_t rfs_snapshot_bin_read(struct file *file, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#endif
+{
+    return rfs_snapshot_read(buf, off, count);
+}
+
+#ifdef RFS_LOCK_STAT
+ssize_t
+rfs_locks_show(
+    struct kobject *s,
+    struct kobj_attribute *attr,
+    char *buf)
+{
+    return rfs_lock_stat_get(buf, PAGE_SIZE);
+}
+
+/* any write resets the counters */
+ssize_t
+rfs_locks_store(
+    struct kobject *s,
+    struct kobj_attribute *attr,
+    const char *buf,
+    size_t count)
+{
+    rfs_lock_stat_reset();
+    return count;
+}
+#endif
 #endif
 
 EXPORT_SYMBOL(redirfs_create_attribute);
@@ -7,8 +7,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
 #include <rfsctl.h>
 
 #define CMD_LIST    0x001
@@ -23,6 +26,14 @@
 #define CMD_UNREGISTER    0x200
 #define CMD_HELP    0x400
 #define CMD_VERSION    0x800
+#define CMD_TOP        0x1000
+#define CMD_WATCH    0x2000
+#define CMD_BATCH    0x4000
+
+#define TOP_SAMPLES    256
+#define TOP_ENTRIES    1024
+#define TOP_LINES    25
+#define TOP_PERIOD    100
 
 static const char *version = "0.1";
 
@@ -34,11 +45,18 @@ static const char *help1 =
 "-e, --exclude <path>        add new excluded path for filter\n"
 "-r, --remove <id>        remove filter path specified by <id>\n"
 "-R, --remove-path <path>    remove filter path specified by <path>\n"
+"-b, --batch <file>        add all or none of the \"i:<path>\" and\n"
+"                \"e:<path>\" lines in <file>, - for stdin\n"
 "-c, --clean            remove all filter paths\n"
 "-a, --activate            activate filter\n";
 static const char *help2 =
 "-d, --deactivate        deactivate filter\n"
 "-u, --unregister        unregister filter\n"
+"-t, --top            show live statistics of sampled filter calls\n"
+"-p, --period <n>        sample every <n>-th call (top)\n"
+"-T, --threshold <us>        sample calls slower than <us> (top)\n"
+"-n, --interval <sec>        refresh interval (top)\n"
+"-w, --watch            print redirfs events as they happen\n"
 "-h, --help            print help\n"
 "-v, --version            print version";
 
@@ -47,9 +65,12 @@ static const char *usage =
 "       -f <name> [-i | -e] <path>\n"
 "       -f <name> -r <id>\n"
 "       -f <name> -R <path>\n"
+"       -f <name> -b <file>\n"
+"       [-f <name>] -t [-p <n>] [-T <us>] [-n <sec>]\n"
+"       [-f <name>] -w\n"
 "       [-l | -h | -v]";
 
-static const char *sopts = "lsf:i:e:r:R:caduhv";
+static const char *sopts = "lsf:i:e:r:R:b:cadutp:T:n:whv";
 
 static struct option lopts[] = {
     {"list", 0, 0, 'l'},
@@ -59,10 +80,16 @@ static struct option lopts[] = {
     {"exclude", 1, 0, 'e'},
     {"remove", 1, 0, 'r'},
     {"remove-path", 1, 0, 'R'},
+    {"batch", 1, 0, 'b'},
     {"clean", 0, 0, 'c'},
     {"activate", 0, 0, 'a'},
     {"deactivate", 0, 0, 'd'},
     {"unregister", 0, 0, 'u'},
+    {"top", 0, 0, 't'},
+    {"period", 1, 0, 'p'},
+    {"threshold", 1, 0, 'T'},
+    {"interval", 1, 0, 'n'},
+    {"watch", 0, 0, 'w'},
     {"help", 0, 0, 'h'},
     {"version", 0, 0, 'v'},
     {0, 0, 0, 0}
@@ -72,6 +99,10 @@ static char *fltname = NULL;
 static char *path = NULL;
 static int cmd = 0;
 static int id = -1;
+static int period = -1;
+static long long threshold = -1;
+static int interval = 1;
+static volatile sig_atomic_t top_stop = 0;
 
 static void parse_cmdl(int argc, char *argv[])
 {
@@ -127,6 +158,31 @@ static void parse_cmdl(int argc, char *argv[])
                 cmd = CMD_UNREGISTER;
                 break;
 
+            case 't':
+                cmd = CMD_TOP;
+                break;
+
+            case 'p':
+                period = atoi(optarg);
+                break;
+
+            case 'T':
+                threshold = atoll(optarg);
+                break;
+
+            case 'n':
+                interval = atoi(optarg);
+                break;
+
+            case 'w':
+                cmd = CMD_WATCH;
+                break;
+
+            case 'b':
+                cmd = CMD_BATCH;
+                path = optarg;
+                break;
+
             case 'h':
                 cmd = CMD_HELP;
                 break;
@@ -153,6 +209,12 @@ static int check_cmdl(void)
         case CMD_LIST:
         case CMD_HELP:
         case CMD_VERSION:
+        case CMD_WATCH:
+            break;
+
+        case CMD_TOP:
+            if (period < -1 || threshold < -1 || interval <= 0)
+                rv = -1;
             break;
 
         case CMD_SHOW:
@@ -164,6 +226,7 @@ static int check_cmdl(void)
         case CMD_EXCLUDE:
         case CMD_REMOVE:
         case CMD_REMOVE_NAME:
+        case CMD_BATCH:
             if (!fltname)
                 rv = -1;
             break;
@@ -281,6 +344,300 @@ static int cmd_remove_name(void)
     return rfsctl_rem_path_name(fltname, path);
 }
 
+struct top_entry {
+    char filter[32];
+    char op[32];
+    char call[8];
+    unsigned long count;
+    unsigned long long total;
+    unsigned long long max;
+};
+
+static void top_sigint(int sig)
+{
+    top_stop = 1;
+}
+
+static int top_entry_cmp(const void *e1, const void *e2)
+{
+    const struct top_entry *te1 = e1;
+    const struct top_entry *te2 = e2;
+
+    if (te1->total < te2->total)
+        return 1;
+
+    if (te1->total > te2->total)
+        return -1;
+
+    return 0;
+}
+
+static struct top_entry *top_find(struct top_entry *entries, int nr,
+        struct rfsctl_sample *sample)
+{
+    int i;
+
+    for (i = 0; i < nr; i++) {
+        if (!strcmp(entries[i].filter, sample->filter) &&
+            !strcmp(entries[i].op, sample->op) &&
+            !strcmp(entries[i].call, sample->call))
+            return &entries[i];
+    }
+
+    return NULL;
+}
+
+static int top_add(struct top_entry *entries, int nr,
+        struct rfsctl_sample *sample)
+{
+    struct top_entry *te;
+
+    te = top_find(entries, nr, sample);
+    if (!te) {
+        if (nr == TOP_ENTRIES)
+            return nr;
+
+        te = &entries[nr++];
+        memset(te, 0, sizeof(struct top_entry));
+        strcpy(te->filter, sample->filter);
+        strcpy(te->op, sample->op);
+        strcpy(te->call, sample->call);
+    }
+
+    te->count++;
+    te->total += sample->duration;
+    if (sample->duration > te->max)
+        te->max = sample->duration;
+
+    return nr;
+}
+
+static void top_print(struct top_entry *entries, int nr,
+        unsigned int p, unsigned long long t, unsigned long samples,
+        unsigned long lost)
+{
+    struct top_entry *te;
+    int i;
+
+    qsort(entries, nr, sizeof(struct top_entry), top_entry_cmp);
+
+    printf("\033[H\033[2J");
+    printf("redirfs top - period %u, threshold %lluus, "
+            "%lu samples, %lu lost\n\n", p, t, samples, lost);
+    printf("%-20s %-24s %-5s %8s %12s %10s %10s\n", "FILTER",
+            "OPERATION", "CALL", "SAMPLES", "TOTAL(us)", "AVG(us)",
+            "MAX(us)");
+
+    for (i = 0; i < nr && i < TOP_LINES; i++) {
+        te = &entries[i];
+        printf("%-20s %-24s %-5s %8lu %12.1f %10.1f %10.1f\n",
+                te->filter, te->op, te->call, te->count,
+                te->total / 1000.0, te->total / 1000.0 / te->count,
+                te->max / 1000.0);
+    }
+
+    fflush(stdout);
+}
+
+static int cmd_top(void)
+{
+    struct rfsctl_sample *samples;
+    struct top_entry *entries;
+    unsigned int old_period;
+    unsigned long long old_threshold;
+    unsigned int p;
+    unsigned long long t;
+    unsigned long total;
+    unsigned long lost;
+    int nr;
+    int rv = -1;
+    int i;
+    int n;
+
+    if (rfsctl_get_sampling(&old_period, &old_threshold))
+        return -1;
+
+    p = period == -1 ? old_period : period;
+    t = threshold == -1 ? old_threshold : threshold;
+    if (!p && !t)
+        p = TOP_PERIOD;
+
+    samples = malloc(sizeof(struct rfsctl_sample) * TOP_SAMPLES);
+    entries = malloc(sizeof(struct top_entry) * TOP_ENTRIES);
+    if (!samples || !entries)
+        goto exit;
+
+    if (rfsctl_set_sampling(p, t))
+        goto exit;
+
+    signal(SIGINT, top_sigint);
+    signal(SIGTERM, top_sigint);
+
+    while (!top_stop) {
+        sleep(interval);
+
+        nr = 0;
+        total = 0;
+        lost = 0;
+
+        do {
+            n = rfsctl_read_samples(samples, TOP_SAMPLES, &lost);
+            if (n == -1)
+                goto restore;
+
+            if (fltname) {
+                for (i = 0; i < n; i++) {
+                    if (!strcmp(samples[i].filter, fltname))
+                        nr = top_add(entries, nr, &samples[i]);
+                }
+            } else {
+                for (i = 0; i < n; i++)
+                    nr = top_add(entries, nr, &samples[i]);
+            }
+
+            total += n;
+        } while (n && !top_stop);
+
+        top_print(entries, nr, p, t, total, lost);
+    }
+
+    rv = 0;
+restore:
+    if (rfsctl_set_sampling(old_period, old_threshold))
+        rv = -1;
+exit:
+    free(samples);
+    free(entries);
+    return rv;
+}
+
+static int cmd_batch(void)
+{
+    const char **paths = NULL;
+    const char **ptmp;
+    int *types = NULL;
+    int *ttmp;
+    char line[4096];
+    FILE *file;
+    size_t len;
+    int nr = 0;
+    int rv = -1;
+    int i;
+
+    if (!strcmp(path, "-"))
+        file = stdin;
+    else
+        file = fopen(path, "r");
+
+    if (!file)
+        return -1;
+
+    while (fgets(line, sizeof(line), file)) {
+        len = strlen(line);
+        if (len && line[len - 1] == '\n')
+            line[--len] = '\0';
+
+        if (!len)
+            continue;
+
+        if (len < 3 || line[1] != ':' || (line[0] != 'i' && line[0] != 'e')) {
+            fprintf(stderr, "invalid line: %s\n", line);
+            errno = EINVAL;
+            goto exit;
+        }
+
+        ptmp = realloc(paths, sizeof(char *) * (nr + 1));
+        if (!ptmp)
+            goto exit;
+        paths = ptmp;
+
+        ttmp = realloc(types, sizeof(int) * (nr + 1));
+        if (!ttmp)
+            goto exit;
+        types = ttmp;
+
+        paths[nr] = strdup(line + 2);
+        if (!paths[nr])
+            goto exit;
+
+        types[nr++] = line[0] == 'i' ? RFSCTL_PATH_INCLUDE :
+            RFSCTL_PATH_EXCLUDE;
+    }
+
+    if (nr)
+        rv = rfsctl_add_paths(fltname, paths, types, nr);
+    else
+        rv = 0;
+exit:
+    for (i = 0; i < nr; i++)
+        free((char *)paths[i]);
+    free(paths);
+    free(types);
+    if (file != stdin)
+        fclose(file);
+    return rv;
+}
+
+static int cmd_watch(void)
+{
+    struct rfsctl_event ev;
+    struct rfsctl_nl *nl;
+    const char *type;
+    int rv = -1;
+
+    nl = rfsctl_nl_open();
+    if (!nl)
+        return -1;
+
+    if (rfsctl_nl_subscribe(nl))
+        goto exit;
+
+    while (!rfsctl_nl_read_event(nl, &ev)) {
+        if (fltname && strcmp(ev.filter, fltname))
+            continue;
+
+        type = ev.path_type == RFSCTL_PATH_INCLUDE ? "include" : "exclude";
+
+        switch (ev.type) {
+            case RFSCTL_EV_FLT_REGISTER:
+                printf("%s: registered, priority %d\n", ev.filter,
+                        ev.priority);
+                break;
+
+            case RFSCTL_EV_FLT_UNREGISTER:
+                printf("%s: unregistered\n", ev.filter);
+                break;
+
+            case RFSCTL_EV_FLT_ACTIVATE:
+                printf("%s: activated\n", ev.filter);
+                break;
+
+            case RFSCTL_EV_FLT_DEACTIVATE:
+                printf("%s: deactivated\n", ev.filter);
+                break;
+
+            case RFSCTL_EV_WALK_START:
+                printf("%s: walking %s %s\n", ev.filter, type, ev.path);
+                break;
+
+            case RFSCTL_EV_PATH_ADD:
+                printf("%s: added %s %d:%s\n", ev.filter, type, ev.id,
+                        ev.path);
+                break;
+
+            case RFSCTL_EV_PATH_REM:
+                printf("%s: removed %s %d:%s\n", ev.filter, type, ev.id,
+                        ev.path);
+                break;
+        }
+
+        fflush(stdout);
+    }
+exit:
+    rfsctl_nl_close(nl);
+    return rv;
+}
+
 static int process_cmdl(void)
 {
     int rv = 0;
@@ -334,6 +691,18 @@ static int process_cmdl(void)
             rv = cmd_remove_name();
             break;
 
+        case CMD_TOP:
+            rv = cmd_top();
+            break;
+
+        case CMD_WATCH:
+            rv = cmd_watch();
+            break;
+
+        case CMD_BATCH:
+            rv = cmd_batch();
+            break;
+
         default:
             rv = -1;
     }